@@ -76,6 +76,9 @@ typedef struct {
     uintptr_t Pml4Phys;
     uint16_t TssSelector;
     uintptr_t AcpiRsdpPhys;
+
+    UINT64 RamDiskBase; // Physical, 0 if there is no RAM disk.
+    UINT64 RamDiskSize;
 } BOOT_INFO;
 
 // ELF definitions
@@ -370,6 +373,36 @@ EFI_STATUS EFIAPI UefiMain(IN EFI_HANDLE ImageHandle, IN EFI_SYSTEM_TABLE* Syste
     File->Read(File, &FileSize, KernelBuffer);
     File->Close(File);
 
+    // 2.5) Optional RAM disk (a disk image the kernel mounts instead of going through AHCI)
+    EFI_PHYSICAL_ADDRESS RamDiskPhys = 0;
+    UINTN RamDiskSize = 0;
+    EFI_FILE_PROTOCOL* RamDiskFile;
+    if (!EFI_ERROR(Root->Open(Root, &RamDiskFile, L"ramdisk.img", EFI_FILE_MODE_READ, 0))) {
+        FileInfoSize = sizeof(EFI_FILE_INFO) + 512;
+        FileInfo = AllocateZeroPool(FileInfoSize);
+        if (FileInfo && !EFI_ERROR(RamDiskFile->GetInfo(RamDiskFile, &gEfiFileInfoGuid, &FileInfoSize, FileInfo))) {
+            RamDiskSize = FileInfo->FileSize;
+        }
+        if (FileInfo) FreePool(FileInfo);
+
+        // Below 4 GiB, EfiLoaderData so the kernel never hands the pages out.
+        RamDiskPhys = 0xFFFFFFFFULL;
+        if (RamDiskSize == 0 ||
+            EFI_ERROR(gBS->AllocatePages(AllocateMaxAddress, EfiLoaderData, EFI_SIZE_TO_PAGES(RamDiskSize), &RamDiskPhys))) {
+            RamDiskPhys = 0;
+            RamDiskSize = 0;
+        }
+        else {
+            UINTN Read = RamDiskSize;
+            if (EFI_ERROR(RamDiskFile->Read(RamDiskFile, &Read, (VOID*)(UINTN)RamDiskPhys)) || Read != RamDiskSize) {
+                gBS->FreePages(RamDiskPhys, EFI_SIZE_TO_PAGES(RamDiskSize));
+                RamDiskPhys = 0;
+                RamDiskSize = 0;
+            }
+        }
+        RamDiskFile->Close(RamDiskFile);
+    }
+
     // 3) AHCI Scan
     UINTN handleCount;
     EFI_HANDLE* handles;
@@ -449,6 +482,8 @@ EFI_STATUS EFIAPI UefiMain(IN EFI_HANDLE ImageHandle, IN EFI_SYSTEM_TABLE* Syste
     BootInfo->Pml4Phys = (UINT64)(UINTN)Pml4Virt;
     BootInfo->TssSelector = selector;
     BootInfo->AcpiRsdpPhys = acpi_rsdp_addr;
+    BootInfo->RamDiskBase = RamDiskPhys;
+    BootInfo->RamDiskSize = RamDiskSize;
 
     // B) Allocate Final Map Buffer (With huge padding)
     UINTN FinalMapSize = 0, MapKey, FinalDescriptorSize;
@@ -25,6 +25,9 @@ Revision History:
 // ->>>>> The handle table handles are accessed in pageable memory, we cannot be at DISPATCH_LEVEL or above.
 // Since we also use push locks.
 
+// Lookups (HtGetObject) are lock-free, updates are serialized by the table push lock.
+// Writers publish with atomic stores (entries are filled before they are linked), and table memory is only freed through the epoch.
+
 DOUBLY_LINKED_LIST HandleTableList;
 PUSH_LOCK HandleTableListLock;
 
@@ -50,13 +53,17 @@ HtpLookupEntry(
 
         The entry on success, or NULL on invalid table/handle.
 
+    Notes:
+
+        Called by lock-free readers too, every table pointer is loaded once.
+
 --*/
 
 {
     // Reject NULL Table, Handles, and handles that are 1/2/3 (must start with 4)
-    if (!Table || !Handle || ((uint64_t)Handle & 3)) return NULL;
+    if (!Table || Handle <= 0 || ((uint64_t)Handle & 3)) return NULL;
 
-    uint64_t TableCode = Table->TableCode;
+    uint64_t TableCode = InterlockedFetchU64(&Table->TableCode);
     uint64_t Level = TableCode & TABLE_LEVEL_MASK;
     void* TableBase = (void*)(TableCode & ~TABLE_LEVEL_MASK);
 
@@ -65,6 +72,7 @@ HtpLookupEntry(
 
     if (Level == 0) {
         // Direct Array
+        if (Index >= LOW_LEVEL_ENTRIES) return NULL;
         PHANDLE_TABLE_ENTRY Entries = (PHANDLE_TABLE_ENTRY)TableBase;
         return &Entries[Index];
     }
@@ -74,9 +82,10 @@ HtpLookupEntry(
         uint64_t MaxEntriesPerLevel = LOW_LEVEL_ENTRIES;
         uint64_t PageIndex = Index / MaxEntriesPerLevel;
         uint64_t EntryIndex = Index % MaxEntriesPerLevel;
+        if (PageIndex >= LOW_LEVEL_ENTRIES) return NULL;
 
         PHANDLE_TABLE_ENTRY* PageTable = (PHANDLE_TABLE_ENTRY*)TableBase;
-        PHANDLE_TABLE_ENTRY ActualPage = PageTable[PageIndex];
+        PHANDLE_TABLE_ENTRY ActualPage = InterlockedFetchPointer((volatile void* volatile*)&PageTable[PageIndex]);
         if (ActualPage) {
             return &ActualPage[EntryIndex];
         }
@@ -154,6 +163,7 @@ HtCreateHandleTable(
     Table->FirstFreeHandle = 4;
     Table->QuotaProcess = Process;
     Table->TableLock.Value = 0;
+    Table->TableLock.Owner = NULL;
 
     // Insert this handle table into the global list.
     MsAcquirePushLockExclusive(&HandleTableListLock);
@@ -262,7 +272,8 @@ HtpExpandTable(
         Directory[1] = NewFreePage;
 
         // Update TableCode: Pointer to Directory | Level 1
-        Table->TableCode = ((uint64_t)Directory) | 1;
+        // The directory is complete before it is published, the old level 0 page stays valid as Directory[0].
+        InterlockedExchangeU64(&Table->TableCode, ((uint64_t)Directory) | 1);
 
         // Update the free list to point to the start of our new page
         // (NewFreePage[0] corresponds to NewBaseIndex)
@@ -292,8 +303,8 @@ HtpExpandTable(
         NewFreePage = HtpAllocateAndInitHandlePage(Table, NewBaseIndex);
         if (!NewFreePage) return;
 
-        // Link it into the directory
-        Directory[DirectoryIndex] = NewFreePage;
+        // Link it into the directory (the page is initialized, publish it)
+        InterlockedExchangePointer((volatile void* volatile*)&Directory[DirectoryIndex], NewFreePage);
 
         // Update Free List
         Table->FirstFreeHandle = NewBaseIndex * 4;
@@ -360,15 +371,15 @@ HtCreateHandle(
     // Update head of free list
     Table->FirstFreeHandle = Entry->NextFreeTableEntry;
 
-    // Setup the Entry
-    Entry->Object = Object;
+    // Setup the Entry, the access mask goes first, a lock-free reader trusts it once it sees the object.
     Entry->GrantedAccess = Access;
+    InterlockedExchangePointer((volatile void* volatile*)&Entry->Object, Object);
     MsReleasePushLockExclusive(&Table->TableLock);
 
     return (HANDLE)FreeIndex;
 }
 
-void 
+void*
 HtDeleteHandle(
     PHANDLE_TABLE Table,
     HANDLE Handle
@@ -387,7 +398,11 @@ HtDeleteHandle(
 
     Return Values:
 
-        None.
+        The object the handle referred to, or NULL if the handle wasn't in use.
+
+    Notes:
+
+        The object is returned so only one of two racing closers gets to drop the handle's reference.
 
 --*/
 
@@ -398,7 +413,7 @@ HtDeleteHandle(
     // Ensure it's not 0 (if 0 is invalid) and is a multiple of 4
     if (!Handle || ((uint64_t)Handle & 3)) {
         MsReleasePushLockExclusive(&Table->TableLock);
-        return;
+        return NULL;
     }
 
     // Lookup the entry
@@ -408,11 +423,12 @@ HtDeleteHandle(
     if (!Entry || !Entry->Object) {
         // Handle is already free or invalid
         MsReleasePushLockExclusive(&Table->TableLock);
-        return;
+        return NULL;
     }
 
-    // 4. Invalidate the Entry
-    Entry->Object = NULL;
+    // 4. Invalidate the Entry (the object first, lock-free readers stop trusting the access mask once it's gone)
+    void* Object = Entry->Object;
+    InterlockedExchangePointer((volatile void* volatile*)&Entry->Object, NULL);
     Entry->GrantedAccess = 0;
 
     // Push onto Free List (LIFO - Stack)
@@ -421,51 +437,106 @@ HtDeleteHandle(
     // This entry becomes the new head.
     Table->FirstFreeHandle = (uint32_t)Handle;
     MsReleasePushLockExclusive(&Table->TableLock);
+
+    return Object;
 }
 
 void* 
 HtGetObject (
     IN  PHANDLE_TABLE Table, 
     IN  HANDLE Handle,
-    _Out_Opt PHANDLE_TABLE_ENTRY* OutEntry
+    _Out_Opt PHANDLE_TABLE_ENTRY OutEntry
 )
 
 /*++
 
     Routine description:
 
-        Retrieves the object for the specified Handle.
+        Retrieves the object for the specified Handle, lock-free.
 
     Arguments:
 
         [IN]    PHANDLE_TABLE Table - The table to enumerate the handle in.
         [IN]    HANDLE Handle - The Object's handle.
-        [OUT OPTIONAL]    PHANDLE_TABLE_ENTRY* OutEntry - The table entry for the handle.
+        [OUT OPTIONAL]    PHANDLE_TABLE_ENTRY OutEntry - Receives a copy of the table entry for the handle.
 
     Return Values:
 
         The Object found for the handle.
 
+    Notes:
+
+        The caller must be inside an epoch section (MsEnterEpoch), the object is not referenced,
+        so it must be referenced (ObReferenceObject) before the section is left if it is used afterwards.
+
 --*/
 
 {
-    void* Object = NULL;
+    PHANDLE_TABLE_ENTRY Entry = HtpLookupEntry(Table, Handle);
+    if (!Entry) return NULL;
 
-    // We can acquire a shared push lock since we are strictly reading and not writing to the table contents.
-    MsAcquirePushLockShared(&Table->TableLock);
+    for (;;) {
+        void* Object = InterlockedFetchPointer((volatile void* volatile*)&Entry->Object);
+        if (!Object) return NULL;
 
-    PHANDLE_TABLE_ENTRY Entry = HtpLookupEntry(Table, Handle);
+        uint32_t GrantedAccess = InterlockedFetchU32((volatile uint32_t*)&Entry->GrantedAccess);
 
-    // Check if valid and allocated
-    if (Entry && Entry->Object) {
-        Object = Entry->Object;
+        // If the entry was closed (or reused) under us, the access mask may belong to someone else, read again.
+        if (InterlockedFetchPointer((volatile void* volatile*)&Entry->Object) != Object) continue;
+
+        if (OutEntry) {
+            OutEntry->Object = Object;
+            OutEntry->GrantedAccess = GrantedAccess;
+        }
+        return Object;
     }
+}
+
+static
+void
+HtpFreeHandleTable(
+    IN PEPOCH_ENTRY EpochEntry
+)
+
+/*++
+
+    Routine description:
+
+        Frees the memory of a deleted handle table (its pages, directory and the table itself).
+
+    Arguments:
+
+        [IN]    PEPOCH_ENTRY EpochEntry - The table's epoch entry.
+
+    Return Values:
+
+        None.
+
+    Notes:
 
-    MsReleasePushLockShared(&Table->TableLock);
-    if (Entry) {
-        if (OutEntry) *OutEntry = Entry;
+        Called by the epoch reclaim thread, once no lock-free lookup can still walk the table.
+
+--*/
+
+{
+    PHANDLE_TABLE Table = CONTAINING_RECORD(EpochEntry, HANDLE_TABLE, EpochEntry);
+
+    uint64_t TableCode = Table->TableCode;
+    uint64_t Level = TableCode & TABLE_LEVEL_MASK;
+    void* TableBase = (void*)(TableCode & ~TABLE_LEVEL_MASK);
+
+    if (Level == 1 && TableBase) {
+        PHANDLE_TABLE_ENTRY* Directory = (PHANDLE_TABLE_ENTRY*)TableBase;
+        for (uint64_t dir = 0; dir < LOW_LEVEL_ENTRIES; dir++) {
+            if (Directory[dir]) MmFreePool(Directory[dir]);
+        }
     }
-    return Object;
+
+    // Level 0 page, or the directory.
+    if (TableBase) MmFreePool(TableBase);
+
+    // Finally, free our table itself.
+    MmFreePool(Table);
 }
 
 void
@@ -487,10 +558,13 @@ HtDeleteHandleTable(
 
         None.
 
+    Notes:
+
+        The memory is freed through the epoch (HtpFreeHandleTable), lookups may still be walking it.
+
 --*/
 
 {
-    // We just free all of the levels and the table itself.
     if (!Table) return;
 
     // Grab the table lock.
@@ -499,72 +573,47 @@ HtDeleteHandleTable(
     uint64_t TableCode = Table->TableCode;
     uint64_t Level = TableCode & TABLE_LEVEL_MASK;
     void* TableBase = (void*)(TableCode & ~TABLE_LEVEL_MASK);
+    PHANDLE_TABLE_ENTRY* Directory = NULL;
+    uint64_t Pages = 1;
 
-    if (Level == 0) {
-        // Single contigious page of entries
-        PHANDLE_TABLE_ENTRY Entries = (PHANDLE_TABLE_ENTRY)TableBase;
-        if (Entries) {
-            // Walk and dereference any live objects that are alive.
-            for (uint64_t i = 0; i < LOW_LEVEL_ENTRIES; i++) {
-                void* Object = Entries[i].Object;
-                if (Object) {
-                    Entries[i].Object = NULL;
-                    // Decrement handle count atomically
-                    POBJECT_HEADER Header = OBJECT_TO_OBJECT_HEADER(Object);
-                    InterlockedDecrementIfNotZero((volatile uint64_t*)&Header->HandleCount);
-                    ObDereferenceObject(Object);
-                }
-            }
-        }
-
-        // No more live handles  release lock and free the page
+    if (Level == 1) {
+        // Directory of page pointers.
+        Directory = (PHANDLE_TABLE_ENTRY*)TableBase;
+        Pages = LOW_LEVEL_ENTRIES;
+    }
+    else if (Level != 0) {
+        // Unsupported level, release lock and get out.
+        assert(false, "Unsupported level encountered on handle table free.");
         MsReleasePushLockExclusive(&Table->TableLock);
-        if (Entries) MmFreePool(Entries);
+        return;
     }
 
-    else if (Level == 1) {
-        // Directory of page pointers.
-        PHANDLE_TABLE_ENTRY* Directory = (PHANDLE_TABLE_ENTRY*)TableBase;
-        if (Directory) {
-            // Walk every allocated page.
-            for (uint64_t dir = 0; dir < LOW_LEVEL_ENTRIES; dir++) {
-                PHANDLE_TABLE_ENTRY Page = Directory[dir];
-                if (!Page) continue;
-
-                for (uint64_t i = 0; i < LOW_LEVEL_ENTRIES; i++) {
-                    void* Object = Page[i].Object;
-                    if (Object) {
-                        Page[i].Object = NULL;
-                        // Decrement handle count atomically
-                        POBJECT_HEADER Header = OBJECT_TO_OBJECT_HEADER(Object);
-                        InterlockedDecrementIfNotZero((volatile uint64_t*)Header->HandleCount);
-                        ObDereferenceObject(Object);
-                    }
-                }
-
-                // Free this page of handles.
-                MmFreePool(Page);
+    // Walk every allocated page and dereference any live objects that are alive.
+    for (uint64_t dir = 0; dir < Pages && TableBase; dir++) {
+        PHANDLE_TABLE_ENTRY Page = Directory ? Directory[dir] : (PHANDLE_TABLE_ENTRY)TableBase;
+        if (!Page) continue;
+
+        for (uint64_t i = 0; i < LOW_LEVEL_ENTRIES; i++) {
+            void* Object = Page[i].Object;
+            if (Object) {
+                InterlockedExchangePointer((volatile void* volatile*)&Page[i].Object, NULL);
+                // Decrement handle count atomically
+                POBJECT_HEADER Header = OBJECT_TO_OBJECT_HEADER(Object);
+                InterlockedDecrementIfNotZero((volatile uint64_t*)&Header->HandleCount);
+                ObDereferenceObject(Object);
             }
         }
-
-        // Release push lock and free the directory itself.
-        MsReleasePushLockExclusive(&Table->TableLock);
-        if (Directory) MmFreePool(Directory);
     }
 
-    else {
-        // Unsupported level, release lock and get out.
-        assert(false, "Unsupported level encountered on handle table free.");
-        MsReleasePushLockExclusive(&Table->TableLock);
-    }
+    MsReleasePushLockExclusive(&Table->TableLock);
 
     // Release this handle table from the global list.
     MsAcquirePushLockExclusive(&HandleTableListLock);
     RemoveEntryList(&Table->TableList);
     MsReleasePushLockExclusive(&HandleTableListLock);
 
-    // Finally, free our table itself.
-    MmFreePool(Table);
+    // Free the pages, the directory and the table once every lookup is done with them.
+    MsEpochDefer(&Table->EpochEntry, HtpFreeHandleTable);
 }
 
 MTSTATUS
@@ -593,13 +642,10 @@ HtClose(
 
     PHANDLE_TABLE Table = PsGetCurrentProcess()->ObjectTable;
 
-    // First get the object for the handle
-    void* Object = HtGetObject(Table, Handle, NULL);
+    // Remove the handle from the table first, under the table lock, so a racing close of the same handle gets nothing.
+    void* Object = HtDeleteHandle(Table, Handle);
     if (!Object) return MT_INVALID_HANDLE;
 
-    // Remove the handle from the table first
-    HtDeleteHandle(Table, Handle);
-
     // Decrement handle count atomically
     POBJECT_HEADER Header = OBJECT_TO_OBJECT_HEADER(Object);
     InterlockedDecrementU64((volatile uint64_t*)&Header->HandleCount);
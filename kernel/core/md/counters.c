@@ -0,0 +1,164 @@
+/*++
+
+Module Name:
+
+    counters.c
+
+Purpose:
+
+    This translation unit contains the registry of the per processor event counters (PERF_COUNTER), their names and readers.
+
+Author:
+
+    slep (Matanel) 2025.
+
+Revision History:
+
+--*/
+
+#include "../../includes/md.h"
+#include "../../includes/mh.h"
+
+//
+// Every processor owns a PerfCounters array in its PROCESSOR block and is the only writer of it (MeAddCounter, a gs relative add).
+// Readers sum the arrays of every processor without synchronization, a value may miss increments still in flight, never tear.
+//
+
+static const char* const MdpCounterNames[PerfCounterMax] = {
+    [PerfCounterContextSwitches] = "ContextSwitches",
+    [PerfCounterSystemCalls] = "SystemCalls",
+    [PerfCounterClockInterrupts] = "ClockInterrupts",
+    [PerfCounterPageFaults] = "PageFaults",
+    [PerfCounterFaultDirtyUpdates] = "FaultDirtyUpdates",
+    [PerfCounterFaultDemandZero] = "FaultDemandZero",
+    [PerfCounterFaultTransition] = "FaultTransition",
+    [PerfCounterFaultFileBacked] = "FaultFileBacked",
+    [PerfCounterFaultAccessViolations] = "FaultAccessViolations",
+    [PerfCounterIpiSentStop] = "IpiSentStop",
+    [PerfCounterIpiSentPrintId] = "IpiSentPrintId",
+    [PerfCounterIpiSentTlbShootdown] = "IpiSentTlbShootdown",
+    [PerfCounterIpiSentWriteDebugRegisters] = "IpiSentWriteDebugRegisters",
+    [PerfCounterIpiSentClearDebugRegisters] = "IpiSentClearDebugRegisters",
+    [PerfCounterIpiSentFlushCr3] = "IpiSentFlushCr3",
+    [PerfCounterIpiReceivedStop] = "IpiReceivedStop",
+    [PerfCounterIpiReceivedPrintId] = "IpiReceivedPrintId",
+    [PerfCounterIpiReceivedTlbShootdown] = "IpiReceivedTlbShootdown",
+    [PerfCounterIpiReceivedWriteDebugRegisters] = "IpiReceivedWriteDebugRegisters",
+    [PerfCounterIpiReceivedClearDebugRegisters] = "IpiReceivedClearDebugRegisters",
+    [PerfCounterIpiReceivedFlushCr3] = "IpiReceivedFlushCr3",
+    [PerfCounterDpcsQueued] = "DpcsQueued",
+    [PerfCounterDpcsRun] = "DpcsRun",
+    [PerfCounterDiskReads] = "DiskReads",
+    [PerfCounterDiskWrites] = "DiskWrites",
+    [PerfCounterDiskReadBytes] = "DiskReadBytes",
+    [PerfCounterDiskWriteBytes] = "DiskWriteBytes",
+    [PerfCounterPoolAllocations] = "PoolAllocations",
+    [PerfCounterPoolLargeAllocations] = "PoolLargeAllocations",
+    [PerfCounterPagedPoolAllocations] = "PagedPoolAllocations",
+    [PerfCounterPoolFrees] = "PoolFrees",
+    [PerfCounterHyperspaceMappings] = "HyperspaceMappings",
+    [PerfCounterDirectMappings] = "DirectMappings",
+    [PerfCounterFaultLargePage] = "FaultLargePage",
+    [PerfCounterLargePageFallbacks] = "LargePageFallbacks",
+    [PerfCounterLargePageSplits] = "LargePageSplits",
+    [PerfCounterStackCacheHits] = "StackCacheHits",
+    [PerfCounterStackCacheMisses] = "StackCacheMisses",
+    [PerfCounterCrossCallsQueued] = "CrossCallsQueued",
+    [PerfCounterCrossCallInterrupts] = "CrossCallInterrupts",
+};
+
+uint32_t
+MdGetCounterProcessorCount(
+    void
+)
+
+/*++
+
+    Routine description:
+
+        Returns the number of processors that own a counter array.
+
+    Arguments:
+
+        None.
+
+    Return Values:
+
+        The processor count, 1 before SMP initialization (the boot processor block).
+
+--*/
+
+{
+    if (!smpInitialized) return 1;
+
+    uint32_t Processors = MeGetActiveProcessorCount();
+    return (Processors > MAX_CPUS) ? MAX_CPUS : Processors;
+}
+
+const char*
+MdGetCounterName(
+    IN PERF_COUNTER Counter
+)
+
+/*++
+
+    Routine description:
+
+        Returns the name of an event counter.
+
+    Arguments:
+
+        [IN]    PERF_COUNTER Counter - The counter.
+
+    Return Values:
+
+        The name, or NULL for an unknown counter.
+
+--*/
+
+{
+    if ((uint32_t)Counter >= PerfCounterMax) return NULL;
+    return MdpCounterNames[Counter];
+}
+
+void
+MdReadCounters(
+    IN uint32_t Processor,
+    OUT uint64_t* Values
+)
+
+/*++
+
+    Routine description:
+
+        Reads the event counters of a processor, or their sum over every processor.
+
+    Arguments:
+
+        [IN]    uint32_t Processor - Processor number, or MD_ALL_PROCESSORS for the sum.
+        [OUT]   uint64_t* Values - Receives PerfCounterMax values, indexed by PERF_COUNTER.
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        Callable at any IRQL, an unknown processor reads as zeroes.
+
+--*/
+
+{
+    uint32_t Processors = MdGetCounterProcessorCount();
+
+    kmemset(Values, 0, PerfCounterMax * sizeof(uint64_t));
+
+    for (uint32_t i = 0; i < Processors; i++) {
+        if (Processor != MD_ALL_PROCESSORS && Processor != i) continue;
+
+        PPROCESSOR Cpu = MeGetProcessorBlock((uint8_t)i);
+        for (uint32_t j = 0; j < PerfCounterMax; j++) {
+            Values[j] += Cpu->PerfCounters[j];
+        }
+    }
+}
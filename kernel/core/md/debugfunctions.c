@@ -6,6 +6,8 @@
 
 #include "../../includes/md.h"
 #include "../../includes/mh.h"
+#include "../../includes/fs.h"
+#include "../../intrinsics/atomic.h"
 
  /* Find a free debug slot (0..3) or -1 if none */
 int find_available_debug_reg(void) {
@@ -116,4 +118,80 @@ MTSTATUS MdClearHardwareBreakpointByAddress(void* BreakpointAddress) {
         }
     }
     return MT_NOT_FOUND;
+}
+
+void
+MdAcquireControlMutex(
+    IN PMUTEX ControlMutex,
+    IN volatile uint32_t* Initialized
+)
+
+/*++
+
+    Routine description:
+
+        Acquires the mutex that serializes a debug facility's control calls (start, stop, dump), initializing it on first use.
+
+    Arguments:
+
+        [IN]    PMUTEX ControlMutex - The facility's control mutex.
+        [IN]    volatile uint32_t* Initialized - Its initialization state, zero until the first call.
+
+    Return Values:
+
+        None, the mutex is held on return (release it with MsReleaseMutexObject).
+
+    Notes:
+
+        Lazily initialized, tracing and profiling are controlled long after boot. PASSIVE_LEVEL.
+
+--*/
+
+{
+    if (InterlockedCompareExchangeU32(Initialized, 1, 0) == 0) {
+        MsInitializeMutexObject(ControlMutex);
+        InterlockedExchangeU32(Initialized, 2);
+    }
+
+    while (InterlockedFetchU32(Initialized) != 2) {
+        __pause();
+    }
+
+    MsAcquireMutexObject(ControlMutex);
+}
+
+MTSTATUS
+MdWriteDumpFile(
+    IN PFILE_OBJECT FileObject,
+    IN OUT uint64_t* Offset,
+    IN void* Data,
+    IN size_t Length
+)
+
+/*++
+
+    Routine description:
+
+        Appends a block of a dump file (trace and profile dumps) at the running offset.
+
+    Arguments:
+
+        [IN]        PFILE_OBJECT FileObject - The dump file.
+        [IN OUT]    uint64_t* Offset - Where to write, advanced by the bytes written.
+        [IN]        void* Data - The block.
+        [IN]        size_t Length - Its size in bytes.
+
+    Return Values:
+
+        MTSTATUS Status Code, MT_IO_ERROR on a short write.
+
+--*/
+
+{
+    size_t Written = 0;
+    MTSTATUS Status = FsWriteFile(FileObject, *Offset, Data, Length, &Written);
+    *Offset += Written;
+
+    if (MT_SUCCEEDED(Status) && Written != Length) Status = MT_IO_ERROR;
+    return Status;
 }
\ No newline at end of file
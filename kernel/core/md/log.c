@@ -0,0 +1,472 @@
+/*++
+
+Module Name:
+
+    log.c
+
+Purpose:
+
+    This translation unit contains the kernel log facility (per processor lock-free record rings, drained to the console and a log file).
+
+Author:
+
+    slep (Matanel) 2025.
+
+Revision History:
+
+--*/
+
+#include "../../includes/md.h"
+#include "../../includes/mg.h"
+#include "../../includes/ms.h"
+#include "../../includes/ps.h"
+#include "../../includes/ob.h"
+#include "../../includes/ht.h"
+#include "../../includes/fs.h"
+#include "../../intrinsics/atomic.h"
+
+//
+// Writers never block and never render anything, MdLogWrite copies the format pointer and the arguments into a
+// fixed size record of the current processor's ring, and returns. A low priority drain thread formats the records
+// and prints them, so gop_printf (interrupts off, GOP lock) only ever runs at PASSIVE_LEVEL, off the hot paths.
+//
+// The rings are multi producer (a thread may migrate, an interrupt may log over a thread that is mid-record),
+// single consumer (the drain thread). Each record carries a sequence number relative to its slot:
+//      Sequence == Base        - free for the writer of position Base + slot
+//      Sequence == Base + 1    - published, ready to be drained
+//      Sequence == Base + SIZE - drained, free for the next lap
+// where Base is the position rounded down to the ring size (so a zeroed ring is free).
+// A writer that finds its slot not yet drained (the ring is full) drops the record and counts it.
+//
+// Writers cannot signal events at every IRQL, so they only raise MdpLogPending, and Schedule() wakes the drain thread.
+//
+
+#define LOG_RING_RECORDS    128
+#define LOG_LINE_SIZE       256
+#define LOG_FILE_BUFFER     4096
+
+typedef struct _LOG_RECORD {
+    volatile uint64_t Sequence;
+    uint64_t Timestamp;                         // TSC
+    const char* Format;
+    uint64_t Arguments[LOG_MAX_ARGUMENTS];
+    uint32_t Color;
+    uint16_t Processor;
+    uint8_t Level;
+    uint8_t ArgumentCount;
+} LOG_RECORD, *PLOG_RECORD;
+
+typedef struct _LOG_RING {
+    volatile uint64_t Head;                     // Next position to reserve (writers)
+    uint64_t Tail;                              // Next position to drain (drain thread only)
+    volatile uint64_t Dropped;                  // Records dropped because the ring was full
+    LOG_RECORD Records[LOG_RING_RECORDS];
+} __attribute__((aligned(64))) LOG_RING, *PLOG_RING;
+
+static LOG_RING LogRings[MAX_CPUS];
+
+#ifdef DEBUG
+static LOG_LEVEL MdpLogLevel = LogLevelTrace;
+#else
+static LOG_LEVEL MdpLogLevel = LogLevelInfo;
+#endif
+
+static volatile bool MdpLogPending;
+static volatile uint32_t MdpLogDrainWaiting;
+static EVENT MdpLogEvent = { .type = SynchronizationEvent };
+static PETHREAD MdpLogDrainThread;
+
+// Set by MdSetLogFile, only used by the drain thread afterwards.
+static PFILE_OBJECT MdpLogFile;
+static uint64_t MdpLogFileOffset;
+
+static const char* const MdpLogLevelNames[] = { "TRACE", "INFO", "WARN", "ERROR" };
+
+void
+MdLogWrite(
+    IN LOG_LEVEL Level,
+    IN uint32_t Color,
+    IN const char* Format,
+    IN uint32_t ArgumentCount,
+    ...
+)
+
+/*++
+
+    Routine description:
+
+        Appends a log record to the current processor's ring.
+
+    Arguments:
+
+        [IN]    LOG_LEVEL Level - Level of the record, records below the current log level are ignored.
+        [IN]    uint32_t Color - Console color of the record.
+        [IN]    const char* Format - gop_printf style format, must stay valid until the record is drained.
+        [IN]    uint32_t ArgumentCount - Number of variadic arguments (filled by the MdLog macro).
+        [IN]    ... - The arguments, integers or pointers.
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        Lock-free and never blocks, callable at any IRQL (including with interrupts disabled).
+        Arguments are read as 64 bit values, narrower integers are formatted from their low bits by the specifier.
+        %s arguments are dereferenced by the drain thread, they must stay valid too.
+
+--*/
+
+{
+    if (Level < MdpLogLevel) return;
+
+    PPROCESSOR Cpu = MeGetCurrentProcessor();
+
+    // The drain thread's own work (file writes, pool frees) would log forever.
+    if (MdpLogDrainThread && Cpu->currentThread == &MdpLogDrainThread->InternalThread) return;
+
+    uint32_t Processor = MeGetCurrentProcessorNumber();
+    if (Processor >= MAX_CPUS) Processor = MAX_CPUS - 1;
+
+    PLOG_RING Ring = &LogRings[Processor];
+    PLOG_RECORD Record;
+    uint64_t Base;
+
+    for (;;) {
+        uint64_t Position = InterlockedFetchU64(&Ring->Head);
+        Record = &Ring->Records[Position % LOG_RING_RECORDS];
+        Base = Position - (Position % LOG_RING_RECORDS);
+
+        uint64_t Sequence = InterlockedFetchU64(&Record->Sequence);
+        if (Sequence == Base) {
+            if (InterlockedCompareExchangeU64(&Ring->Head, Position + 1, Position) == Position) break;
+        }
+        else if (Sequence < Base) {
+            // The previous lap wasn't drained yet, the ring is full.
+            InterlockedIncrementU64(&Ring->Dropped);
+            return;
+        }
+        // Otherwise another writer took the position, try the next one.
+    }
+
+    va_list ap;
+    va_start(ap, ArgumentCount);
+
+    if (ArgumentCount > LOG_MAX_ARGUMENTS) ArgumentCount = LOG_MAX_ARGUMENTS;
+    for (uint32_t i = 0; i < LOG_MAX_ARGUMENTS; i++) {
+        Record->Arguments[i] = (i < ArgumentCount) ? va_arg(ap, uint64_t) : 0;
+    }
+
+    va_end(ap);
+
+    Record->Timestamp = __rdtsc();
+    Record->Format = Format;
+    Record->Color = Color;
+    Record->Processor = (uint16_t)Processor;
+    Record->Level = (uint8_t)Level;
+    Record->ArgumentCount = (uint8_t)ArgumentCount;
+
+    // Publish, the record's contents are visible before its sequence.
+    InterlockedExchangeU64(&Record->Sequence, Base + 1);
+    MdpLogPending = true;
+}
+
+void
+MdLogQuiescentState(
+    void
+)
+
+/*++
+
+    Routine description:
+
+        Wakes the drain thread if records were written since it last went to sleep.
+
+    Arguments:
+
+        None.
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        Called by Schedule() (may signal events), a single load when nothing was logged.
+
+--*/
+
+{
+    if (!MdpLogPending) return;
+
+    // Only one waker per sleep.
+    if (InterlockedCompareExchangeU32(&MdpLogDrainWaiting, 0, 1) == 1) {
+        MsSetEvent(&MdpLogEvent);
+    }
+}
+
+uint64_t
+MdGetLogDropCount(
+    void
+)
+
+/*++
+
+    Routine description:
+
+        Returns the number of log records dropped because a ring was full.
+
+    Arguments:
+
+        None.
+
+    Return Values:
+
+        Sum of the dropped records of every processor since boot.
+
+--*/
+
+{
+    uint64_t Dropped = 0;
+
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        Dropped += InterlockedFetchU64(&LogRings[i].Dropped);
+    }
+
+    return Dropped;
+}
+
+static
+bool
+MdpTakeOldestRecord(
+    OUT PLOG_RECORD Out
+)
+
+/*++
+
+    Routine description:
+
+        Removes the oldest published record across the processor rings.
+
+    Arguments:
+
+        [OUT]   PLOG_RECORD Out - Receives a copy of the record.
+
+    Return Values:
+
+        True if a record was taken, false if every ring is empty.
+
+    Notes:
+
+        Only the head of each ring is considered, so records are in timestamp order per processor, and merged
+        across processors by their (synchronized) TSC.
+
+--*/
+
+{
+    PLOG_RING Oldest = NULL;
+    PLOG_RECORD OldestRecord = NULL;
+
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        PLOG_RING Ring = &LogRings[i];
+        PLOG_RECORD Record = &Ring->Records[Ring->Tail % LOG_RING_RECORDS];
+        uint64_t Base = Ring->Tail - (Ring->Tail % LOG_RING_RECORDS);
+
+        if (InterlockedFetchU64(&Record->Sequence) != Base + 1) continue;
+
+        if (!OldestRecord || Record->Timestamp < OldestRecord->Timestamp) {
+            Oldest = Ring;
+            OldestRecord = Record;
+        }
+    }
+
+    if (!Oldest) return false;
+
+    uint64_t Base = Oldest->Tail - (Oldest->Tail % LOG_RING_RECORDS);
+
+    *Out = *OldestRecord;
+    InterlockedExchangeU64(&OldestRecord->Sequence, Base + LOG_RING_RECORDS);
+    Oldest->Tail++;
+    return true;
+}
+
+static
+void
+MdpFlushLogFile(
+    IN char* Buffer,
+    IN size_t* Length
+)
+
+{
+    if (!*Length) return;
+
+    size_t Written = 0;
+    MTSTATUS Status = FsWriteFile(MdpLogFile, MdpLogFileOffset, Buffer, *Length, &Written);
+    MdpLogFileOffset += Written;
+    *Length = 0;
+
+    if (MT_FAILURE(Status)) {
+        gop_printf(COLOR_RED, "[LOG] Writing the log file failed: %x, file logging disabled.\n", Status);
+        MdpLogFile = NULL;
+    }
+}
+
+static
+void
+MdpLogDrainRoutine(
+    void
+)
+
+/*++
+
+    Routine description:
+
+        Formats the published records, prints them to the console and appends them to the log file.
+
+    Arguments:
+
+        None.
+
+    Return Values:
+
+        None, never returns.
+
+--*/
+
+{
+    static char Line[LOG_LINE_SIZE];
+    static char FileBuffer[LOG_FILE_BUFFER];
+    uint64_t ReportedDrops = 0;
+    LOG_RECORD Record;
+
+    for (;;) {
+        size_t FileLength = 0;
+
+        MdpLogPending = false;
+
+        while (MdpTakeOldestRecord(&Record)) {
+            ksnprintf(Line, sizeof(Line), Record.Format,
+                Record.Arguments[0], Record.Arguments[1], Record.Arguments[2],
+                Record.Arguments[3], Record.Arguments[4], Record.Arguments[5]);
+
+            gop_printf(Record.Color, "%s", Line);
+
+            if (!MdpLogFile) continue;
+
+            char Prefix[64];
+            int PrefixLength = ksnprintf(Prefix, sizeof(Prefix), "[%llu] [CPU %u] [%s] ",
+                (unsigned long long)Record.Timestamp, (uint32_t)Record.Processor, MdpLogLevelNames[Record.Level & 3]);
+            size_t LineLength = kstrlen(Line);
+
+            if (PrefixLength < 0 || (size_t)PrefixLength >= sizeof(Prefix)) PrefixLength = sizeof(Prefix) - 1;
+            if (FileLength + (size_t)PrefixLength + LineLength > sizeof(FileBuffer)) {
+                MdpFlushLogFile(FileBuffer, &FileLength);
+                if (!MdpLogFile) continue;
+            }
+
+            kmemcpy(FileBuffer + FileLength, Prefix, (size_t)PrefixLength);
+            FileLength += (size_t)PrefixLength;
+            kmemcpy(FileBuffer + FileLength, Line, LineLength);
+            FileLength += LineLength;
+        }
+
+        if (MdpLogFile) MdpFlushLogFile(FileBuffer, &FileLength);
+
+        uint64_t Dropped = MdGetLogDropCount();
+        if (Dropped != ReportedDrops) {
+            gop_printf(COLOR_YELLOW, "[LOG] %llu records dropped (rings full).\n", (unsigned long long)(Dropped - ReportedDrops));
+            ReportedDrops = Dropped;
+        }
+
+        // Sleep, unless something was published after the rings were emptied (Schedule() won't see it after we clear Waiting).
+        InterlockedExchangeU32(&MdpLogDrainWaiting, 1);
+        if (MdpLogPending && InterlockedCompareExchangeU32(&MdpLogDrainWaiting, 0, 1) == 1) continue;
+
+        MsWaitForEvent(&MdpLogEvent);
+    }
+}
+
+void
+MdInitializeLogging(
+    void
+)
+
+/*++
+
+    Routine description:
+
+        Creates the log drain thread.
+
+    Arguments:
+
+        None.
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        Records written before this is called wait in the rings (dropped once a ring is full).
+
+--*/
+
+{
+    PETHREAD DrainThread = NULL;
+    MTSTATUS Status = PsCreateSystemThread((ThreadEntry)MdpLogDrainRoutine, NULL, LOW_TIMESLICE_TICKS, &DrainThread);
+
+    if (MT_FAILURE(Status)) {
+        MeBugCheckEx(
+            PSWORKER_INIT_FAILED,
+            (void*)(uintptr_t)Status,
+            NULL,
+            NULL,
+            NULL
+        );
+    }
+
+    DrainThread->WorkerThread = true;
+    MdpLogDrainThread = DrainThread;
+}
+
+MTSTATUS
+MdSetLogFile(
+    IN const char* Path
+)
+
+/*++
+
+    Routine description:
+
+        Opens (or creates) the log file, drained records are appended to it from now on.
+
+    Arguments:
+
+        [IN]    const char* Path - Full path of the log file.
+
+    Return Values:
+
+        MTSTATUS Status Code.
+
+    Notes:
+
+        Call once, at PASSIVE_LEVEL, after FsInitialize.
+
+--*/
+
+{
+    HANDLE FileHandle;
+    PFILE_OBJECT FileObject = NULL;
+
+    MTSTATUS Status = FsCreateFile(Path, MT_FILE_WRITE_DATA | MT_FILE_APPEND_DATA, &FileHandle);
+    if (MT_FAILURE(Status)) return Status;
+
+    // Keep a reference of our own, the handle isn't needed.
+    Status = ObReferenceObjectByHandle(FileHandle, MT_FILE_WRITE_DATA, FsFileType, (void**)&FileObject, NULL);
+    HtClose(FileHandle);
+    if (MT_FAILURE(Status)) return Status;
+
+    MdpLogFileOffset = FileObject->FileSize;
+    InterlockedExchangePointer((volatile void* volatile*)&MdpLogFile, FileObject);
+    return MT_SUCCESS;
+}
@@ -0,0 +1,727 @@
+/*++
+
+Module Name:
+
+    profile.c
+
+Purpose:
+
+    This translation unit contains the statistical sampling profiler (clock tick or performance counter overflow NMI samples,
+    aggregated into per processor hash tables).
+
+Author:
+
+    slep (Matanel) 2025.
+
+Revision History:
+
+--*/
+
+#include "../../includes/md.h"
+#include "../../includes/mh.h"
+#include "../../includes/mm.h"
+#include "../../includes/ps.h"
+#include "../../includes/ob.h"
+#include "../../includes/ht.h"
+#include "../../includes/fs.h"
+#include "../../intrinsics/atomic.h"
+#include "../../assert.h"
+
+//
+// A sample is the interrupted RIP, the interrupted IRQL, the current process and thread, and (for kernel mode) a frame
+// pointer walk, the kernel is built with -fno-omit-frame-pointer. Samples with the same stack, IRQL and process are
+// aggregated into one entry of the processor's open addressing table, only that processor ever writes to it.
+//
+// Samples come from the clock interrupt (every Interval ticks), or from general purpose counter 0 of the architectural
+// PMU counting unhalted core cycles, its overflow is delivered as an NMI (LVT performance counter entry).
+// Start/stop reach the counters of every processor on its next clock tick (the profiler generation changed).
+//
+// The tables are allocated on the first start and kept afterwards, the dump is what tools/profsym symbolizes.
+//
+
+#define PROFILE_TABLE_SIZE 2048         // Entries per processor, a power of 2 (192 KiB)
+#define PROFILE_PROBE_LIMIT 16          // Slots probed before the sample is dropped
+#define PROFILE_DEFAULT_CYCLES 1000000  // Cycles per sample when no interval is given
+#define PROFILE_MAX_CYCLES 0x7FFFFFFF   // The counter is written through its low 32 bits (sign extended)
+#define PROFILE_MAX_STACK_SPAN 0x10000  // The largest kernel stack is 60 KiB, frame pointers further away are garbage
+
+// IA32_PERFEVTSEL0, unhalted core cycles (event 0x3C, umask 0) in both rings, interrupt on overflow.
+#define PERFEVTSEL_CORE_CYCLES (0x3CULL | (1ULL << 16) | (1ULL << 17) | (1ULL << 20) | (1ULL << 22))
+
+typedef struct _PROFILE_TABLE {
+    PPROFILE_ENTRY Entries;
+    uint64_t Samples;                   // Samples recorded into Entries
+    volatile uint64_t Dropped;
+    uint64_t Countdown;                 // Clock ticks until the next sample (timer source)
+    volatile uint32_t InSample;         // A sample is being recorded (start/stop wait for it)
+    uint32_t Generation;                // The profiler generation the counters of this processor are programmed for
+    bool CountersArmed;
+} __attribute__((aligned(64))) PROFILE_TABLE, *PPROFILE_TABLE;
+
+static PROFILE_TABLE ProfileTables[MAX_CPUS];
+
+static volatile bool MdpProfileEnabled;
+static volatile uint32_t MdpProfileGeneration;
+static PROFILE_SOURCE MdpProfileSource;
+static uint64_t MdpProfileInterval;
+
+// Architectural PMU, probed on the first start.
+static bool MdpPmuProbed;
+static uint32_t MdpPmuVersion;          // 0 if unavailable
+static uint64_t MdpCounterSignBit;
+
+// Serializes start/stop/dump/query (system calls, PASSIVE_LEVEL).
+static MUTEX ProfileControlMutex;
+static volatile uint32_t ProfileControlMutexInitialized;
+
+// Staging buffer for the dump, protected by ProfileControlMutex.
+static PROFILE_ENTRY ProfileStaging[4096 / sizeof(PROFILE_ENTRY)];
+
+static
+uint32_t
+MdpWalkFrames(
+    IN uint64_t FramePointer,
+    OUT uint64_t* Frames,
+    IN uint32_t MaxFrames
+)
+
+/*++
+
+    Routine description:
+
+        Follows the saved frame pointer chain of a kernel stack.
+
+    Arguments:
+
+        [IN]    uint64_t FramePointer - RBP of the interrupted context.
+        [OUT]   uint64_t* Frames - Receives the return addresses.
+        [IN]    uint32_t MaxFrames - Capacity of Frames.
+
+    Return Values:
+
+        The number of return addresses written.
+
+    Notes:
+
+        Runs in NMI context, so it must never fault: every frame is checked to be mapped (without allocating), to grow
+        upwards within the stack span, and to hold a return address inside the kernel image.
+
+--*/
+
+{
+    uint64_t Start = FramePointer;
+    uint64_t CheckedPage = 0;
+    uint32_t Count = 0;
+
+    while (Count < MaxFrames) {
+        if (FramePointer < KernelVaStart || (FramePointer & 7)) break;
+        if (FramePointer - Start > PROFILE_MAX_STACK_SPAN) break;
+
+        // The saved RBP and the return address (16 bytes) may straddle a page.
+        uint64_t FirstPage = FramePointer & ~(uint64_t)(VirtualPageSize - 1);
+        uint64_t LastPage = (FramePointer + 15) & ~(uint64_t)(VirtualPageSize - 1);
+
+        if (FirstPage != CheckedPage && !MiIsAddressMapped(FirstPage)) break;
+        if (LastPage != FirstPage && !MiIsAddressMapped(LastPage)) break;
+        CheckedPage = LastPage;
+
+        uint64_t* Frame = (uint64_t*)FramePointer;
+        uint64_t ReturnAddress = Frame[1];
+
+        if (ReturnAddress < (uint64_t)&kernel_start || ReturnAddress >= (uint64_t)&kernel_end) break;
+        Frames[Count++] = ReturnAddress;
+
+        if (Frame[0] <= FramePointer) break;
+        FramePointer = Frame[0];
+    }
+
+    return Count;
+}
+
+static
+void
+MdpRecordSample(
+    IN PPROFILE_TABLE Table,
+    IN uint32_t Processor,
+    IN PTRAP_FRAME TrapFrame,
+    IN IRQL Irql
+)
+
+{
+    // An NMI sample that arrived during a clock sample (source change) is dropped, the table has a single writer.
+    if (InterlockedExchangeU32(&Table->InSample, 1)) {
+        InterlockedIncrementU64(&Table->Dropped);
+        return;
+    }
+
+    PPROFILE_ENTRY Entries = Table->Entries;
+
+    // Stopped (or started before this processor came up).
+    if (!MdpProfileEnabled || !Entries) goto Exit;
+
+    uint64_t Frames[PROFILE_STACK_DEPTH];
+    uint32_t Depth = 1;
+    bool FromUserMode = (TrapFrame->cs & 3) == 3;
+
+    Frames[0] = TrapFrame->rip;
+    if (!FromUserMode) {
+        Depth += MdpWalkFrames(TrapFrame->rbp, &Frames[1], PROFILE_STACK_DEPTH - 1);
+    }
+
+    PETHREAD Current = (PETHREAD)MeGetCurrentProcessor()->currentThread;
+    uint32_t Thread = Current ? (uint32_t)Current->TID : 0;
+    uint32_t Process = Current ? (uint32_t)Current->PID : 0;
+
+    // FNV-1a over the key.
+    uint64_t Hash = 0xcbf29ce484222325ULL;
+    Hash = (Hash ^ (((uint64_t)Process << 16) | ((uint64_t)Irql << 8) | FromUserMode)) * 0x100000001b3ULL;
+    for (uint32_t i = 0; i < Depth; i++) {
+        Hash = (Hash ^ Frames[i]) * 0x100000001b3ULL;
+    }
+    Hash ^= Hash >> 29;
+
+    for (uint32_t Probe = 0; Probe < PROFILE_PROBE_LIMIT; Probe++) {
+        PPROFILE_ENTRY Entry = &Entries[(Hash + Probe) & (PROFILE_TABLE_SIZE - 1)];
+
+        if (!Entry->Hits) {
+            for (uint32_t i = 0; i < Depth; i++) Entry->Frames[i] = Frames[i];
+            Entry->Process = Process;
+            Entry->Thread = Thread;
+            Entry->Processor = (uint16_t)Processor;
+            Entry->Irql = (uint8_t)Irql;
+            Entry->Depth = (uint8_t)Depth;
+            Entry->UserMode = FromUserMode;
+
+            // Readers (query) skip free slots, publish the key first.
+            __asm__ volatile("" ::: "memory");
+            Entry->Hits = 1;
+            Table->Samples++;
+            goto Exit;
+        }
+
+        if (Entry->Depth != Depth || Entry->Process != Process || Entry->Irql != Irql || Entry->UserMode != FromUserMode) continue;
+
+        bool Match = true;
+        for (uint32_t i = 0; i < Depth; i++) {
+            if (Entry->Frames[i] != Frames[i]) {
+                Match = false;
+                break;
+            }
+        }
+
+        if (Match) {
+            Entry->Hits++;
+            Entry->Thread = Thread;
+            Table->Samples++;
+            goto Exit;
+        }
+    }
+
+    // Too many distinct stacks.
+    InterlockedIncrementU64(&Table->Dropped);
+
+Exit:
+    InterlockedExchangeU32(&Table->InSample, 0);
+}
+
+static
+void
+MdpProgramCounters(
+    IN PPROFILE_TABLE Table
+)
+
+/*++
+
+    Routine description:
+
+        Arms or disarms the current processor's performance counter to match the profiler state.
+
+    Arguments:
+
+        [IN]    PPROFILE_TABLE Table - The current processor's table.
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        Called from the clock interrupt (CLOCK_LEVEL), on the processor that owns Table.
+
+--*/
+
+{
+    uint32_t Generation = MdpProfileGeneration;
+    bool Arm = MdpProfileEnabled && MdpProfileSource == ProfileSourceCycles;
+
+    if (Arm || Table->CountersArmed) {
+        // Stop counting while reprogramming.
+        __writemsr(IA32_PERFEVTSEL0, 0);
+
+        if (Arm) {
+            __writemsr(IA32_PMC0, (uint64_t)-(int64_t)MdpProfileInterval);
+            if (MdpPmuVersion >= 2) {
+                __writemsr(IA32_PERF_GLOBAL_OVF_CTRL, 1);
+                __writemsr(IA32_PERF_GLOBAL_CTRL, __readmsr(IA32_PERF_GLOBAL_CTRL) | 1);
+            }
+
+            Table->CountersArmed = true;
+            lapic_set_perfmon_nmi(true);
+            __writemsr(IA32_PERFEVTSEL0, PERFEVTSEL_CORE_CYCLES);
+        }
+        else {
+            lapic_set_perfmon_nmi(false);
+            if (MdpPmuVersion >= 2) __writemsr(IA32_PERF_GLOBAL_OVF_CTRL, 1);
+            Table->CountersArmed = false;
+        }
+    }
+
+    Table->Generation = Generation;
+}
+
+void
+MdProfileClockTick(
+    IN PTRAP_FRAME TrapFrame,
+    IN IRQL InterruptedIrql
+)
+
+/*++
+
+    Routine description:
+
+        Clock interrupt hook of the profiler, takes timer samples and applies start/stop to the performance counters.
+
+    Arguments:
+
+        [IN]    PTRAP_FRAME TrapFrame - The interrupted context.
+        [IN]    IRQL InterruptedIrql - The IRQL before the clock interrupt raised it.
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        Called from MiLapicInterrupt, a load and a compare while the profiler is stopped.
+
+--*/
+
+{
+    uint32_t Processor = MeGetCurrentProcessorNumber();
+    if (Processor >= MAX_CPUS) return;
+
+    PPROFILE_TABLE Table = &ProfileTables[Processor];
+
+    if (unlikely(Table->Generation != MdpProfileGeneration)) {
+        MdpProgramCounters(Table);
+    }
+
+    if (likely(!MdpProfileEnabled) || MdpProfileSource != ProfileSourceTimer) return;
+
+    if (Table->Countdown > 1) {
+        Table->Countdown--;
+        return;
+    }
+
+    Table->Countdown = MdpProfileInterval;
+    MdpRecordSample(Table, Processor, TrapFrame, InterruptedIrql);
+}
+
+bool
+MdProfileInterrupt(
+    IN PTRAP_FRAME TrapFrame
+)
+
+/*++
+
+    Routine description:
+
+        NMI hook of the profiler, takes a sample if the NMI is a performance counter overflow.
+
+    Arguments:
+
+        [IN]    PTRAP_FRAME TrapFrame - The interrupted context.
+
+    Return Values:
+
+        True if the NMI was a counter overflow (handled), false if it must be treated as a hardware NMI.
+
+    Notes:
+
+        NMI context, takes no locks and doesn't change the IRQL (the current IRQL is the interrupted one).
+
+--*/
+
+{
+    uint32_t Processor = MeGetCurrentProcessorNumber();
+    if (Processor >= MAX_CPUS) return false;
+
+    PPROFILE_TABLE Table = &ProfileTables[Processor];
+    if (!Table->CountersArmed) return false;
+
+    bool Overflowed;
+    if (MdpPmuVersion >= 2) {
+        Overflowed = (__readmsr(IA32_PERF_GLOBAL_STATUS) & 1) != 0;
+    }
+    else {
+        // Counting up from -Interval, the sign bit clears on overflow.
+        Overflowed = (__readmsr(IA32_PMC0) & MdpCounterSignBit) == 0;
+    }
+
+    if (!Overflowed) return false;
+
+    if (MdpProfileEnabled && MdpProfileSource == ProfileSourceCycles) {
+        MdpRecordSample(Table, Processor, TrapFrame, MeGetCurrentIrql());
+    }
+
+    // Re-arm, the LVT entry masked itself on delivery.
+    __writemsr(IA32_PMC0, (uint64_t)-(int64_t)MdpProfileInterval);
+    if (MdpPmuVersion >= 2) __writemsr(IA32_PERF_GLOBAL_OVF_CTRL, 1);
+    lapic_set_perfmon_nmi(true);
+
+    return true;
+}
+
+static
+void
+MdpDisableSampling(
+    void
+)
+
+{
+    // Samples check the flag after marking themselves in progress, wait for the ones that saw it set.
+    MdpProfileEnabled = false;
+    MmFullBarrier();
+
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        while (InterlockedFetchU32(&ProfileTables[i].InSample)) {
+            __pause();
+        }
+    }
+
+    // Disarm the counters on the next clock ticks.
+    InterlockedIncrementU32(&MdpProfileGeneration);
+}
+
+static
+void
+MdpProbePmu(
+    void
+)
+
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    MdpPmuProbed = true;
+
+    __cpuid(0, eax, ebx, ecx, edx);
+    if (eax < 0xA) return;
+
+    __cpuid(0xA, eax, ebx, ecx, edx);
+    uint32_t Version = eax & 0xFF;
+    uint32_t Counters = (eax >> 8) & 0xFF;
+    uint32_t Width = (eax >> 16) & 0xFF;
+    uint32_t EventsLength = (eax >> 24) & 0xFF;
+
+    // Need a general purpose counter, and the core cycles event (EBX bit 0 set means unavailable).
+    if (!Version || !Counters || Width < 32 || !EventsLength || (ebx & 1)) return;
+
+    MdpPmuVersion = Version;
+    MdpCounterSignBit = 1ULL << (Width - 1);
+}
+
+MTSTATUS
+MdStartProfile(
+    IN PROFILE_SOURCE Source,
+    IN uint64_t Interval
+)
+
+/*++
+
+    Routine description:
+
+        Starts the sampling profiler, previous samples are discarded.
+
+    Arguments:
+
+        [IN]    PROFILE_SOURCE Source - What triggers a sample.
+        [IN]    uint64_t Interval - Clock ticks (ProfileSourceTimer) or core cycles (ProfileSourceCycles) per sample, 0 for the default.
+
+    Return Values:
+
+        MT_SUCCESS, MT_INVALID_PARAM for an unknown source, or MT_NO_MEMORY if the tables couldn't be allocated.
+
+    Notes:
+
+        PASSIVE_LEVEL. Without an architectural PMU, ProfileSourceCycles falls back to the timer (the dump records the source used).
+
+--*/
+
+{
+    if (Source != ProfileSourceTimer && Source != ProfileSourceCycles) return MT_INVALID_PARAM;
+
+    MTSTATUS Status = MT_SUCCESS;
+    uint32_t Processors = MeGetActiveProcessorCount();
+
+    if (Processors > MAX_CPUS) Processors = MAX_CPUS;
+
+    MdAcquireControlMutex(&ProfileControlMutex, &ProfileControlMutexInitialized);
+    MdpDisableSampling();
+
+    if (!MdpPmuProbed) MdpProbePmu();
+    if (Source == ProfileSourceCycles && !MdpPmuVersion) Source = ProfileSourceTimer;
+
+    if (!Interval) Interval = (Source == ProfileSourceTimer) ? 1 : PROFILE_DEFAULT_CYCLES;
+    if (Source == ProfileSourceCycles && Interval > PROFILE_MAX_CYCLES) Interval = PROFILE_MAX_CYCLES;
+
+    for (uint32_t i = 0; i < Processors; i++) {
+        PPROFILE_TABLE Table = &ProfileTables[i];
+
+        if (!Table->Entries) {
+            PPROFILE_ENTRY Entries = MmAllocatePoolWithTag(NonPagedPool, PROFILE_TABLE_SIZE * sizeof(PROFILE_ENTRY), 'forP'); // Prof
+            if (!Entries) {
+                Status = MT_NO_MEMORY;
+                break;
+            }
+            Table->Entries = Entries;
+        }
+
+        kmemset(Table->Entries, 0, PROFILE_TABLE_SIZE * sizeof(PROFILE_ENTRY));
+        Table->Samples = 0;
+        Table->Dropped = 0;
+        Table->Countdown = Interval;
+    }
+
+    if (MT_SUCCEEDED(Status)) {
+        MdpProfileSource = Source;
+        MdpProfileInterval = Interval;
+        MdpProfileEnabled = true;
+        InterlockedIncrementU32(&MdpProfileGeneration);
+    }
+
+    MsReleaseMutexObject(&ProfileControlMutex);
+    return Status;
+}
+
+void
+MdStopProfile(
+    void
+)
+
+/*++
+
+    Routine description:
+
+        Stops the sampling profiler, the samples are kept until the next start.
+
+    Arguments:
+
+        None.
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        PASSIVE_LEVEL.
+
+--*/
+
+{
+    MdAcquireControlMutex(&ProfileControlMutex, &ProfileControlMutexInitialized);
+    MdpDisableSampling();
+    MsReleaseMutexObject(&ProfileControlMutex);
+}
+
+static
+void
+MdpFillHeader(
+    OUT PPROFILE_DUMP_HEADER Header
+)
+
+{
+    kmemset(Header, 0, sizeof(*Header));
+    Header->Magic = PROFILE_DUMP_MAGIC;
+    Header->Version = PROFILE_DUMP_VERSION;
+    Header->EntrySize = sizeof(PROFILE_ENTRY);
+    Header->Source = MdpProfileSource;
+    Header->Interval = MdpProfileInterval;
+
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        PPROFILE_TABLE Table = &ProfileTables[i];
+        if (!Table->Entries) continue;
+
+        Header->TotalSamples += Table->Samples;
+        Header->DroppedSamples += InterlockedFetchU64(&Table->Dropped);
+
+        for (uint32_t j = 0; j < PROFILE_TABLE_SIZE; j++) {
+            if (Table->Entries[j].Hits) Header->EntryCount++;
+        }
+    }
+}
+
+static
+uint32_t
+MdpReadEntries(
+    IN OUT uint64_t* Cursor,
+    OUT PPROFILE_ENTRY Entries,
+    IN uint32_t Count
+)
+
+{
+    uint32_t Copied = 0;
+    uint64_t Position = *Cursor;
+
+    while (Copied < Count && Position < (uint64_t)MAX_CPUS * PROFILE_TABLE_SIZE) {
+        PPROFILE_TABLE Table = &ProfileTables[Position / PROFILE_TABLE_SIZE];
+
+        if (!Table->Entries) {
+            // Skip the whole table.
+            Position = (Position / PROFILE_TABLE_SIZE + 1) * PROFILE_TABLE_SIZE;
+            continue;
+        }
+
+        PPROFILE_ENTRY Entry = &Table->Entries[Position % PROFILE_TABLE_SIZE];
+        Position++;
+
+        if (!Entry->Hits) continue;
+
+        // A running profiler may bump Hits meanwhile, the key itself never changes once published.
+        Entries[Copied] = *Entry;
+        Copied++;
+    }
+
+    *Cursor = Position;
+    return Copied;
+}
+
+void
+MdQueryProfileHeader(
+    OUT PPROFILE_DUMP_HEADER Header
+)
+
+/*++
+
+    Routine description:
+
+        Returns the profiler summary, EntryCount is the number of entries over every processor.
+
+    Arguments:
+
+        [OUT]   PPROFILE_DUMP_HEADER Header - Receives the summary.
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        PASSIVE_LEVEL, the profiler may keep running (the counts are then a snapshot).
+
+--*/
+
+{
+    MdAcquireControlMutex(&ProfileControlMutex, &ProfileControlMutexInitialized);
+    MdpFillHeader(Header);
+    MsReleaseMutexObject(&ProfileControlMutex);
+}
+
+uint32_t
+MdReadProfileEntries(
+    IN OUT uint64_t* Cursor,
+    OUT PPROFILE_ENTRY Entries,
+    IN uint32_t Count
+)
+
+/*++
+
+    Routine description:
+
+        Copies the next profile entries (over every processor's table) into a kernel buffer.
+
+    Arguments:
+
+        [IN OUT]    uint64_t* Cursor - Position to continue from, 0 for the first call.
+        [OUT]       PPROFILE_ENTRY Entries - Receives the entries.
+        [IN]        uint32_t Count - Capacity of Entries.
+
+    Return Values:
+
+        The number of entries copied, 0 once every entry was returned.
+
+    Notes:
+
+        PASSIVE_LEVEL. Used by MtQueryProfile in chunks, so that user buffers are only touched by the system call itself.
+
+--*/
+
+{
+    MdAcquireControlMutex(&ProfileControlMutex, &ProfileControlMutexInitialized);
+    uint32_t Copied = MdpReadEntries(Cursor, Entries, Count);
+    MsReleaseMutexObject(&ProfileControlMutex);
+
+    return Copied;
+}
+
+MTSTATUS
+MdDumpProfile(
+    IN const char* Path
+)
+
+/*++
+
+    Routine description:
+
+        Stops the profiler and writes every entry to a file.
+
+    Arguments:
+
+        [IN]    const char* Path - Full path of the dump file (created if it doesn't exist, overwritten from offset 0).
+
+    Return Values:
+
+        MTSTATUS Status Code.
+
+    Notes:
+
+        PASSIVE_LEVEL. Symbolize the dump against build/kernel.elf with tools/profsym.
+
+--*/
+
+{
+    HANDLE FileHandle;
+    PFILE_OBJECT FileObject = NULL;
+    uint64_t Offset = 0;
+
+    MdAcquireControlMutex(&ProfileControlMutex, &ProfileControlMutexInitialized);
+
+    // A stable table, and no samples of the file write itself.
+    MdpDisableSampling();
+
+    MTSTATUS Status = FsCreateFile(Path, MT_FILE_WRITE_DATA, &FileHandle);
+    if (MT_FAILURE(Status)) goto Exit;
+
+    Status = ObReferenceObjectByHandle(FileHandle, MT_FILE_WRITE_DATA, FsFileType, (void**)&FileObject, NULL);
+    HtClose(FileHandle);
+    if (MT_FAILURE(Status)) goto Exit;
+
+    PROFILE_DUMP_HEADER Header;
+    MdpFillHeader(&Header);
+
+    Status = MdWriteDumpFile(FileObject, &Offset, &Header, sizeof(Header));
+
+    uint64_t Cursor = 0;
+    uint32_t Copied;
+    const uint32_t Capacity = sizeof(ProfileStaging) / sizeof(ProfileStaging[0]);
+
+    while (MT_SUCCEEDED(Status) && (Copied = MdpReadEntries(&Cursor, ProfileStaging, Capacity)) != 0) {
+        Status = MdWriteDumpFile(FileObject, &Offset, ProfileStaging, (size_t)Copied * sizeof(PROFILE_ENTRY));
+    }
+
+    ObDereferenceObject(FileObject);
+
+Exit:
+    MsReleaseMutexObject(&ProfileControlMutex);
+    return Status;
+}
@@ -0,0 +1,158 @@
+/*++
+
+Module Name:
+
+    selftest.c
+
+Purpose:
+
+    This translation unit contains the kernel self tests (enabled with MT_SELF_TESTS in behavior.h).
+
+Author:
+
+    slep (Matanel) 2025.
+
+Revision History:
+
+--*/
+
+#include "../../includes/md.h"
+#include "../../includes/me.h"
+#include "../../includes/mg.h"
+#include "../../includes/ps.h"
+#include "../../includes/mm.h"
+#include "../../includes/mt.h"
+
+typedef bool (*SELF_TEST_ROUTINE)(void);
+
+typedef struct _SELF_TEST {
+    const char* Name;
+    SELF_TEST_ROUTINE Routine;
+} SELF_TEST;
+
+//
+// Threaded DPC: queued from PASSIVE_LEVEL, must run in the processor's threaded DPC thread at PASSIVE_LEVEL.
+//
+
+typedef struct _THREADED_DPC_TEST {
+    EVENT Done;
+    IRQL Irql;
+    PETHREAD Thread;
+    void* Argument;
+} THREADED_DPC_TEST;
+
+static
+void
+MdpThreadedDpcTestRoutine(
+    DPC* Dpc,
+    void* DeferredContext,
+    void* SystemArgument1,
+    void* SystemArgument2
+)
+
+{
+    THREADED_DPC_TEST* Test = (THREADED_DPC_TEST*)DeferredContext;
+
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    Test->Irql = MeGetCurrentIrql();
+    Test->Thread = PsGetCurrentThread();
+    Test->Argument = SystemArgument1;
+    MsSetEvent(&Test->Done);
+}
+
+static
+bool
+MdpTestThreadedDpc(
+    void
+)
+
+{
+    static THREADED_DPC_TEST Test;
+    static DPC Dpc;
+
+    Test.Done.type = SynchronizationEvent;
+    Test.Done.signaled = false;
+    Test.Done.lock.locked = 0;
+    Test.Done.waitingQueue.head = Test.Done.waitingQueue.tail = NULL;
+    Test.Irql = HIGH_LEVEL;
+    Test.Thread = NULL;
+    Test.Argument = NULL;
+
+    MeInitializeThreadedDpc(&Dpc, MdpThreadedDpcTestRoutine, &Test, MEDIUM_PRIORITY);
+    MeSetTargetProcessorDpc(&Dpc, 0);
+    MeInsertQueueDpc(&Dpc, (void*)&Test, NULL);
+
+    MsWaitForEvent(&Test.Done);
+
+    PETHREAD Expected = MeGetProcessorBlock(0)->ThreadedDpcThread;
+    return Test.Irql == PASSIVE_LEVEL && Test.Argument == (void*)&Test && (!Expected || Test.Thread == Expected);
+}
+
+//
+// User buffer fault: a system call that copies with kmemcpy into an unmapped user address must return the exception code, not bugcheck.
+// The copy is inline in the caller, so the faulting RIP lies in the system call's try range.
+//
+
+static
+bool
+MdpTestUserBufferFault(
+    void
+)
+
+{
+    // No VAD backs this address in the system process, the fault is an access violation.
+    void* Buffer = (void*)((MmHighestUserAddress / 2) & ~(uintptr_t)(VirtualPageSize - 1));
+    size_t Required = 0;
+
+    MTSTATUS Status = MtQuerySystemInformation(SystemCounterInformation, NULL, 0, &Required);
+    if (Status != MT_BUFFER_TOO_SMALL || !Required) return false;
+
+    Status = MtQuerySystemInformation(SystemCounterInformation, Buffer, Required, NULL);
+    return Status == MT_ACCESS_VIOLATION;
+}
+
+static const SELF_TEST MdpSelfTests[] = {
+    { "Threaded DPC", MdpTestThreadedDpc },
+    { "User buffer fault in a system call", MdpTestUserBufferFault },
+};
+
+void
+MdRunSelfTests(
+    IN void* Parameter
+)
+
+/*++
+
+    Routine description:
+
+        Self test thread, runs every test in MdpSelfTests and prints its result.
+
+    Arguments:
+
+        [IN]    void* Parameter - Unused.
+
+    Return Values:
+
+        None, results are printed to the screen.
+
+    Notes:
+
+        Started after the threaded DPC threads (kernel.c). A test that hangs names itself by being the last one printed.
+
+--*/
+
+{
+    UNREFERENCED_PARAMETER(Parameter);
+    uint32_t Failed = 0;
+
+    for (size_t i = 0; i < sizeof(MdpSelfTests) / sizeof(MdpSelfTests[0]); i++) {
+        gop_printf(COLOR_CYAN, "[SELFTEST] %s...\n", MdpSelfTests[i].Name);
+        bool Passed = MdpSelfTests[i].Routine();
+        if (!Passed) Failed++;
+        gop_printf(Passed ? COLOR_GREEN : COLOR_RED, "[SELFTEST] %s: %s\n", MdpSelfTests[i].Name, Passed ? "passed" : "FAILED");
+    }
+
+    gop_printf(Failed ? COLOR_RED : COLOR_GREEN, "[SELFTEST] Done, %u failed.\n", Failed);
+}
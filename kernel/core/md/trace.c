@@ -0,0 +1,317 @@
+/*++
+
+Module Name:
+
+    trace.c
+
+Purpose:
+
+    This translation unit contains the static tracepoint facility (per processor binary trace buffers, dumped to a file).
+
+Author:
+
+    slep (Matanel) 2025.
+
+Revision History:
+
+--*/
+
+#include "../../includes/md.h"
+#include "../../includes/mh.h"
+#include "../../includes/mm.h"
+#include "../../includes/ps.h"
+#include "../../includes/ob.h"
+#include "../../includes/ht.h"
+#include "../../includes/fs.h"
+#include "../../intrinsics/atomic.h"
+#include "../../assert.h"
+
+//
+// Tracepoints (MD_TRACE) are compiled in everywhere, and cost a load of MdTraceEnabled while tracing is stopped.
+// When started, each one reserves a record in the current processor's ring with a locked increment (an interrupt, or a
+// migrated thread, gets a record of its own) and fills it. The rings wrap, the newest records are kept.
+//
+// The buffers are allocated on the first start and kept afterwards, the dump is what tools/trace2json reads.
+//
+
+#define TRACE_RECORDS_PER_PROCESSOR 16384 // 512 KiB per processor
+
+typedef struct _TRACE_BUFFER {
+    volatile uint64_t Head;                     // Records ever reserved (the next slot is Head % TRACE_RECORDS_PER_PROCESSOR)
+    PTRACE_RECORD Records;
+} __attribute__((aligned(64))) TRACE_BUFFER, *PTRACE_BUFFER;
+
+static TRACE_BUFFER TraceBuffers[MAX_CPUS];
+
+volatile bool MdTraceEnabled = false;
+
+// Serializes start/stop/dump (system calls, PASSIVE_LEVEL).
+static MUTEX TraceControlMutex;
+static volatile uint32_t TraceControlMutexInitialized;
+
+void
+MdTraceWrite(
+    IN TRACE_EVENT Event,
+    IN uint64_t Argument1,
+    IN uint64_t Argument2
+)
+
+/*++
+
+    Routine description:
+
+        Writes a trace record into the current processor's buffer.
+
+    Arguments:
+
+        [IN]    TRACE_EVENT Event - The tracepoint.
+        [IN]    uint64_t Argument1 - Event specific.
+        [IN]    uint64_t Argument2 - Event specific.
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        Called through MD_TRACE only, lock-free, callable at any IRQL.
+
+--*/
+
+{
+    uint32_t Processor = MeGetCurrentProcessorNumber();
+    if (Processor >= MAX_CPUS) return;
+
+    PTRACE_BUFFER Buffer = &TraceBuffers[Processor];
+    PTRACE_RECORD Records = Buffer->Records;
+
+    // Started before this processor came up.
+    if (!Records) return;
+
+    uint64_t Position = InterlockedIncrementU64(&Buffer->Head) - 1;
+    PTRACE_RECORD Record = &Records[Position % TRACE_RECORDS_PER_PROCESSOR];
+    PITHREAD Current = MeGetCurrentProcessor()->currentThread;
+
+    Record->Timestamp = __rdtsc();
+    Record->Event = (uint16_t)Event;
+    Record->Processor = (uint16_t)Processor;
+    Record->Thread = Current ? (uint32_t)((PETHREAD)Current)->TID : 0;
+    Record->Arguments[0] = Argument1;
+    Record->Arguments[1] = Argument2;
+}
+
+MTSTATUS
+MdStartTrace(
+    void
+)
+
+/*++
+
+    Routine description:
+
+        Starts tracing, the buffers are emptied first.
+
+    Arguments:
+
+        None.
+
+    Return Values:
+
+        MT_SUCCESS, or MT_NO_MEMORY if the buffers couldn't be allocated.
+
+    Notes:
+
+        PASSIVE_LEVEL.
+
+--*/
+
+{
+    MTSTATUS Status = MT_SUCCESS;
+    uint32_t Processors = MeGetActiveProcessorCount();
+
+    if (Processors > MAX_CPUS) Processors = MAX_CPUS;
+
+    MdAcquireControlMutex(&TraceControlMutex, &TraceControlMutexInitialized);
+
+    // Stop while the rings are reset.
+    MdTraceEnabled = false;
+    MmFullBarrier();
+
+    for (uint32_t i = 0; i < Processors; i++) {
+        if (!TraceBuffers[i].Records) {
+            PTRACE_RECORD Records = MmAllocatePoolWithTag(NonPagedPool, TRACE_RECORDS_PER_PROCESSOR * sizeof(TRACE_RECORD), 'ecrT'); // Trce
+            if (!Records) {
+                Status = MT_NO_MEMORY;
+                break;
+            }
+            TraceBuffers[i].Records = Records;
+        }
+
+        InterlockedExchangeU64(&TraceBuffers[i].Head, 0);
+    }
+
+    if (MT_SUCCEEDED(Status)) {
+        MdTraceEnabled = true;
+    }
+
+    MsReleaseMutexObject(&TraceControlMutex);
+    return Status;
+}
+
+void
+MdStopTrace(
+    void
+)
+
+/*++
+
+    Routine description:
+
+        Stops tracing, the buffers are kept until the next start.
+
+    Arguments:
+
+        None.
+
+    Return Values:
+
+        None.
+
+--*/
+
+{
+    MdTraceEnabled = false;
+    MmFullBarrier();
+}
+
+static
+uint64_t
+MdpGetTscFrequency(
+    void
+)
+
+/*++
+
+    Routine description:
+
+        Returns the TSC frequency reported by CPUID (leaf 0x15, or the base frequency of leaf 0x16).
+
+    Arguments:
+
+        None.
+
+    Return Values:
+
+        The frequency in Hz, 0 if the processor doesn't report it.
+
+--*/
+
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    __cpuid(0, eax, ebx, ecx, edx);
+    uint32_t MaxLeaf = eax;
+
+    if (MaxLeaf >= 0x15) {
+        __cpuid(0x15, eax, ebx, ecx, edx);
+        // TSC = crystal (ECX) * EBX / EAX
+        if (eax && ebx && ecx) return ((uint64_t)ecx * ebx) / eax;
+    }
+
+    if (MaxLeaf >= 0x16) {
+        __cpuid(0x16, eax, ebx, ecx, edx);
+        if (eax & 0xFFFF) return (uint64_t)(eax & 0xFFFF) * 1000000ULL;
+    }
+
+    return 0;
+}
+
+MTSTATUS
+MdDumpTrace(
+    IN const char* Path
+)
+
+/*++
+
+    Routine description:
+
+        Stops tracing and writes every processor's trace buffer to a file.
+
+    Arguments:
+
+        [IN]    const char* Path - Full path of the dump file (created if it doesn't exist, overwritten from offset 0).
+
+    Return Values:
+
+        MTSTATUS Status Code.
+
+    Notes:
+
+        PASSIVE_LEVEL. The dump is converted to the Chrome trace format by tools/trace2json.
+
+--*/
+
+{
+    HANDLE FileHandle;
+    PFILE_OBJECT FileObject = NULL;
+    uint64_t Offset = 0;
+    uint32_t Processors = MeGetActiveProcessorCount();
+
+    if (Processors > MAX_CPUS) Processors = MAX_CPUS;
+
+    MdAcquireControlMutex(&TraceControlMutex, &TraceControlMutexInitialized);
+
+    // Tracing the file write would overwrite what we are writing.
+    MdStopTrace();
+
+    MTSTATUS Status = FsCreateFile(Path, MT_FILE_WRITE_DATA, &FileHandle);
+    if (MT_FAILURE(Status)) goto Exit;
+
+    Status = ObReferenceObjectByHandle(FileHandle, MT_FILE_WRITE_DATA, FsFileType, (void**)&FileObject, NULL);
+    HtClose(FileHandle);
+    if (MT_FAILURE(Status)) goto Exit;
+
+    TRACE_DUMP_HEADER Header = { 0 };
+    Header.Magic = TRACE_DUMP_MAGIC;
+    Header.Version = TRACE_DUMP_VERSION;
+    Header.RecordSize = sizeof(TRACE_RECORD);
+    Header.TscFrequency = MdpGetTscFrequency();
+    Header.ProcessorCount = Processors;
+
+    Status = MdWriteDumpFile(FileObject, &Offset, &Header, sizeof(Header));
+
+    for (uint32_t i = 0; i < Processors && MT_SUCCEEDED(Status); i++) {
+        PTRACE_BUFFER Buffer = &TraceBuffers[i];
+        uint64_t Head = InterlockedFetchU64(&Buffer->Head);
+        TRACE_DUMP_PROCESSOR Descriptor = { 0 };
+
+        Descriptor.Processor = i;
+        if (Buffer->Records) {
+            Descriptor.RecordCount = (uint32_t)((Head < TRACE_RECORDS_PER_PROCESSOR) ? Head : TRACE_RECORDS_PER_PROCESSOR);
+            Descriptor.Overwritten = Head - Descriptor.RecordCount;
+        }
+
+        Status = MdWriteDumpFile(FileObject, &Offset, &Descriptor, sizeof(Descriptor));
+        if (MT_FAILURE(Status) || !Descriptor.RecordCount) continue;
+
+        // Oldest first, when wrapped the oldest record is at the next write position.
+        uint32_t First = (uint32_t)(Descriptor.Overwritten ? (Head % TRACE_RECORDS_PER_PROCESSOR) : 0);
+        uint32_t Tail = TRACE_RECORDS_PER_PROCESSOR - First;
+
+        if (Descriptor.Overwritten) {
+            Status = MdWriteDumpFile(FileObject, &Offset, &Buffer->Records[First], (size_t)Tail * sizeof(TRACE_RECORD));
+            if (MT_SUCCEEDED(Status) && First) {
+                Status = MdWriteDumpFile(FileObject, &Offset, Buffer->Records, (size_t)First * sizeof(TRACE_RECORD));
+            }
+        }
+        else {
+            Status = MdWriteDumpFile(FileObject, &Offset, Buffer->Records, (size_t)Descriptor.RecordCount * sizeof(TRACE_RECORD));
+        }
+    }
+
+    ObDereferenceObject(FileObject);
+
+Exit:
+    MsReleaseMutexObject(&TraceControlMutex);
+    return Status;
+}
@@ -209,6 +209,9 @@ static void resolveStopCode(char** s, uint64_t stopcode) {
     case ATTEMPTED_EXECUTE_OF_NOEXECUTE_MEMORY:
         *s = "ATTEMPTED_EXECUTE_OF_NOEXECUTE_MEMORY";
         break;
+    case HYPERSPACE_INIT_FAILURE:
+        *s = "HYPERSPACE_INIT_FAILURE";
+        break;
     default:
         *s = "UNKNOWN_BUGCHECK_CODE";
         break;
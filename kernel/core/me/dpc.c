@@ -44,6 +44,192 @@ void ReapOb(DPC* dpc, void* DeferredContext, void* SystemArgument1, void* System
 
 //End
 
+//
+// A DPC targeted at another processor interrupts it (an asynchronous cross call requests its DISPATCH_LEVEL
+// software interrupt), instead of waiting for that processor to lower its IRQL by itself.
+//
+// Threaded DPCs run at PASSIVE_LEVEL in a thread per processor (pinned, created by MeStartThreadedDpcThreads),
+// for long deferred work that shouldn't hold the processor at DISPATCH_LEVEL. They are queued to ThreadedDpcData,
+// the first one queues ThreadedDpcKick (a normal DPC on the same processor), which wakes the thread there and
+// requests a reschedule. Before the threads exist, threaded DPCs run as normal ones.
+//
+// Every DPC records its queue to start latency and its runtime in the histograms of the processor it ran for.
+//
+
+static
+uint32_t
+MepDpcHistogramBucket(
+    IN uint64_t Cycles
+)
+
+{
+    uint64_t CyclesPerUs = lapic_tsc_frequency() / 1000000;
+    if (!CyclesPerUs) return 0;
+
+    uint64_t Us = Cycles / CyclesPerUs;
+    if (Us < 2) return 0;
+
+    uint32_t Bucket = 63 - (uint32_t)__builtin_clzll(Us);
+    return (Bucket < DPC_HISTOGRAM_BUCKETS) ? Bucket : DPC_HISTOGRAM_BUCKETS - 1;
+}
+
+static
+void
+MepRecordDpcTimes(
+    IN PPROCESSOR Cpu,
+    IN uint64_t QueueTime,
+    IN uint64_t StartTime,
+    IN uint64_t EndTime
+)
+
+{
+    Cpu->DpcLatencyHistogram[MepDpcHistogramBucket(StartTime - QueueTime)]++;
+    Cpu->DpcRuntimeHistogram[MepDpcHistogramBucket(EndTime - StartTime)]++;
+}
+
+static
+void
+MepRequestDpcInterrupt(
+    IN void* Context
+)
+
+// Cross call routine, runs on the target processor at IPI_LEVEL (the interrupt is taken when it lowers).
+{
+    UNREFERENCED_PARAMETER(Context);
+    MhRequestSoftwareInterrupt(DISPATCH_LEVEL);
+}
+
+static
+void
+MepThreadedDpcKick(
+    DPC* Dpc,
+    void* DeferredContext,
+    void* SystemArgument1,
+    void* SystemArgument2
+)
+
+{
+    PPROCESSOR Cpu = (PPROCESSOR)DeferredContext;
+
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    // Runs on Cpu, so the thread is readied in its queue.
+    MsSetEvent(&Cpu->ThreadedDpcEvent);
+    Cpu->schedulePending = true;
+}
+
+static
+void
+MepThreadedDpcThread(
+    IN THREAD_PARAMETER Parameter
+)
+
+{
+    PPROCESSOR Cpu = (PPROCESSOR)Parameter;
+    PDPC_DATA DpcData = &Cpu->ThreadedDpcData;
+
+    for (;;) {
+        MsWaitForEvent(&Cpu->ThreadedDpcEvent);
+
+        for (;;) {
+            // HIGH_LEVEL while holding the lock, like MeInsertQueueDpc (which takes it from any IRQL).
+            // We are at PASSIVE_LEVEL here, the lock must not be taken below DISPATCH_LEVEL.
+            IRQL OldIrql;
+            MeRaiseIrql(HIGH_LEVEL, &OldIrql);
+            MsAcquireSpinlockAtDpcLevel(&DpcData->DpcLock);
+
+            PDOUBLY_LINKED_LIST Entry = DpcData->DpcListHead.Flink;
+            if (Entry == &DpcData->DpcListHead) {
+                MsReleaseSpinlockFromDpcLevel(&DpcData->DpcLock);
+                MeLowerIrql(OldIrql);
+                break;
+            }
+
+            RemoveEntryList(Entry);
+            PDPC Dpc = CONTAINING_RECORD(Entry, DPC, DpcListEntry);
+            PDEFERRED_ROUTINE DeferredRoutine = Dpc->DeferredRoutine;
+            void* DeferredContext = Dpc->DeferredContext;
+            void* SystemArgument1 = Dpc->SystemArgument1;
+            void* SystemArgument2 = Dpc->SystemArgument2;
+            uint64_t QueueTime = Dpc->QueueTime;
+
+            MmFullBarrier();
+
+            // Clear DpcData so it can be re-queued inside its own routine
+            Dpc->DpcData = NULL;
+            DpcData->DpcQueueDepth -= 1;
+
+            MsReleaseSpinlockFromDpcLevel(&DpcData->DpcLock);
+            MeLowerIrql(OldIrql);
+
+            uint64_t StartTime = __rdtsc();
+            DeferredRoutine(Dpc, DeferredContext, SystemArgument1, SystemArgument2);
+            MepRecordDpcTimes(Cpu, QueueTime, StartTime, __rdtsc());
+            MeIncrementCounter(PerfCounterDpcsRun);
+
+            assert(MeGetCurrentIrql() == PASSIVE_LEVEL, "Threaded DPC returned at a raised IRQL");
+        }
+    }
+}
+
+void
+MeStartThreadedDpcThreads(
+    void
+)
+
+/*++
+
+    Routine description:
+
+        Creates the threaded DPC thread of every processor.
+
+    Arguments:
+
+        None.
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        Called once by the BSP after the APs are online. A processor whose thread couldn't be
+        created keeps running its threaded DPCs as normal ones.
+
+--*/
+
+{
+    for (uint32_t i = 0; i < MeGetActiveProcessorCount(); i++) {
+        PPROCESSOR Cpu = MeGetProcessorBlock((uint8_t)i);
+        PETHREAD Thread = NULL;
+
+        Cpu->ThreadedDpcEvent.lock.locked = 0;
+        Cpu->ThreadedDpcEvent.signaled = false;
+        Cpu->ThreadedDpcEvent.type = SynchronizationEvent;
+        Cpu->ThreadedDpcEvent.waitingQueue.head = Cpu->ThreadedDpcEvent.waitingQueue.tail = NULL;
+
+        Cpu->ThreadedDpcData.DpcLock.locked = 0;
+        InitializeListHead(&Cpu->ThreadedDpcData.DpcListHead);
+
+        MeInitializeDpc(&Cpu->ThreadedDpcKick, MepThreadedDpcKick, Cpu, HIGH_PRIORITY);
+        MeSetTargetProcessorDpc(&Cpu->ThreadedDpcKick, Cpu->ID);
+
+        MTSTATUS Status = PsCreateSystemThread(MepThreadedDpcThread, Cpu, DEFAULT_TIMESLICE_TICKS, &Thread);
+        if (MT_FAILURE(Status)) {
+            MdLog(LogLevelWarning, COLOR_YELLOW, "[DPC] Couldn't create the threaded DPC thread of processor %u (%x)\n", i, Status);
+            continue;
+        }
+
+        Thread->WorkerThread = true;
+        Thread->PinnedProcessor = Cpu->ID + 1;
+
+        __asm__ volatile("" ::: "memory");
+        Cpu->ThreadedDpcThread = Thread;
+    }
+}
+
 bool
 MeInsertQueueDpc(
     IN PDPC Dpc,
@@ -79,6 +265,9 @@ MeInsertQueueDpc(
     PDPC_DATA DpcData;
     PPROCESSOR Cpu;
     bool Inserted = false;
+    bool Threaded;
+    bool KickRemote = false;
+    bool KickThread = false;
     IRQL OldIrql;
 
     if (!Dpc->DeferredRoutine) {
@@ -99,6 +288,8 @@ MeInsertQueueDpc(
 #endif
     }
 
+    MD_TRACE(TraceEventDpcQueue, Dpc, Dpc->DeferredRoutine);
+
     // Raise IRQL to HIGH_LEVEL to prevent all interrupts while we touch the processor DPC queue. (prevent corruption)
     MeRaiseIrql(HIGH_LEVEL, &OldIrql);
 
@@ -109,7 +300,8 @@ MeInsertQueueDpc(
         Cpu = MeGetCurrentProcessor();
     }
 
-    DpcData = &Cpu->DpcData;
+    Threaded = Dpc->Threaded && Cpu->ThreadedDpcThread;
+    DpcData = Threaded ? &Cpu->ThreadedDpcData : &Cpu->DpcData;
 
     // Acquire the DpcData lock for the current processor.
     MsAcquireSpinlockAtDpcLevel(&DpcData->DpcLock);
@@ -120,8 +312,10 @@ MeInsertQueueDpc(
         // Success: It was not queued.
         DpcData->DpcQueueDepth += 1;
         DpcData->DpcCount += 1;
+        MeIncrementCounter(PerfCounterDpcsQueued);
         Dpc->SystemArgument1 = SystemArgument1;
         Dpc->SystemArgument2 = SystemArgument2;
+        Dpc->QueueTime = __rdtsc();
 
         // Insert Head (High Priority) or Tail (Normal)
         if (Dpc->priority == HIGH_PRIORITY) {
@@ -132,13 +326,21 @@ MeInsertQueueDpc(
         }
 
         Inserted = true;
-        // Increment request rate
-        Cpu->DpcRequestRate++;
+
+        if (Threaded) {
+            // The first one wakes the thread, it drains the rest.
+            KickThread = (DpcData->DpcQueueDepth == 1);
+        }
+        else {
+            // Increment request rate
+            Cpu->DpcRequestRate++;
+        }
 
         // Check if we need to request an interurpt
         // We only request if a DPC isnt currently running.
         // And we haven't already requested an interrupt for a DPC.
-        if ((Cpu->DpcRoutineActive == false) &&
+        if (!Threaded &&
+            (Cpu->DpcRoutineActive == false) &&
             (Cpu->DpcInterruptRequested == false)) {
 
             // If the DPC priority is higher than lowest, or we are to deep in the queue depth, retire DPCs immediately.
@@ -148,8 +350,12 @@ MeInsertQueueDpc(
                 // Always mark that an interrupt is needed eventually
                 Cpu->DpcInterruptRequested = true;
 
+                if (Cpu != MeGetCurrentProcessor()) {
+                    // The software interrupt must be requested on the target, interrupt it once we are unlocked.
+                    KickRemote = true;
+                }
                 // Cannot request an interrupt on DISPATCH_LEVEL already.
-                if (MeGetCurrentIrql() < DISPATCH_LEVEL) {
+                else if (MeGetCurrentIrql() < DISPATCH_LEVEL) {
                     // Request an interrupt from HAL.
                     MhRequestSoftwareInterrupt(DISPATCH_LEVEL);
                 }
@@ -161,6 +367,14 @@ MeInsertQueueDpc(
     MsReleaseSpinlockFromDpcLevel(&DpcData->DpcLock);
     MeLowerIrql(OldIrql);
 
+    if (KickThread) {
+        MeInsertQueueDpc(&Cpu->ThreadedDpcKick, NULL, NULL);
+    }
+
+    if (KickRemote) {
+        MhCrossCall(1ULL << Cpu->ID, MepRequestDpcInterrupt, NULL, CROSS_CALL_ASYNCHRONOUS);
+    }
+
     return Inserted;
 }
 
@@ -246,8 +460,9 @@ MeRetireDPCs(
 
 {
 #ifdef DEBUG
-    gop_printf(COLOR_WHITE, "Retiring DPCs!\n");
+    MdLog(LogLevelTrace, COLOR_WHITE, "Retiring DPCs!\n");
 #endif
+    MD_TRACE(TraceEventDpcRetireStart, 0, 0);
     // Few assertions.
     assert(MeGetCurrentIrql() == DISPATCH_LEVEL);
     assert(MeAreInterruptsEnabled() == false);
@@ -261,6 +476,8 @@ MeRetireDPCs(
     void* SystemArgument1;
     void* SystemArgument2;
     uintptr_t TimerHand;
+    uint64_t QueueTime;
+    uint64_t StartTime;
     PPROCESSOR Cpu = MeGetCurrentProcessor();
 
     DpcData = &Cpu->DpcData;
@@ -301,6 +518,7 @@ MeRetireDPCs(
                     DeferredContext = Dpc->DeferredContext;
                     SystemArgument1 = Dpc->SystemArgument1;
                     SystemArgument2 = Dpc->SystemArgument2;
+                    QueueTime = Dpc->QueueTime;
 
                     // Changes must be set before others can modify.
                     MmFullBarrier();
@@ -318,10 +536,13 @@ MeRetireDPCs(
                     // Execute
                     Cpu->CurrentDeferredRoutine = Dpc;
 #ifdef DEBUG
-                    gop_printf(COLOR_WHITE, "I'm about to execute DPC %p | Routine: %p | SysArg1: %p | SysArg2: %p | Priority: %d\n", Dpc, Dpc->DeferredRoutine, Dpc->SystemArgument1, Dpc->SystemArgument2, Dpc->priority);
+                    MdLog(LogLevelTrace, COLOR_WHITE, "I'm about to execute DPC %p | Routine: %p | SysArg1: %p | SysArg2: %p | Priority: %d\n", Dpc, Dpc->DeferredRoutine, Dpc->SystemArgument1, Dpc->SystemArgument2, Dpc->priority);
 #endif
+                    StartTime = __rdtsc();
                     DeferredRoutine(Dpc, DeferredContext, SystemArgument1, SystemArgument2);
+                    MepRecordDpcTimes(Cpu, QueueTime, StartTime, __rdtsc());
                     Cpu->CurrentDeferredRoutine = NULL;
+                    MeIncrementCounter(PerfCounterDpcsRun);
 
                     // Assertion, incase the DPC changed the IRQL level.
                     assert(MeGetCurrentIrql() == DISPATCH_LEVEL);
@@ -343,6 +564,8 @@ MeRetireDPCs(
 
     } while (DpcData->DpcQueueDepth != 0);
 
+    MD_TRACE(TraceEventDpcRetireEnd, 0, 0);
+
     // Return statement, assert that interrupts are disabled.
     assert(MeAreInterruptsEnabled() == false, "Interrupts must not enabled at DPC Retirement exit");
 }
@@ -420,6 +643,45 @@ MeInitializeDpc(
     // Set to current CPU. (the driver can modify his CPU)
     DpcAllocated->CpuNumber = DPC_TARGET_CURRENT;
 
+    DpcAllocated->Threaded = false;
+    DpcAllocated->QueueTime = 0;
+
     // Initialize list head for DPC.
     InitializeListHead(&DpcAllocated->DpcListEntry);
+}
+
+void
+MeInitializeThreadedDpc(
+    IN PDPC DpcAllocated,
+    IN PDEFERRED_ROUTINE DeferredRoutine,
+    IN void* DeferredContext,
+    IN DPC_PRIORITY DeferredPriority
+)
+
+/*++
+
+    Routine description:
+
+        This function initializes a threaded DPC, the routine runs at PASSIVE_LEVEL in the threaded DPC thread of the target processor.
+
+    Arguments:
+
+        [IN] PDPC DpcAllocated - Pointer to DPC allocated in resident memory (e.g, pool alloc)
+        [IN] PDEFERRED_ROUTINE DeferredRoutine - Pointer to deferred routine for the DPC to execute.
+        [IN] void* DeferredContext - Opaque pointer to deferred context, passed to the DeferredRoutine function as a parameter.
+        [IN] DPC_PRIORITY DeferredPriority - HIGH_PRIORITY DPCs are queued ahead of the others.
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        Queued with MeInsertQueueDpc like any DPC. Until MeStartThreadedDpcThreads it runs as a normal DPC (at DISPATCH_LEVEL).
+
+--*/
+
+{
+    MeInitializeDpc(DpcAllocated, DeferredRoutine, DeferredContext, DeferredPriority);
+    DpcAllocated->Threaded = true;
 }
\ No newline at end of file
@@ -101,6 +101,9 @@ static void InitialiseControlRegisters(void) {
             "ldmxcsr %0\n\t"
             : : "m"(mxcsr) : "memory"
             );
+
+        // Enable XSAVE (if present) and size the per-thread extended state areas.
+        MeInitializeExtendedState();
     }
 
     // Enable NX Bit.
@@ -168,6 +171,52 @@ static void MeInitGdtTssForCurrentProcessor(void) {
 extern IDT_ENTRY64 IDT[];
 extern IDT_PTR  PIDT;
 
+void
+MeAllocateProcessorResources(
+    IN PPROCESSOR CPU
+)
+
+/*++
+
+    Routine description:
+
+        Allocates the RSP0 and IST stacks, the TSS and the GDT of a processor.
+
+    Arguments:
+
+        [IN]    PPROCESSOR CPU - The processor, doesn't have to be the current one.
+
+    Return Values:
+
+        None.
+
+    Note:
+
+        The BSP calls this for every AP in one batch before starting them (prepare_percpu), so the APs
+        don't fight over the pool while they come up together. Anything already allocated is kept.
+
+--*/
+
+{
+    // Create RSP0 and ISTs for processor.
+    if (!CPU->Rsp0) CPU->Rsp0 = MiCreateKernelStack(false);
+    if (!CPU->IstPFStackTop) CPU->IstPFStackTop = MiCreateKernelStack(true);
+    if (!CPU->IstDFStackTop) CPU->IstDFStackTop = MiCreateKernelStack(true);
+    if (!CPU->IstIpiStackTop) CPU->IstIpiStackTop = MiCreateKernelStack(false);
+    if (!CPU->IstTimerStackTop) CPU->IstTimerStackTop = MiCreateKernelStack(false);
+#ifdef DEBUG
+    bool exists = (CPU->IstTimerStackTop && CPU->IstIpiStackTop && CPU->IstDFStackTop && CPU->IstPFStackTop && CPU->Rsp0) != 0;
+    assert(exists == true);
+#endif
+
+    // Create new GDT and TSS For Processor.
+    // Allocate TSS.
+    if (!CPU->tss) CPU->tss = MmAllocatePoolWithTag(NonPagedPool, sizeof(TSS), ' ssT'); // If fails on here, check alignment (16 byte)
+
+    // Allocate GDT.
+    if (!CPU->gdt) CPU->gdt = MmAllocatePoolWithTag(NonPagedPool, sizeof(uint64_t) * 7, ' TDG');
+}
+
 void
 MeInitializeProcessor(
     IN PPROCESSOR CPU,
@@ -230,30 +279,8 @@ StartInit: {
     // If we don't RSP0 will be taken.
     // RSP0 Is also taken in syscall instructions, but it is immediately replaced by ITHREAD.KernelStack.
 
-    // Create RSP0 and ISTs for processor.
-    void* Rsp0 = MiCreateKernelStack(false);
-    void* IstPf = MiCreateKernelStack(true);
-    void* IstDf = MiCreateKernelStack(true);
-    void* IstIpi = MiCreateKernelStack(false);
-    void* IstTimer = MiCreateKernelStack(false);
-#ifdef DEBUG
-    bool exists = (IstTimer && IstIpi && IstDf && IstPf && Rsp0) != 0;
-    assert(exists == true);
-#endif
-    CPU->Rsp0 = Rsp0;
-    CPU->IstPFStackTop = IstPf;
-    CPU->IstDFStackTop = IstDf;
-    CPU->IstIpiStackTop = IstIpi;
-    CPU->IstTimerStackTop = IstTimer;
-
-    // Create new GDT and TSS For Processor.
-    // Allocate TSS.
-    void* tss = MmAllocatePoolWithTag(NonPagedPool, sizeof(TSS), ' ssT'); // If fails on here, check alignment (16 byte)
-    CPU->tss = tss;
-
-    // Allocate GDT.
-    uint64_t* gdt = MmAllocatePoolWithTag(NonPagedPool, sizeof(uint64_t) * 7, ' TDG');
-    CPU->gdt = gdt;
+    // APs normally have these from prepare_percpu already.
+    MeAllocateProcessorResources(CPU);
 
     MeInitGdtTssForCurrentProcessor();
 
@@ -9,6 +9,7 @@
 #include "../../includes/ps.h"
 #include "../../includes/mg.h"
 #include "../../includes/ob.h"
+#include "../../includes/md.h"
 extern PROCESSOR cpus[];
 
 // assembly stubs to save and restore register contexts.
@@ -92,9 +93,19 @@ static PITHREAD MeAcquireNextScheduledThread(void) {
             // The reason I used the self pointer here, is because the BSP in the cpus array, is empty except for 4 fields, as its main struct is cpu0, 
             // which is defined at the kernel main, so we access it through self, view SMP.C prepare_percpu for more info.
             Queue* victimQueue = &cpus[i].self->readyQueue;
-            if (!victimQueue->head) continue; // skip empty queues
 
-            chosenThread = MeDequeueThreadWithLock(victimQueue);
+            // Unlocked peek, the owner may dequeue its last thread at any time, so the head is read once.
+            PETHREAD Head = __atomic_load_n(&victimQueue->head, __ATOMIC_RELAXED);
+            if (!Head || Head->PinnedProcessor) continue; // empty, or pinned to its processor (e.g. threaded DPC threads)
+
+            // The head may have changed since we peeked, check it again under the lock so a pinned thread is never
+            // taken (and never has to be given back, which would reorder the victim's queue).
+            LOCK_QUEUE_HANDLE LockHandle;
+            MsAcquireInStackQueuedSpinlock(&victimQueue->lock, &LockHandle);
+            Head = victimQueue->head;
+            chosenThread = (Head && !Head->PinnedProcessor) ? MeDequeueThread(victimQueue) : NULL;
+            MsReleaseInStackQueuedSpinlock(&LockHandle);
+
             // Found a suitable thread, return it.
             if (chosenThread) return &chosenThread->InternalThread;
         }
@@ -116,6 +127,12 @@ Schedule(void) {
     PITHREAD prev = MeGetCurrentProcessor()->currentThread;
     PITHREAD IdleThread = &MeGetCurrentProcessor()->idleThread->InternalThread;
 
+    // A context switch is a quiescent point for epoch reclamation.
+    MsEpochQuiescentState(true);
+
+    // Wake the log drain thread if something was logged (loggers cannot signal events themselves).
+    MdLogQuiescentState();
+
     // Check if we need to delete another thread's (safe now, we are at a separate stack)
     if (cpu->ZombieThread) {
         // Drop the reference, we are on another thread's stack.
@@ -140,8 +157,20 @@ Schedule(void) {
     }
 
     next->ThreadState = THREAD_RUNNING;
+
+    if (prev != next) {
+        MeIncrementCounter(PerfCounterContextSwitches);
+        MD_TRACE(TraceEventSwitchOut, prev ? ((PETHREAD)prev)->TID : 0, prev ? ((PETHREAD)prev)->PID : 0);
+    }
+
+    // Write back the FPU/SSE/AVX registers if they were used, arm the lazy restore for next.
+    MeSwitchExtendedState(prev, next);
     MeGetCurrentProcessor()->currentThread = next;
 
+    if (prev != next) {
+        MD_TRACE(TraceEventSwitchIn, ((PETHREAD)next)->TID, ((PETHREAD)next)->PID);
+    }
+
     // Disable interrupts, we must not scheduled away now.
     MeDisableInterrupts();
     
@@ -155,6 +184,12 @@ Schedule(void) {
         restore_context(&next->TrapRegisters);
     }
     else {
+        // The user GS base is the thread's TEB (LdrInitializeThread), it sits in KERNEL_GS_BASE until the swapgs back to user mode.
+        // The MSR is per processor, so the previous thread's TEB would leak into this one.
+        if (prev != next) {
+            __writemsr(IA32_KERNEL_GS_BASE, (uint64_t)PsGetEThreadFromIThread(next)->Teb);
+        }
+
         // User thread - Check if we should execute swapgs, because if we will execute it when we return to kernel RIP (like in a syscall for example), then GS would point to user mode.
         // Check RIP, if its in kernel then WE DO NOT swap.
         // This works ONLY when there is a CLI call before doing swapgs, since we could prepare to return to user mode, and then we return with an opposite GS.
@@ -0,0 +1,159 @@
+/*++
+
+Module Name:
+
+    systime.c
+
+Purpose:
+
+    This translation unit contains the maintenance of the shared user data page (tick count, interrupt time, TSC to wall clock conversion).
+
+Author:
+
+    slep (Matanel) 2025.
+
+Revision History:
+
+--*/
+
+#include "../../includes/me.h"
+#include "../../includes/mh.h"
+#include "../../includes/mm.h"
+#include "../../includes/md.h"
+#include "../../includes/mg.h"
+#include "../../time.h"
+
+//
+// The page is mapped read only into every process (MmMapSharedUserData), so user mode reads time without a system call:
+// the tick count and interrupt time are refreshed by the clock interrupt of processor 0, and the wall clock is
+// SystemTimeBase + (RDTSC - TscBase) * TscScale, computed by the reader itself (mtdll GetSystemTime).
+//
+// Processor 0 is the only writer. Sequence is odd while it writes, readers retry until they see the same even value
+// before and after reading. x86 keeps stores in order, so only the compiler has to be fenced on the writer side.
+//
+
+#define CPUID_80000007_EDX_INVARIANT_TSC (1U << 8)
+
+static PSHARED_USER_DATA MeSharedUserData;
+
+static
+uint64_t
+MepTscTo100ns(
+    IN PSHARED_USER_DATA Data,
+    IN uint64_t Cycles
+)
+
+{
+    return (uint64_t)(((unsigned __int128)Cycles * Data->TscScale) >> 32);
+}
+
+static
+bool
+MepIsTscInvariant(
+    void
+)
+
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    __cpuid(0x80000000, eax, ebx, ecx, edx);
+    if (eax < 0x80000007) return false;
+
+    __cpuid(0x80000007, eax, ebx, ecx, edx);
+    return (edx & CPUID_80000007_EDX_INVARIANT_TSC) != 0;
+}
+
+void
+MeInitializeSharedUserData(
+    IN uint32_t ClockFrequency
+)
+
+/*++
+
+    Routine description:
+
+        Creates and fills the shared user data page.
+
+    Arguments:
+
+        [IN]    uint32_t ClockFrequency - Clock interrupts per second (init_lapic_timer).
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        Must be called on the boot processor after lapic_timer_calibrate (the TSC frequency is measured there),
+        and before the clock interrupt starts and the first process is created.
+        On failure processes still get the VAD, reading the page raises an access violation.
+
+--*/
+
+{
+    PSHARED_USER_DATA Data = (PSHARED_USER_DATA)MmCreateSharedUserData();
+    if (!Data) {
+        MdLog(LogLevelError, COLOR_RED, "[SYSTIME] Couldn't allocate the shared user data page\n");
+        return;
+    }
+
+    uint64_t Frequency = lapic_tsc_frequency();
+
+    Data->Version = SHARED_USER_DATA_VERSION;
+    Data->TscFrequency = Frequency;
+    Data->TscScale = Frequency ? (10000000ULL << 32) / Frequency : 0;
+    Data->TickInterval = ClockFrequency ? 10000000U / ClockFrequency : 0;
+    Data->NumberOfProcessors = MeGetActiveProcessorCount();
+    Data->PageSize = VirtualPageSize;
+    Data->Flags = MepIsTscInvariant() ? SHARED_USER_DATA_TSC_INVARIANT : 0;
+
+    // The RTC has a one second resolution, the TSC carries the time from here.
+    Data->SystemTimeBase = MeGetEpoch() * 10000000ULL;
+    Data->TscBase = __rdtsc();
+
+    __asm__ volatile("" ::: "memory");
+    MeSharedUserData = Data;
+}
+
+void
+MeUpdateSharedUserData(
+    void
+)
+
+/*++
+
+    Routine description:
+
+        Advances the tick count and interrupt time of the shared user data page.
+
+    Arguments:
+
+        None.
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        Called by every clock interrupt (MiLapicInterrupt), only processor 0 writes.
+
+--*/
+
+{
+    PSHARED_USER_DATA Data = MeSharedUserData;
+    if (!Data || MeGetCurrentProcessorNumber() != 0) return;
+
+    uint64_t Now = __rdtsc();
+    uint64_t Ticks = Data->TickCount + 1;
+
+    Data->Sequence++;
+    __asm__ volatile("" ::: "memory");
+
+    Data->TickCount = Ticks;
+    Data->InterruptTime = Data->TscScale ? MepTscTo100ns(Data, Now - Data->TscBase) : Ticks * Data->TickInterval;
+    Data->NumberOfProcessors = MeGetActiveProcessorCount();
+
+    __asm__ volatile("" ::: "memory");
+    Data->Sequence++;
+}
@@ -0,0 +1,444 @@
+/*++
+
+Module Name:
+
+    xstate.c
+
+Purpose:
+
+    This translation unit contains the extended processor state (x87/SSE/AVX/AVX-512) management, lazy context switching and kernel SIMD sections.
+
+Author:
+
+    slep (Matanel) 2025.
+
+Revision History:
+
+--*/
+
+#include "../../includes/me.h"
+#include "../../includes/mh.h"
+#include "../../assert.h"
+
+//
+// Switching is lazy: Schedule() sets CR0.TS when the next thread's state isn't already in the registers,
+// and the first FPU/SSE/AVX instruction of the thread raises #NM, which loads it (MeHandleExtendedStateFault).
+// The state of a thread that used the registers is written back when it is switched out, so it can migrate freely,
+// and a thread that comes back to the same processor with nobody touching the registers in between doesn't fault at all.
+//
+// System threads have no area, the kernel is built with -mgeneral-regs-only and uses the registers only inside
+// MeSaveExtendedState/MeRestoreExtendedState.
+//
+
+#define CR0_TS                  (1UL << 3)   // Task Switched
+#define CR4_OSXSAVE             (1UL << 18)  // XSAVE and Processor Extended States Enable
+
+#define CPUID_1_ECX_XSAVE       (1U << 26)
+#define CPUID_D_1_EAX_XSAVEOPT  (1U << 0)
+#define CPUID_D_1_EAX_XSAVEC    (1U << 1)
+
+// XCR0 state components.
+#define XSTATE_X87              (1ULL << 0)
+#define XSTATE_SSE              (1ULL << 1)
+#define XSTATE_AVX              (1ULL << 2)
+#define XSTATE_OPMASK           (1ULL << 5)
+#define XSTATE_ZMM_HI256        (1ULL << 6)
+#define XSTATE_HI16_ZMM         (1ULL << 7)
+#define XSTATE_AVX512           (XSTATE_OPMASK | XSTATE_ZMM_HI256 | XSTATE_HI16_ZMM)
+#define XSTATE_MANAGED          (XSTATE_X87 | XSTATE_SSE | XSTATE_AVX | XSTATE_AVX512)
+
+#define FXSAVE_AREA_SIZE        512
+#define FXSAVE_FCW_OFFSET       0
+#define FXSAVE_MXCSR_OFFSET     24
+#define XSAVE_HEADER_SIZE       64
+#define XSAVE_AREA_ALIGNMENT    64
+
+#define DEFAULT_FCW             0x037F
+#define DEFAULT_MXCSR           0x1F80
+
+typedef enum _EXTENDED_STATE_INSTRUCTION {
+    ExtendedStateFxsave,        // No XSAVE, legacy 512 byte area (x87/SSE only)
+    ExtendedStateXsave,
+    ExtendedStateXsaveopt,      // Skips components that weren't modified since the last XRSTOR of the same area
+    ExtendedStateXsavec         // Compacted format, skips components in their init state
+} EXTENDED_STATE_INSTRUCTION;
+
+static EXTENDED_STATE_INSTRUCTION ExtendedStateInstruction = ExtendedStateFxsave;
+static uint64_t ExtendedStateMask;
+static uint32_t ExtendedStateSize = FXSAVE_AREA_SIZE;
+
+static
+void
+MepSaveExtendedState(
+    IN void* Area
+)
+
+{
+    uint32_t Low = (uint32_t)ExtendedStateMask;
+    uint32_t High = (uint32_t)(ExtendedStateMask >> 32);
+
+    switch (ExtendedStateInstruction) {
+    case ExtendedStateXsavec:
+        __asm__ volatile("xsavec64 (%0)" : : "r"(Area), "a"(Low), "d"(High) : "memory");
+        break;
+    case ExtendedStateXsaveopt:
+        __asm__ volatile("xsaveopt64 (%0)" : : "r"(Area), "a"(Low), "d"(High) : "memory");
+        break;
+    case ExtendedStateXsave:
+        __asm__ volatile("xsave64 (%0)" : : "r"(Area), "a"(Low), "d"(High) : "memory");
+        break;
+    default:
+        __asm__ volatile("fxsave64 (%0)" : : "r"(Area) : "memory");
+        break;
+    }
+}
+
+static
+void
+MepRestoreExtendedState(
+    IN void* Area
+)
+
+{
+    uint32_t Low = (uint32_t)ExtendedStateMask;
+    uint32_t High = (uint32_t)(ExtendedStateMask >> 32);
+
+    // XRSTOR handles both the standard and the compacted format (told apart by XCOMP_BV).
+    if (ExtendedStateInstruction == ExtendedStateFxsave) {
+        __asm__ volatile("fxrstor64 (%0)" : : "r"(Area) : "memory");
+    }
+    else {
+        __asm__ volatile("xrstor64 (%0)" : : "r"(Area), "a"(Low), "d"(High) : "memory");
+    }
+}
+
+FORCEINLINE
+void
+MepSetTaskSwitched(
+    void
+)
+
+{
+    __write_cr0(__read_cr0() | CR0_TS);
+}
+
+void
+MeInitializeExtendedState(
+    void
+)
+
+/*++
+
+    Routine description:
+
+        Enables XSAVE on the current processor, programs XCR0 and sizes the per-thread save area from CPUID leaf 0xD.
+
+    Arguments:
+
+        None.
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        Called by every processor from its control register setup (after CR4.OSFXSR is set).
+        Processors are assumed to be identical, so the size and instruction chosen are global.
+        Leaves CR0.TS set, no state is loaded yet, so the first thread to use the registers faults and gets its own.
+
+--*/
+
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    __cpuid(1, eax, ebx, ecx, edx);
+    if (!(ecx & CPUID_1_ECX_XSAVE)) {
+        // FXSAVE/FXRSTOR, x87 and SSE only.
+        ExtendedStateInstruction = ExtendedStateFxsave;
+        ExtendedStateMask = 0;
+        ExtendedStateSize = FXSAVE_AREA_SIZE;
+        MepSetTaskSwitched();
+        return;
+    }
+
+    __write_cr4(__read_cr4() | CR4_OSXSAVE);
+
+    // Enable every user state component we know how to manage.
+    __cpuid_count(0xD, 0, eax, ebx, ecx, edx);
+    uint64_t Mask = (((uint64_t)edx << 32) | eax) & XSTATE_MANAGED;
+
+    // The AVX-512 components can only be enabled together.
+    if ((Mask & XSTATE_AVX512) != XSTATE_AVX512) Mask &= ~XSTATE_AVX512;
+    __xsetbv(0, Mask);
+
+    // EBX now reports the standard format size for the enabled components.
+    __cpuid_count(0xD, 0, eax, ebx, ecx, edx);
+    uint32_t Size = ebx;
+
+    __cpuid_count(0xD, 1, eax, ebx, ecx, edx);
+    if (eax & CPUID_D_1_EAX_XSAVEC) {
+        ExtendedStateInstruction = ExtendedStateXsavec;
+        Size = ebx; // Compacted size (XCR0 | IA32_XSS, we use no supervisor states)
+    }
+    else if (eax & CPUID_D_1_EAX_XSAVEOPT) {
+        ExtendedStateInstruction = ExtendedStateXsaveopt;
+    }
+    else {
+        ExtendedStateInstruction = ExtendedStateXsave;
+    }
+
+    if (Size < FXSAVE_AREA_SIZE + XSAVE_HEADER_SIZE) Size = FXSAVE_AREA_SIZE + XSAVE_HEADER_SIZE;
+
+    ExtendedStateMask = Mask;
+    ExtendedStateSize = Size;
+    MepSetTaskSwitched();
+}
+
+MTSTATUS
+MeAllocateExtendedState(
+    IN PITHREAD Thread
+)
+
+/*++
+
+    Routine description:
+
+        Allocates the extended state save area of a (user) thread, in its initial state.
+
+    Arguments:
+
+        [IN]    PITHREAD Thread - The thread.
+
+    Return Values:
+
+        MT_SUCCESS, or MT_NO_RESOURCES if the area could not be allocated.
+
+--*/
+
+{
+    // Pool blocks are not 64 byte aligned, over allocate and align.
+    void* Allocation = MmAllocatePoolWithTag(NonPagedPool, ExtendedStateSize + XSAVE_AREA_ALIGNMENT - 1, 'tSxE'); // ExSt - Extended State
+    if (!Allocation) return MT_NO_RESOURCES;
+
+    uint8_t* Area = (uint8_t*)ALIGN_UP(Allocation, XSAVE_AREA_ALIGNMENT);
+    kmemset(Area, 0, ExtendedStateSize);
+
+    // The XSAVE header (XSTATE_BV) is zero, so XRSTOR puts every component in its init state,
+    // except MXCSR (and FCW for FXRSTOR), which are taken from the legacy region.
+    *(uint16_t*)(Area + FXSAVE_FCW_OFFSET) = DEFAULT_FCW;
+    *(uint32_t*)(Area + FXSAVE_MXCSR_OFFSET) = DEFAULT_MXCSR;
+
+    Thread->ExtendedStateAllocation = Allocation;
+    Thread->ExtendedState = Area;
+    Thread->ExtendedStateProcessor = 0;
+    return MT_SUCCESS;
+}
+
+void
+MeFreeExtendedState(
+    IN PITHREAD Thread
+)
+
+/*++
+
+    Routine description:
+
+        Frees the extended state save area of a thread.
+
+    Arguments:
+
+        [IN]    PITHREAD Thread - The thread (not running).
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        Processors may still name the thread as their ExtendedStateOwner, the pointer is only ever compared, never followed.
+
+--*/
+
+{
+    if (!Thread->ExtendedStateAllocation) return;
+
+    MmFreePool(Thread->ExtendedStateAllocation);
+    Thread->ExtendedStateAllocation = NULL;
+    Thread->ExtendedState = NULL;
+    Thread->ExtendedStateProcessor = 0;
+}
+
+void
+MeSwitchExtendedState(
+    IN PITHREAD PreviousThread,
+    IN PITHREAD NextThread
+)
+
+/*++
+
+    Routine description:
+
+        Called by the scheduler on a context switch, writes back the registers of the thread that used them,
+        and arms CR0.TS unless the next thread's state is still loaded.
+
+    Arguments:
+
+        [IN]    PITHREAD PreviousThread - The thread being switched out (may be NULL).
+        [IN]    PITHREAD NextThread - The thread about to run.
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        Runs at DISPATCH_LEVEL.
+
+--*/
+
+{
+    PPROCESSOR cpu = MeGetCurrentProcessor();
+
+    if (PreviousThread == NextThread && cpu->ExtendedStateLive) return;
+
+    if (cpu->ExtendedStateLive) {
+        // The owner (the previous thread) used the registers this quantum, save them so it can run on any processor.
+        PITHREAD Owner = cpu->ExtendedStateOwner;
+        if (Owner && Owner->ExtendedState) MepSaveExtendedState(Owner->ExtendedState);
+        cpu->ExtendedStateLive = false;
+    }
+
+    // The registers still hold the next thread's latest state, let it use them without faulting.
+    if (NextThread->ExtendedState && NextThread == cpu->ExtendedStateOwner && NextThread->ExtendedStateProcessor == cpu->ID + 1) {
+        __clts();
+        cpu->ExtendedStateLive = true;
+        return;
+    }
+
+    // Not live here, whatever the registers hold belongs to someone else, the next FPU/SSE/AVX instruction must fault.
+    MepSetTaskSwitched();
+}
+
+bool
+MeHandleExtendedStateFault(
+    void
+)
+
+/*++
+
+    Routine description:
+
+        Handles #NM (device not available), loads the current thread's extended state into the registers.
+
+    Arguments:
+
+        None.
+
+    Return Values:
+
+        True if handled, false if the current thread has no extended state (a kernel thread used the FPU outside of MeSaveExtendedState).
+
+--*/
+
+{
+    PPROCESSOR cpu = MeGetCurrentProcessor();
+    PITHREAD Thread = cpu->currentThread;
+
+    if (!Thread || !Thread->ExtendedState) return false;
+
+    __clts();
+
+    // CR0.TS was set, so nobody modified the registers since they were saved, there is nothing to write back.
+    if (cpu->ExtendedStateOwner != Thread || Thread->ExtendedStateProcessor != cpu->ID + 1) {
+        MepRestoreExtendedState(Thread->ExtendedState);
+        cpu->ExtendedStateOwner = Thread;
+        Thread->ExtendedStateProcessor = cpu->ID + 1;
+    }
+
+    cpu->ExtendedStateLive = true;
+    return true;
+}
+
+void
+MeSaveExtendedState(
+    OUT PEXTENDED_STATE_SAVE Save
+)
+
+/*++
+
+    Routine description:
+
+        Begins a kernel SIMD section, the FPU/SSE/AVX registers may be used until MeRestoreExtendedState.
+
+    Arguments:
+
+        [OUT]   PEXTENDED_STATE_SAVE Save - Receives what MeRestoreExtendedState needs.
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        Raises to DISPATCH_LEVEL (the section cannot be preempted), callable at IRQL <= DISPATCH_LEVEL,
+        not from interrupt service routines. Sections do not nest.
+        Code inside the section must be compiled with SIMD enabled (e.g __attribute__((target("sse2,avx2")))),
+        the kernel is built with -mgeneral-regs-only.
+
+--*/
+
+{
+    MeRaiseIrql(DISPATCH_LEVEL, &Save->OldIrql);
+
+    PPROCESSOR cpu = MeGetCurrentProcessor();
+
+    // Write back the thread state living in the registers (e.g the caller's user mode state during a system call).
+    if (cpu->ExtendedStateLive) {
+        PITHREAD Owner = cpu->ExtendedStateOwner;
+        if (Owner && Owner->ExtendedState) MepSaveExtendedState(Owner->ExtendedState);
+        cpu->ExtendedStateLive = false;
+    }
+
+    // The registers are about to be clobbered, they belong to nobody now.
+    cpu->ExtendedStateOwner = NULL;
+    __clts();
+
+    // Start from the default control state.
+    uint32_t Mxcsr = DEFAULT_MXCSR;
+    __asm__ volatile(
+        "fninit\n\t"
+        "ldmxcsr %0\n\t"
+        : : "m"(Mxcsr) : "memory"
+        );
+}
+
+void
+MeRestoreExtendedState(
+    IN PEXTENDED_STATE_SAVE Save
+)
+
+/*++
+
+    Routine description:
+
+        Ends a kernel SIMD section started with MeSaveExtendedState.
+
+    Arguments:
+
+        [IN]    PEXTENDED_STATE_SAVE Save - The value filled by MeSaveExtendedState.
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        The registers are not cleared, the next thread that uses them faults and XRSTOR overwrites every component.
+
+--*/
+
+{
+    MepSetTaskSwitched();
+    MeLowerIrql(Save->OldIrql);
+}
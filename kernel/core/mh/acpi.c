@@ -129,7 +129,7 @@ MhRebootComputer (
 
 }
 
-MTSTATUS MhParseLAPICs(uint8_t* buffer, size_t maxCPUs, uint32_t* cpuCount, uint32_t* lapicAddress) {
+MTSTATUS MhParseLAPICs(uint32_t* buffer, size_t maxCPUs, uint32_t* cpuCount, uint32_t* lapicAddress) {
 	if (!madt) return MT_NO_RESOURCES;
 	// Deference the lapicAddress ptr and put the lapic address for each CPU there.
 	*lapicAddress = madt->lapicAddress;
@@ -152,6 +152,18 @@ MTSTATUS MhParseLAPICs(uint8_t* buffer, size_t maxCPUs, uint32_t* cpuCount, uint
 				buffer[count++] = lapic->ApicId; // Store the APIC ID.
 			}
 		}
+		else if (type == MADT_X2APIC && lapic_is_x2apic()) {
+			// Processors with an APIC ID above 254 are only listed here (firmware may list the others in both).
+			MADT_LOCAL_X2APIC* x2apic = (MADT_LOCAL_X2APIC*)ptr;
+			bool listed = false;
+			for (size_t i = 0; i < count; i++) {
+				if (buffer[i] == x2apic->X2ApicId) { listed = true; break; }
+			}
+			if ((x2apic->Flags & 1) && !listed) {
+				gop_printf(COLOR_LIME, "Found a CPU with x2APIC ID %d\n", x2apic->X2ApicId);
+				buffer[count++] = x2apic->X2ApicId;
+			}
+		}
 
 		ptr += len;
 	}
@@ -205,4 +217,3 @@ MTSTATUS MhInitializeACPI(void) {
 
 	return MT_SUCCESS;
 }
-
@@ -20,9 +20,20 @@ static inline uint64_t build_seg(uint32_t base, uint32_t limit, uint8_t access,
     return desc;
 }
 
-static inline uint8_t get_initial_apic_id(void) {
+static inline uint32_t get_initial_apic_id(void) {
     uint32_t eax, ebx, ecx, edx;
 
+    // Leaf 0xB (extended topology) has the full 32 bit x2APIC ID in EDX.
+    __asm__ volatile("cpuid"
+        : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+        : "a"(0), "c"(0));
+    if (eax >= 0xB) {
+        __asm__ volatile("cpuid"
+            : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+            : "a"(0xB), "c"(0));
+        if (ebx) return edx; // EBX is 0 if the leaf isn't implemented.
+    }
+
     // When EAX=1, CPUID returns processor info.
     // The initial APIC ID is in bits 31-24 of the EBX register.
     __asm__ volatile("cpuid"
@@ -36,7 +47,7 @@ void APMain(void) {
 	// First, setup the GDT&TSS, then IDT.
 	int idx = -1;
 	// early map lapic mmio (lapic_init_cpu maps it).
-    uint8_t id = get_initial_apic_id();
+    uint32_t id = get_initial_apic_id();
 
 	for (int i = 0; i < (int)bootInfo.cpu_count && i < MAX_CPUS; i++) {
 		if (cpus[i].lapic_ID == id) { idx = i; break; }
@@ -48,6 +59,7 @@ void APMain(void) {
         __hlt();
 	}
     __writemsr(IA32_GS_BASE, (uint64_t)&cpus[idx]);
+    MhApCheckIn((uint32_t)idx, false);
 
     // Self invalidate all TLBs
     __write_cr3(__read_cr3());
@@ -67,6 +79,7 @@ void APMain(void) {
 	// mark as online and clear being unavailable
 	InterlockedOrU64(&cpus[idx].flags, CPU_ONLINE); 
     InterlockedAndU64(&cpus[idx].flags, ~CPU_UNAVAILABLE);   // clear unavailable
+    MhApCheckIn((uint32_t)idx, true);
     gop_printf(COLOR_ORANGE, "**Hello From AP CPU! - I'm ID: %d | StackTop: %p | CPU Ptr: %p**\n", id, MeGetCurrentProcessor()->VirtStackTop, MeGetCurrentProcessor());
 	// enable interupts, initiate timer and join scheduler queue
     lapic_init_cpu();
@@ -145,7 +145,33 @@ long_mode_entry:
 
     ; Set to OUR stack that was allocated by the prepare_percpu routine.
     ; Get the LAPIC ID (stored in rbx)
-    call .get_initial_apic_id
+    ; Inline and without the stack, every AP runs this at the same time on the same temporary stack.
+    ; Output: rbx = LAPIC ID (EDX of CPUID EAX=0Bh, the full x2APIC ID, else bits 31-24 of EBX from CPUID EAX=1)
+
+    xor eax, eax          ; CPUID function 0, highest leaf
+    xor ecx, ecx
+    cpuid
+    cmp eax, 0xB
+    jb .apic_id_leaf1
+
+    mov eax, 0xB          ; CPUID function 0Bh, extended topology
+    xor ecx, ecx          ; level 0
+    cpuid
+    test ebx, ebx         ; 0 if the leaf isn't implemented
+    jz .apic_id_leaf1
+    mov ebx, edx          ; x2APIC ID (writing ebx zero extends rbx)
+    jmp .have_apic_id
+
+.apic_id_leaf1:
+    mov eax, 1            ; CPUID function 1
+    xor ecx, ecx          ; CPUID subfunction 0
+    cpuid                 ; EAX, EBX, ECX, EDX updated
+
+    ; LAPIC ID is bits 31-24 of EBX
+    shr ebx, 24           ; shift down to lowest byte
+    movzx rbx, bl         ; zero-extend to 64-bit rbx
+
+.have_apic_id:
     ; RBX = LAPIC_ID
     
     ; Loop through the CPUs array until MAX_CPUS
@@ -190,18 +216,5 @@ long_mode_entry:
     hlt
     jmp .hlt_loop
 
-.get_initial_apic_id:
-    ; No params.
-    ; Output: rbx = LAPIC ID (bits 31-24 of EBX from CPUID EAX=1)
-
-    mov eax, 1            ; CPUID function 1
-    xor ecx, ecx          ; CPUID subfunction 0
-    cpuid                 ; EAX, EBX, ECX, EDX updated
-
-    ; LAPIC ID is bits 31-24 of EBX
-    shr ebx, 24           ; shift down to lowest byte
-    movzx rbx, bl         ; zero-extend to 64-bit rbx
-
-    ret
 ; pad the rest of the 4kib page as 0.
 times 4096 - ($ - _start) db 0
@@ -8,6 +8,13 @@
 
 #define IA32_APIC_BASE_MSR     0x1BULL
 #define APIC_BASE_RESERVED     0xFFF0000000000000ULL
+#define APIC_BASE_X2APIC_ENABLE (1ULL << 10)
+#define APIC_BASE_GLOBAL_ENABLE (1ULL << 11)
+
+// In x2APIC mode every register is an MSR at 0x800 + (xAPIC offset >> 4), the ICR is a single 64 bit MSR.
+#define X2APIC_MSR_BASE        0x800U
+#define X2APIC_ICR_MSR         0x830U
+#define X2APIC_SELF_IPI_MSR    0x83FU
 
 #define LAPIC_PAGE_SIZE    0x1000
 #define LAPIC_MAP_FLAGS (PAGE_PRESENT | PAGE_RW | PAGE_PCD)
@@ -18,6 +25,7 @@ enum {
     LAPIC_TPR = 0x080,
     LAPIC_EOI = 0x0B0,
     LAPIC_SVR = 0x0F0,
+    LAPIC_IRR = 0x200,
     LAPIC_ESR = 0x280,
     LAPIC_ICR_LOW = 0x300,
     LAPIC_ICR_HIGH = 0x310,
@@ -48,8 +56,57 @@ void lapic_mmio_write(uint32_t off, uint32_t val) {
     (void)MeGetCurrentProcessor()->LapicAddressVirt[0]; // Serializing read
 }
 
+// x2APIC is used when the CPU has it (build with XAPIC=1 to force the MMIO interface, for comparisons).
+// Under a hypervisor every MMIO access to the xAPIC is a VM exit with instruction decode, an x2APIC MSR access
+// is a cheap exit (or none at all with APICv / AVIC), and an IPI is one ICR write without delivery status polling.
+// The boot processor decides the mode in its first lapic_enable, the application processors follow it.
+static bool g_x2apic = false;
+static bool g_apic_mode_decided = false;
+
+static bool lapic_x2apic_supported(void) {
+#ifdef MT_FORCE_XAPIC
+    return false;
+#else
+    unsigned int eax, ebx, ecx, edx;
+    __cpuid(1, eax, ebx, ecx, edx);
+    return (ecx & CPUID_FEAT_ECX_X2APIC) != 0;
+#endif
+}
+
+// Mode of the current processor's Local APIC (xAPIC until its lapic_enable).
+static inline bool lapic_x2apic_active(void) {
+    return MeGetCurrentProcessor()->X2ApicEnabled;
+}
+
+bool lapic_is_x2apic(void) {
+    return g_x2apic;
+}
+
+// --- register access, x2APIC MSRs or xAPIC MMIO ---
+uint32_t lapic_read(uint32_t off) {
+    if (lapic_x2apic_active()) return (uint32_t)__readmsr(X2APIC_MSR_BASE + (off >> 4));
+    return lapic_mmio_read(off);
+}
+
+void lapic_write(uint32_t off, uint32_t val) {
+    if (lapic_x2apic_active()) {
+        __writemsr(X2APIC_MSR_BASE + (off >> 4), val);
+        return;
+    }
+    lapic_mmio_write(off, val);
+}
+
+// The APIC ID of the current processor, the full 32 bits in x2APIC mode.
+uint32_t lapic_get_id(void) {
+    uint32_t id = lapic_read(LAPIC_ID);
+    return lapic_x2apic_active() ? id : (id >> 24);
+}
+
 // Wait for ICR delivery to complete (ICR low: bit 12 = Delivery Status)
+// x2APIC has no delivery status, the ICR write is accepted at once.
 static void lapic_wait_icr(void) {
+    if (lapic_x2apic_active()) return;
+
     while (lapic_mmio_read(LAPIC_ICR_LOW) & (1 << 12)) {
         /* spin */
         __pause();
@@ -58,10 +115,10 @@ static void lapic_wait_icr(void) {
 
 // Initialize the Spurious Interrupt Vector
 void lapic_init_siv(void) {
-    uint32_t svr = lapic_mmio_read(LAPIC_SVR);
+    uint32_t svr = lapic_read(LAPIC_SVR);
     uint32_t vector = 0xFF; // IDT Entry
     svr = (svr & 0xFFFFFF00) | vector; // preserve enable bit, update vector.
-    lapic_mmio_write(LAPIC_SVR, svr);
+    lapic_write(LAPIC_SVR, svr);
 }
 
 static void map_lapic(uint64_t lapicPhysicalAddr) {
@@ -96,17 +153,31 @@ static inline uint64_t get_lapic_base_address(void) {
 
 // Enable local APIC via IA32_APIC_BASE MSR and set SVR
 void lapic_enable(void) {
+    if (!g_apic_mode_decided) {
+        g_x2apic = lapic_x2apic_supported();
+        g_apic_mode_decided = true;
+    }
+
     uint64_t apic_msr = __readmsr(IA32_APIC_BASE_MSR);
-    if (!(apic_msr & (1ULL << 11))) {
+    if (!(apic_msr & APIC_BASE_GLOBAL_ENABLE)) {
         // set APIC global enable
-        apic_msr |= (1ULL << 11);
+        apic_msr |= APIC_BASE_GLOBAL_ENABLE;
+        __writemsr(IA32_APIC_BASE_MSR, apic_msr);
+    }
+
+    // x2APIC can only be entered from the enabled xAPIC state, so it is a second write.
+    if (g_x2apic && !(apic_msr & APIC_BASE_X2APIC_ENABLE)) {
+        apic_msr |= APIC_BASE_X2APIC_ENABLE;
         __writemsr(IA32_APIC_BASE_MSR, apic_msr);
     }
+    MeGetCurrentProcessor()->X2ApicEnabled = g_x2apic;
+
+    // Still mapped in x2APIC mode, unused.
     map_lapic(get_lapic_base_address());
 
     // Set Spurious Vector Register and enable (bit 8 = APIC enable)
     uint32_t svr = (0xFF) | (1 << 8);
-    lapic_mmio_write(LAPIC_SVR, svr);
+    lapic_write(LAPIC_SVR, svr);
 }
 
 // Initialize CPU's LAPIC (call early from kernel init on BSP, and from each ap)
@@ -116,17 +187,24 @@ void lapic_init_cpu(void) {
     lapic_enable();
 
     // mask LINT0/LINT1 as appropriate, clear error status, etc.
-    lapic_mmio_write(LAPIC_LVT_LINT0, (1U << 16)); // mask
-    lapic_mmio_write(LAPIC_LVT_LINT1, (1U << 16)); // mask
-    lapic_mmio_write(LAPIC_LVT_ERROR, (1U << 16)); // mask (until handler in place)
-    lapic_mmio_write(LAPIC_EOI, 0);
+    lapic_write(LAPIC_LVT_LINT0, (1U << 16)); // mask
+    lapic_write(LAPIC_LVT_LINT1, (1U << 16)); // mask
+    lapic_write(LAPIC_LVT_ERROR, (1U << 16)); // mask (until handler in place)
+    lapic_write(LAPIC_EOI, 0);
 }
 
 // send IPI to APIC id 
 // apic_id - APICId of the CPU.
 // vector - IDT Vector number
 // flags - specified cpu flags, 0 for none.
-void lapic_send_ipi(uint8_t apic_id, uint8_t vector, uint32_t flags) {
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector, uint32_t flags) {
+    if (lapic_x2apic_active()) {
+        // WRMSR to the x2APIC isn't serializing, the mailbox stores must be visible before the IPI arrives.
+        __asm__ volatile("mfence; lfence" ::: "memory");
+        __writemsr(X2APIC_ICR_MSR, ((uint64_t)apic_id << 32) | vector | flags);
+        return;
+    }
+
     uint32_t high = ((uint32_t)apic_id) << 24;
     lapic_mmio_write(LAPIC_ICR_HIGH, high);
     lapic_mmio_write(LAPIC_ICR_LOW, (uint32_t)vector | flags);
@@ -134,9 +212,20 @@ void lapic_send_ipi(uint8_t apic_id, uint8_t vector, uint32_t flags) {
 }
 
 void lapic_eoi(void) {
+    if (lapic_x2apic_active()) {
+        // Not serializing, and no read back needed.
+        __writemsr(X2APIC_MSR_BASE + (LAPIC_EOI >> 4), 0);
+        return;
+    }
     lapic_mmio_write(LAPIC_EOI, 0);
 }
 
+// Route the performance counter overflow interrupt as an NMI (or mask it)
+// The LVT entry masks itself when the NMI is delivered, the handler calls this again to re-arm it.
+void lapic_set_perfmon_nmi(bool enable) {
+    lapic_write(LAPIC_LVT_PCC, enable ? (0x4U << 8) /* delivery mode NMI */ : (1U << 16));
+}
+
 // --- Timer calibration and init ---
 // NOTE: the APIC timer is a downward counter. Strategy:
 //  1. Set divide to known divisor.
@@ -149,16 +238,21 @@ void lapic_eoi(void) {
 #define APIC_LVT_TIMER_PERIODIC (1U << 17)
 #define APIC_TIMER_MASKED        (1U << 16)
 
+// The TSC is measured over the same 100 ms window (shared user data, user mode time conversion).
+static uint64_t g_tsc_frequency = 0;
+
 static uint32_t calibrate_lapic_ticks_per_10ms(void) {
     // choose divide config: here set encode 0x3 (divide by 16). Adjust if needed.
-    lapic_mmio_write(LAPIC_TIMER_DIV, 0x3);
+    lapic_write(LAPIC_TIMER_DIV, 0x3);
 
     const uint32_t start = 0xFFFFFFFFU;
-    lapic_mmio_write(LAPIC_TIMER_INITCNT, start);
+    lapic_write(LAPIC_TIMER_INITCNT, start);
+    uint64_t tsc_start = __rdtsc();
 
     pit_sleep_ms(100);
 
-    uint32_t curr = lapic_mmio_read(LAPIC_TIMER_CURRCNT);
+    uint32_t curr = lapic_read(LAPIC_TIMER_CURRCNT);
+    g_tsc_frequency = (__rdtsc() - tsc_start) * 10;
     uint32_t ticks = start - curr;
     if (ticks == 0) return 0;
     return ticks / 10; // ticks per 10ms -> for 100Hz (10ms period)
@@ -175,6 +269,10 @@ void lapic_timer_calibrate(void) {
     }
 }
 
+uint64_t lapic_tsc_frequency(void) {
+    return g_tsc_frequency;
+}
+
 // Renamed and simplified init function
 int init_lapic_timer(uint32_t hz) {
     if (hz == 0) return -1;
@@ -190,8 +288,8 @@ int init_lapic_timer(uint32_t hz) {
     if (initial == 0) initial = 1;
 
     // Program THIS CPU's timer using the shared calibration value
-    lapic_mmio_write(LAPIC_LVT_TIMER, APIC_LVT_TIMER_PERIODIC | VECTOR_CLOCK /* vector */);
-    lapic_mmio_write(LAPIC_TIMER_INITCNT, (uint32_t)initial);
+    lapic_write(LAPIC_LVT_TIMER, APIC_LVT_TIMER_PERIODIC | VECTOR_CLOCK /* vector */);
+    lapic_write(LAPIC_TIMER_INITCNT, (uint32_t)initial);
     return 0;
 }
 
@@ -245,17 +343,24 @@ MhRequestSoftwareInterrupt(
         cpu->ApcInterruptRequested = false;
     }
 
+    uint8_t vector = (RequestIrql == DISPATCH_LEVEL) ? (uint8_t)VECTOR_DPC : (uint8_t)VECTOR_APC;
+
+    if (lapic_x2apic_active()) {
+        // The SELF IPI register, then wait until it is pending (interrupts are off, it stays in the IRR).
+        __writemsr(X2APIC_SELF_IPI_MSR, vector);
+        while (!(lapic_read(LAPIC_IRR + (vector / 32) * 0x10) & (1U << (vector % 32)))) {
+            __pause();
+        }
+
+        MeEnableInterrupts(prev_if);
+        return;
+    }
+
     // wait until previous ICR is not busy
     lapic_wait_icr();
 
     // For a self IPI we can use the destination shorthand
-    uint32_t icr_low;
-    if (RequestIrql == DISPATCH_LEVEL) {
-        icr_low = (uint32_t)VECTOR_DPC | (1U << 18);
-    }
-    else {
-        icr_low = (uint32_t)VECTOR_APC | (1U << 18);
-    }
+    uint32_t icr_low = (uint32_t)vector | (1U << 18);
 
     // ICR high is ignored when shorthand is used, but zero it for clarity.
     lapic_mmio_write(LAPIC_ICR_HIGH, 0);
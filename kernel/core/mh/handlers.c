@@ -64,22 +64,28 @@ static void MiHandleTimer(bool schedulerEnabled, PTRAP_FRAME trap) {
 
 extern void lapic_eoi(void);
 
-void MiLapicInterrupt(bool schedulerEnabled, PTRAP_FRAME trap) {
+void MiLapicInterrupt(bool schedulerEnabled, IRQL InterruptedIrql, PTRAP_FRAME trap) {
+    // Profiler samples (timer source) are taken before the quantum bookkeeping.
+    MdProfileClockTick(trap, InterruptedIrql);
+    MeIncrementCounter(PerfCounterClockInterrupts);
+    MeUpdateSharedUserData();
     MiHandleTimer(schedulerEnabled, trap);
+    // Let epoch reclamation make progress, Schedule() does the wake (we cannot signal events here).
+    MsEpochQuiescentState(false);
     lapic_eoi(); // Signal end of interrupt.
 }
 
-void MiInterprocessorInterrupt (
-    void
-) 
+void MhExecuteCpuAction (
+    void* Context
+)
 
 /*++
 
-    Routine description : Handles an interprocessor interupt.
+    Routine description : Performs a CPU_ACTION on the current processor.
 
     Arguments:
 
-        None. (arguments to IPI's are taken from the PROCESSOR struct, accessed in MeGetCurrentProcessor)
+        Pointer to the CPU_ACTION_REQUEST (queued by MhSendActionToCpusAndWait).
 
     Return Values:
 
@@ -89,31 +95,31 @@ void MiInterprocessorInterrupt (
 
 {
     PPROCESSOR cpu = MeGetCurrentProcessor();
-    InterlockedOrU64(&cpu->flags, CPU_DOING_IPI);
-    uint64_t addr = cpu->IpiParameter.debugRegs.address;
-    CPU_ACTION action = cpu->IpiAction;
+    PCPU_ACTION_REQUEST request = (PCPU_ACTION_REQUEST)Context;
+    uint64_t addr = request->Parameter.debugRegs.address;
+    CPU_ACTION action = request->Action;
     int idx = find_available_debug_reg();
+    if (action <= CPU_ACTION_FLUSH_CR3) MeIncrementCounter(PerfCounterIpiReceivedStop + action);
     switch (action) {
     case CPU_ACTION_STOP:
         // explicit action to halt, since we are in an interrupt, unless an NMI somehow comes, we will stay stopped.
-        // clear the flag before we halt so BSP can continue iterations
-        cpu->IpiSeq = 0;
+        // (the sender doesn't wait for this one)
         MmFullBarrier();
         InterlockedAndU64(&cpu->flags, ~CPU_DOING_IPI);
         __cli();
         for (;;) __hlt();
     case CPU_ACTION_PERFORM_TLB_SHOOTDOWN:
-        invlpg((void*)cpu->IpiParameter.pageParams.addressToInvalidate);
+        invlpg((void*)request->Parameter.pageParams.addressToInvalidate);
         break;
     case CPU_ACTION_PRINT_ID:
         gop_printf(COLOR_RED, "[CPU-IPI] Hello from CPU ID: %d\n", cpu->lapic_ID);
         break;
     case CPU_ACTION_WRITE_DEBUG_REGS:
         if (idx == -1) break;
-        __write_dr(7, cpu->IpiParameter.debugRegs.dr7);
-        __write_dr(idx, cpu->IpiParameter.debugRegs.address);
-        MeGetCurrentProcessor()->DebugEntry[idx].Address = (void*)cpu->IpiParameter.debugRegs.address;
-        MeGetCurrentProcessor()->DebugEntry[idx].Callback = cpu->IpiParameter.debugRegs.callback;
+        __write_dr(7, request->Parameter.debugRegs.dr7);
+        __write_dr(idx, request->Parameter.debugRegs.address);
+        MeGetCurrentProcessor()->DebugEntry[idx].Address = (void*)request->Parameter.debugRegs.address;
+        MeGetCurrentProcessor()->DebugEntry[idx].Callback = request->Parameter.debugRegs.callback;
         break;
     case CPU_ACTION_CLEAR_DEBUG_REGS:
         for (int i = 0; i < 4; i++) {
@@ -141,9 +147,32 @@ void MiInterprocessorInterrupt (
         __write_cr3(__read_cr3());
         break;
     }
+}
+
+void MiInterprocessorInterrupt (
+    void
+) 
+
+/*++
+
+    Routine description : Handles an interprocessor interupt.
+
+    Arguments:
+
+        None. (the work is queued to the PROCESSOR struct, see xcall.c)
+
+    Return Values:
+
+        None.
+
+--*/
+
+{
+    PPROCESSOR cpu = MeGetCurrentProcessor();
+    InterlockedOrU64(&cpu->flags, CPU_DOING_IPI);
+
+    MhRetireCrossCalls();
 
-    MmFullBarrier();
-    cpu->IpiSeq = 0;
     InterlockedAndU64(&cpu->flags, ~CPU_DOING_IPI);
 
     // End of Interrupt for LAPIC is signaled at function return.
@@ -190,12 +219,17 @@ MiPageFault (
 
     
     PRIVILEGE_MODE PreviousMode = MeGetPreviousMode();
+    MeIncrementCounter(PerfCounterPageFaults);
+    MD_TRACE(TraceEventFaultEnter, fault_addr, trap->error_code);
     MTSTATUS status = MmAccessFault(trap->error_code, fault_addr, PreviousMode, trap);
+    MD_TRACE(TraceEventFaultExit, status, 0);
 #ifdef DEBUG
     gop_printf(COLOR_RED, "I have returned from MmAccessFault with status %x\n", status);
 #endif
 
     if (MT_FAILURE(status)) {
+        MeIncrementCounter(PerfCounterFaultAccessViolations);
+
         // If MmAccessFault returned a failire (e.g MT_ACCESS_VIOLATION), but hasn't bugchecked, we check for exception handlers in the current thread
         // If there are no exceptions handlers (for user mode, we check the FS exception (todo TEB)) (for kernel mode we check the section by linker script)
         // - For user mode, thread termination, for kernel mode - bugcheck with KMODE_EXCEPTION_NOT_HANDLED.
@@ -384,7 +418,6 @@ MiDebugTrap (
 #endif
 }
 
-NORETURN
 void 
 MiNonMaskableInterrupt ( 
     PTRAP_FRAME trap
@@ -400,11 +433,17 @@ MiNonMaskableInterrupt (
 
     Return Values:
 
-        None. This function will never return.
+        None. Returns only for performance counter overflows (profiler samples), any other NMI bugchecks.
+
+    Notes:
+
+        Entered at the interrupted IRQL, a profiler sample must not touch the IRQL state (the NMI may have interrupted MeRaiseIrql itself).
 
 --*/
 
 {
+    if (MdProfileInterrupt(trap)) return;
+
     /*++
 
     NMI bugcheck parameters:
@@ -412,7 +451,7 @@ MiNonMaskableInterrupt (
     No Parameters.
 
     --*/
-    UNREFERENCED_PARAMETER(trap);
+    _MeSetIrql(HIGH_LEVEL); // Non Maskable Interrupt - basically when the CPU encounters a hardware fault, cannot be masked, very alarming.
     MeBugCheck(NON_MASKABLE_INTERRUPT);
 }
 
@@ -453,7 +492,10 @@ void MiInvalidOpcode(PTRAP_FRAME trap) {
 }
 
 void MiNoCoprocessor(PTRAP_FRAME trap) {
-    // rarely triggered, if a floating point chip is not integrated, or is not attached, bugcheck.
+    // CR0.TS is set on context switches, the first FPU/SSE/AVX instruction of a thread lands here to load its extended state.
+    if (MeHandleExtendedStateFault()) return;
+
+    // rarely triggered, if a floating point chip is not integrated, or is not attached (or the kernel used the FPU outside of MeSaveExtendedState), bugcheck.
     MeBugCheckEx(NO_COPROCESSOR, (void*)trap->rip, NULL, NULL, NULL);
 }
 
@@ -541,4 +583,3 @@ void MiMachineCheck(PTRAP_FRAME trap) {
     // obviously bugcheck.
     MeBugCheckEx(SEVERE_MACHINE_CHECK, (void*)trap->rip, NULL, NULL, NULL);
 }
-
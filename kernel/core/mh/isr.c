@@ -88,7 +88,7 @@ MhHandleInterrupt (
         MiDebugTrap(trap);
         break;
     case EXCEPTION_NON_MASKABLE_INTERRUPT:
-        _MeSetIrql(HIGH_LEVEL); // Non Maskable Interrupt - basically when the CPU encounters a hardware fault, cannot be masked, very alarming.
+        // Raises to HIGH_LEVEL itself, unless it is a profiler sample.
         MiNonMaskableInterrupt(trap);
         break;
     case EXCEPTION_BREAKPOINT:
@@ -140,7 +140,7 @@ MhHandleInterrupt (
         break;
     case VECTOR_CLOCK:
         MeRaiseIrql(CLOCK_LEVEL, &oldIrql);
-        MiLapicInterrupt(schedulerEnabled, trap);
+        MiLapicInterrupt(schedulerEnabled, oldIrql, trap);
         MeLowerIrql(oldIrql);
         break;
     case VECTOR_IPI:
@@ -8,6 +8,7 @@
 #include "../../includes/mh.h"
 #include "../../includes/mm.h"
 #include "../../includes/me.h"
+#include "../../includes/mg.h"
 #include <stdint.h>
 
 extern uint8_t _binary_build_ap_trampoline_bin_start[];
@@ -18,9 +19,8 @@ int smp_cpu_count = 0;
 SMP_BOOTINFO bootInfo;
 extern bool smpInitialized;
 
-static inline uint8_t my_lapic_id(void) {
-	uint32_t x = lapic_mmio_read(LAPIC_ID);
-	return (uint8_t)(x >> 24);
+static inline uint32_t my_lapic_id(void) {
+	return lapic_get_id();
 }
 
 // Copy trampoline binary to low phys and map identity for this page.
@@ -50,11 +50,11 @@ static void install_trampoline(void) {
 extern PROCESSOR cpu0;
 
 // Allocate PER CPU stack and populare cpus[]
-static void prepare_percpu(uint8_t* apic_list, uint32_t cpu_count) {
-    uint8_t my_id = my_lapic_id();
+static void prepare_percpu(uint32_t* apic_list, uint32_t cpu_count) {
+    uint32_t my_id = my_lapic_id();
 
     for (uint32_t i = 0; i < cpu_count && i < MAX_CPUS; i++) {
-        uint8_t aid = apic_list[i];
+        uint32_t aid = apic_list[i];
 
 		if (aid == my_id) {
 			// BSP slot, since we want synchronization for all APs, we migrate cpu0 to this global variable of CPUs, and change gs once again.
@@ -96,7 +96,8 @@ static void prepare_percpu(uint8_t* apic_list, uint32_t cpu_count) {
 		void* stack = MiCreateKernelStack(true);
 		cpus[i].VirtStackTop = stack;
 
-		// IST Stack setup & GDT & TSS have been moved to MeInitProcesor function.
+		// RSP0, IST stacks, GDT & TSS are allocated here in one batch, the AP only fills them (MeInitializeProcessor).
+		MeAllocateProcessorResources(&cpus[i]);
 
 		// CPU Flags
 		cpus[i].flags |= CPU_UNAVAILABLE; // Start unavailable.
@@ -109,29 +110,132 @@ static void prepare_percpu(uint8_t* apic_list, uint32_t cpu_count) {
 	smp_cpu_count = cpu_count;
 }
 
-static void send_startup_ipis(uint8_t apic_id) {
-	// init
-	lapic_send_ipi(apic_id, 0, (0x5 << 8) | (1 << 14)); // init assert
-	pit_sleep_ms(10);
+//
+// All APs are started together: INIT to every AP back to back, a single INIT settle delay, SIPI to every AP,
+// and a second SIPI only to the APs that didn't check in. The APs then initialize concurrently.
+// Every AP checks in twice, in g_ap_started when it reaches APMain and in g_ap_online when it is ready to schedule.
+// The INIT IPIs are addressed to the MADT processors and not broadcast, a broadcast would also wake processors
+// the firmware lists as disabled (or not at all), and those have no slot in cpus[].
+//
+
+#define SMP_INIT_DELAY_US 10000 // Legacy INIT deassert settle time (10ms)
+#define SMP_SIPI_DELAY_US 200   // Time an AP gets to check in before the second SIPI
+#define SMP_MASK_WORDS ((MAX_CPUS + 63) / 64)
+
+static volatile uint64_t g_ap_started[SMP_MASK_WORDS];
+static volatile uint64_t g_ap_online[SMP_MASK_WORDS];
+static uint64_t g_ap_expected[SMP_MASK_WORDS];
+
+// Boot phase timestamps (TSC) of the last MhInitializeSMP.
+static struct {
+	uint64_t Start;     // MhInitializeSMP entry
+	uint64_t Prepared;  // per CPU structures, stacks, GDT & TSS allocated
+	uint64_t Init;      // INIT sent to every AP
+	uint64_t Sipi;      // first SIPI sent to every AP
+	uint64_t Started;   // every AP reached APMain
+	uint64_t Online;    // every AP is online
+} g_smp_times;
+
+static void smp_delay_us(uint32_t us) {
+	uint64_t freq = lapic_tsc_frequency();
+	if (!freq) {
+		pit_sleep_ms((us + 999) / 1000);
+		return;
+	}
+
+	uint64_t end = __rdtsc() + (freq / 1000000) * us;
+	while (__rdtsc() < end) {
+		__pause();
+	}
+}
+
+static bool smp_all_checked_in(volatile uint64_t* mask) {
+	for (uint32_t w = 0; w < SMP_MASK_WORDS; w++) {
+		if ((mask[w] & g_ap_expected[w]) != g_ap_expected[w]) return false;
+	}
+	return true;
+}
+
+// Waits until every AP has checked in to mask, up to us microseconds (0 = no limit).
+static bool smp_wait_check_in(volatile uint64_t* mask, uint32_t us) {
+	uint64_t freq = lapic_tsc_frequency();
+	uint64_t end = __rdtsc() + (freq / 1000000) * us;
+
+	while (!smp_all_checked_in(mask)) {
+		if (us && freq && __rdtsc() >= end) return false;
+		__pause();
+	}
+	return true;
+}
+
+// True if the processor needs the 10ms INIT settle delay (only old processors do, virtual ones never).
+static bool smp_init_delay_needed(void) {
+	unsigned int eax, ebx, ecx, edx;
+
+	__cpuid(1, eax, ebx, ecx, edx);
+	if (ecx & CPUID_FEAT_ECX_HYPERVISOR) return false;
 
+	uint32_t family = (eax >> 8) & 0xF;
+	if (family == 0xF) family += (eax >> 20) & 0xFF;
+
+	__cpuid(0, eax, ebx, ecx, edx);
+	if (ebx == 0x756E6547 /* "Genu"ineIntel */ && family >= 6) return false;
+	if (ebx == 0x68747541 /* "Auth"enticAMD */ && family >= 0xF) return false;
+
+	return true;
+}
+
+static uint64_t smp_tsc_to_us(uint64_t cycles) {
+	uint64_t freq = lapic_tsc_frequency();
+	return freq ? (cycles * 1000000ULL) / freq : 0;
+}
+
+static void send_startup_ipis(uint32_t* apic_list, uint32_t cpu_count, uint32_t my_id) {
 	uint8_t vector = (uint8_t)(AP_TRAMP_PHYS >> 12);
 
-	// SIPI x2
-	lapic_send_ipi(apic_id, vector, (0x6 << 8));
-	pit_sleep_ms(1);
-	lapic_send_ipi(apic_id, vector, (0x6 << 8));
-	pit_sleep_ms(1);
+	// INIT to every AP, then a single delay for all of them.
+	for (uint32_t i = 0; i < cpu_count; i++) {
+		if (apic_list[i] == my_id) continue;
+		lapic_send_ipi(apic_list[i], 0, (0x5 << 8) | (1 << 14)); // init assert
+	}
+	if (smp_init_delay_needed()) {
+		smp_delay_us(SMP_INIT_DELAY_US);
+	}
+	g_smp_times.Init = __rdtsc();
+
+	// SIPI to every AP.
+	for (uint32_t i = 0; i < cpu_count; i++) {
+		if (apic_list[i] == my_id) continue;
+		lapic_send_ipi(apic_list[i], vector, (0x6 << 8));
+	}
+	g_smp_times.Sipi = __rdtsc();
+
+	// The second SIPI only to the APs that haven't checked in (it is ignored by an AP that left wait-for-SIPI).
+	if (smp_wait_check_in(g_ap_started, SMP_SIPI_DELAY_US)) return;
+
+	for (uint32_t i = 0; i < cpu_count; i++) {
+		if (apic_list[i] == my_id) continue;
+		if (g_ap_started[i / 64] & (1ULL << (i % 64))) continue;
+		lapic_send_ipi(apic_list[i], vector, (0x6 << 8));
+	}
+}
+
+void MhApCheckIn(uint32_t index, bool online) {
+	volatile uint64_t* mask = online ? g_ap_online : g_ap_started;
+	InterlockedOrU64(&mask[index / 64], 1ULL << (index % 64));
 }
 
 // Globals for use of IPI & other functions.
-uint8_t g_apic_list[MAX_CPUS];
+uint32_t g_apic_list[MAX_CPUS];
 uint32_t g_cpuCount = 1; // Must be 1, to include the BSP.
 uint32_t g_lapicAddress;
 
 // BSP Entry: start all APs.
-void MhInitializeSMP(uint8_t* apic_list, uint32_t cpu_count, uint32_t lapicAddress) {
+void MhInitializeSMP(uint32_t* apic_list, uint32_t cpu_count, uint32_t lapicAddress) {
+	g_smp_times.Start = __rdtsc();
 	// populate cpus and per cpu stacks.
 	prepare_percpu(apic_list, cpu_count);
+	g_smp_times.Prepared = __rdtsc();
 	// copy trampoline
 	install_trampoline();
 
@@ -176,19 +280,29 @@ void MhInitializeSMP(uint8_t* apic_list, uint32_t cpu_count, uint32_t lapicAddre
 	kmemcpy((void*)virt, &cpuAddress, sizeof(cpuAddress));
 
 	// send INIT/SIPI/SIPI to APs (skip BSP)
-	uint8_t my_id = my_lapic_id();
-	for (uint32_t i = 0; i < cpu_count; i++) {
-		uint8_t aid = apic_list[i];
-		if (aid == my_id) continue;
-		send_startup_ipis(aid);
+	uint32_t my_id = my_lapic_id();
+	for (uint32_t i = 0; i < cpu_count && i < MAX_CPUS; i++) {
+		if (apic_list[i] == my_id) continue;
+		g_ap_expected[i / 64] |= 1ULL << (i % 64);
 	}
+	send_startup_ipis(apic_list, cpu_count, my_id);
+
 	// over - Application Processors (the other CPUs) should execute trampoline and call ap_main();
 	// now, we wait until all are online.
-	for (uint32_t i = 0; i < g_cpuCount; i++) {
-		while (!(cpus[i].flags & CPU_ONLINE)) {
-			__pause();
-		}
-	}
+	smp_wait_check_in(g_ap_started, 0);
+	g_smp_times.Started = __rdtsc();
+	smp_wait_check_in(g_ap_online, 0);
+	g_smp_times.Online = __rdtsc();
+
+	gop_printf(COLOR_LIME, "[SMP] %u CPUs online in %u us (prepare %u us, INIT %u us, SIPI %u us, check-in %u us, initialize %u us)\n",
+		cpu_count,
+		(uint32_t)smp_tsc_to_us(g_smp_times.Online - g_smp_times.Start),
+		(uint32_t)smp_tsc_to_us(g_smp_times.Prepared - g_smp_times.Start),
+		(uint32_t)smp_tsc_to_us(g_smp_times.Init - g_smp_times.Prepared),
+		(uint32_t)smp_tsc_to_us(g_smp_times.Sipi - g_smp_times.Init),
+		(uint32_t)smp_tsc_to_us(g_smp_times.Started - g_smp_times.Sipi),
+		(uint32_t)smp_tsc_to_us(g_smp_times.Online - g_smp_times.Started));
+
 	smpInitialized = true;
 }
 
@@ -210,60 +324,22 @@ MeGetProcessorBlock(
 	return MeGetCurrentProcessor();
 }
 
-static void MhSpinAndProcessIpis(void) {
-	uint64_t rflags;
-
-	// Get currnet RFLAGS
-	__asm__ volatile("pushfq; pop %0" : "=rm"(rflags) :: "memory");
-
-	// Let the CPU have a window to process an interrupt in the NOP.
-	__asm__ volatile("sti");
-	__asm__ volatile("nop");
-
-	// Restore original state, (interrupts off before = still off, on before = still on)
-	if (!(rflags & (1 << 9))) {
-		__asm__ volatile("cli");
-	}
-
-	__asm__ volatile("pause");
-}
-
 void MhSendActionToCpusAndWait(CPU_ACTION action, IPI_PARAMS parameter) {
 	if (!g_cpuCount || !smpInitialized) return;
-	uint8_t myid = my_lapic_id();
-
-	static uint64_t g_ipiSeq = 1; // Global sequence of IPIs made.
-	uint64_t seq = InterlockedIncrementU64(&g_ipiSeq);
-
-	__asm__ volatile("mfence" ::: "memory");
 
-	for (uint32_t i = 0; i < g_cpuCount; i++) {
-		if (cpus[i].lapic_ID == myid) continue;
-		if (!(cpus[i].flags & CPU_ONLINE)) continue;
+	// Every other online processor, through the cross call queues (xcall.c).
+	PROCESSOR_MASK targets = MhGetOnlineProcessorMask() & ~(1ULL << MeGetCurrentProcessorNumber());
+	if (!targets) return;
 
-		while (InterlockedCompareExchangeU64(&cpus[i].MailboxLock, 1, 0) == 1) {
-			MhSpinAndProcessIpis();
-		}
-
-		cpus[i].IpiAction = action;
-		cpus[i].IpiParameter = parameter;
-		cpus[i].IpiSeq = seq; // assign sequence number
+	if (action <= CPU_ACTION_FLUSH_CR3) MeAddCounter(PerfCounterIpiSentStop + action, (uint64_t)__builtin_popcountll(targets));
 
-		uint32_t LAPIC_ACTION_VECTOR = VECTOR_IPI;
-		lapic_send_ipi(cpus[i].lapic_ID, (uint8_t)LAPIC_ACTION_VECTOR, 0x0);
+	if (action == CPU_ACTION_STOP) {
+		// The targets never return from it, so nobody waits, and the request can't live on this stack.
+		static CPU_ACTION_REQUEST stopRequest = { .Action = CPU_ACTION_STOP };
+		MhCrossCall(targets, MhExecuteCpuAction, &stopRequest, CROSS_CALL_ASYNCHRONOUS);
+		return;
 	}
 
-	// wait for all CPUs to handle this exact IPI
-	for (uint32_t i = 0; i < g_cpuCount; i++) {
-		if (cpus[i].lapic_ID == myid) continue;
-		if (!(cpus[i].flags & CPU_ONLINE)) continue;
-	
-		// Wait for completion while still processing incoming IPIs
-		while (*(volatile uint64_t*)&cpus[i].IpiSeq == seq) {
-			MhSpinAndProcessIpis();
-		}
-
-		// We let the other CPUs use this cpu mailbox.
-		InterlockedExchangeU64(&cpus[i].MailboxLock, 0);
-	}
+	CPU_ACTION_REQUEST request = { .Action = action, .Parameter = parameter };
+	MhCrossCall(targets, MhExecuteCpuAction, &request, 0);
 }
\ No newline at end of file
@@ -0,0 +1,360 @@
+/*++
+
+Module Name:
+
+    xcall.c
+
+Purpose:
+
+    This translation unit contains the cross processor calls (run a routine on other processors through the IPI vector).
+
+Author:
+
+    slep (Matanel) 2025.
+
+Revision History:
+
+--*/
+
+#include "../../includes/mh.h"
+#include "../../includes/me.h"
+#include "../../assert.h"
+
+//
+// Every processor has a lock free queue of calls (PROCESSOR.CrossCallQueue), senders push, the IPI handler
+// takes the whole queue at once (MhRetireCrossCalls). Only the sender that finds the queue empty interrupts the
+// target, a call queued while an IPI is already pending runs with it, so a burst of calls costs one interrupt.
+//
+// The queue entries are the slots below, one per sender and target. A slot is busy from its claim until the
+// target has run the routine, so a synchronous sender just waits for its slots, and an asynchronous sender
+// only waits when it reuses a slot whose previous call hasn't run yet. Nothing is allocated.
+//
+// Deferred calls stay in their claimed slots, private to the sender (MhpDeferredTargets), and are only pushed
+// by the next non deferred call or MhFlushCrossCalls. The queue of a target therefore only ever holds calls
+// whose sender has interrupted it (or will, before enabling interrupts), and every sender sees the queue as it is.
+//
+// Interrupts stay disabled from the first claim until the IPIs are sent. Waiting for a busy slot opens them,
+// but only after interrupting the targets of everything queued so far, so a cross call made from an interrupt
+// never waits on a slot whose IPI is held by the interrupted one. Routines run at IPI_LEVEL, with interrupts
+// disabled, and must not make synchronous cross calls.
+//
+
+_Static_assert(MAX_CPUS <= 64, "PROCESSOR_MASK has a bit per processor.");
+
+typedef struct _CROSS_CALL_SLOT {
+    SINGLE_LINKED_LIST Entry;       // Must be first, the queue holds the entries.
+    PCROSS_CALL_ROUTINE Routine;
+    void* Context;
+    volatile uint64_t Busy;         // Queued and not run yet.
+} CROSS_CALL_SLOT, *PCROSS_CALL_SLOT;
+
+// [Sender][Target]
+static CROSS_CALL_SLOT MhpCrossCallSlots[MAX_CPUS][MAX_CPUS];
+
+// Targets with deferred calls from this sender that weren't interrupted yet.
+static PROCESSOR_MASK MhpDeferredTargets[MAX_CPUS];
+
+extern PROCESSOR cpus[];
+extern uint32_t g_cpuCount;
+
+static
+bool
+MhpPushCrossCall(
+    IN PPROCESSOR Target,
+    IN PCROSS_CALL_SLOT Slot
+)
+
+// Returns true if the queue was empty (the target needs an IPI).
+{
+    PSINGLE_LINKED_LIST Old;
+
+    do {
+        Old = __atomic_load_n(&Target->CrossCallQueue, __ATOMIC_RELAXED);
+        Slot->Entry.Next = Old;
+    } while (!__atomic_compare_exchange_n(&Target->CrossCallQueue, &Old, &Slot->Entry, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    return Old == NULL;
+}
+
+static
+PROCESSOR_MASK
+MhpPushDeferredCalls(
+    IN uint32_t Self
+)
+
+// Queues the deferred calls of this sender, returns the targets that need an IPI. Interrupts must be disabled.
+{
+    PROCESSOR_MASK Targets = MhpDeferredTargets[Self];
+    PROCESSOR_MASK Kick = 0;
+
+    MhpDeferredTargets[Self] = 0;
+
+    while (Targets) {
+        uint32_t i = (uint32_t)__builtin_ctzll(Targets);
+        Targets &= Targets - 1;
+
+        if (MhpPushCrossCall(&cpus[i], &MhpCrossCallSlots[Self][i])) Kick |= 1ULL << i;
+    }
+
+    return Kick;
+}
+
+static
+void
+MhpInterruptProcessors(
+    IN PROCESSOR_MASK Targets,
+    IN uint32_t Self
+)
+
+{
+    if (!Targets) return;
+
+    // One ICR write when every other online processor is a target.
+    PROCESSOR_MASK Others = MhGetOnlineProcessorMask() & ~(1ULL << Self);
+    if (Targets == Others && (Targets & (Targets - 1))) {
+        lapic_send_ipi(0, (uint8_t)VECTOR_IPI, LAPIC_ICR_DEST_ALL_BUT_SELF);
+        MeIncrementCounter(PerfCounterCrossCallInterrupts);
+        return;
+    }
+
+    while (Targets) {
+        uint32_t i = (uint32_t)__builtin_ctzll(Targets);
+        Targets &= Targets - 1;
+
+        lapic_send_ipi(cpus[i].lapic_ID, (uint8_t)VECTOR_IPI, 0);
+        MeIncrementCounter(PerfCounterCrossCallInterrupts);
+    }
+}
+
+static void MhpSpinAndProcessIpis(void) {
+    uint64_t rflags;
+
+    // Get current RFLAGS
+    __asm__ volatile("pushfq; pop %0" : "=rm"(rflags) :: "memory");
+
+    // Let the CPU have a window to process an interrupt in the NOP (a target may be waiting on us).
+    __asm__ volatile("sti");
+    __asm__ volatile("nop");
+
+    // Restore original state, (interrupts off before = still off, on before = still on)
+    if (!(rflags & (1 << 9))) {
+        __asm__ volatile("cli");
+    }
+
+    __asm__ volatile("pause");
+}
+
+PROCESSOR_MASK
+MhGetOnlineProcessorMask(
+    void
+)
+
+/*++
+
+    Routine description:
+
+        Retrieves the processors that are online.
+
+    Arguments:
+
+        None.
+
+    Return Values:
+
+        Bit N set if cpus[N] is online (bit 0 only before SMP is initialized).
+
+--*/
+
+{
+    if (!smpInitialized) return 1;
+
+    PROCESSOR_MASK Mask = 0;
+    for (uint32_t i = 0; i < g_cpuCount && i < MAX_CPUS; i++) {
+        if (cpus[i].flags & CPU_ONLINE) Mask |= 1ULL << i;
+    }
+    return Mask;
+}
+
+void
+MhFlushCrossCalls(
+    void
+)
+
+/*++
+
+    Routine description:
+
+        Queues the deferred cross calls made by the current processor and interrupts their targets.
+
+    Arguments:
+
+        None.
+
+    Return Values:
+
+        None.
+
+--*/
+
+{
+    bool Enabled = MeDisableInterrupts();
+    uint32_t Self = MeGetCurrentProcessorNumber();
+
+    MhpInterruptProcessors(MhpPushDeferredCalls(Self), Self);
+
+    MeEnableInterrupts(Enabled);
+}
+
+void
+MhCrossCall(
+    IN PROCESSOR_MASK Targets,
+    IN PCROSS_CALL_ROUTINE Routine,
+    IN void* Context,
+    IN uint32_t Flags
+)
+
+/*++
+
+    Routine description:
+
+        Runs a routine on a set of processors.
+
+    Arguments:
+
+        [IN]    PROCESSOR_MASK Targets - Processors to run it on, offline ones are skipped.
+        [IN]    PCROSS_CALL_ROUTINE Routine - Runs at IPI_LEVEL with interrupts disabled.
+        [IN]    void* Context - Passed to the routine, must stay valid until every target ran it.
+        [IN]    uint32_t Flags - CROSS_CALL_ASYNCHRONOUS, CROSS_CALL_DEFERRED, or 0 to wait for every target.
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        If the current processor is in Targets, the routine runs here too (last, with interrupts disabled).
+        Calls from one sender to one target run in order.
+
+--*/
+
+{
+    IRQL OldIrql = PASSIVE_LEVEL;
+    bool Raised = false;
+
+    // Stay on this processor, the slots are per sender.
+    if (MeGetCurrentIrql() < DISPATCH_LEVEL) {
+        MeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+        Raised = true;
+    }
+
+    uint32_t Self = MeGetCurrentProcessorNumber();
+    bool RunHere = (Targets & (1ULL << Self)) != 0;
+    PROCESSOR_MASK Remote = Targets & MhGetOnlineProcessorMask() & ~(1ULL << Self);
+    PROCESSOR_MASK Kick = 0;
+
+    if (Flags & CROSS_CALL_DEFERRED) Flags |= CROSS_CALL_ASYNCHRONOUS;
+
+    // Disabled until the IPIs are sent, see the comment at the top.
+    bool Enabled = MeDisableInterrupts();
+
+    for (PROCESSOR_MASK Pending = Remote; Pending; Pending &= Pending - 1) {
+        uint32_t i = (uint32_t)__builtin_ctzll(Pending);
+        PCROSS_CALL_SLOT Slot = &MhpCrossCallSlots[Self][i];
+
+        // Claim the slot, its previous call may still be queued (or deferred, then it must be queued now).
+        while (InterlockedCompareExchangeU64(&Slot->Busy, 1, 0) != 0) {
+            // Interrupts open while we wait, everything queued so far gets its IPI first.
+            if (MhpDeferredTargets[Self] & (1ULL << i)) Kick |= MhpPushDeferredCalls(Self);
+            MhpInterruptProcessors(Kick, Self);
+            Kick = 0;
+            MhpSpinAndProcessIpis();
+        }
+
+        Slot->Routine = Routine;
+        Slot->Context = Context;
+        MeIncrementCounter(PerfCounterCrossCallsQueued);
+
+        if (Flags & CROSS_CALL_DEFERRED) {
+            // Kept by this sender until it flushes.
+            MhpDeferredTargets[Self] |= 1ULL << i;
+        }
+        else if (MhpPushCrossCall(&cpus[i], Slot)) {
+            Kick |= 1ULL << i;
+        }
+    }
+
+    // Deliver everything (earlier deferred calls ride along), a single IPI per target.
+    if (!(Flags & CROSS_CALL_DEFERRED)) Kick |= MhpPushDeferredCalls(Self);
+    MhpInterruptProcessors(Kick, Self);
+
+    if (RunHere) Routine(Context);
+
+    MeEnableInterrupts(Enabled);
+
+    if (!(Flags & CROSS_CALL_ASYNCHRONOUS)) {
+        for (PROCESSOR_MASK Pending = Remote; Pending; Pending &= Pending - 1) {
+            uint32_t i = (uint32_t)__builtin_ctzll(Pending);
+
+            // Wait for completion while still processing incoming IPIs
+            while (__atomic_load_n(&MhpCrossCallSlots[Self][i].Busy, __ATOMIC_ACQUIRE)) {
+                MhpSpinAndProcessIpis();
+            }
+        }
+    }
+
+    if (Raised) MeLowerIrql(OldIrql);
+}
+
+void
+MhRetireCrossCalls(
+    void
+)
+
+/*++
+
+    Routine description:
+
+        Runs the cross calls queued to the current processor.
+
+    Arguments:
+
+        None.
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        Called by the IPI handler at IPI_LEVEL.
+
+--*/
+
+{
+    PPROCESSOR Cpu = MeGetCurrentProcessor();
+
+    for (;;) {
+        PSINGLE_LINKED_LIST List = __atomic_exchange_n(&Cpu->CrossCallQueue, NULL, __ATOMIC_ACQUIRE);
+        if (!List) break;
+
+        // The queue is LIFO, run in the order they were queued.
+        PSINGLE_LINKED_LIST Ordered = NULL;
+        while (List) {
+            PSINGLE_LINKED_LIST Next = List->Next;
+            List->Next = Ordered;
+            Ordered = List;
+            List = Next;
+        }
+
+        while (Ordered) {
+            PCROSS_CALL_SLOT Slot = (PCROSS_CALL_SLOT)Ordered;
+            PCROSS_CALL_ROUTINE Routine = Slot->Routine;
+            void* Context = Slot->Context;
+
+            // The sender may reuse the slot as soon as it isn't busy.
+            Ordered = Ordered->Next;
+            Routine(Context);
+            __atomic_store_n(&Slot->Busy, 0, __ATOMIC_RELEASE);
+        }
+    }
+}
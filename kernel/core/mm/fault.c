@@ -23,6 +23,91 @@ Revision History:
 #include "../../includes/mg.h"
 #include "../../assert.h"
 #include "../../includes/fs.h"
+#include "../../includes/md.h"
+
+static
+bool
+MiResolveLargePageFault(
+    IN  uint64_t FaultBits,
+    IN  uint64_t VirtualAddress,
+    OUT MTSTATUS* Status
+)
+
+/*++
+
+    Routine description:
+
+        Handles a user mode address fault with a 2 MiB page, if the region has (or can have) one.
+
+    Arguments:
+
+        [IN]    FaultBits - The error code pushed by the CPU.
+        [IN]    VirtualAddress - The Memory Address Referenced (CR2), in user range.
+        [OUT]   Status - The fault status, when handled.
+
+    Return Values:
+
+        True if the fault was handled here, false to handle it with 4 KiB pages.
+
+    Notes:
+
+        A region gets a large page on its first fault, when the 2 MiB around the address lie in a writable anonymous VAD
+        and nothing is mapped there yet. If the large page pool is empty the region is mapped 4 KiB at a time, as before.
+
+--*/
+
+{
+    PMMPTE Pde = MiGetLargePdePointer(VirtualAddress);
+    if (!Pde) return false;
+
+    uint64_t OldPde = Pde->Value;
+    if (OldPde & PAGE_PRESENT) {
+        if (!(OldPde & PAGE_PS)) return false;
+
+        // The page was present when the processor faulted (bit 0), so the access isn't allowed (write, execute, SMAP).
+        // Otherwise another thread mapped it after our access missed, just retry.
+        *Status = (FaultBits & 1) ? MT_ACCESS_VIOLATION : MT_SUCCESS;
+        return true;
+    }
+
+    uintptr_t Base = VirtualAddress & ~(MI_LARGE_PAGE_SIZE - 1);
+    bool Eligible = false;
+    bool Executable = false;
+
+    EPOCH_SECTION Section;
+    MsEnterEpoch(&Section);
+    PMMVAD Vad = MiFindVad(PsGetCurrentProcess(), VirtualAddress);
+    if (Vad) {
+        Eligible = (Vad->Flags & VAD_FLAG_WRITE) &&
+            !(Vad->Flags & (VAD_FLAG_RESERVED | VAD_FLAG_GUARD_PAGE | VAD_FLAG_SHARED_USER_DATA | VAD_FLAG_MAPPED_FILE | VAD_FLAG_COPY_ON_WRITE)) &&
+            !Vad->File && !Vad->Image &&
+            Vad->StartVa <= Base && Base + MI_LARGE_PAGE_SIZE - 1 <= Vad->EndVa;
+        Executable = (Vad->Flags & VAD_FLAG_EXECUTE) != 0;
+    }
+    MsLeaveEpoch(&Section);
+
+    if (!Eligible) return false;
+
+    PAGE_INDEX Pfn = MiRequestLargePage();
+    if (Pfn == PFN_ERROR) {
+        MeIncrementCounter(PerfCounterLargePageFallbacks);
+        return false;
+    }
+
+    // The entry wasn't present, so there is nothing to invalidate.
+    uint64_t NewPde = PFN_TO_PHYS(Pfn) | PAGE_PRESENT | PAGE_RW | PAGE_USER | PAGE_PS | (Executable ? 0 : PAGE_NX);
+    if (InterlockedCompareExchangeU64(&Pde->Value, NewPde, OldPde) != OldPde) {
+        // Another thread mapped the region first, retry the access against its mapping.
+        MiReleaseLargePage(Pfn);
+        *Status = MT_SUCCESS;
+        return true;
+    }
+
+    INDEX_TO_PPFN(Pfn)->Descriptor.Mapping.PteAddress = Pde;
+    MeIncrementCounter(PerfCounterFaultLargePage);
+    *Status = MT_SUCCESS;
+    return true;
+}
 
 MTSTATUS
 MmAccessFault(
@@ -67,6 +152,15 @@ MmAccessFault(
 
 {
     // Declarations
+    FAULT_OPERATION OperationDone = MiRetrieveOperationFromErrorCode(FaultBits);
+    IRQL PreviousIrql = MeGetCurrentIrql();
+
+    // User 2 MiB pages come first, looking up the 4 KiB PTE below allocates a page table in the region (or splits its large page).
+    if (VirtualAddress <= MmHighestUserAddress && PreviousIrql < DISPATCH_LEVEL && MmLargePagesEnabled) {
+        MTSTATUS LargePageStatus;
+        if (MiResolveLargePageFault(FaultBits, VirtualAddress, &LargePageStatus)) return LargePageStatus;
+    }
+
 #ifdef DEBUG
     // These are used when I'm debugging.
     PMMPTE ReferencedPml4e = MiGetPml4ePointer(VirtualAddress);
@@ -75,11 +169,9 @@ MmAccessFault(
     UNREFERENCED_PARAMETER(ReferencedPml4e); UNREFERENCED_PARAMETER(ReferencedPdpte); UNREFERENCED_PARAMETER(ReferencedPde);
 #endif
     PMMPTE ReferencedPte = MiGetPtePointer(VirtualAddress);
-    FAULT_OPERATION OperationDone = MiRetrieveOperationFromErrorCode(FaultBits);
-    IRQL PreviousIrql = MeGetCurrentIrql();
 
 #ifdef DEBUG
-    gop_printf(COLOR_RED, "Inside MmAccessFault | FaultBits: %llx | VirtualAddress: %p | PreviousMode: %d | TrapFrame->rip: %p | Operation: %d | Irql: %d\n", (unsigned long long)FaultBits, (void*)(uintptr_t)VirtualAddress, PreviousMode, (void*)(uintptr_t)TrapFrame->rip, OperationDone, PreviousIrql);
+    MdLog(LogLevelTrace, COLOR_RED, "Inside MmAccessFault | FaultBits: %llx | VirtualAddress: %p | PreviousMode: %d | TrapFrame->rip: %p | Operation: %d | Irql: %d\n", (unsigned long long)FaultBits, (void*)(uintptr_t)VirtualAddress, PreviousMode, (void*)(uintptr_t)TrapFrame->rip, OperationDone, PreviousIrql);
 #endif
 
     if (!ReferencedPte) {
@@ -167,6 +259,7 @@ MmAccessFault(
                 MiAtomicExchangePte(ReferencedPte, NewPte.Value);
                 MiInvalidateTlbForVa((void*)VirtualAddress);
             }
+            MeIncrementCounter(PerfCounterFaultDirtyUpdates);
             return MT_SUCCESS;
         }
         
@@ -208,6 +301,7 @@ MmAccessFault(
             // Write the PTE.
             MI_WRITE_PTE(ReferencedPte, VirtualAddress, PPFN_TO_PHYSICAL_ADDRESS(INDEX_TO_PPFN(pfn)), ProtectionFlags);
 
+            MeIncrementCounter(PerfCounterFaultDemandZero);
             return MT_SUCCESS;
         }
 
@@ -218,14 +312,14 @@ MmAccessFault(
             if (!MiIsValidPfn(pfn)) goto BugCheck;
 
             // Acquire Standby PFN DB List lock. (acquiring spinlock is okay, IRQL detection was checked above)
-            IRQL oldIrql;
-            MsAcquireSpinlock(&PfnDatabase.StandbyPageList.PfnListLock, &oldIrql);
+            LOCK_QUEUE_HANDLE LockHandle;
+            MsAcquireInStackQueuedSpinlock(&PfnDatabase.StandbyPageList.PfnListLock, &LockHandle);
 
             // Check the PFN, it has to be in the StandBy list and be equal to our PTE, if not, bugcheck.
             PPFN_ENTRY PPfn = INDEX_TO_PPFN(pfn);
             if (PPfn->State != PfnStateStandby || PPfn->Descriptor.Mapping.PteAddress == NULL || PPfn->Descriptor.Mapping.PteAddress != ReferencedPte) {
                 // Release spinlock.
-                MsReleaseSpinlock(&PfnDatabase.StandbyPageList.PfnListLock, oldIrql);
+                MsReleaseInStackQueuedSpinlock(&LockHandle);
                 goto BugCheck;
             }
             // PFN Is matching to this pte, now we can set the PTE.
@@ -241,9 +335,10 @@ MmAccessFault(
             MI_WRITE_PTE(ReferencedPte, VirtualAddress, PFN_TO_PHYS(pfn), ProtectionFlags);
 
             // Release PFN Standby list lock.
-            MsReleaseSpinlock(&PfnDatabase.StandbyPageList.PfnListLock, oldIrql);
+            MsReleaseInStackQueuedSpinlock(&LockHandle);
 
             // Return success.
+            MeIncrementCounter(PerfCounterFaultTransition);
             return MT_SUCCESS;
         }
 
@@ -276,26 +371,47 @@ MmAccessFault(
         }
 
         // Fault on a user address, we check if there is a vad for it, if so, allocate the page.
-        PMMVAD vad = MiFindVad(PsGetCurrentProcess(), VirtualAddress);
-        if (!vad) return MT_ACCESS_VIOLATION; // If kernel mode exception dispatcher should catch.
-
-        // Check if we are allowed to allocate.
-        if (vad->Flags & VAD_FLAG_RESERVED) {
-            // Check if this is a guard page.
-            if (vad->Flags & VAD_FLAG_GUARD_PAGE) {
+        // The lookup is lock-free, the VAD may be freed once we leave the epoch section, so we work on a copy of it.
+        EPOCH_SECTION Section;
+        MMVAD VadSnapshot;
+        MsEnterEpoch(&Section);
+
+        PMMVAD FoundVad = MiFindVad(PsGetCurrentProcess(), VirtualAddress);
+        if (FoundVad) {
+            // Guard pages turn into normal pages on first touch.
+            if ((FoundVad->Flags & VAD_FLAG_RESERVED) && (FoundVad->Flags & VAD_FLAG_GUARD_PAGE)) {
                 // Raise an guard page violation status and allocate the page.
                 //ExpRaiseStatus() TODO
-                vad->Flags = VAD_FLAG_WRITE | VAD_FLAG_READ;
+                FoundVad->Flags = VAD_FLAG_WRITE | VAD_FLAG_READ;
             }
+            VadSnapshot = *FoundVad;
+        }
 
-            else {
-                // Allocation is forbidden, return access violation.
-                return MT_ACCESS_VIOLATION;
-            }
+        MsLeaveEpoch(&Section);
+        if (!FoundVad) return MT_ACCESS_VIOLATION; // If kernel mode exception dispatcher should catch.
+        PMMVAD vad = &VadSnapshot;
+
+        // Check if we are allowed to allocate.
+        if (vad->Flags & VAD_FLAG_RESERVED) {
+            // Allocation is forbidden, return access violation.
+            return MT_ACCESS_VIOLATION;
         }
 
         MMPTE TempPte = *ReferencedPte;
 
+        // The shared user data page, every process maps the frame the kernel updates (read only, see systime.c).
+        if (vad->Flags & VAD_FLAG_SHARED_USER_DATA) {
+            if (OperationDone != ReadOperation || MiSharedUserDataPfn == PFN_ERROR) return MT_ACCESS_VIOLATION;
+
+            // Another thread of the process may have mapped it already.
+            if (TempPte.Hard.Present) return MT_SUCCESS;
+
+            // The process mapping holds a reference, released with the address space.
+            InterlockedIncrementU32(&INDEX_TO_PPFN(MiSharedUserDataPfn)->RefCount);
+            MI_WRITE_PTE(ReferencedPte, VirtualAddress, PFN_TO_PHYS(MiSharedUserDataPfn), PAGE_PRESENT | PAGE_USER | PAGE_NX);
+            return MT_SUCCESS;
+        }
+
         // Now check for transition PTE (after checking reserved vad flag)
         // PTE Isn't present, and its a transition (USER MODE PATH) (ACCESS VIOLATION RETURN)
         // If the previous mode is kernel mode and an access violation is returned, KMODE_EXCEPTION_NOT_HANDLED bugcheck comes
@@ -306,14 +422,14 @@ MmAccessFault(
             if (!MiIsValidPfn(pfn)) return MT_ACCESS_VIOLATION;
 
             // Acquire Standby PFN DB List lock. (acquiring spinlock is okay, IRQL detection was checked above)
-            IRQL oldIrql;
-            MsAcquireSpinlock(&PfnDatabase.StandbyPageList.PfnListLock, &oldIrql);
+            LOCK_QUEUE_HANDLE LockHandle;
+            MsAcquireInStackQueuedSpinlock(&PfnDatabase.StandbyPageList.PfnListLock, &LockHandle);
 
             // Check the PFN, it has to be in the StandBy list and be equal to our PTE, if not, bugcheck.
             PPFN_ENTRY PPfn = INDEX_TO_PPFN(pfn);
             if (PPfn->State != PfnStateStandby || PPfn->Descriptor.Mapping.PteAddress == NULL || PPfn->Descriptor.Mapping.PteAddress != ReferencedPte) {
                 // Release spinlock.
-                MsReleaseSpinlock(&PfnDatabase.StandbyPageList.PfnListLock, oldIrql);
+                MsReleaseInStackQueuedSpinlock(&LockHandle);
                 return MT_ACCESS_VIOLATION;
             }
 
@@ -338,9 +454,10 @@ MmAccessFault(
             MI_WRITE_PTE(ReferencedPte, VirtualAddress, PFN_TO_PHYS(pfn), ProtectionFlags);
 
             // Release PFN Standby list lock.
-            MsReleaseSpinlock(&PfnDatabase.StandbyPageList.PfnListLock, oldIrql);
+            MsReleaseInStackQueuedSpinlock(&LockHandle);
 
             // Return success.
+            MeIncrementCounter(PerfCounterFaultTransition);
             return MT_SUCCESS;
         }
 
@@ -372,9 +489,35 @@ MmAccessFault(
         // Acquire the PTE for the faulty VA.
         PMMPTE pte = MiGetPtePointer(VirtualAddress);
 
+        // Mapped images are copied from the image cache, no file system read (the page is already zeroed past the file).
+        if (vad->Image) {
+            uint64_t ActualFileOffset = vad->FileOffset + ((uint64_t)PAGE_ALIGN(VirtualAddress) - (uint64_t)vad->StartVa);
+            bool Copied = false;
+
+            // The image lives as long as its VAD, which may be gone since we left the epoch section, look it up again.
+            MsEnterEpoch(&Section);
+            PMMVAD ImageVad = MiFindVad(PsGetCurrentProcess(), VirtualAddress);
+            if (ImageVad == FoundVad && ImageVad->ImageContents == vad->ImageContents) {
+                uint64_t FileLength = ImageVad->Image->FileSize;
+
+                IRQL oldIrql;
+                void* AddressToOperate = MiMapPageInHyperspace(pfn, &oldIrql);
+                if (ActualFileOffset < FileLength) {
+                    kmemcpy(AddressToOperate, ImageVad->ImageContents + ActualFileOffset, (size_t)MIN((uint64_t)VirtualPageSize, FileLength - ActualFileOffset));
+                }
+                MiUnmapHyperSpaceMap(AddressToOperate, oldIrql);
+                Copied = true;
+            }
+            MsLeaveEpoch(&Section);
+
+            if (!Copied) {
+                MiReleasePhysicalPage(pfn);
+                return MT_ACCESS_VIOLATION;
+            }
+        }
         // Now we check if the VAD has any file attached to it, if it does, we copy the contents of the file to the RAM
         // This could be a process file (executable, dll), or even our pagefile.
-        if (vad->File) {
+        else if (vad->File) {
             // Calculate file offset to load into VAD.
             uint64_t AlignedAddress = (uint64_t)PAGE_ALIGN(VirtualAddress);
             uint64_t PageOffsetWithinVad = AlignedAddress - (uint64_t)vad->StartVa;
@@ -419,14 +562,15 @@ MmAccessFault(
             // As well as performed the read operation in PASSIVE_LEVEL (or APC)
             IRQL oldIrql;
             void* AddressToOperate = MiMapPageInHyperspace(pfn, &oldIrql);
-            kmemcpy(AddressToOperate, Tmp, VirtualPageSize);
-            MiUnmapHyperSpaceMap(oldIrql);
+            MiCopyPage(AddressToOperate, Tmp);
+            MiUnmapHyperSpaceMap(AddressToOperate, oldIrql);
         }
 
         // Write the PTE.
         MI_WRITE_PTE(pte, VirtualAddress, PFN_TO_PHYS(pfn), PteFlags);
 
         // Return success.
+        MeIncrementCounter(vad->File ? PerfCounterFaultFileBacked : PerfCounterFaultDemandZero);
         return MT_SUCCESS;
     }
 
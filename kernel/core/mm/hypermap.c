@@ -6,7 +6,7 @@ Module Name:
 
 Purpose:
 
-    This translation unit contains the implementation of the temporary mapping functions. (hyperspace)/s
+    This translation unit contains the implementation of the temporary mapping functions. (direct map, hyperspace)/s
 
 Author:
 
@@ -18,20 +18,301 @@ Revision History:
 
 #include "../../includes/mm.h"
 #include "../../includes/mh.h"
+#include "../../includes/me.h"
 #include "../../assert.h"
 
-// The physical memory offset itself is the hypermap virtual address. This is ruled by not touching the 0x0 - 0x1000 physical addresses AT ALL (you may touch the physical addresses, but not map them with the PhysicalMemoryOffset virtual arithemtic.)
+//
+// Usable RAM is mapped once at boot into the direct map (MI_DIRECT_MAP_BASE + physical address), with 1 GiB and 2 MiB pages where possible,
+// so a temporary mapping is pointer arithmetic, no lock, no IRQL raise, no invlpg.
+// Frames outside of it (or any frame before MiInitializeDirectMap) go through the hyperspace, a single PTE per processor used at DISPATCH_LEVEL.
+//
+
+// The physical memory offset itself is the boot hypermap virtual address (processor 0's slot). This is ruled by not touching the 0x0 - 0x1000 physical addresses AT ALL (you may touch the physical addresses, but not map them with the PhysicalMemoryOffset virtual arithemtic.)
 #define HYPERMAP_VIRTUAL_ADDRESS PhysicalMemoryOffset
 
-SPINLOCK HyperLock;
-PPFN_ENTRY g_pfnInUse;
+// The UEFI memory map is coalesced into at most this many ranges, RAM beyond them stays hyperspace only.
+#define MI_DIRECT_MAP_MAX_RANGES 64
+
+#define CPUID_80000001_EDX_PAGE1GB (1U << 26)
+
+typedef struct _MI_DIRECT_MAP_RANGE {
+    PAGE_INDEX StartPfn;
+    PAGE_INDEX EndPfn;      // Exclusive
+} MI_DIRECT_MAP_RANGE, *PMI_DIRECT_MAP_RANGE;
+
+// Sorted, disjoint and non adjacent (adjacent ranges are merged).
+static MI_DIRECT_MAP_RANGE MiDirectMapRanges[MI_DIRECT_MAP_MAX_RANGES];
+static uint32_t MiDirectMapRangeCount;
+static volatile bool MiDirectMapActive;
+
+// Hyperspace, every processor maps into its own slot, raised to DISPATCH_LEVEL, so a slot is never shared.
+static PMMPTE HyperspacePte[MAX_CPUS];
+static PPFN_ENTRY HyperspacePfnInUse[MAX_CPUS];
+
+FORCEINLINE
+uintptr_t
+MiGetHyperspaceSlot(
+    IN uint32_t Processor
+)
+
+{
+    if (Processor == 0) return HYPERMAP_VIRTUAL_ADDRESS;
+    return MI_HYPERSPACE_BASE + (uintptr_t)Processor * VirtualPageSize;
+}
+
+static
+bool
+MiIsDirectMapMemoryType(
+    IN uint32_t Type
+)
+
+{
+    // RAM the kernel may hand out or read, firmware runtime regions and MMIO are left alone.
+    switch (Type) {
+    case EfiConventionalMemory:
+    case EfiLoaderCode:
+    case EfiLoaderData:
+    case EfiBootServicesCode:
+    case EfiBootServicesData:
+    case EfiACPIReclaimMemory:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static
+void
+MiAddDirectMapRange(
+    IN PAGE_INDEX StartPfn,
+    IN PAGE_INDEX EndPfn
+)
+
+/*++
+
+    Routine description:
+
+        Inserts a range of frames into the sorted direct map range list, merging it with the ranges it touches.
+
+    Arguments:
+
+        [IN]    PAGE_INDEX StartPfn - First frame.
+        [IN]    PAGE_INDEX EndPfn - Frame after the last one.
+
+    Return Values:
+
+        None, the range is dropped if the list is full.
+
+--*/
+
+{
+    uint32_t i = 0;
+
+    if (StartPfn >= EndPfn) return;
+
+    // Find the first range that ends at or after our start.
+    while (i < MiDirectMapRangeCount && MiDirectMapRanges[i].EndPfn < StartPfn) i++;
+
+    if (i < MiDirectMapRangeCount && MiDirectMapRanges[i].StartPfn <= EndPfn) {
+        // Overlapping or adjacent, grow it, then swallow the ranges it now reaches.
+        PMI_DIRECT_MAP_RANGE Range = &MiDirectMapRanges[i];
+        if (StartPfn < Range->StartPfn) Range->StartPfn = StartPfn;
+        if (EndPfn > Range->EndPfn) Range->EndPfn = EndPfn;
+
+        uint32_t Next = i + 1;
+        while (Next < MiDirectMapRangeCount && MiDirectMapRanges[Next].StartPfn <= Range->EndPfn) {
+            if (MiDirectMapRanges[Next].EndPfn > Range->EndPfn) Range->EndPfn = MiDirectMapRanges[Next].EndPfn;
+            Next++;
+        }
+
+        uint32_t Removed = Next - (i + 1);
+        for (uint32_t j = i + 1; j + Removed < MiDirectMapRangeCount; j++) {
+            MiDirectMapRanges[j] = MiDirectMapRanges[j + Removed];
+        }
+        MiDirectMapRangeCount -= Removed;
+        return;
+    }
+
+    if (MiDirectMapRangeCount == MI_DIRECT_MAP_MAX_RANGES) return;
+
+    for (uint32_t j = MiDirectMapRangeCount; j > i; j--) {
+        MiDirectMapRanges[j] = MiDirectMapRanges[j - 1];
+    }
+
+    MiDirectMapRanges[i].StartPfn = StartPfn;
+    MiDirectMapRanges[i].EndPfn = EndPfn;
+    MiDirectMapRangeCount++;
+}
+
+static
+bool
+MiIsPfnDirectMapped(
+    IN PAGE_INDEX Pfn
+)
+
+{
+    uint32_t Low = 0;
+    uint32_t High = MiDirectMapRangeCount;
+
+    if (!MiDirectMapActive) return false;
+
+    // Binary search over the sorted ranges.
+    while (Low < High) {
+        uint32_t Middle = (Low + High) / 2;
+        PMI_DIRECT_MAP_RANGE Range = &MiDirectMapRanges[Middle];
+
+        if (Pfn < Range->StartPfn) High = Middle;
+        else if (Pfn >= Range->EndPfn) Low = Middle + 1;
+        else return true;
+    }
+
+    return false;
+}
+
+static
+MTSTATUS
+MiMapDirectRange(
+    IN uint64_t PhysicalStart,
+    IN uint64_t PhysicalEnd,
+    IN bool HugePages
+)
+
+{
+    const uint64_t Flags = PAGE_PRESENT | PAGE_RW | PAGE_NX;
+    uint64_t Physical = PhysicalStart;
+
+    while (Physical < PhysicalEnd) {
+        uintptr_t va = MI_DIRECT_MAP_BASE + Physical;
+        uint64_t Remaining = PhysicalEnd - Physical;
+        MTSTATUS Status;
+
+        // Use the largest page that is aligned and fully inside the range (a large page never covers a hole in the memory map).
+        if (HugePages && (Physical & (MI_HUGE_PAGE_SIZE - 1)) == 0 && Remaining >= MI_HUGE_PAGE_SIZE) {
+            Status = MiMapKernelLargePage(va, Physical, MI_HUGE_PAGE_SIZE, Flags);
+            Physical += MI_HUGE_PAGE_SIZE;
+        }
+        else if ((Physical & (MI_LARGE_PAGE_SIZE - 1)) == 0 && Remaining >= MI_LARGE_PAGE_SIZE) {
+            Status = MiMapKernelLargePage(va, Physical, MI_LARGE_PAGE_SIZE, Flags);
+            Physical += MI_LARGE_PAGE_SIZE;
+        }
+        else {
+            PMMPTE pte = MiGetPtePointer(va);
+            if (!pte) return MT_NO_RESOURCES;
+
+            // Not MI_WRITE_PTE, the frame's PFN entry must not be claimed by the window.
+            MiAtomicExchangePte(pte, Physical | Flags);
+            Status = MT_SUCCESS;
+            Physical += VirtualPageSize;
+        }
+
+        if (MT_FAILURE(Status)) return Status;
+    }
+
+    return MT_SUCCESS;
+}
+
+void
+MiInitializeHyperspace(
+    void
+)
+
+/*++
+
+    Routine description:
+
+        Creates the page tables of every processor's hyperspace slot.
+
+    Arguments:
+
+        None.
+
+    Return Values:
+
+        None, bugchecks if a page table couldn't be allocated.
 
-#ifdef PERFORMANCE_ANALYTICS
-uint64_t g_HypermappingsDone;
-#endif
+    Notes:
 
-#define LOCK_HYPERSPACE(PtrOldIrql) MsAcquireSpinlock(&HyperLock, PtrOldIrql)
-#define UNLOCK_HYPERSPACE(OldIrql) MsReleaseSpinlock(&HyperLock, OldIrql)
+        Called by the BSP after the PFN database is initialized, before any process is created (the slots are copied into every address space) and before the APs start.
+        Processor 0 uses the boot slot, which the bootloader already has page tables for.
+
+--*/
+
+{
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        HyperspacePte[i] = MiGetPtePointer(MiGetHyperspaceSlot(i));
+        if (!HyperspacePte[i]) {
+            MeBugCheckEx(
+                HYPERSPACE_INIT_FAILURE,
+                (void*)(uintptr_t)i,
+                NULL,
+                NULL,
+                NULL
+            );
+        }
+    }
+}
+
+MTSTATUS
+MiInitializeDirectMap(
+    IN PBOOT_INFO BootInfo
+)
+
+/*++
+
+    Routine description:
+
+        Maps all usable RAM described by the UEFI memory map at MI_DIRECT_MAP_BASE, with 1 GiB pages when the processor supports them, 2 MiB pages, and 4 KiB pages at the edges.
+
+    Arguments:
+
+        [IN]    PBOOT_INFO BootInfo - The boot information supplied by the UEFI Bootloader.
+
+    Return Values:
+
+        MT_SUCCESS, or MT_NO_RESOURCES if the page tables couldn't be allocated (the hyperspace stays in use for everything then).
+
+    Notes:
+
+        Called by the BSP after MiInitializeHyperspace, before any process is created.
+        Mapped write back, non executable, the MTRRs still govern whatever the firmware set differently.
+
+--*/
+
+{
+    PEFI_MEMORY_DESCRIPTOR desc = BootInfo->MemoryMap;
+    size_t entryCount = BootInfo->MapSize / BootInfo->DescriptorSize;
+    const PAGE_INDEX MaxPfn = MI_DIRECT_MAP_SIZE / PhysicalFrameSize;
+    unsigned int eax, ebx, ecx, edx;
+
+    // The memory map isn't sorted, and neighbouring descriptors of different types are often contiguous, sort and merge first.
+    for (size_t i = 0; i < entryCount; i++) {
+        if (MiIsDirectMapMemoryType(desc->Type)) {
+            PAGE_INDEX StartPfn = desc->PhysicalStart / PhysicalFrameSize;
+            PAGE_INDEX EndPfn = StartPfn + desc->NumberOfPages;
+            if (EndPfn > MaxPfn) EndPfn = MaxPfn;
+            MiAddDirectMapRange(StartPfn, EndPfn);
+        }
+
+        desc = (PEFI_MEMORY_DESCRIPTOR)((uint8_t*)desc + BootInfo->DescriptorSize);
+    }
+
+    bool HugePages = false;
+    __cpuid(0x80000000, eax, ebx, ecx, edx);
+    if (eax >= 0x80000001) {
+        __cpuid(0x80000001, eax, ebx, ecx, edx);
+        HugePages = (edx & CPUID_80000001_EDX_PAGE1GB) != 0;
+    }
+
+    for (uint32_t i = 0; i < MiDirectMapRangeCount; i++) {
+        MTSTATUS Status = MiMapDirectRange(MiDirectMapRanges[i].StartPfn * PhysicalFrameSize, MiDirectMapRanges[i].EndPfn * PhysicalFrameSize, HugePages);
+        if (MT_FAILURE(Status)) return Status;
+    }
+
+    // Publish, the ranges are immutable from now on.
+    MmFullBarrier();
+    MiDirectMapActive = true;
+    return MT_SUCCESS;
+}
 
 void*
 MiMapPageInHyperspace(
@@ -43,13 +324,13 @@ MiMapPageInHyperspace(
 
     Routine description:
 
-        Temporary maps the specified PFN Page into hyperspace and returns the virtual address mapped into.
+        Temporary maps the specified PFN Page and returns the virtual address mapped into.
 
-            ************************************
-            *                                  *
-            * Returns with a spin lock held!!! * // thanks lou
-            *                                  *
-            ************************************
+            ******************************************************
+            *                                                    *
+            * May return at DISPATCH_LEVEL (hyperspace fallback) * // thanks lou
+            *                                                    *
+            ******************************************************
 
 
     Arguments:
@@ -61,38 +342,63 @@ MiMapPageInHyperspace(
 
         Valid Pointer to mapped region.
 
+    Notes:
+
+        Frames in the direct map are returned as is (lock free, the IRQL is unchanged).
+        Other frames are mapped in the current processor's hyperspace slot at DISPATCH_LEVEL, so one mapping at a time per processor,
+        callable at IRQL <= DISPATCH_LEVEL.
+
 --*/
 
 {
-    // First, lock the hyperspace.
-    LOCK_HYPERSPACE (OldIrql);
+    PPFN_ENTRY pfn = INDEX_TO_PPFN (PfnIndex);
+
+    if (MiIsPfnDirectMapped(PfnIndex)) {
+        *OldIrql = MeGetCurrentIrql();
+
+        // Same PFN metadata as a hyperspace mapping, there is just no PTE behind it.
+        pfn->State = PfnStateActive;
+        pfn->Descriptor.Mapping.PteAddress = NULL;
+        pfn->Descriptor.Mapping.Vad = NULL;
+
+        MeIncrementCounter(PerfCounterDirectMappings);
+
+        return (void*)(MI_DIRECT_MAP_BASE + PfnIndex * PhysicalFrameSize);
+    }
+
+    // Stay on this processor, and keep its DPCs (the only other users of the slot) away.
+    MeRaiseIrql(DISPATCH_LEVEL, OldIrql);
+
+    uint32_t Processor = MeGetCurrentProcessorNumber();
+    assert((HyperspacePfnInUse[Processor]) == NULL, "Nested hyperspace mapping");
+
+    uintptr_t Slot = MiGetHyperspaceSlot(Processor);
+    PMMPTE pte = HyperspacePte[Processor];
+    if (!pte) {
+        // Before MiInitializeHyperspace (processor 0, the boot slot's tables exist).
+        pte = MiGetPtePointer(Slot);
+    }
 
     // Map the PFN into the page.
-    // We do not send an IPI, as we are in a spinlock.
-    // Besides, an IPI does not need to be used here, as the hyperspace is a one CPU exclusive object, 2 cpus cannot use it at the same time
-    // so their TLBs do not need to be updated for this VA.
-    PPFN_ENTRY pfn = INDEX_TO_PPFN (PfnIndex);
+    // We do not send an IPI, the slot is only ever used by this processor, so no other TLB holds it.
     uint64_t physAddr = PPFN_TO_PHYSICAL_ADDRESS (pfn);
-    PMMPTE pte = MiGetPtePointer(HYPERMAP_VIRTUAL_ADDRESS);
-    MI_WRITE_PTE_NO_IPI(pte, HYPERMAP_VIRTUAL_ADDRESS, physAddr, PAGE_PRESENT | PAGE_RW);
+    MI_WRITE_PTE_NO_IPI(pte, Slot, physAddr, PAGE_PRESENT | PAGE_RW);
 
     // Set PFN metadata.
     pfn->State = PfnStateActive;
     pfn->Descriptor.Mapping.PteAddress = pte;
     pfn->Descriptor.Mapping.Vad = NULL;
-    g_pfnInUse = pfn;
+    HyperspacePfnInUse[Processor] = pfn;
 
-#ifdef PERFORMANCE_ANALYTICS
-    // No need for atomic increment, we are under spinlock.
-    g_HypermappingsDone++;
-#endif
+    MeIncrementCounter(PerfCounterHyperspaceMappings);
 
     // Return the virtual address (now mapped)
-    return (void*)HYPERMAP_VIRTUAL_ADDRESS;
+    return (void*)Slot;
 }
 
 void
 MiUnmapHyperSpaceMap(
+    IN  void* MappedAddress,
     IN  IRQL OldIrql
 )
 
@@ -100,10 +406,11 @@ MiUnmapHyperSpaceMap(
 
     Routine description:
 
-        Unlocks the hyperspace, clears previous mapping.
+        Ends a temporary mapping, clears the hyperspace slot if one was used.
 
     Arguments:
 
+        [IN]    void* MappedAddress - The address returned by MiMapPageInHyperspace.
         [IN]    OldIrql - Entry IRQL given by MiMapPageInHyperspace
 
     Return Values:
@@ -117,23 +424,39 @@ MiUnmapHyperSpaceMap(
 --*/
 
 {
-    // Assertion that the hyperspace lock must be locked already (double unlock catch)
-    assert((HyperLock.locked) == 1, "Double hypermap unlock");
-    assert((g_pfnInUse) != 0, "No PFN when releasing hyperspace.");
-    PPFN_ENTRY pfn = g_pfnInUse;
+    uintptr_t Address = (uintptr_t)MappedAddress;
+    PPFN_ENTRY pfn;
+
+    if (Address >= MI_DIRECT_MAP_BASE && Address < MI_DIRECT_MAP_END) {
+        pfn = INDEX_TO_PPFN((Address - MI_DIRECT_MAP_BASE) / PhysicalFrameSize);
+
+        // Same as below, the frame goes back to the caller, unmapped.
+        pfn->Descriptor.Mapping.PteAddress = NULL;
+        pfn->Descriptor.Mapping.Vad = NULL;
+        pfn->State = PfnStateTransition;
+        return;
+    }
+
+    uint32_t Processor = MeGetCurrentProcessorNumber();
+
+    // Assertion that the slot must be in use already (double unlock catch)
+    assert((HyperspacePfnInUse[Processor]) != NULL, "No PFN when releasing hyperspace.");
+    assert(Address == MiGetHyperspaceSlot(Processor), "Hyperspace released on another processor");
+    pfn = HyperspacePfnInUse[Processor];
 
     // Clear the PTE present bit (to prevent use after free)
-    MiGetPtePointer(HYPERMAP_VIRTUAL_ADDRESS)->Hard.Present = 0;
-    invlpg((void*)HYPERMAP_VIRTUAL_ADDRESS); // No need to call the MiInvalidateTlb (IPI) as this addr is spinlock protected (and next access rewrites the PTE and does invplg in MI_WRITE_PTE)
+    PMMPTE pte = HyperspacePte[Processor] ? HyperspacePte[Processor] : MiGetPtePointer(Address);
+    pte->Hard.Present = 0;
+    invlpg((void*)Address); // No need to call the MiInvalidateTlb (IPI) as this slot is only used by this processor (and next access rewrites the PTE and does invplg in MI_WRITE_PTE)
 
     // After MiUnmapPte changed the pfn metadata, we change it once again to invalidate it.
     pfn->Descriptor.Mapping.PteAddress = NULL;
     pfn->Descriptor.Mapping.Vad = NULL;
     pfn->State = PfnStateTransition;
-    g_pfnInUse = NULL;
+    HyperspacePfnInUse[Processor] = NULL;
 
     // We do not release the PFN, caller must do so, because it might have other uses with it.
 
-    // Unlock the hyperspace.
-    UNLOCK_HYPERSPACE (OldIrql);
+    // Lower back.
+    MeLowerIrql(OldIrql);
 }
\ No newline at end of file
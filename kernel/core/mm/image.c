@@ -0,0 +1,483 @@
+/*++
+
+Module Name:
+
+    image.c
+
+Purpose:
+
+    This translation unit contains the image cache (executables and DLLs parsed once, and kept in memory for every later load).
+
+Author:
+
+    slep (Matanel) 2025.
+
+Revision History:
+
+--*/
+
+#include "../../includes/mm.h"
+#include "../../includes/ms.h"
+#include "../../includes/mg.h"
+#include "../../includes/fs.h"
+#include "../../assert.h"
+
+//
+// The first section created for a file reads it whole, in a single FsReadFile, and parses it: the MTE header,
+// the exports (into a hash table) and the R_X86_64_RELATIVE relocations. Later sections of the same file
+// (same path and size) reuse it, and their VADs fault pages straight from the copy in memory.
+//
+// Images mapped away from their preferred base share a copy relocated for the first such base, so the usual
+// fallback address costs one relocation pass for the whole system. Any other base is relocated in place, in
+// the process (MmMapViewOfSection).
+//
+// Writing or deleting a file invalidates its entry (MmInvalidateImage). An entry is freed with its last
+// reference, the cache list holds one, every section and VAD using it holds one.
+//
+
+static DOUBLY_LINKED_LIST MiImageCacheList = { &MiImageCacheList, &MiImageCacheList };
+static PUSH_LOCK MiImageCacheLock;
+
+#define MI_IMAGE_TAG 'egmI'
+#define MI_MAX_EXPORT_NAME 256
+#define MI_IMAGE_DROP_BATCH 8
+
+static
+uint32_t
+MiHashExportName(
+    IN const char* Name
+)
+
+{
+    // FNV-1a
+    uint32_t Hash = 2166136261u;
+    while (*Name) {
+        Hash ^= (uint8_t)*Name++;
+        Hash *= 16777619u;
+    }
+    return Hash;
+}
+
+static
+void
+MiFreeImage(
+    IN PMM_IMAGE Image
+)
+
+{
+    if (Image->Contents) MmFreePool(Image->Contents);
+    if (Image->RelocatedContents) MmFreePool(Image->RelocatedContents);
+    if (Image->Exports) MmFreePool(Image->Exports);
+    if (Image->Relocations) MmFreePool(Image->Relocations);
+    MmFreePool(Image);
+}
+
+static
+MTSTATUS
+MiParseImageExports(
+    IN PMM_IMAGE Image
+)
+
+{
+    MTE_HEADER* Header = &Image->Header;
+
+    if (Header->exports_rva == 0 || Header->exports_size < sizeof(MT_EXPORT_ENTRY)) return MT_SUCCESS;
+    if (Header->exports_rva > Image->FileSize || Header->exports_size > Image->FileSize - Header->exports_rva) {
+        return MT_INVALID_IMAGE_FORMAT;
+    }
+
+    size_t Count = Header->exports_size / sizeof(MT_EXPORT_ENTRY);
+    MT_EXPORT_ENTRY* Entries = (MT_EXPORT_ENTRY*)(Image->Contents + Header->exports_rva);
+
+    // At most half full.
+    uint32_t Slots = 1;
+    while (Slots < Count * 2) Slots <<= 1;
+
+    Image->Exports = (PMM_IMAGE_EXPORT)MmAllocatePoolWithTag(NonPagedPool, Slots * sizeof(MM_IMAGE_EXPORT), MI_IMAGE_TAG);
+    if (!Image->Exports) return MT_NO_MEMORY;
+    kmemset(Image->Exports, 0, Slots * sizeof(MM_IMAGE_EXPORT));
+    Image->ExportMask = Slots - 1;
+
+    for (size_t i = 0; i < Count; i++) {
+        uint64_t NameRva = Entries[i].name_rva;
+
+        // The entry on disk is ALREADY an RVA, the name must end inside the file.
+        if (NameRva == 0 || NameRva >= Image->FileSize || NameRva > UINT32_MAX) continue;
+        size_t Room = (size_t)MIN((uint64_t)MI_MAX_EXPORT_NAME, Image->FileSize - NameRva);
+        const char* Name = (const char*)(Image->Contents + NameRva);
+        if (!kmemchr(Name, '\0', Room)) continue;
+
+        uint32_t Hash = MiHashExportName(Name);
+        uint32_t Slot = Hash & Image->ExportMask;
+        while (Image->Exports[Slot].NameOffset) Slot = (Slot + 1) & Image->ExportMask;
+
+        Image->Exports[Slot].Hash = Hash;
+        Image->Exports[Slot].NameOffset = (uint32_t)NameRva;
+        Image->Exports[Slot].FuncRva = Entries[i].func_rva;
+    }
+
+    return MT_SUCCESS;
+}
+
+static
+MTSTATUS
+MiParseImageRelocations(
+    IN PMM_IMAGE Image
+)
+
+{
+    MTE_HEADER* Header = &Image->Header;
+
+    Image->RelocationsInFile = true;
+    if (Header->reloc_rva == 0 || Header->reloc_size < sizeof(Rela)) return MT_SUCCESS;
+    if (Header->reloc_rva > Image->FileSize || Header->reloc_size > Image->FileSize - Header->reloc_rva) {
+        return MT_INVALID_IMAGE_FORMAT;
+    }
+
+    size_t Count = Header->reloc_size / sizeof(Rela);
+    Rela* Table = (Rela*)(Image->Contents + Header->reloc_rva);
+
+    Image->Relocations = (PMM_IMAGE_RELOCATION)MmAllocatePoolWithTag(NonPagedPool, Count * sizeof(MM_IMAGE_RELOCATION), MI_IMAGE_TAG);
+    if (!Image->Relocations) return MT_NO_MEMORY;
+
+    // Only R_X86_64_RELATIVE, targets past the end of the file (.bss) are only reachable in the process.
+    uint64_t ImageEnd = Image->FileSize + Header->BssSize;
+    for (size_t i = 0; i < Count; i++) {
+        if ((Table[i].r_info & 0xFFFFFFFF) != R_X86_64_RELATIVE) continue;
+        if (Table[i].r_offset > ImageEnd - sizeof(uintptr_t)) continue;
+        if (Table[i].r_offset > Image->FileSize - sizeof(uintptr_t)) Image->RelocationsInFile = false;
+
+        Image->Relocations[Image->RelocationCount].Rva = Table[i].r_offset;
+        Image->Relocations[Image->RelocationCount].Addend = Table[i].r_addend;
+        Image->RelocationCount++;
+    }
+
+    return MT_SUCCESS;
+}
+
+static
+MTSTATUS
+MiCreateImage(
+    IN PFILE_OBJECT FileObject,
+    OUT PMM_IMAGE* OutImage
+)
+
+{
+    MTSTATUS Status;
+    size_t Read = 0;
+
+    if (!FileObject->FileName || kstrlen(FileObject->FileName) >= MM_IMAGE_NAME_LENGTH) return MT_INVALID_PARAM;
+    if (FileObject->FileSize < sizeof(MTE_HEADER)) return MT_INVALID_IMAGE_FORMAT;
+
+    PMM_IMAGE Image = (PMM_IMAGE)MmAllocatePoolWithTag(NonPagedPool, sizeof(MM_IMAGE), MI_IMAGE_TAG);
+    if (!Image) return MT_NO_MEMORY;
+    kmemset(Image, 0, sizeof(MM_IMAGE));
+
+    kstrncpy(Image->FileName, FileObject->FileName, sizeof(Image->FileName));
+    Image->FileSize = FileObject->FileSize;
+    Image->ReferenceCount = 1;
+
+    // The whole file in one read (the cluster chain is walked once).
+    Image->Contents = (uint8_t*)MmAllocatePoolWithTag(NonPagedPool, (size_t)Image->FileSize, MI_IMAGE_TAG);
+    if (!Image->Contents) {
+        Status = MT_NO_MEMORY;
+        goto Failure;
+    }
+
+    Status = FsReadFile(FileObject, 0, Image->Contents, (size_t)Image->FileSize, &Read);
+    if (MT_FAILURE(Status)) goto Failure;
+    if (Read != Image->FileSize) {
+        Status = MT_IO_ERROR;
+        goto Failure;
+    }
+
+    kmemcpy(&Image->Header, Image->Contents, sizeof(MTE_HEADER));
+    if (kmemcmp(Image->Header.Magic, "MTE\0", 4) != 0) {
+        Status = MT_INVALID_IMAGE_FORMAT;
+        goto Failure;
+    }
+
+    Status = MiParseImageExports(Image);
+    if (MT_FAILURE(Status)) goto Failure;
+
+    Status = MiParseImageRelocations(Image);
+    if (MT_FAILURE(Status)) goto Failure;
+
+    *OutImage = Image;
+    return MT_SUCCESS;
+
+Failure:
+    MiFreeImage(Image);
+    return Status;
+}
+
+static
+PMM_IMAGE
+MiLookupImage(
+    IN PFILE_OBJECT FileObject
+)
+
+// Cache lock held, returns a referenced image or NULL.
+{
+    for (PDOUBLY_LINKED_LIST Entry = MiImageCacheList.Flink; Entry != &MiImageCacheList; Entry = Entry->Flink) {
+        PMM_IMAGE Image = CONTAINING_RECORD(Entry, MM_IMAGE, ListEntry);
+
+        if (Image->FileSize == FileObject->FileSize && kstrcmp(Image->FileName, FileObject->FileName) == 0) {
+            InterlockedIncrementU64(&Image->ReferenceCount);
+            return Image;
+        }
+    }
+
+    return NULL;
+}
+
+MTSTATUS
+MmReferenceImage(
+    IN PFILE_OBJECT FileObject,
+    OUT PMM_IMAGE* Image
+)
+
+/*++
+
+    Routine description:
+
+        Retrieves the cached image of a file, reading and parsing the file if it isn't cached yet.
+
+    Arguments:
+
+        [IN]    PFILE_OBJECT FileObject - The executable or DLL.
+        [OUT]   PMM_IMAGE* Image - Receives the image, release it with MmDereferenceImage.
+
+    Return Values:
+
+        MT_SUCCESS on success.
+        MT_INVALID_IMAGE_FORMAT - The file isn't a valid MTE image.
+        Other MTSTATUS codes on read or allocation failures.
+
+    Notes:
+
+        Must be called at PASSIVE_LEVEL or APC_LEVEL (the file is read).
+
+--*/
+
+{
+    assert(MeGetCurrentIrql() <= APC_LEVEL);
+    PMM_IMAGE NewImage = NULL;
+
+    if (!FileObject->FileName) return MT_INVALID_PARAM;
+
+    MsAcquirePushLockShared(&MiImageCacheLock);
+    PMM_IMAGE Cached = MiLookupImage(FileObject);
+    MsReleasePushLockShared(&MiImageCacheLock);
+
+    if (Cached) {
+        *Image = Cached;
+        return MT_SUCCESS;
+    }
+
+    // Parse it without the lock held, another thread may be loading the same file.
+    MTSTATUS Status = MiCreateImage(FileObject, &NewImage);
+    if (MT_FAILURE(Status)) return Status;
+
+    MsAcquirePushLockExclusive(&MiImageCacheLock);
+    Cached = MiLookupImage(FileObject);
+    if (!Cached) {
+        // One reference for the list, one for the caller.
+        NewImage->ReferenceCount = 2;
+        InsertTailList(&MiImageCacheList, &NewImage->ListEntry);
+        Cached = NewImage;
+        NewImage = NULL;
+    }
+    MsReleasePushLockExclusive(&MiImageCacheLock);
+
+    if (NewImage) MiFreeImage(NewImage);
+
+    *Image = Cached;
+    return MT_SUCCESS;
+}
+
+void
+MmDereferenceImage(
+    IN PMM_IMAGE Image
+)
+
+/*++
+
+    Routine description:
+
+        Releases a reference to a cached image, freeing it with the last one.
+
+    Arguments:
+
+        [IN]    PMM_IMAGE Image - The image.
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        Callable at IRQL <= DISPATCH_LEVEL (VADs release theirs from the epoch).
+
+--*/
+
+{
+    if (InterlockedDecrementU64(&Image->ReferenceCount) == 0) {
+        MiFreeImage(Image);
+    }
+}
+
+MTSTATUS
+MmFindImageExport(
+    IN PMM_IMAGE Image,
+    IN const char* Name,
+    OUT uint64_t* FuncRva
+)
+
+/*++
+
+    Routine description:
+
+        Looks up an export of a cached image.
+
+    Arguments:
+
+        [IN]    PMM_IMAGE Image - The image.
+        [IN]    const char* Name - Name of the export.
+        [OUT]   uint64_t* FuncRva - Receives the RVA of the export.
+
+    Return Values:
+
+        MT_SUCCESS if found, MT_NOT_FOUND otherwise.
+
+--*/
+
+{
+    if (!Image->Exports) return MT_NOT_FOUND;
+
+    uint32_t Hash = MiHashExportName(Name);
+    for (uint32_t Slot = Hash & Image->ExportMask; Image->Exports[Slot].NameOffset; Slot = (Slot + 1) & Image->ExportMask) {
+        PMM_IMAGE_EXPORT Export = &Image->Exports[Slot];
+
+        if (Export->Hash == Hash && kstrcmp((const char*)(Image->Contents + Export->NameOffset), Name) == 0) {
+            *FuncRva = Export->FuncRva;
+            return MT_SUCCESS;
+        }
+    }
+
+    return MT_NOT_FOUND;
+}
+
+void
+MmInvalidateImage(
+    IN const char* FileName
+)
+
+/*++
+
+    Routine description:
+
+        Drops the cached images of a file, the next section created for it reads it again.
+
+    Arguments:
+
+        [IN]    const char* FileName - Full path of the file.
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        Called by the file system before a file is written or deleted.
+        Views that are already mapped keep the old contents.
+
+--*/
+
+{
+    PMM_IMAGE Drop[MI_IMAGE_DROP_BATCH];
+    uint32_t DropCount;
+
+    if (!FileName) return;
+
+    do {
+        DropCount = 0;
+
+        MsAcquirePushLockExclusive(&MiImageCacheLock);
+        PDOUBLY_LINKED_LIST Entry = MiImageCacheList.Flink;
+        while (Entry != &MiImageCacheList && DropCount < MI_IMAGE_DROP_BATCH) {
+            PMM_IMAGE Image = CONTAINING_RECORD(Entry, MM_IMAGE, ListEntry);
+            Entry = Entry->Flink;
+
+            if (kstrcmp(Image->FileName, FileName) == 0) {
+                RemoveEntryList(&Image->ListEntry);
+                Drop[DropCount++] = Image;
+            }
+        }
+        MsReleasePushLockExclusive(&MiImageCacheLock);
+
+        // The list's references.
+        for (uint32_t i = 0; i < DropCount; i++) MmDereferenceImage(Drop[i]);
+    } while (DropCount == MI_IMAGE_DROP_BATCH);
+}
+
+const uint8_t*
+MiGetImageContents(
+    IN PMM_IMAGE Image,
+    IN uintptr_t BaseAddress
+)
+
+/*++
+
+    Routine description:
+
+        Retrieves the contents of an image relocated for a base address.
+
+    Arguments:
+
+        [IN]    PMM_IMAGE Image - The image.
+        [IN]    uintptr_t BaseAddress - The address the image is mapped at.
+
+    Return Values:
+
+        The contents to fault the view from, NULL if none matches the base (the view must be relocated in place).
+
+    Notes:
+
+        The first base other than the preferred one gets a shared relocated copy.
+
+--*/
+
+{
+    if (BaseAddress == Image->Header.PreferredImageBase || !Image->RelocationCount) return Image->Contents;
+
+    // Published once, never changed.
+    uint8_t* Relocated = __atomic_load_n(&Image->RelocatedContents, __ATOMIC_ACQUIRE);
+    if (Relocated) return (Image->RelocatedBase == BaseAddress) ? Relocated : NULL;
+    if (!Image->RelocationsInFile) return NULL;
+
+    uint8_t* Copy = (uint8_t*)MmAllocatePoolWithTag(NonPagedPool, (size_t)Image->FileSize, MI_IMAGE_TAG);
+    if (!Copy) return NULL;
+
+    kmemcpy(Copy, Image->Contents, (size_t)Image->FileSize);
+    for (size_t i = 0; i < Image->RelocationCount; i++) {
+        uintptr_t Value = BaseAddress + (uintptr_t)Image->Relocations[i].Addend;
+        kmemcpy(Copy + Image->Relocations[i].Rva, &Value, sizeof(Value));
+    }
+
+    MsAcquirePushLockExclusive(&MiImageCacheLock);
+    if (!Image->RelocatedContents) {
+        Image->RelocatedBase = BaseAddress;
+        __atomic_store_n(&Image->RelocatedContents, Copy, __ATOMIC_RELEASE);
+        Copy = NULL;
+    }
+    MsReleasePushLockExclusive(&MiImageCacheLock);
+
+    // Lost the race, use whatever won if it's for the same base.
+    if (Copy) {
+        MmFreePool(Copy);
+        return (Image->RelocatedBase == BaseAddress) ? Image->RelocatedContents : NULL;
+    }
+
+    return Image->RelocatedContents;
+}
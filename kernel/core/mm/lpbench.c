@@ -0,0 +1,116 @@
+/*++
+
+Module Name:
+
+    lpbench.c
+
+Purpose:
+
+    This translation unit contains the user large page benchmark (enabled with MT_LARGE_PAGE_BENCHMARK in behavior.h).
+
+Author:
+
+    slep (Matanel) 2025.
+
+Revision History:
+
+--*/
+
+#include "../../includes/mm.h"
+#include "../../includes/me.h"
+#include "../../includes/mg.h"
+#include "../../includes/md.h"
+#include "../../includes/ps.h"
+
+#define LPBENCH_REGION_SIZE (1ULL * 1024 * 1024 * 1024)
+
+static
+void
+MmpRunLargePagePass(
+    IN bool LargePages
+)
+
+{
+    PEPROCESS Process = PsGetCurrentProcess();
+    uint64_t Before[PerfCounterMax];
+    uint64_t After[PerfCounterMax];
+    void* Base = NULL;
+    MTSTATUS Status = MT_SUCCESS;
+
+    MTSTATUS st = MmAllocateVirtualMemory(Process, &Base, LPBENCH_REGION_SIZE, VAD_FLAG_READ | VAD_FLAG_WRITE);
+    if (MT_FAILURE(st)) {
+        gop_printf(COLOR_RED, "[LPBENCH] Failed to reserve the region (%x).\n", st);
+        return;
+    }
+
+    MmLargePagesEnabled = LargePages;
+    MdReadCounters(MD_ALL_PROCESSORS, Before);
+
+    // One write per 4 KiB page, in order.
+    uint64_t Start = __rdtsc();
+    try {
+        for (uint64_t Offset = 0; Offset < LPBENCH_REGION_SIZE; Offset += VirtualPageSize) {
+            ((volatile uint8_t*)Base)[Offset] = 1;
+        }
+    } except{
+        Status = GetExceptionCode();
+    } end_try;
+    uint64_t TouchCycles = __rdtsc() - Start;
+
+    MdReadCounters(MD_ALL_PROCESSORS, After);
+
+    Start = __rdtsc();
+    MmFreeVirtualMemory(Process, Base);
+    uint64_t FreeCycles = __rdtsc() - Start;
+
+    MmLargePagesEnabled = true;
+
+    if (MT_FAILURE(Status)) {
+        gop_printf(COLOR_RED, "[LPBENCH] %s pass faulted (%x), out of memory?\n", LargePages ? "2 MiB" : "4 KiB", Status);
+        return;
+    }
+
+    gop_printf(COLOR_CYAN, "[LPBENCH] %s pages: %lu faults (%lu large, %lu fallbacks), touch %lu Mcycles, free %lu Mcycles\n",
+        LargePages ? "2 MiB" : "4 KiB",
+        (After[PerfCounterFaultDemandZero] - Before[PerfCounterFaultDemandZero]) + (After[PerfCounterFaultLargePage] - Before[PerfCounterFaultLargePage]),
+        After[PerfCounterFaultLargePage] - Before[PerfCounterFaultLargePage],
+        After[PerfCounterLargePageFallbacks] - Before[PerfCounterLargePageFallbacks],
+        TouchCycles / 1000000, FreeCycles / 1000000);
+}
+
+void
+MmRunLargePageBenchmark(
+    IN void* Parameter
+)
+
+/*++
+
+    Routine description:
+
+        User large page benchmark thread.
+        Touches a 1 GiB anonymous region of the system process sequentially, once mapped 4 KiB at a time and once with
+        2 MiB pages, and prints the fault count and cycles of each pass.
+
+    Arguments:
+
+        [IN]    void* Parameter - Unused.
+
+    Return Values:
+
+        None, results are printed to the screen.
+
+    Notes:
+
+        The fault counts are system wide, other activity during a pass shows up in them.
+        With less than 1 GiB of free memory (or pool) the 2 MiB pass falls back to 4 KiB pages, the fallback count says so.
+
+--*/
+
+{
+    UNREFERENCED_PARAMETER(Parameter);
+
+    gop_printf(COLOR_CYAN, "[LPBENCH] Starting, %lu runs in the large page pool.\n", (uint64_t)PfnDatabase.LargePageList.Count);
+
+    MmpRunLargePagePass(false);
+    MmpRunLargePagePass(true);
+}
@@ -18,6 +18,7 @@ Revision History:
 
 #include "../../includes/mm.h"
 #include "../../includes/mh.h"
+#include "../../includes/me.h"
 #include "../../assert.h"
 
 static inline uint64_t canonical_high(uint64_t addr) {
@@ -72,6 +73,25 @@ static inline size_t get_pdpt_index(uint64_t va) { return (va >> 30) & 0x1FF; }
 static inline size_t get_pd_index(uint64_t va) { return (va >> 21) & 0x1FF; }
 static inline size_t get_pt_index(uint64_t va) { return (va >> 12) & 0x1FF; }
 
+// Physical address of a 2 MiB PDE (bit 12 is PAT there).
+#define MI_LARGE_PDE_TO_PHYSICAL(Value) ((Value) & 0x000FFFFFFFE00000ULL)
+
+static
+void
+MiDiscardPageTable(
+    IN  PAGE_INDEX Pfn
+)
+
+// Releases a page table that was never linked (MiReleasePhysicalPage only puts active pages back on a list).
+
+{
+    PPFN_ENTRY Entry = INDEX_TO_PPFN(Pfn);
+    Entry->State = PfnStateActive;
+    Entry->Descriptor.Mapping.Vad = NULL;
+    Entry->Descriptor.Mapping.PteAddress = NULL;
+    MiReleasePhysicalPage(Pfn);
+}
+
 PMMPTE
 MiGetPtePointer(
     IN  uintptr_t va
@@ -89,6 +109,10 @@ MiGetPtePointer(
 
         Pointer to PTE associated with the Virtual Address. (NULL if out of memory)
 
+    Notes:
+
+        A user large page mapping the address is split into 4 KiB PTEs first (MiSplitLargePage).
+
 --*/
 
 {
@@ -128,14 +152,32 @@ MiGetPtePointer(
     }
 
     uint64_t* pd_va = pd_from_recursive(pml4_i, pdpt_i);
-    if (!(pd_va[pd_i] & PAGE_PRESENT)) {
+    uint64_t pdeValue = pd_va[pd_i];
+    if (!(pdeValue & PAGE_PRESENT)) {
         // Allocate a new Page Table
         PAGE_INDEX pfn = MiRequestPhysicalPage(PfnStateZeroed);
         if (pfn == PFN_ERROR) return NULL;
 
-        // Link new PT into PD
+        // Link new PT into PD, a user fault may have put a large page there meanwhile (MmAccessFault), so only over the entry we saw.
         PMMPTE pde = (PMMPTE)&pd_va[pd_i];
-        MI_WRITE_PTE(pde, pt_from_recursive(pml4_i, pdpt_i, pd_i), PFN_TO_PHYS(pfn), intermediateFlags);
+        if (InterlockedCompareExchangeU64(&pde->Value, PFN_TO_PHYS(pfn) | intermediateFlags, pdeValue) == pdeValue) {
+            if (MmPfnDatabaseInitialized) {
+                PPFN_ENTRY tablePfn = INDEX_TO_PPFN(pfn);
+                tablePfn->Descriptor.Mapping.PteAddress = pde;
+                tablePfn->State = PfnStateActive;
+                tablePfn->Flags = PFN_FLAG_NONPAGED;
+            }
+            MiInvalidateTlbForVa(pt_from_recursive(pml4_i, pdpt_i, pd_i));
+        }
+        else {
+            MiDiscardPageTable(pfn);
+        }
+        pdeValue = pd_va[pd_i];
+    }
+
+    if ((pdeValue & PAGE_PS) && va <= MmHighestUserAddress) {
+        // Callers of this routine work on 4 KiB PTEs.
+        if (!MiSplitLargePage(va)) return NULL;
     }
 
     // Return addr of PTE.
@@ -269,6 +311,203 @@ MiGetPdePointer(
     return (PMMPTE)&pd_va[pd_i];
 }
 
+MTSTATUS
+MiMapKernelLargePage(
+    IN  uintptr_t va,
+    IN  uint64_t PhysicalAddress,
+    IN  uint64_t PageSize,
+    IN  uint64_t Flags
+)
+
+/*++
+
+    Routine description:
+
+        Maps a 2 MiB (PDE) or 1 GiB (PDPTE) kernel page, allocating the upper level tables as needed.
+
+    Arguments:
+
+        [IN]    uintptr_t va - Kernel virtual address, aligned to PageSize.
+        [IN]    uint64_t PhysicalAddress - Physical address, aligned to PageSize.
+        [IN]    uint64_t PageSize - MI_LARGE_PAGE_SIZE or MI_HUGE_PAGE_SIZE (the caller checked the processor supports it).
+        [IN]    uint64_t Flags - PTE flags (PAGE_PS is added).
+
+    Return Values:
+
+        MT_SUCCESS, MT_NO_RESOURCES if a page table couldn't be allocated.
+
+    Notes:
+
+        The entry must not be present (no TLB shootdown is done).
+        The PFN database is not touched, the mapped frames keep their state (this is a window, not an owner).
+
+--*/
+
+{
+    size_t pml4_i = get_pml4_index(va);
+    size_t pdpt_i = get_pdpt_index(va);
+    size_t pd_i = get_pd_index(va);
+    PMMPTE entry;
+
+    assert((va & (PageSize - 1)) == 0 && (PhysicalAddress & (PageSize - 1)) == 0);
+
+    if (PageSize == MI_HUGE_PAGE_SIZE) {
+        // Allocates the PDPT if needed.
+        if (!MiGetPml4ePointer(va)) return MT_NO_RESOURCES;
+        entry = (PMMPTE)&pdpt_from_recursive(pml4_i)[pdpt_i];
+    }
+    else {
+        // Allocates the PDPT and the page directory if needed.
+        if (!MiGetPdptePointer(va)) return MT_NO_RESOURCES;
+        entry = (PMMPTE)&pd_from_recursive(pml4_i, pdpt_i)[pd_i];
+    }
+
+    assert(entry->Hard.Present == 0);
+    MiAtomicExchangePte(entry, (PhysicalAddress & ~(PageSize - 1)) | Flags | PAGE_PS);
+    return MT_SUCCESS;
+}
+
+PMMPTE
+MiGetLargePdePointer(
+    IN  uintptr_t va
+)
+
+/*++
+
+    Routine description:
+
+        Retrieves the pointer to the PDE of the virtual address given, the entry a 2 MiB page of it lives in.
+
+    Arguments:
+
+        [IN]    uintptr_t va - Virtual address.
+
+    Return Values:
+
+        Pointer to the PDE, NULL if out of memory.
+
+    Notes:
+
+        Allocates the PDPT and the page directory if needed, but never the page table (unlike MiGetPdePointer).
+
+--*/
+
+{
+    if (!MiGetPdptePointer(va)) return NULL;
+    return (PMMPTE)&pd_from_recursive(get_pml4_index(va), get_pdpt_index(va))[get_pd_index(va)];
+}
+
+bool
+MiSplitLargePage(
+    IN  uintptr_t va
+)
+
+/*++
+
+    Routine description:
+
+        Remaps the user large page that maps the virtual address with a page table of 512 PTEs, to the same frames.
+
+    Arguments:
+
+        [IN]    uintptr_t va - User virtual address inside the large page.
+
+    Return Values:
+
+        True if the address isn't mapped by a large page anymore, false if the page table couldn't be allocated.
+
+    Notes:
+
+        The frames become ordinary 4 KiB pages, each released on its own (MiReleasePhysicalPage).
+        Done for callers that need a 4 KiB PTE in the range (partial frees and the like, see MiGetPtePointer).
+
+--*/
+
+{
+    PMMPTE Pde = MiGetLargePdePointer(va);
+    if (!Pde) return false;
+
+    uint64_t Old = Pde->Value;
+    if (!(Old & PAGE_PRESENT) || !(Old & PAGE_PS)) return true;
+
+    PAGE_INDEX TablePfn = MiRequestPhysicalPage(PfnStateZeroed);
+    if (TablePfn == PFN_ERROR) return false;
+
+    // Same frames and protection, 4 KiB at a time.
+    uint64_t LargePhysical = MI_LARGE_PDE_TO_PHYSICAL(Old);
+    uint64_t Flags = Old & (PAGE_PRESENT | PAGE_RW | PAGE_USER | PAGE_PWT | PAGE_PCD | PAGE_ACCESSED | PAGE_DIRTY | PAGE_GLOBAL | PAGE_NX);
+
+    IRQL oldIrql;
+    uint64_t* Table = (uint64_t*)MiMapPageInHyperspace(TablePfn, &oldIrql);
+    for (size_t i = 0; i < MI_LARGE_PAGE_FRAMES; i++) {
+        Table[i] = (LargePhysical + i * PhysicalFrameSize) | Flags;
+    }
+    MiUnmapHyperSpaceMap(Table, oldIrql);
+
+    // Another split (or an unmap) may beat us to the entry, then the table was never seen.
+    if (InterlockedCompareExchangeU64(&Pde->Value, PFN_TO_PHYS(TablePfn) | PAGE_PRESENT | PAGE_RW | PAGE_USER, Old) != Old) {
+        MiDiscardPageTable(TablePfn);
+        return true;
+    }
+
+    PPFN_ENTRY TableEntry = INDEX_TO_PPFN(TablePfn);
+    TableEntry->Descriptor.Mapping.PteAddress = Pde;
+    TableEntry->State = PfnStateActive;
+    TableEntry->Flags = PFN_FLAG_NONPAGED;
+
+    // The recursive address of the table was a window into the large page, drop that translation too.
+    uint64_t* Ptes = pt_from_recursive(get_pml4_index(va), get_pdpt_index(va), get_pd_index(va));
+    MiInvalidateTlbForVa(Ptes);
+
+    PPFN_ENTRY Frames = PHYSICAL_TO_PPFN(LargePhysical);
+    for (size_t i = 0; i < MI_LARGE_PAGE_FRAMES; i++) {
+        Frames[i].Descriptor.Mapping.PteAddress = (PMMPTE)&Ptes[i];
+        Frames[i].State = PfnStateActive;
+        Frames[i].Flags = PFN_FLAG_NONPAGED;
+    }
+
+    // A single invalidation anywhere in the range drops the 2 MiB translation.
+    MiInvalidateTlbForVa((void*)(va & ~(MI_LARGE_PAGE_SIZE - 1)));
+    MeIncrementCounter(PerfCounterLargePageSplits);
+    return true;
+}
+
+bool
+MiUnmapLargePage(
+    IN  uintptr_t va
+)
+
+/*++
+
+    Routine description:
+
+        Unmaps the user large page that maps the virtual address and returns its frames to the large page pool.
+
+    Arguments:
+
+        [IN]    uintptr_t va - User virtual address inside the large page.
+
+    Return Values:
+
+        True if a large page was unmapped, false if the address isn't mapped by one.
+
+--*/
+
+{
+    PMMPTE Pde = MiGetLargePdePointer(va);
+    if (!Pde) return false;
+
+    uint64_t Old = Pde->Value;
+    if (!(Old & PAGE_PRESENT) || !(Old & PAGE_PS)) return false;
+
+    // Split under us, the caller goes over the PTEs instead.
+    if (InterlockedCompareExchangeU64(&Pde->Value, 0, Old) != Old) return false;
+
+    MiInvalidateTlbForVa((void*)(va & ~(MI_LARGE_PAGE_SIZE - 1)));
+    MiReleaseLargePage(PHYS_TO_INDEX(MI_LARGE_PDE_TO_PHYSICAL(Old)));
+    return true;
+}
+
 void
 MiInvalidateTlbForVa(
     IN void* VirtualAddress
@@ -572,3 +811,48 @@ MmIsAddressPresent(
     PMMPTE pte = MiGetPtePointer(VirtualAddress);
     return pte && pte->Hard.Present;
 }
+
+bool
+MiIsAddressMapped(
+    IN  uintptr_t VirtualAddress
+)
+
+/*++
+
+    Routine description:
+
+        Checks if the given address is mapped, without creating missing paging structures (unlike MmIsAddressPresent).
+
+    Arguments:
+
+        [IN]    uintptr_t VirtualAddress - The virtual address.
+
+    Return Values:
+
+        True if reading the address won't page fault, false otherwise.
+
+    Notes:
+
+        Takes no locks and allocates nothing, safe at any IRQL (NMI included).
+        Large (2 MiB) and huge (1 GiB) mappings are honored.
+
+--*/
+
+{
+    size_t pml4_i = get_pml4_index(VirtualAddress);
+    size_t pdpt_i = get_pdpt_index(VirtualAddress);
+    size_t pd_i = get_pd_index(VirtualAddress);
+    size_t pt_i = get_pt_index(VirtualAddress);
+
+    if (!(pml4_from_recursive()[pml4_i] & PAGE_PRESENT)) return false;
+
+    uint64_t pdpte = pdpt_from_recursive(pml4_i)[pdpt_i];
+    if (!(pdpte & PAGE_PRESENT)) return false;
+    if (pdpte & PAGE_PS) return true;
+
+    uint64_t pde = pd_from_recursive(pml4_i, pdpt_i)[pd_i];
+    if (!(pde & PAGE_PRESENT)) return false;
+    if (pde & PAGE_PS) return true;
+
+    return (pt_from_recursive(pml4_i, pdpt_i, pd_i)[pt_i] & PAGE_PRESENT) != 0;
+}
@@ -0,0 +1,250 @@
+/*++
+
+Module Name:
+
+    membench.c
+
+Purpose:
+
+    This translation unit contains the memory primitives microbenchmark (enabled with MT_MEMORY_BENCHMARK in behavior.h).
+
+Author:
+
+    slep (Matanel) 2025.
+
+Revision History:
+
+--*/
+
+#include "../../includes/mm.h"
+#include "../../includes/me.h"
+#include "../../includes/mg.h"
+
+// Every variant moves (about) this many bytes per size, so the short sizes run enough iterations to be measurable.
+#define MEMBENCH_BYTES_PER_RUN (8ULL * 1024 * 1024)
+#define MEMBENCH_BUFFER_SIZE   (64 * 1024)
+
+typedef void (*MEMBENCH_ROUTINE)(void* Destination, const void* Source, size_t Length);
+
+typedef struct _MEMBENCH_VARIANT {
+    const char* Name;
+    MEMBENCH_ROUTINE Routine;
+    bool PageOnly;              // Only measured with Length == VirtualPageSize
+} MEMBENCH_VARIANT;
+
+static const size_t MemBenchSizes[] = { 16, 64, 256, 1024, 4096, 16384, MEMBENCH_BUFFER_SIZE };
+
+// The byte loops the kernel used before (the baseline), kept out of the loop distribution pass so they stay byte loops.
+__attribute__((optimize("no-tree-loop-distribute-patterns")))
+static
+void
+MmpBenchCopyBytes(
+    void* Destination,
+    const void* Source,
+    size_t Length
+)
+
+{
+    uint8_t* d = (uint8_t*)Destination;
+    const uint8_t* s = (const uint8_t*)Source;
+    for (size_t i = 0; i < Length; i++) d[i] = s[i];
+}
+
+__attribute__((optimize("no-tree-loop-distribute-patterns")))
+static
+void
+MmpBenchSetBytes(
+    void* Destination,
+    const void* Source,
+    size_t Length
+)
+
+{
+    UNREFERENCED_PARAMETER(Source);
+    uint8_t* d = (uint8_t*)Destination;
+    for (size_t i = 0; i < Length; i++) d[i] = 0;
+}
+
+static
+void
+MmpBenchCopyString(
+    void* Destination,
+    const void* Source,
+    size_t Length
+)
+
+{
+    MiCopyMemoryString(Destination, Source, Length);
+}
+
+static
+void
+MmpBenchCopyQword(
+    void* Destination,
+    const void* Source,
+    size_t Length
+)
+
+{
+    MiCopyMemoryQword(Destination, Source, Length);
+}
+
+static
+void
+MmpBenchSetString(
+    void* Destination,
+    const void* Source,
+    size_t Length
+)
+
+{
+    UNREFERENCED_PARAMETER(Source);
+    MiSetMemoryString(Destination, 0, Length);
+}
+
+static
+void
+MmpBenchSetQword(
+    void* Destination,
+    const void* Source,
+    size_t Length
+)
+
+{
+    UNREFERENCED_PARAMETER(Source);
+    MiSetMemoryQword(Destination, 0, Length);
+}
+
+static
+void
+MmpBenchCopyPage(
+    void* Destination,
+    const void* Source,
+    size_t Length
+)
+
+{
+    UNREFERENCED_PARAMETER(Length);
+    MiCopyPage(Destination, Source);
+}
+
+static
+void
+MmpBenchZeroPage(
+    void* Destination,
+    const void* Source,
+    size_t Length
+)
+
+{
+    UNREFERENCED_PARAMETER(Source);
+    UNREFERENCED_PARAMETER(Length);
+    MiZeroPage(Destination);
+}
+
+static
+void
+MmpBenchCompare(
+    void* Destination,
+    const void* Source,
+    size_t Length
+)
+
+{
+    // Equal buffers, the whole length is compared.
+    (void)kmemcmp(Destination, Source, Length);
+}
+
+static const MEMBENCH_VARIANT MemBenchVariants[] = {
+    { "copy bytes",      MmpBenchCopyBytes,  false },
+    { "copy qword",      MmpBenchCopyQword,  false },
+    { "copy rep movsb",  MmpBenchCopyString, false },
+    { "copy nt page",    MmpBenchCopyPage,   true  },
+    { "set bytes",       MmpBenchSetBytes,   false },
+    { "set qword",       MmpBenchSetQword,   false },
+    { "set rep stosb",   MmpBenchSetString,  false },
+    { "zero nt page",    MmpBenchZeroPage,   true  },
+    { "kmemcmp",         MmpBenchCompare,    false },
+};
+
+void
+MmRunMemoryBenchmark(
+    IN void* Parameter
+)
+
+/*++
+
+    Routine description:
+
+        Memory primitives microbenchmark thread.
+        Runs every copy/set variant (byte loop baseline, qword, REP MOVSB/STOSB, non-temporal page routines) and kmemcmp
+        over a range of sizes, and prints the throughput of each.
+
+    Arguments:
+
+        [IN]    void* Parameter - Unused.
+
+    Return Values:
+
+        None, results are printed to the screen in bytes per TSC cycle.
+
+    Notes:
+
+        The REP MOVSB/STOSB variants are measured even without ERMS, to show why they are not selected there.
+        Buffers are cache resident for the small sizes, the non-temporal variants always go to memory (their point is the cache they don't evict).
+
+--*/
+
+{
+    UNREFERENCED_PARAMETER(Parameter);
+
+    uint8_t* Source = (uint8_t*)MmAllocatePoolWithTag(NonPagedPool, MEMBENCH_BUFFER_SIZE + VirtualPageSize, 'hcnB'); // Bnch - Benchmark
+    uint8_t* Destination = (uint8_t*)MmAllocatePoolWithTag(NonPagedPool, MEMBENCH_BUFFER_SIZE + VirtualPageSize, 'hcnB');
+    if (!Source || !Destination) {
+        gop_printf(COLOR_RED, "[MEMBENCH] Failed to allocate the buffers.\n");
+        if (Source) MmFreePool(Source);
+        if (Destination) MmFreePool(Destination);
+        return;
+    }
+
+    // The page variants need page aligned buffers.
+    uint8_t* AlignedSource = (uint8_t*)ALIGN_UP(Source, VirtualPageSize);
+    uint8_t* AlignedDestination = (uint8_t*)ALIGN_UP(Destination, VirtualPageSize);
+
+    gop_printf(COLOR_CYAN, "[MEMBENCH] Starting, kmemcpy/kmemset use %s for short lengths, %s for long ones.\n",
+        MiIsStringOperationPreferred(16) ? "rep movsb/stosb" : "rep movsq/stosq",
+        MiIsStringOperationPreferred(MEMBENCH_BUFFER_SIZE) ? "rep movsb/stosb" : "rep movsq/stosq");
+
+    for (size_t v = 0; v < sizeof(MemBenchVariants) / sizeof(MemBenchVariants[0]); v++) {
+        const MEMBENCH_VARIANT* Variant = &MemBenchVariants[v];
+
+        for (size_t s = 0; s < sizeof(MemBenchSizes) / sizeof(MemBenchSizes[0]); s++) {
+            size_t Length = MemBenchSizes[s];
+            if (Variant->PageOnly && Length != VirtualPageSize) continue;
+
+            uint64_t Iterations = MEMBENCH_BYTES_PER_RUN / Length;
+            IRQL OldIrql;
+
+            // Warm up (caches, TLB), then measure without being preempted.
+            Variant->Routine(AlignedDestination, AlignedSource, Length);
+
+            MeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+            uint64_t Start = __rdtsc();
+            for (uint64_t i = 0; i < Iterations; i++) {
+                Variant->Routine(AlignedDestination, AlignedSource, Length);
+            }
+            uint64_t Cycles = __rdtsc() - Start;
+            MeLowerIrql(OldIrql);
+
+            if (!Cycles) Cycles = 1;
+
+            // Bytes per cycle, two decimal places.
+            uint64_t Hundredths = (Iterations * Length * 100) / Cycles;
+            gop_printf(COLOR_CYAN, "[MEMBENCH] %s %u bytes: %lu.%lu%lu bytes/cycle\n",
+                Variant->Name, (uint32_t)Length, Hundredths / 100, (Hundredths / 10) % 10, Hundredths % 10);
+        }
+    }
+
+    MmFreePool(Source);
+    MmFreePool(Destination);
+}
@@ -0,0 +1,163 @@
+/*++
+
+Module Name:
+
+    memory.c
+
+Purpose:
+
+    This translation unit contains the selection of the kernel memory primitives (kmemset, kmemcpy, kmemcmp live in mm.h) and the page zero/copy routines.
+
+Author:
+
+    slep (Matanel) 2025.
+
+Revision History:
+
+--*/
+
+#include "../../includes/mm.h"
+#include "../../includes/mh.h"
+
+//
+// The kernel is built with -fno-inline and -mgeneral-regs-only, so the compiler never turns these into anything better than what is written here.
+// String instructions are used for the bulk of the work, they move up to a cache line per cycle on processors with
+// ERMS (Enhanced REP MOVSB/STOSB) and have no startup cost for short lengths on processors with FSRM (Fast Short REP MOV).
+// Whole pages are zeroed/copied with non-temporal stores, a fresh page is rarely read back right away, and it shouldn't evict the working set.
+//
+
+#define CPUID_7_EBX_ERMS        (1U << 9)
+#define CPUID_7_EDX_FSRM        (1U << 4)
+
+#define MI_PAGE_QWORDS          (VirtualPageSize / sizeof(uint64_t))
+
+// Set once at boot by MiInitializeMemoryRoutines, the qword routines are used until then (always valid).
+bool MiErmsAvailable;
+bool MiFsrmAvailable;
+
+void
+MiInitializeMemoryRoutines(
+    void
+)
+
+/*++
+
+    Routine description:
+
+        Selects the memory primitives for this processor family (ERMS/FSRM string instructions, or the qword routines).
+
+    Arguments:
+
+        None.
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        Called by the BSP early in MmInitSystem, processors are assumed to be identical.
+
+--*/
+
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    __cpuid(0, eax, ebx, ecx, edx);
+    if (eax < 7) return;
+
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    MiErmsAvailable = (ebx & CPUID_7_EBX_ERMS) != 0;
+    MiFsrmAvailable = (edx & CPUID_7_EDX_FSRM) != 0;
+}
+
+void
+MiZeroPage(
+    IN void* PageVa
+)
+
+/*++
+
+    Routine description:
+
+        Zeroes a page with non-temporal stores.
+
+    Arguments:
+
+        [IN]    void* PageVa - Page aligned virtual address of the page (write back mapping).
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        Ends with an SFENCE, the zeroes are globally visible before the page can be published (e.g by a PTE write).
+
+--*/
+
+{
+    uint64_t* Qword = (uint64_t*)PageVa;
+
+    for (size_t i = 0; i < MI_PAGE_QWORDS; i += 8) {
+        __asm__ volatile(
+            "movnti %1, 0(%0)\n\t"
+            "movnti %1, 8(%0)\n\t"
+            "movnti %1, 16(%0)\n\t"
+            "movnti %1, 24(%0)\n\t"
+            "movnti %1, 32(%0)\n\t"
+            "movnti %1, 40(%0)\n\t"
+            "movnti %1, 48(%0)\n\t"
+            "movnti %1, 56(%0)\n\t"
+            : : "r"(Qword + i), "r"(0ULL) : "memory"
+            );
+    }
+
+    __asm__ volatile("sfence" ::: "memory");
+}
+
+void
+MiCopyPage(
+    IN void* DestinationPageVa,
+    IN const void* SourcePageVa
+)
+
+/*++
+
+    Routine description:
+
+        Copies a page, the destination is written with non-temporal stores.
+
+    Arguments:
+
+        [IN]    void* DestinationPageVa - Page aligned virtual address of the destination page.
+        [IN]    const void* SourcePageVa - Virtual address of the source page (qword aligned).
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        Ends with an SFENCE, like MiZeroPage.
+
+--*/
+
+{
+    uint64_t* Destination = (uint64_t*)DestinationPageVa;
+    const uint64_t* Source = (const uint64_t*)SourcePageVa;
+
+    for (size_t i = 0; i < MI_PAGE_QWORDS; i += 4) {
+        uint64_t Q0 = Source[i], Q1 = Source[i + 1], Q2 = Source[i + 2], Q3 = Source[i + 3];
+
+        __asm__ volatile(
+            "movnti %1, 0(%0)\n\t"
+            "movnti %2, 8(%0)\n\t"
+            "movnti %3, 16(%0)\n\t"
+            "movnti %4, 24(%0)\n\t"
+            : : "r"(Destination + i), "r"(Q0), "r"(Q1), "r"(Q2), "r"(Q3) : "memory"
+            );
+    }
+
+    __asm__ volatile("sfence" ::: "memory");
+}
@@ -111,6 +111,9 @@ MmInitSystem(
     // Currently we only support the first and only phase.
     if (Phase == SYSTEM_PHASE_INITIALIZE_ALL) {
 
+        // Select the memory primitives (kmemcpy, kmemset) before the heavy users below.
+        MiInitializeMemoryRoutines();
+
         // Initialize PAT (Page Attribute Table)
         bool PatAvailable = MiIsPATAvailable();
         assert(PatAvailable == true);
@@ -131,6 +134,15 @@ MmInitSystem(
             );
         }
 
+        // Temporary mappings, per-CPU hyperspace slots first (the direct map's page tables are zeroed through them).
+        MiInitializeHyperspace();
+
+        st = MiInitializeDirectMap(BootInformation);
+        if (MT_FAILURE(st)) {
+            // Not fatal, every temporary mapping goes through the hyperspace instead.
+            gop_printf(COLOR_YELLOW, "**[MTSTATUS-FAILURE]** Direct map initialization failed: %x, using hyperspace only.\n", st);
+        }
+
         if (!MiInitializePoolVaSpace()) {
             MeBugCheck(VA_SPACE_INIT_FAILURE);
         }
@@ -207,7 +219,8 @@ MiMoveUefiDataToHigherHalf(
     uint64_t oldBase = gop_local.FrameBufferBase;
 #endif
 
-    gop_local.FrameBufferBase = (uint64_t)MmMapIoSpace(Phys, gop_local.FrameBufferSize, MmCached);
+    // Write combined, the console only ever writes whole scanlines to it (see gop.c).
+    gop_local.FrameBufferBase = (uint64_t)MmMapIoSpace(Phys, gop_local.FrameBufferSize, MmWriteCombined);
     assert(gop_local.FrameBufferBase != Phys);
     assert((void*)gop_local.FrameBufferBase != NULL);
 
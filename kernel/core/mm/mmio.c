@@ -118,7 +118,7 @@ MmAllocateContigiousMemory(
     size_t pageCount = BYTES_TO_PAGES(NumberOfBytes);
     PAGE_INDEX MaxPfn = PPFN_TO_INDEX(PHYSICAL_TO_PPFN(HighestAcceptableAddress));
     size_t ConsecutiveFound = 0;
-    IRQL DbIrql;
+    LOCK_QUEUE_HANDLE DbLockHandle;
     PAGE_INDEX StartIndex = 0;
     void* BaseAddress = NULL; // Null initially, unless enough pages.
 
@@ -142,7 +142,7 @@ MmAllocateContigiousMemory(
     */
 
     // Acquire the global DB lock so we dont get the contigious pages stolen from us.
-    MsAcquireSpinlock(&PfnDatabase.PfnDatabaseLock, &DbIrql);
+    MsAcquireInStackQueuedSpinlock(&PfnDatabase.PfnDatabaseLock, &DbLockHandle);
 
     for (PAGE_INDEX i = 0; i < PfnDatabase.TotalPageCount; i++) {
         // Check bounds.
@@ -150,8 +150,9 @@ MmAllocateContigiousMemory(
 
         PPFN_ENTRY pfn = &PfnDatabase.PfnEntries[i];
 
-        // Is this page a candidate
-        bool isCandidate = (pfn->State == PfnStateFree || pfn->State == PfnStateZeroed || pfn->State == PfnStateStandby);
+        // Is this page a candidate (frames of the large page pool aren't on the lists MiUnlinkPageFromList knows)
+        bool isCandidate = (pfn->State == PfnStateFree || pfn->State == PfnStateZeroed || pfn->State == PfnStateStandby) &&
+            !(pfn->Flags & PFN_FLAG_LARGE_PAGE);
 
         if (isCandidate) {
             if (ConsecutiveFound == 0) {
@@ -204,7 +205,7 @@ MmAllocateContigiousMemory(
         }
     }
 
-    MsReleaseSpinlock(&PfnDatabase.PfnDatabaseLock, DbIrql);
+    MsReleaseInStackQueuedSpinlock(&DbLockHandle);
     // This could be NULL if we didnt find a contigious amount, or the valid pointer to start of block (mapped with PhysicalMemoryOffset)
     return BaseAddress;
 }
@@ -234,7 +235,7 @@ MmFreeContigiousMemory(
 
 {
     // Declarations
-    IRQL DbIrql;
+    LOCK_QUEUE_HANDLE DbLockHandle;
     size_t pageCount = BYTES_TO_PAGES(NumberOfBytes);
     uintptr_t CurrentAddress = (uintptr_t)BaseAddress;
 
@@ -245,7 +246,7 @@ MmFreeContigiousMemory(
     }
 
     // Just unmap each page, and return the PFN to DB.
-    MsAcquireSpinlock(&PfnDatabase.PfnDatabaseLock, &DbIrql);
+    MsAcquireInStackQueuedSpinlock(&PfnDatabase.PfnDatabaseLock, &DbLockHandle);
 
     for (size_t i = 0; i < pageCount; i++) {
         // Retrieve the PTE for the current VA.
@@ -262,7 +263,7 @@ MmFreeContigiousMemory(
         CurrentAddress += VirtualPageSize;
     }
 
-    MsReleaseSpinlock(&PfnDatabase.PfnDatabaseLock, DbIrql);
+    MsReleaseInStackQueuedSpinlock(&DbLockHandle);
 }
 
 void*
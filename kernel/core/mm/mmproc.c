@@ -217,6 +217,252 @@ MiFreeKernelStack(
     MiFreePoolVaContiguous(BaseVa, TotalSize, NonPagedPool);
 }
 
+//
+// Kernel stack cache.
+// Stacks of deleted threads stay mapped (guard page included) and go to a cache of the processor, MI_STACK_CACHE_DEPTH per size,
+// new threads take them from there without touching the PFN database, the PTEs or the TLBs of other processors.
+// A processor with a full cache moves half of it to the depot, one with an empty cache takes a batch back.
+// Stacks beyond the depot, and every stack while memory is low, are deleted by the stack reaper (PsDeferKernelStackDeletion).
+// The caches are only touched at DISPATCH_LEVEL by their processor, the depot under its lock.
+//
+
+#define MI_NEXT_CACHED_STACK(Top) (((void**)(Top))[-1])
+
+static MM_STACK_CACHE MiStackDepot[2];
+static QUEUED_SPINLOCK MiStackDepotLock;
+
+static
+void*
+MiTakeStackBatch(
+    IN  PMM_STACK_CACHE Cache,
+    IN  uint32_t Count,
+    OUT void** Tail
+)
+
+// Unlinks up to Count stacks from the front of a cache, returns the first one (the last one in Tail).
+
+{
+    void* Head = Cache->Head;
+    void* Last = Head;
+
+    if (!Count || !Head) return NULL;
+
+    uint32_t Taken = 1;
+    while (Taken < Count && MI_NEXT_CACHED_STACK(Last)) {
+        Last = MI_NEXT_CACHED_STACK(Last);
+        Taken++;
+    }
+
+    Cache->Head = MI_NEXT_CACHED_STACK(Last);
+    Cache->Count -= Taken;
+    MI_NEXT_CACHED_STACK(Last) = NULL;
+    *Tail = Last;
+    return Head;
+}
+
+static
+void
+MiPutStackBatch(
+    IN  PMM_STACK_CACHE Cache,
+    IN  void* Head,
+    IN  void* Tail,
+    IN  uint32_t Count
+)
+
+{
+    MI_NEXT_CACHED_STACK(Tail) = Cache->Head;
+    Cache->Head = Head;
+    Cache->Count += Count;
+}
+
+void*
+MmAllocateKernelStack(
+    IN  bool LargeStack
+)
+
+/*++
+
+    Routine description:
+
+        Allocates a kernel stack for a thread, reusing a cached one when possible.
+
+    Arguments:
+
+        [IN]    bool LargeStack - Determines if the stack allocated should be MI_LARGE_STACK_SIZE bytes long. (default is MI_STACK_SIZE)
+
+    Return Values:
+
+        Pointer to top of the stack, or NULL on failure (same as MiCreateKernelStack).
+
+    Notes:
+
+        A reused stack is not zeroed, it holds whatever the previous thread left on it.
+        Free it with MmFreeKernelStack, once nothing runs on it anymore.
+
+--*/
+
+{
+    IRQL OldIrql = PASSIVE_LEVEL;
+    bool Raised = false;
+    void* Stack = NULL;
+
+    // Stay on this processor, the caches are per processor.
+    if (MeGetCurrentIrql() < DISPATCH_LEVEL) {
+        MeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+        Raised = true;
+    }
+
+    PMM_STACK_CACHE Cache = &MeGetCurrentProcessor()->KernelStackCache[LargeStack];
+
+    if (!Cache->Count) {
+        // Refill half of the cache from the depot.
+        LOCK_QUEUE_HANDLE LockHandle;
+        void* Tail = NULL;
+
+        MsAcquireInStackQueuedSpinlockAtDpcLevel(&MiStackDepotLock, &LockHandle);
+        uint32_t Before = MiStackDepot[LargeStack].Count;
+        void* Batch = MiTakeStackBatch(&MiStackDepot[LargeStack], MI_STACK_CACHE_DEPTH / 2, &Tail);
+        uint32_t Taken = Before - MiStackDepot[LargeStack].Count;
+        MsReleaseInStackQueuedSpinlockFromDpcLevel(&LockHandle);
+
+        if (Batch) MiPutStackBatch(Cache, Batch, Tail, Taken);
+    }
+
+    if (Cache->Count) {
+        Stack = Cache->Head;
+        Cache->Head = MI_NEXT_CACHED_STACK(Stack);
+        Cache->Count--;
+        MeIncrementCounter(PerfCounterStackCacheHits);
+    }
+
+    if (Raised) MeLowerIrql(OldIrql);
+
+    if (Stack) return Stack;
+
+    MeIncrementCounter(PerfCounterStackCacheMisses);
+    return MiCreateKernelStack(LargeStack);
+}
+
+void
+MmFreeKernelStack(
+    IN void* AllocatedStackTop,
+    IN bool LargeStack
+)
+
+/*++
+
+    Routine description:
+
+        Frees a kernel stack allocated by MmAllocateKernelStack (or MiCreateKernelStack), caching it for the next thread.
+
+    Arguments:
+
+        [IN]    void* AllocatedStackTop - The pointer given by MmAllocateKernelStack.
+        [IN]    bool LargeStack - Signifies if the stack is MI_LARGE_STACK_SIZE bytes long (true), or MI_STACK_SIZE bytes long (false)
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        Callable at DISPATCH_LEVEL (PsDeleteThread runs from the scheduler), stacks that aren't cached are deleted by the stack reaper.
+
+--*/
+
+{
+    IRQL OldIrql = PASSIVE_LEVEL;
+    bool Raised = false;
+
+    // Low on memory, let the reaper delete this stack, and the ones in the depot.
+    if (PfnDatabase.AvailablePages < MI_STACK_CACHE_LOW_MEMORY) {
+        MmTrimKernelStackCache();
+        PsDeferKernelStackDeletion(AllocatedStackTop, LargeStack);
+        return;
+    }
+
+    if (MeGetCurrentIrql() < DISPATCH_LEVEL) {
+        MeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+        Raised = true;
+    }
+
+    PMM_STACK_CACHE Cache = &MeGetCurrentProcessor()->KernelStackCache[LargeStack];
+    MI_NEXT_CACHED_STACK(AllocatedStackTop) = Cache->Head;
+    Cache->Head = AllocatedStackTop;
+    Cache->Count++;
+
+    void* Overflow = NULL;
+
+    if (Cache->Count > MI_STACK_CACHE_DEPTH) {
+        // Move half of the cache to the depot, what doesn't fit there is deleted.
+        LOCK_QUEUE_HANDLE LockHandle;
+        void* Tail = NULL;
+        uint32_t Before = Cache->Count;
+        void* Batch = MiTakeStackBatch(Cache, MI_STACK_CACHE_DEPTH / 2, &Tail);
+        uint32_t Taken = Before - Cache->Count;
+
+        MsAcquireInStackQueuedSpinlockAtDpcLevel(&MiStackDepotLock, &LockHandle);
+        if (MiStackDepot[LargeStack].Count + Taken <= MI_STACK_DEPOT_DEPTH) {
+            MiPutStackBatch(&MiStackDepot[LargeStack], Batch, Tail, Taken);
+        }
+        else {
+            Overflow = Batch;
+        }
+        MsReleaseInStackQueuedSpinlockFromDpcLevel(&LockHandle);
+    }
+
+    if (Raised) MeLowerIrql(OldIrql);
+
+    while (Overflow) {
+        void* Next = MI_NEXT_CACHED_STACK(Overflow);
+        PsDeferKernelStackDeletion(Overflow, LargeStack);
+        Overflow = Next;
+    }
+}
+
+void
+MmTrimKernelStackCache(
+    void
+)
+
+/*++
+
+    Routine description:
+
+        Hands every stack of the depot to the stack reaper for deletion.
+
+    Arguments:
+
+        None.
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        Called when memory is low, the processor caches are left alone (at most MI_STACK_CACHE_DEPTH stacks each).
+
+--*/
+
+{
+    for (int Large = 0; Large < 2; Large++) {
+        LOCK_QUEUE_HANDLE LockHandle;
+
+        MsAcquireInStackQueuedSpinlock(&MiStackDepotLock, &LockHandle);
+        void* Stack = MiStackDepot[Large].Head;
+        MiStackDepot[Large].Head = NULL;
+        MiStackDepot[Large].Count = 0;
+        MsReleaseInStackQueuedSpinlock(&LockHandle);
+
+        while (Stack) {
+            void* Next = MI_NEXT_CACHED_STACK(Stack);
+            PsDeferKernelStackDeletion(Stack, Large != 0);
+            Stack = Next;
+        }
+    }
+}
+
 MTSTATUS
 MmCreateProcessAddressSpace(
     OUT void** DirectoryTable
@@ -290,7 +536,7 @@ MmCreateProcessAddressSpace(
     MmFullBarrier();
 
     // Unmap from Hyperspace.
-    MiUnmapHyperSpaceMap(oldIrql);
+    MiUnmapHyperSpaceMap(pml4Base, oldIrql);
 
     // Return the Physical Address.
     // The scheduler will load this into CR3 when switching to this process.
@@ -352,22 +598,25 @@ MiFreePageTableHierarchy(
             isPresent = true;
             childPfn = MiTranslatePteToPfn(&pte);
 
-            // We dont support large pages yet (or we do and I didnt update this comment)
-            // But we will scan for them anyway to prevent bugs in the future (faults and such)
+            // User large pages (2 MiB, see MiResolveLargePageFault).
             if (Level > 1 && (pte.Value & PAGE_PS)) {
                 isLargePage = true;
             }
         }
 
         // Unmap immediately so we can use Hyperspace in the recursion
-        MiUnmapHyperSpaceMap(oldIrql);
+        MiUnmapHyperSpaceMap(mapping, oldIrql);
 
         // Process the entry if it was valid
         if (isPresent && childPfn != PFN_ERROR) {
 
             if (Level > 1) {
-                if (isLargePage) {
-                    // It's a 2MB or 1GB user page. Release the physical memory directly.
+                if (isLargePage && Level == 2) {
+                    // A 2 MiB run goes back to the large page pool.
+                    MiReleaseLargePage(childPfn);
+                }
+                else if (isLargePage) {
+                    // It's a 1GB user page. Release the physical memory directly.
                     MiReleasePhysicalPage(childPfn);
                 }
                 else {
@@ -565,9 +814,78 @@ MmCreateTeb(
     PTEB* Teb = (PTEB*)OutTeb;
     if (MT_SUCCEEDED(Status)) {
         *Teb = BaseAddress;
-    }
 
-    // Set Thread->InternalThread->Teb (TODO)
+        // The scheduler loads it as the thread's user GS base on every switch.
+        Thread->Teb = BaseAddress;
+    }
 
     return Status;
+}
+
+// Frame of the shared user data page, PFN_ERROR until MmCreateSharedUserData.
+PAGE_INDEX MiSharedUserDataPfn = PFN_ERROR;
+
+void*
+MmCreateSharedUserData(
+    void
+)
+
+/*++
+
+    Routine description:
+
+        Allocates the frame of the shared user data page, the kernel writes it through the returned address.
+
+    Arguments:
+
+        None.
+
+    Return Values:
+
+        The kernel virtual address of the zeroed page, NULL on failure.
+
+    Notes:
+
+        Called once at boot, before the first process is created.
+        The frame is never freed, the allocation keeps a reference and every process mapping adds one (see MmAccessFault).
+
+--*/
+
+{
+    void* Page = MmAllocateContigiousMemory(VirtualPageSize, UINT64_T_MAX);
+    if (!Page) return NULL;
+
+    kmemset(Page, 0, VirtualPageSize);
+    MiSharedUserDataPfn = MiTranslatePteToPfn(MiGetPtePointer((uintptr_t)Page));
+    return Page;
+}
+
+MTSTATUS
+MmMapSharedUserData(
+    IN PEPROCESS Process
+)
+
+/*++
+
+    Routine description:
+
+        Reserves the shared user data page in the process address space, at MM_SHARED_USER_DATA_VA.
+
+    Arguments:
+
+        [IN] PEPROCESS Process - The process being created.
+
+    Return Values:
+
+        MTSTATUS Status code.
+
+    Notes:
+
+        Only the VAD is created, the first read faults the shared frame in (read only, no execute).
+
+--*/
+
+{
+    void* BaseAddress = (void*)MM_SHARED_USER_DATA_VA;
+    return MmAllocateVirtualMemory(Process, &BaseAddress, VirtualPageSize, VAD_FLAG_READ | VAD_FLAG_SHARED_USER_DATA);
 }
\ No newline at end of file
@@ -29,6 +29,7 @@ Revision History:
 MM_PFN_DATABASE PfnDatabase;
 bool MmPfnDatabaseInitialized = false;
 PAGE_INDEX MmHighestPfn = 0;
+bool MmLargePagesEnabled = true; // User faults may map 2 MiB pages from the large page pool.
 
 uint64_t MmTotalMemory = 0;
 uint64_t MmTotalUsableMemory = 0;
@@ -98,6 +99,58 @@ MiReservePhysRange(
     }
 }
 
+static
+void
+MiInitializeLargePagePool(
+    void
+)
+
+/*++
+
+    Routine description:
+
+        Moves 2 MiB aligned runs of free frames from the free list to the large page list.
+
+    Arguments:
+
+        None.
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        At most half of the free frames go to the pool. 4 KiB requests break runs up once the other lists are empty,
+        so the pool never makes memory unavailable, it only keeps the 4 KiB allocations off the aligned runs for as long as it can.
+
+--*/
+
+{
+    size_t Budget = PfnDatabase.FreePageList.Count / 2;
+
+    for (PAGE_INDEX Base = 0; Base + MI_LARGE_PAGE_FRAMES <= PfnDatabase.TotalPageCount && Budget >= MI_LARGE_PAGE_FRAMES; Base += MI_LARGE_PAGE_FRAMES) {
+        PAGE_INDEX i;
+        for (i = 0; i < MI_LARGE_PAGE_FRAMES; i++) {
+            if (PfnDatabase.PfnEntries[Base + i].State != PfnStateFree) break;
+        }
+        if (i != MI_LARGE_PAGE_FRAMES) continue;
+
+        // Only the first frame of the run stays linked.
+        for (i = 0; i < MI_LARGE_PAGE_FRAMES; i++) {
+            PPFN_ENTRY Entry = &PfnDatabase.PfnEntries[Base + i];
+            RemoveEntryList(&Entry->Descriptor.ListEntry);
+            Entry->Descriptor.ListEntry.Flink = Entry->Descriptor.ListEntry.Blink = NULL;
+            Entry->Flags = PFN_FLAG_LARGE_PAGE;
+        }
+
+        InsertTailList(&PfnDatabase.LargePageList.ListEntry, &PfnDatabase.PfnEntries[Base].Descriptor.ListEntry);
+        PfnDatabase.FreePageList.Count -= MI_LARGE_PAGE_FRAMES;
+        PfnDatabase.LargePageList.Count++;
+        Budget -= MI_LARGE_PAGE_FRAMES;
+    }
+}
+
 MTSTATUS
 MiInitializePfnDatabase(
     IN  PBOOT_INFO BootInfo
@@ -165,6 +218,7 @@ MiInitializePfnDatabase(
     InitializeListHead(&PfnDatabase.StandbyPageList.ListEntry);
     InitializeListHead(&PfnDatabase.ZeroedPageList.ListEntry);
     InitializeListHead(&PfnDatabase.ModifiedPageList.ListEntry);
+    InitializeListHead(&PfnDatabase.LargePageList.ListEntry);
 
     // Map the whole region, acquire its PTE for each 4KiB.
     uint64_t neededPages = (neededRam + VirtualPageSize - 1) / VirtualPageSize; 
@@ -200,14 +254,16 @@ MiInitializePfnDatabase(
     PfnDatabase.StandbyPageList.Count = 0;
     PfnDatabase.ZeroedPageList.Count = 0;
     PfnDatabase.ModifiedPageList.Count = 0;
+    PfnDatabase.LargePageList.Count = 0;
 
     // Initialize locks
-    PfnDatabase.PfnDatabaseLock.locked = 0;
-    PfnDatabase.BadPageList.PfnListLock.locked = 0;
-    PfnDatabase.StandbyPageList.PfnListLock.locked = 0;
-    PfnDatabase.ZeroedPageList.PfnListLock.locked = 0;
-    PfnDatabase.FreePageList.PfnListLock.locked = 0;
-    PfnDatabase.ModifiedPageList.PfnListLock.locked = 0;
+    PfnDatabase.PfnDatabaseLock.Tail = NULL;
+    PfnDatabase.BadPageList.PfnListLock.Tail = NULL;
+    PfnDatabase.StandbyPageList.PfnListLock.Tail = NULL;
+    PfnDatabase.ZeroedPageList.PfnListLock.Tail = NULL;
+    PfnDatabase.FreePageList.PfnListLock.Tail = NULL;
+    PfnDatabase.ModifiedPageList.PfnListLock.Tail = NULL;
+    PfnDatabase.LargePageList.PfnListLock.Tail = NULL;
 
     // Reserve the PFN Array in the PFN List.
     MiReservePhysRange(pfn_region_phys, neededPages * VirtualPageSize);
@@ -292,6 +348,9 @@ MiInitializePfnDatabase(
         desc = (PEFI_MEMORY_DESCRIPTOR)((uint8_t*)desc + BootInfo->DescriptorSize);
     }
 
+    // Keep some of the aligned runs whole for user large pages.
+    MiInitializeLargePagePool();
+
     // Set the global state as initialized.
     MmPfnDatabaseInitialized = true;
     MmHighestPfn = lastPfnIdx;
@@ -329,6 +388,54 @@ MiReleaseAnyPage(
     return pPfnEntry;
 }
 
+static
+bool
+MiBreakLargePageRun(
+    void
+)
+
+/*++
+
+    Routine description:
+
+        Moves a run of the large page pool to the free list.
+
+    Arguments:
+
+        None.
+
+    Return Values:
+
+        True if a run was moved, false if the pool is empty.
+
+    Notes:
+
+        Called with the PFN database lock held (at DISPATCH_LEVEL).
+
+--*/
+
+{
+    LOCK_QUEUE_HANDLE ListLockHandle;
+
+    MsAcquireInStackQueuedSpinlockAtDpcLevel(&PfnDatabase.LargePageList.PfnListLock, &ListLockHandle);
+    PPFN_ENTRY Head = MiReleaseAnyPage(&PfnDatabase.LargePageList.ListEntry);
+    if (Head) InterlockedDecrementU64(&PfnDatabase.LargePageList.Count);
+    MsReleaseInStackQueuedSpinlockFromDpcLevel(&ListLockHandle);
+
+    if (!Head) return false;
+
+    // The frames were available all along, AvailablePages doesn't change.
+    MsAcquireInStackQueuedSpinlockAtDpcLevel(&PfnDatabase.FreePageList.PfnListLock, &ListLockHandle);
+    for (PAGE_INDEX i = 0; i < MI_LARGE_PAGE_FRAMES; i++) {
+        Head[i].Flags = PFN_FLAG_NONE;
+        InsertTailList(&PfnDatabase.FreePageList.ListEntry, &Head[i].Descriptor.ListEntry);
+    }
+    InterlockedAddU64(&PfnDatabase.FreePageList.Count, MI_LARGE_PAGE_FRAMES);
+    MsReleaseInStackQueuedSpinlockFromDpcLevel(&ListLockHandle);
+
+    return true;
+}
+
 PAGE_INDEX
 MiRequestPhysicalPage(
     IN  PFN_STATE ListType
@@ -356,18 +463,19 @@ MiRequestPhysicalPage(
 
 {  
     // Declarations
-    IRQL oldIrql;
-    IRQL DbIrql;
+    LOCK_QUEUE_HANDLE ListLockHandle;
+    LOCK_QUEUE_HANDLE DbLockHandle;
     PPFN_ENTRY pfn = NULL;
     PFN_STATE oldState; // To know if we need to zero
 
     // Acquire global PFN DB lock.
-    MsAcquireSpinlock(&PfnDatabase.PfnDatabaseLock, &DbIrql);
+    MsAcquireInStackQueuedSpinlock(&PfnDatabase.PfnDatabaseLock, &DbLockHandle);
     
+    // We are at DISPATCH_LEVEL now, the list locks do not need to touch the IRQL.
     // 1. Try ZeroedPageList
-    MsAcquireSpinlock(&PfnDatabase.ZeroedPageList.PfnListLock, &oldIrql);
+    MsAcquireInStackQueuedSpinlockAtDpcLevel(&PfnDatabase.ZeroedPageList.PfnListLock, &ListLockHandle);
     pfn = MiReleaseAnyPage(&PfnDatabase.ZeroedPageList.ListEntry);
-    MsReleaseSpinlock(&PfnDatabase.ZeroedPageList.PfnListLock, oldIrql);
+    MsReleaseInStackQueuedSpinlockFromDpcLevel(&ListLockHandle);
     if (pfn) {
         InterlockedDecrementU64(&PfnDatabase.ZeroedPageList.Count);
         oldState = PfnStateZeroed;
@@ -375,9 +483,9 @@ MiRequestPhysicalPage(
     }
 
     // 2. Try FreePageList
-    MsAcquireSpinlock(&PfnDatabase.FreePageList.PfnListLock, &oldIrql);
+    MsAcquireInStackQueuedSpinlockAtDpcLevel(&PfnDatabase.FreePageList.PfnListLock, &ListLockHandle);
     pfn = MiReleaseAnyPage(&PfnDatabase.FreePageList.ListEntry);
-    MsReleaseSpinlock(&PfnDatabase.FreePageList.PfnListLock, oldIrql);
+    MsReleaseInStackQueuedSpinlockFromDpcLevel(&ListLockHandle);
     if (pfn) {
         InterlockedDecrementU64(&PfnDatabase.FreePageList.Count);
         oldState = PfnStateFree;
@@ -385,21 +493,33 @@ MiRequestPhysicalPage(
     }
 
     // 3. Try StandbyPageList
-    MsAcquireSpinlock(&PfnDatabase.StandbyPageList.PfnListLock, &oldIrql);
+    MsAcquireInStackQueuedSpinlockAtDpcLevel(&PfnDatabase.StandbyPageList.PfnListLock, &ListLockHandle);
     pfn = MiReleaseAnyPage(&PfnDatabase.StandbyPageList.ListEntry);
-    MsReleaseSpinlock(&PfnDatabase.StandbyPageList.PfnListLock, oldIrql);
+    MsReleaseInStackQueuedSpinlockFromDpcLevel(&ListLockHandle);
     if (pfn) {
         InterlockedDecrementU64(&PfnDatabase.StandbyPageList.Count);
         oldState = PfnStateStandby;
         goto found;
     }
 
-    // 4. All lists are empty
+    // 4. Break up a run of the large page pool, 4 KiB requests come first.
+    if (MiBreakLargePageRun()) {
+        MsAcquireInStackQueuedSpinlockAtDpcLevel(&PfnDatabase.FreePageList.PfnListLock, &ListLockHandle);
+        pfn = MiReleaseAnyPage(&PfnDatabase.FreePageList.ListEntry);
+        MsReleaseInStackQueuedSpinlockFromDpcLevel(&ListLockHandle);
+        if (pfn) {
+            InterlockedDecrementU64(&PfnDatabase.FreePageList.Count);
+            oldState = PfnStateFree;
+            goto found;
+        }
+    }
+
+    // 5. All lists are empty
     // TODO: Paging (flush modified list to disk, give a page from there.)
     // If paging fails, that means a buggy storage driver, a thread starve, or other (view the NO_PAGES_AVAILABLE 0x4D bugcheck in msdn)
    
     // Release Global Lock
-    MsReleaseSpinlock(&PfnDatabase.PfnDatabaseLock, DbIrql);
+    MsReleaseInStackQueuedSpinlock(&DbLockHandle);
     return PFN_ERROR;
 
 found:
@@ -411,7 +531,7 @@ found:
     pfn->RefCount = 1;
 
     // Release Global Lock
-    MsReleaseSpinlock(&PfnDatabase.PfnDatabaseLock, DbIrql);
+    MsReleaseInStackQueuedSpinlock(&DbLockHandle);
     // Decrement total available pages
     InterlockedDecrementU64(&PfnDatabase.AvailablePages);
 
@@ -421,13 +541,128 @@ found:
     if (ListType == PfnStateZeroed && oldState != PfnStateZeroed) {
         IRQL hyperIrql;
         uint8_t* va = MiMapPageInHyperspace(pfnIndex, &hyperIrql);
-        kmemset(va, 0, VirtualPageSize);
-        MiUnmapHyperSpaceMap(hyperIrql);
+        MiZeroPage(va);
+        MiUnmapHyperSpaceMap(va, hyperIrql);
     }
 
     return pfnIndex;
 }
 
+PAGE_INDEX
+MiRequestLargePage(
+    void
+)
+
+/*++
+
+    Routine description:
+
+        Retrieves a zeroed, 2 MiB aligned run of physical frames from the large page pool.
+
+    Arguments:
+
+        None.
+
+    Return Values:
+
+        PFN Index of the first frame of the run, PFN_ERROR if the pool is empty.
+
+    Notes:
+
+        Every frame of the run is active with a single reference and PFN_FLAG_LARGE_PAGE, the caller maps it and sets the
+        mapping of the first frame. Release it with MiReleaseLargePage (or map it with 4 KiB PTEs first, see MiSplitLargePage).
+
+--*/
+
+{
+    LOCK_QUEUE_HANDLE DbLockHandle;
+    LOCK_QUEUE_HANDLE ListLockHandle;
+
+    MsAcquireInStackQueuedSpinlock(&PfnDatabase.PfnDatabaseLock, &DbLockHandle);
+
+    MsAcquireInStackQueuedSpinlockAtDpcLevel(&PfnDatabase.LargePageList.PfnListLock, &ListLockHandle);
+    PPFN_ENTRY Head = MiReleaseAnyPage(&PfnDatabase.LargePageList.ListEntry);
+    if (Head) InterlockedDecrementU64(&PfnDatabase.LargePageList.Count);
+    MsReleaseInStackQueuedSpinlockFromDpcLevel(&ListLockHandle);
+
+    if (!Head) {
+        MsReleaseInStackQueuedSpinlock(&DbLockHandle);
+        return PFN_ERROR;
+    }
+
+    // Claim every frame while locked.
+    for (PAGE_INDEX i = 0; i < MI_LARGE_PAGE_FRAMES; i++) {
+        assert((Head[i].RefCount) == 0);
+        Head[i].State = PfnStateActive;
+        Head[i].Flags = PFN_FLAG_LARGE_PAGE;
+        Head[i].RefCount = 1;
+        Head[i].Descriptor.Mapping.Vad = NULL;
+        Head[i].Descriptor.Mapping.PteAddress = NULL;
+    }
+
+    MsReleaseInStackQueuedSpinlock(&DbLockHandle);
+    InterlockedAddU64(&PfnDatabase.AvailablePages, (uint64_t)-MI_LARGE_PAGE_FRAMES);
+
+    // Pool runs are not kept zeroed, clear them a frame at a time. MiMapPageInHyperspace hands out the direct map
+    // address of usable RAM (no hyperspace slot, no IRQL change), the slot is only used before the direct map exists.
+    PAGE_INDEX PfnIndex = PPFN_TO_INDEX(Head);
+    for (PAGE_INDEX i = 0; i < MI_LARGE_PAGE_FRAMES; i++) {
+        IRQL hyperIrql;
+        uint8_t* va = MiMapPageInHyperspace(PfnIndex + i, &hyperIrql);
+        MiZeroPage(va);
+        MiUnmapHyperSpaceMap(va, hyperIrql);
+
+        // The unmap leaves the frame in transition, it is ours and about to be mapped.
+        Head[i].State = PfnStateActive;
+    }
+
+    return PfnIndex;
+}
+
+void
+MiReleaseLargePage(
+    IN  PAGE_INDEX PfnIndex
+)
+
+/*++
+
+    Routine description:
+
+        Returns a run given by MiRequestLargePage to the large page pool.
+
+    Arguments:
+
+        [IN]    PAGE_INDEX PfnIndex - First frame of the run.
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        The run must not be mapped anymore (the PDE is cleared and the TLBs flushed).
+
+--*/
+
+{
+    LOCK_QUEUE_HANDLE LockHandle;
+    PPFN_ENTRY Head = INDEX_TO_PPFN(PfnIndex);
+
+    assert((PfnIndex & (MI_LARGE_PAGE_FRAMES - 1)) == 0 && (Head->Flags & PFN_FLAG_LARGE_PAGE));
+
+    for (PAGE_INDEX i = 0; i < MI_LARGE_PAGE_FRAMES; i++) {
+        Head[i].RefCount = 0;
+        Head[i].State = PfnStateFree;
+        Head[i].Descriptor.ListEntry.Flink = Head[i].Descriptor.ListEntry.Blink = NULL;
+    }
+
+    MsAcquireInStackQueuedSpinlock(&PfnDatabase.LargePageList.PfnListLock, &LockHandle);
+    InsertTailList(&PfnDatabase.LargePageList.ListEntry, &Head->Descriptor.ListEntry);
+    InterlockedIncrementU64(&PfnDatabase.LargePageList.Count);
+    InterlockedAddU64(&PfnDatabase.AvailablePages, MI_LARGE_PAGE_FRAMES);
+    MsReleaseInStackQueuedSpinlock(&LockHandle);
+}
+
 extern char MiReleasePhysicalPage_start;
 extern char MiReleasePhysicalPage_end;
 
@@ -477,9 +712,9 @@ MiReleasePhysicalPage(
             if (pfn->Descriptor.Mapping.PteAddress != NULL &&
                 pfn->Descriptor.Mapping.PteAddress->Hard.Dirty) {
                 // Dirty bit is set, we throw it back to the modified page list.
-                IRQL oldIrql;
+                LOCK_QUEUE_HANDLE LockHandle;
                 pfn->State = PfnStateModified;
-                MsAcquireSpinlock(&PfnDatabase.ModifiedPageList.PfnListLock, &oldIrql);
+                MsAcquireInStackQueuedSpinlock(&PfnDatabase.ModifiedPageList.PfnListLock, &LockHandle);
                 InsertTailList(&PfnDatabase.ModifiedPageList.ListEntry, &pfn->Descriptor.ListEntry);
                 
                 // Increment the counters
@@ -489,11 +724,11 @@ MiReleasePhysicalPage(
                 // 
                 //InterlockedIncrementU64(&PfnDatabase.AvailablePages);
                 
-                MsReleaseSpinlock(&PfnDatabase.ModifiedPageList.PfnListLock, oldIrql);
+                MsReleaseInStackQueuedSpinlock(&LockHandle);
             }
             else {
                 // Dirty bit is not set, we throw it to the standby list.
-                IRQL oldIrql;
+                LOCK_QUEUE_HANDLE LockHandle;
                 pfn->State = PfnStateStandby;
 
                 // Grab the PTE address now, BEFORE we touch the linked list
@@ -511,14 +746,14 @@ MiReleasePhysicalPage(
                 // Now it is safe to put the PFN back into list, since now we are allowed to overwrite the union.
                 // Before, MiAtomicSetTransitionPte was given an overwritten pte address (which was the flink of the pfn itself)
                 // Corrupting the PFN List.
-                MsAcquireSpinlock(&PfnDatabase.StandbyPageList.PfnListLock, &oldIrql);
+                MsAcquireInStackQueuedSpinlock(&PfnDatabase.StandbyPageList.PfnListLock, &LockHandle);
                 InsertTailList(&PfnDatabase.StandbyPageList.ListEntry, &pfn->Descriptor.ListEntry);
 
                 // Increment the counters
                 InterlockedIncrementU64(&PfnDatabase.StandbyPageList.Count);
                 InterlockedIncrementU64(&PfnDatabase.AvailablePages);
 
-                MsReleaseSpinlock(&PfnDatabase.StandbyPageList.PfnListLock, oldIrql);
+                MsReleaseInStackQueuedSpinlock(&LockHandle);
             }
         }
     }
@@ -555,8 +790,8 @@ MiUnlinkPageFromList(
 // Unlink a specified PPFN_ENTRY from its PfnDb list.
 
 {
-    IRQL oldIrql;
-    SPINLOCK* lock = NULL;
+    LOCK_QUEUE_HANDLE LockHandle;
+    PQUEUED_SPINLOCK lock = NULL;
     volatile uint64_t* count = NULL;
 
     /* Determine which list this PFN is on and pick the corresponding lock/count */
@@ -578,7 +813,7 @@ MiUnlinkPageFromList(
         return;
     }
 
-    MsAcquireSpinlock(lock, &oldIrql);
+    MsAcquireInStackQueuedSpinlock(lock, &LockHandle);
 
     /*
      * Guard: if the entry isn't linked (both pointers NULL) then nothing to do.
@@ -586,7 +821,7 @@ MiUnlinkPageFromList(
      */
     if (pfn->Descriptor.ListEntry.Flink == NULL &&
         pfn->Descriptor.ListEntry.Blink == NULL) {
-        MsReleaseSpinlock(lock, oldIrql);
+        MsReleaseInStackQueuedSpinlock(&LockHandle);
         return;
     }
 
@@ -600,5 +835,5 @@ MiUnlinkPageFromList(
     InterlockedDecrementU64(count);
     InterlockedDecrementU64(&PfnDatabase.AvailablePages);
 
-    MsReleaseSpinlock(lock, oldIrql);
+    MsReleaseInStackQueuedSpinlock(&LockHandle);
 }
\ No newline at end of file
@@ -19,6 +19,7 @@ Revision History:
 #include "../../includes/mm.h"
 #include "../../includes/me.h"
 #include "../../includes/mg.h"
+#include "../../includes/md.h"
 #include "../../assert.h"
 
 // Can hold any size. (NonPaged)
@@ -529,6 +530,7 @@ MmAllocatePoolWithTag(
 
     if (PoolType == PagedPool) {
         // Use the internal paged pool allocator.
+        MeIncrementCounter(PerfCounterPagedPoolAllocations);
         return MiAllocatePagedPool(NumberOfBytes, Tag);
     }
 
@@ -564,6 +566,7 @@ MmAllocatePoolWithTag(
 
     if (Desc == NULL) {
         // Allocation is larger than 2048 bytes, use the large pool allocator.
+        MeIncrementCounter(PerfCounterPoolLargeAllocations);
         return MiAllocateLargePool(PoolType, NumberOfBytes, Tag);
     }
     
@@ -623,6 +626,7 @@ MmAllocatePoolWithTag(
     // it usually (USUALLY, maybe it changed) came from acquiring a physical page with a zeroed pfn state value
     // so the page comes zeroed, which means the memset below can be skipped) (PERFORMANCE TODO)
     kmemset(UserAddress, 0, NumberOfBytes);
+    MeIncrementCounter(PerfCounterPoolAllocations);
 
     // Return the pointer (exclude metadata start).
     return UserAddress;
@@ -659,11 +663,12 @@ MmFreePool(
 {
     if (!buf) return;
     assert(MeGetCurrentIrql() <= DISPATCH_LEVEL, "Any pool frees must not happen with IRQL higher than DISPATCH.");
+    MeIncrementCounter(PerfCounterPoolFrees);
 
     // Convert the buffer to the header.
     PPOOL_HEADER header = (PPOOL_HEADER)((uint8_t*)buf - sizeof(POOL_HEADER));
 
-    gop_printf(COLOR_YELLOW, "MmFreePool called with IRQL: %d | Header: %p\n", MeGetCurrentIrql(), header);
+    MdLog(LogLevelTrace, COLOR_YELLOW, "MmFreePool called with IRQL: %d | Header: %p\n", MeGetCurrentIrql(), header);
 
     if (header->PoolCanary != 'BEKA') {
         MeBugCheckEx(
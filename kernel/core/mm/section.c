@@ -20,6 +20,22 @@ Revision History:
 #include "../../includes/ob.h"
 #include "../../includes/mg.h"
 #include "../../includes/fs.h"
+#include "../../includes/ps.h"
+#include "../../includes/exception.h"
+
+static
+void
+MiRelocateImageView(
+    IN PMM_IMAGE Image,
+    IN uintptr_t BaseAddress
+)
+
+// Relocates a view in place, the caller is attached to the process.
+{
+    for (size_t i = 0; i < Image->RelocationCount; i++) {
+        *(uintptr_t*)(BaseAddress + Image->Relocations[i].Rva) = BaseAddress + (uintptr_t)Image->Relocations[i].Addend;
+    }
+}
 
 MTSTATUS
 MmCreateSection(
@@ -27,33 +43,32 @@ MmCreateSection(
     IN struct _FILE_OBJECT* FileObject
 )
 {
-    MTE_HEADER Header;
+    PMM_IMAGE Image;
     MTSTATUS Status;
     // Assume failure.
     *SectionHandle = 0;
 
-    // Read the header from the file.
-    Status = FsReadFile(FileObject, 0, &Header, sizeof(MTE_HEADER), NULL);
+    // Get the parsed image (the file is only read by the first section created for it).
+    Status = MmReferenceImage(FileObject, &Image);
     if (MT_FAILURE(Status)) {
-        return Status;
-    }
-
-    // Validate header magic.
-    if (kmemcmp(Header.Magic, "MTE\0", 4) != 0) {
-        // Invalid header.
 #ifdef DEBUG
-        gop_printf(COLOR_RED, "Invalid executable given, magic is not MTE.\n");
+        if (Status == MT_INVALID_IMAGE_FORMAT) gop_printf(COLOR_RED, "Invalid executable given, magic is not MTE.\n");
 #endif
-        return MT_INVALID_IMAGE_FORMAT;
+        return Status;
     }
+    MTE_HEADER Header = Image->Header;
 
     // Allocate the actual section object (pool)
     PMM_SECTION NewSection = NULL;
     Status = ObCreateObject(MmSectionType, sizeof(MM_SECTION), (void**)&NewSection);
-    if (MT_FAILURE(Status)) return Status;
+    if (MT_FAILURE(Status)) {
+        MmDereferenceImage(Image);
+        return Status;
+    }
 
     // Set fields
     NewSection->FileObject = FileObject;
+    NewSection->Image = Image;
     NewSection->EntryPointOffset = Header.EntryRVA;
     NewSection->PreferredBase = Header.PreferredImageBase;
 
@@ -78,7 +93,7 @@ MmCreateSection(
     NewSection->Bss.IsDemandZero = 1;
 
     // The file end RVA is just the file size.
-    uintptr_t FileEndRVA = FileObject->FileSize;
+    uintptr_t FileEndRVA = Image->FileSize;
 
     // Configure the WholeFileSection.
     // This represents the chunk of virtual memory that maps directly to the file.
@@ -146,11 +161,20 @@ MmMapViewOfSection(
 
     // Store the file and fileoffset into the vad we just got.
     // IMPORTANT: We map from FileOffset 0. This exposes the MTE Header in memory.
+    // The VAD lock keeps the VAD alive (and the fields consistent for the fault handler) while we write them.
+    // Pages fault from the cached image, pre-relocated when this base has a shared copy.
+    const uint8_t* Contents = MiGetImageContents(Section->Image, load_base);
+
+    MsAcquirePushLockExclusive(&Process->VadLock);
     PMMVAD Vad = MiFindVad(Process, load_base);
     if (Vad) {
         Vad->File = Section->FileObject;
         Vad->FileOffset = Section->WholeFileSection.FileOffset; // 0
+        InterlockedIncrementU64(&Section->Image->ReferenceCount);
+        Vad->ImageContents = Contents ? Contents : Section->Image->Contents;
+        Vad->Image = Section->Image;
     }
+    MsReleasePushLockExclusive(&Process->VadLock);
 
     // .bss lives immediately after the file data in Virtual Memory.
     if (Section->Bss.VirtualSize > 0) {
@@ -182,6 +206,25 @@ MmMapViewOfSection(
         }
     }
 
+    // No relocated copy for this base, fix the view up in the process (this dirties every relocated page).
+    if (!Contents) {
+        APC_STATE ApcState;
+        MeAttachProcess(&Process->InternalProcess, &ApcState);
+
+        try {
+            MiRelocateImageView(Section->Image, load_base);
+        } except{
+            Status = GetExceptionCode();
+        } end_try;
+
+        MeDetachProcess(&ApcState);
+
+        if (MT_FAILURE(Status)) {
+            MmFreeVirtualMemory(Process, (void*)load_base);
+            goto Cleanup;
+        }
+    }
+
     // The true base address is at load_base
     *BaseAddress = (void*)load_base;
 
@@ -205,4 +248,8 @@ MmpDeleteSection(
     if (Section->FileObject) {
         ObDereferenceObject(Section->FileObject);
     }
+
+    if (Section->Image) {
+        MmDereferenceImage(Section->Image);
+    }
 }
\ No newline at end of file
@@ -53,7 +53,7 @@ MiGetNodeHeight(
 
 FORCEINLINE
 void
-MiUpdateNodeHeight(
+MiUpdateNode(
     IN  PMMVAD Node
 )
 
@@ -61,7 +61,7 @@ MiUpdateNodeHeight(
 
     Routine description:
 
-        Updates the node's height based on its children.
+        Updates the node's height, span and largest gap based on its children.
 
     Arguments:
 
@@ -71,11 +71,36 @@ MiUpdateNodeHeight(
 
         None.
 
+    Notes:
+
+        The children must be up to date, update bottom up.
+
 --*/
 
 {
     if (!Node) return;
-    Node->Height = 1 + MAX(MiGetNodeHeight(Node->LeftChild), MiGetNodeHeight(Node->RightChild));
+    PMMVAD Left = Node->LeftChild;
+    PMMVAD Right = Node->RightChild;
+
+    Node->Height = 1 + MAX(MiGetNodeHeight(Left), MiGetNodeHeight(Right));
+
+    // The gaps of the subtree are the children's, and the two between the children and this node.
+    uintptr_t MaxGap = 0;
+    Node->SubtreeStartVa = Node->StartVa;
+    Node->SubtreeEndVa = Node->EndVa;
+
+    if (Left) {
+        MaxGap = MAX(Left->MaxGap, Node->StartVa - Left->SubtreeEndVa - 1);
+        Node->SubtreeStartVa = Left->SubtreeStartVa;
+    }
+
+    if (Right) {
+        MaxGap = MAX(MaxGap, Right->MaxGap);
+        MaxGap = MAX(MaxGap, Right->SubtreeStartVa - Node->EndVa - 1);
+        Node->SubtreeEndVa = Right->SubtreeEndVa;
+    }
+
+    Node->MaxGap = MaxGap;
 }
 
 FORCEINLINE
@@ -137,6 +162,20 @@ MiAllocateVad(
 }
 
 
+static
+void
+MiFreeVadEpoch(
+    IN PEPOCH_ENTRY EpochEntry
+)
+
+{
+    PMMVAD Vad = CONTAINING_RECORD(EpochEntry, MMVAD, EpochEntry);
+
+    // The fault handler may still have been copying from it until now.
+    if (Vad->Image) MmDereferenceImage(Vad->Image);
+    MmFreePool(Vad);
+}
+
 static
 void
 MiFreeVad(
@@ -157,10 +196,14 @@ MiFreeVad(
 
         None.
 
+    Notes:
+
+        The VAD must be unlinked from the tree, the free is deferred until no lock-free MiFindVad can still be walking through it.
+
 --*/
 
 {
-    return MmFreePool((void*)Vad);
+    MsEpochDefer(&Vad->EpochEntry, MiFreeVadEpoch);
 }
 
 static
@@ -205,9 +248,9 @@ MiRotateRight(
     y->Parent = x;
     if (T2) T2->Parent = y;
 
-    // Update heights (update Y before X, since the function uses X)
-    MiUpdateNodeHeight(y);
-    MiUpdateNodeHeight(x);
+    // Update heights and gaps (update Y before X, since the function uses X)
+    MiUpdateNode(y);
+    MiUpdateNode(x);
 
     // Return new root of subtree.
     return x;
@@ -255,9 +298,9 @@ MiRotateLeft(
     x->Parent = y;
     if (T2) T2->Parent = x;
 
-    // Update heights (update X before Y, since the function uses Y)
-    MiUpdateNodeHeight(x);
-    MiUpdateNodeHeight(y);
+    // Update heights and gaps (update X before Y, since the function uses Y)
+    MiUpdateNode(x);
+    MiUpdateNode(y);
 
     // Return new root of subtree.
     return y;
@@ -348,6 +391,30 @@ MiCheckVadOverlap(
     return false;
 }
 
+#define MAX_VAD_DEPTH 64 // Usually enough for a 64-bit tree
+#define MAX_VAD_LOOKUP_RETRIES 3 // Lock-free attempts before MiFindVad falls back to the shared lock
+
+static
+void
+MiBeginVadUpdate(
+    IN PEPROCESS Process
+)
+
+{
+    // Odd sequence, lock-free lookups that overlap the update will retry.
+    InterlockedIncrementU64(&Process->VadSequence);
+}
+
+static
+void
+MiEndVadUpdate(
+    IN PEPROCESS Process
+)
+
+{
+    InterlockedIncrementU64(&Process->VadSequence);
+}
+
 PMMVAD
 MiFindVad(
     IN  PEPROCESS Process,
@@ -369,10 +436,63 @@ MiFindVad(
 
         Returns the VAD if found, NULL otherwise.
 
+    Notes:
+
+        The walk is lock-free (validated by the process VadSequence), the caller must either be in an epoch section
+        or hold the VadLock, and must not use the VAD after leaving it.
+
+        The last VAD found is checked before walking the tree (Process->VadHint), a hint published by a lookup that
+        raced a delete is rejected through the VAD's Unlinked flag.
+
+        Callers holding the VadLock exclusive (MmFreeVirtualMemory, MmMapViewOfSection) never reach the shared lock fallback,
+        nobody can update the tree under them, so the first lock-free attempt always validates.
+
 --*/
 
 {
-    // Acquire the reading lock for the process.
+    for (int Try = 0; Try < MAX_VAD_LOOKUP_RETRIES; Try++) {
+        uint64_t Sequence = InterlockedFetchU64(&Process->VadSequence);
+
+        // A writer is in the middle of an update.
+        if (Sequence & 1) continue;
+
+        // VADs are freed through the epoch and we are in an epoch section (or hold the lock), the hint can be read.
+        // It may name a VAD deleted before Sequence (published late by a lookup that raced the delete),
+        // the delete set Unlinked before ending its update, so it is visible here.
+        PMMVAD Hint = InterlockedFetchPointer((volatile void* volatile*)&Process->VadHint);
+        if (Hint && VirtualAddress >= Hint->StartVa && VirtualAddress <= Hint->EndVa &&
+            !__atomic_load_n(&Hint->Unlinked, __ATOMIC_ACQUIRE) &&
+            InterlockedFetchU64(&Process->VadSequence) == Sequence) {
+            return Hint;
+        }
+
+        PMMVAD current = InterlockedFetchPointer((volatile void* volatile*)&Process->VadRoot);
+        PMMVAD found = NULL;
+
+        // Rotations can send us down the wrong path, but never into freed memory, bound the walk and let the sequence decide.
+        for (int Depth = 0; current && Depth < MAX_VAD_DEPTH; Depth++) {
+            if (VirtualAddress < current->StartVa) {
+                current = InterlockedFetchPointer((volatile void* volatile*)&current->LeftChild);
+            }
+            else if (VirtualAddress > current->EndVa) {
+                current = InterlockedFetchPointer((volatile void* volatile*)&current->RightChild);
+            }
+            else {
+                found = current;
+                break;
+            }
+        }
+
+        // The tree didn't change while we walked it, the result is exact.
+        if (InterlockedFetchU64(&Process->VadSequence) == Sequence) {
+            // Only a validated result becomes the hint.
+            if (found) InterlockedExchangePointer((volatile void* volatile*)&Process->VadHint, found);
+            return found;
+        }
+    }
+
+    // Too much update traffic, wait for the writers (an exclusive owner of the VadLock validates on its first attempt).
+    assert(Process->VadLock.Owner != MeGetCurrentThread());
     MsAcquirePushLockShared(&Process->VadLock);
 
     PMMVAD current = Process->VadRoot;
@@ -390,6 +510,8 @@ MiFindVad(
 
         // Then, it must be inside of this VAD.
         else {
+            // Deletes hold the lock exclusively, the hint can't go stale under us.
+            InterlockedExchangePointer((volatile void* volatile*)&Process->VadHint, current);
             MsReleasePushLockShared(&Process->VadLock);
             return current;
         }
@@ -426,7 +548,12 @@ MiInsertVadNode(
 
 {
     // Found the best spot to insert
-    if (!Node) return NewVad;
+    if (!Node) {
+        NewVad->LeftChild = NULL;
+        NewVad->RightChild = NULL;
+        MiUpdateNode(NewVad);
+        return NewVad;
+    }
 
     // Recursive step
     if (NewVad->StartVa < Node->StartVa) {
@@ -441,8 +568,8 @@ MiInsertVadNode(
         if (newRight) newRight->Parent = Node;
     }
 
-    // Update height
-    MiUpdateNodeHeight(Node);
+    // Update height and gaps
+    MiUpdateNode(Node);
 
     // Get balance, and rebalance the tree if needed.
     int balance = MiGetBalanceFactor(Node);
@@ -536,28 +663,25 @@ MiDeleteVadNode(
         else {
             PMMVAD successor = MiFindMinimumVad(Root->RightChild);
 
-            // Save Root's tree links
-            PMMVAD oldLeft = Root->LeftChild;
-            PMMVAD oldParent = Root->Parent;
-
-            // Copy all of successor's data (data + tree links)
-            kmemcpy(Root, successor, sizeof(MMVAD));
+            // Unlink the successor from the right subtree (it has no left child, so that is the simple case).
+            PMMVAD newRight = MiDeleteVadNode(Root->RightChild, successor);
 
-            // Restore Root's original tree links
-            Root->LeftChild = oldLeft;
-            Root->Parent = oldParent;
+            // The successor node itself takes Root's place, VADs are never copied,
+            // the caller frees VadToDelete (Root) and lock-free lookups or PFNs may still point at the successor.
+            successor->LeftChild = Root->LeftChild;
+            successor->RightChild = newRight;
+            successor->Parent = Root->Parent;
 
-            // Update parent pointers for Root's children
-            if (Root->LeftChild) Root->LeftChild->Parent = Root;
-            if (Root->RightChild) Root->RightChild->Parent = Root; // successor's right
+            // Update parent pointers for the successor's new children
+            if (successor->LeftChild) successor->LeftChild->Parent = successor;
+            if (successor->RightChild) successor->RightChild->Parent = successor;
 
-            // Now delete the original successor
-            Root->RightChild = MiDeleteVadNode(Root->RightChild, successor);
+            Root = successor;
         }
     }
 
-    // Update height.
-    MiUpdateNodeHeight(Root);
+    // Update height and gaps.
+    MiUpdateNode(Root);
 
     // Get balance and rebalance if needed.
     int balance = MiGetBalanceFactor(Root);
@@ -591,131 +715,109 @@ MiDeleteVadNode(
     return Root;
 }
 
-#define MAX_VAD_DEPTH 64 // Usually enough for a 64-bit tree
-
 static
 uintptr_t
-MiFindGap(
-    IN  PEPROCESS Process,
-    IN  size_t NumberOfBytes,
+MiFindGapInSubtree(
+    IN  PMMVAD Node,
+    IN  uintptr_t Lower,
+    IN  uintptr_t Upper,
+    IN  size_t Size,
     IN  uintptr_t SearchStart,
-    IN  uintptr_t SearchEnd    // exclusive
+    IN  uintptr_t SearchEnd
 )
 
 /*++
 
     Routine description:
 
-        Finds a VA gap in the VAD Tree using an iterative in-order traversal. (does NOT claim the gap)
+        Finds the lowest gap of Size bytes in a subtree, between its neighbours outside of it.
 
     Arguments:
 
-        [IN] PMMVAD Root - The ROOT of the VAD Tree.
-        [IN] size_t NumberOfBytes - The size of the gap needed.
+        [IN] PMMVAD Node - Root of the subtree (may be NULL).
+        [IN] uintptr_t Lower - First address after the VAD before the subtree (inclusive).
+        [IN] uintptr_t Upper - Start of the VAD after the subtree (exclusive).
+        [IN] size_t Size - Page aligned size of the gap.
         [IN] uintptr_t SearchStart - Inclusive start of the search range.
-        [IN] uintptr_t SearchEnd   - Exclusive end of the search range.
+        [IN] uintptr_t SearchEnd - Exclusive end of the search range.
 
     Return Values:
 
-        Start of VA that has enough bytes for 'size'. 0 If gap isn't found.
+        Page aligned start of the gap, 0 if the subtree has none.
+
+    Notes:
+
+        Subtrees outside of the range or without a large enough gap are skipped, the search is O(log n).
 
 --*/
+
 {
-    if (SearchStart >= SearchEnd) return 0;                // invalid range
-    if (NumberOfBytes == 0) return 0;                     // no zero-sized allocations
-    if (SearchStart == 0) return 0;                       // defensive: we don't expect VA 0
+    // Nothing of this subtree's space is in the range.
+    if (Upper <= SearchStart || Lower >= SearchEnd) return 0;
 
-    PMMVAD vadStack[MAX_VAD_DEPTH];
-    int stackTop = -1;
+    if (!Node) {
+        uintptr_t GapStart = ALIGN_UP(MAX(Lower, SearchStart), VirtualPageSize);
+        uintptr_t GapEnd = MIN(Upper, SearchEnd);
 
-    // Acquire the reading lock.
-    MsAcquirePushLockShared(&Process->VadLock);
+        if (GapStart < GapEnd && GapEnd - GapStart >= Size) return GapStart;
+        return 0;
+    }
 
-    PMMVAD current = Process->VadRoot;
-    size_t size_needed = ALIGN_UP(NumberOfBytes, VirtualPageSize);
+    // The largest gap this subtree can offer, inside of it or at its edges.
+    uintptr_t Largest = Node->MaxGap;
+    Largest = MAX(Largest, Node->SubtreeStartVa - Lower);
+    Largest = MAX(Largest, Upper - Node->SubtreeEndVa - 1);
+    if (Largest < Size) return 0;
 
-    // Start from one byte before SearchStart so ALIGN_UP(lastEndVa + 1, page) == aligned SearchStart
-    uintptr_t lastEndVa = SearchStart - 1;
+    // First fit, lower addresses first.
+    uintptr_t GapStart = MiFindGapInSubtree(Node->LeftChild, Lower, Node->StartVa, Size, SearchStart, SearchEnd);
+    if (GapStart) return GapStart;
 
-    stackTop = -1; // Reset stack (you already use this global stack)
+    return MiFindGapInSubtree(Node->RightChild, Node->EndVa + 1, Upper, Size, SearchStart, SearchEnd);
+}
 
-    while (current != NULL || stackTop != -1) {
-        // Go all the way left, pushing nodes onto the stack
-        while (current != NULL) {
-            if (stackTop + 1 >= MAX_VAD_DEPTH) {
-                // Tree is too deep (shouldn't happen if we balanced it though)
-                MsReleasePushLockShared(&Process->VadLock);
-                return 0;
-            }
-            vadStack[++stackTop] = current;
-            current = current->LeftChild;
-        }
+static
+uintptr_t
+MiFindGap(
+    IN  PEPROCESS Process,
+    IN  size_t NumberOfBytes,
+    IN  uintptr_t SearchStart,
+    IN  uintptr_t SearchEnd    // exclusive
+)
 
-        // Pop the next in-order node
-        current = vadStack[stackTop--];
+/*++
 
-        // If this VAD is entirely before our search range, skip it.
-        if (current->EndVa < SearchStart) {
-            // Still update lastEndVa so gaps before SearchStart are ignored
-            if (current->EndVa > lastEndVa) lastEndVa = current->EndVa;
-            current = current->RightChild;
-            continue;
-        }
+    Routine description:
 
-        // If this VAD starts at/after the search end, we can check the final gap and exit.
-        if (current->StartVa >= SearchEnd) {
-            uintptr_t gapStart = ALIGN_UP(lastEndVa + 1, VirtualPageSize);
+        Finds a VA gap in the VAD Tree. (does NOT claim the gap)
 
-            // Overflow check: gapStart + size_needed must not wrap
-            if (gapStart <= (uintptr_t)-1 - (size_needed - 1)) {
-                if (gapStart + size_needed <= SearchEnd) {
-                    MsReleasePushLockShared(&Process->VadLock);
-                    return gapStart;
-                }
-            }
-            MsReleasePushLockShared(&Process->VadLock);
-            return 0;
-        }
+    Arguments:
 
-        // Normal case: VAD intersects our search range in some way.
-        // We compute gapStart relative to lastEndVa, but it must also be >= SearchStart.
-        uintptr_t gapStart = ALIGN_UP(lastEndVa + 1, VirtualPageSize);
-        if (gapStart < SearchStart) gapStart = ALIGN_UP(SearchStart, VirtualPageSize);
-
-        // If gapStart is strictly before this VAD's StartVa, we have candidate gap.
-        if (gapStart < current->StartVa) {
-            // check overflow and fit into both current VAD and SearchEnd
-            if (gapStart <= (uintptr_t)-1 - (size_needed - 1)) {
-                uintptr_t gapEndExclusive = gapStart + size_needed;
-                // must fit before current VAD and before SearchEnd (SearchEnd is exclusive)
-                if (gapEndExclusive <= current->StartVa && gapEndExclusive <= SearchEnd) {
-                    MsReleasePushLockShared(&Process->VadLock);
-                    return gapStart;
-                }
-            }
-        }
+        [IN] PEPROCESS Process - The process whose VAD tree is searched.
+        [IN] size_t NumberOfBytes - The size of the gap needed.
+        [IN] uintptr_t SearchStart - Inclusive start of the search range.
+        [IN] uintptr_t SearchEnd   - Exclusive end of the search range.
 
-        // Update lastEndVa to cover this VAD. ensure monotonicity.
-        if (current->EndVa > lastEndVa) lastEndVa = current->EndVa;
+    Return Values:
 
-        // Move to right subtree
-        current = current->RightChild;
-    }
+        Start of VA that has enough bytes for 'size'. 0 If gap isn't found.
 
-    // After traversing entire tree, check the gap between lastEndVa and SearchEnd (exclusive)
-    uintptr_t finalGapStart = ALIGN_UP(lastEndVa + 1, VirtualPageSize);
-    if (finalGapStart < SearchStart) finalGapStart = ALIGN_UP(SearchStart, VirtualPageSize);
+    Notes:
 
-    if (finalGapStart <= (uintptr_t)-1 - (size_needed - 1)) {
-        if (finalGapStart + size_needed <= SearchEnd) {
-            MsReleasePushLockShared(&Process->VadLock);
-            return finalGapStart;
-        }
-    }
+        The caller must hold the VadLock (shared at least), or the gap may be claimed before it is used.
 
-    // No gap found anywhere
-    MsReleasePushLockShared(&Process->VadLock);
-    return 0;
+--*/
+{
+    if (SearchStart >= SearchEnd) return 0;                // invalid range
+    if (NumberOfBytes == 0) return 0;                     // no zero-sized allocations
+    if (SearchStart == 0) return 0;                       // defensive: we don't expect VA 0
+
+    // Can't fit the range at all (also keeps the alignment below from wrapping).
+    if (NumberOfBytes > SearchEnd - SearchStart) return 0;
+    size_t size_needed = ALIGN_UP(NumberOfBytes, VirtualPageSize);
+
+    // Nothing is below the lowest VAD or above the highest one.
+    return MiFindGapInSubtree(Process->VadRoot, 0, UINTPTR_MAX, size_needed, SearchStart, SearchEnd);
 }
 
 // PUBLIC API
@@ -731,7 +833,10 @@ MmFindFreeAddressSpace(
 
 {
     if (Process && NumberOfBytes) {
-        return MiFindGap(Process, NumberOfBytes, SearchStart, SearchEnd);
+        MsAcquirePushLockShared(&Process->VadLock);
+        uintptr_t Gap = MiFindGap(Process, NumberOfBytes, SearchStart, SearchEnd);
+        MsReleasePushLockShared(&Process->VadLock);
+        return Gap;
     }
     return 0;
 }
@@ -793,38 +898,38 @@ MmAllocateVirtualMemory(
     size_t Pages = BYTES_TO_PAGES(NumberOfBytes);
     uintptr_t EndVa = StartVa + PAGES_TO_BYTES(Pages) - 1;
     bool checkForOverlap = true;
+    bool gapChosen = false;
+
+    // Acquire rundown protection for process
+    if (!MsAcquireRundownProtection(&Process->ProcessRundown)) {
+        return MT_INVALID_STATE;
+    }
+
+    // Acquire lock for this process VAD tree.
+    MsAcquirePushLockExclusive(&Process->VadLock);
 
     if (!StartVa) {
+        // Search and claim under the same lock, or another allocation could take the gap in between.
         // Its + 1 because its exclusive (so we want the actual end of the page, not excluding the last one)
-        StartVa = MiFindGap(Process, NumberOfBytes, USER_VA_START, (uintptr_t)USER_VA_END + 1);
-        if (!StartVa) return MT_NOT_FOUND;
-        
-        // Update the newly found address.
-        if (BaseAddress) {
-            try {
-                *BaseAddress = (void*)StartVa;
-            }
-            except{
-                return GetExceptionCode();
-            }
-            end_try;
+        // Large writable allocations start 2 MiB aligned, so their faults can map large pages (MiResolveLargePageFault).
+        if (NumberOfBytes >= MI_LARGE_PAGE_SIZE && (VadFlags & VAD_FLAG_WRITE) && !(VadFlags & VAD_FLAG_RESERVED)) {
+            StartVa = MiFindGap(Process, PAGES_TO_BYTES(Pages) + MI_LARGE_PAGE_SIZE - VirtualPageSize, USER_VA_START, (uintptr_t)USER_VA_END + 1);
+            if (StartVa) StartVa = ALIGN_UP(StartVa, MI_LARGE_PAGE_SIZE);
         }
-        
+        if (!StartVa) StartVa = MiFindGap(Process, NumberOfBytes, USER_VA_START, (uintptr_t)USER_VA_END + 1);
+        if (!StartVa) {
+            status = MT_NOT_FOUND;
+            goto cleanup;
+        }
+
         // No need to check for an overlap as if we found a sufficient gap, there is guranteed to be no overlap.
         checkForOverlap = false;
+        gapChosen = true;
 
         // Calculate the end VA.
         EndVa = StartVa + PAGES_TO_BYTES(Pages) - 1;
-    } 
-
-    // Acquire rundown protection for process
-    if (!MsAcquireRundownProtection(&Process->ProcessRundown)) {
-        return MT_INVALID_STATE;
     }
 
-    // Acquire lock for this process VAD tree.
-    MsAcquirePushLockExclusive(&Process->VadLock);
-
     // Check for overlap
     if (checkForOverlap && MiCheckVadOverlap(Process->VadRoot, StartVa, EndVa)) {
         status = MT_CONFLICTING_ADDRESSES;
@@ -842,17 +947,36 @@ MmAllocateVirtualMemory(
     newVad->EndVa = EndVa;
     newVad->Flags = VadFlags;
     newVad->OwningProcess = Process;
+    newVad->Image = NULL;
+    newVad->ImageContents = NULL;
+    newVad->LeftChild = NULL;
+    newVad->RightChild = NULL;
+    newVad->Parent = NULL;
 
     // TODO init file info if VAD_FLAG_MAPPED_FILE is set. (TODO FILE PAGING)
 
     // Insert the VAD into the the process's tree.
+    MiBeginVadUpdate(Process);
     Process->VadRoot = MiInsertVadNode(Process->VadRoot, newVad);
+    MiEndVadUpdate(Process);
     status = MT_SUCCESS;
     goto cleanup;
 
 cleanup:
     MsReleaseRundownProtection(&Process->ProcessRundown);
     MsReleasePushLockExclusive(&Process->VadLock);
+
+    // Update the newly found address, outside of the lock (the write may fault).
+    if (MT_SUCCEEDED(status) && gapChosen) {
+        try {
+            *BaseAddress = (void*)StartVa;
+        }
+        except{
+            status = GetExceptionCode();
+        }
+        end_try;
+    }
+
     return status;
 }
 
@@ -912,6 +1036,13 @@ MmFreeVirtualMemory(
 
     // Unmap all PTEs and physical pages from VAD.
     for (uintptr_t virtualaddr = VadToFree->StartVa; virtualaddr <= VadToFree->EndVa; virtualaddr += VirtualPageSize) {
+        // A large page inside the VAD goes back to the large page pool whole (one that isn't is split by MiGetPtePointer).
+        if ((virtualaddr & (MI_LARGE_PAGE_SIZE - 1)) == 0 && virtualaddr + MI_LARGE_PAGE_SIZE - 1 <= VadToFree->EndVa &&
+            MiUnmapLargePage(virtualaddr)) {
+            virtualaddr += MI_LARGE_PAGE_SIZE - VirtualPageSize;
+            continue;
+        }
+
         // Get the PTE pointer for the current VA.
         PMMPTE pte = MiGetPtePointer(virtualaddr);
         // Atomically unmap the PTE.
@@ -922,8 +1053,12 @@ MmFreeVirtualMemory(
         MiReleasePhysicalPage(pfn);
     }
 
-    // Delete the VAD from the tree.
+    // Delete the VAD from the tree, lookups must not find it through the hint either.
+    MiBeginVadUpdate(Process);
     Process->VadRoot = MiDeleteVadNode(Process->VadRoot, VadToFree);
+    __atomic_store_n(&VadToFree->Unlinked, true, __ATOMIC_RELEASE);
+    InterlockedCompareExchangePointer((volatile void* volatile*)&Process->VadHint, NULL, VadToFree);
+    MiEndVadUpdate(Process);
     // Free the VAD struct itself (from kernel's nonpagedpool memory, its not a double free)
     MiFreeVad(VadToFree);
 
@@ -0,0 +1,389 @@
+/*++
+
+Module Name:
+
+    epoch.c
+
+Purpose:
+
+    This translation unit contains the epoch based reclamation facility (lock-free readers, deferred frees).
+
+Author:
+
+    slep (Matanel) 2025.
+
+Revision History:
+
+--*/
+
+#include "../../includes/ms.h"
+#include "../../includes/me.h"
+#include "../../includes/mh.h"
+#include "../../includes/mm.h"
+#include "../../includes/ps.h"
+#include "../../assert.h"
+
+//
+// Readers here are preemptible (handle tables and VADs live in paged pool, so they are walked at PASSIVE_LEVEL),
+// a context switch alone does not prove a processor left its section.
+// So every processor counts the sections it entered and left, split by the parity of the epoch they started in.
+// The global epoch moves from E to E + 1 once every section of parity (E - 1) has ended,
+// which means an object retired at epoch E is unreachable once the epoch is E + 2.
+//
+// Schedule() and the timer are the quiescent points that push the epoch forward, only while something is waiting for it.
+//
+
+typedef struct _EPOCH_PROCESSOR {
+    volatile uint64_t Enters[2];        // Sections entered on this processor, per epoch parity
+    volatile uint64_t Exits[2];         // Sections left on this processor, per epoch parity
+    volatile void* Pending;             // Deferred entries retired on this processor (PEPOCH_ENTRY LIFO)
+} __attribute__((aligned(64))) EPOCH_PROCESSOR, *PEPOCH_PROCESSOR;
+
+static EPOCH_PROCESSOR EpochProcessors[MAX_CPUS];
+
+volatile uint64_t MsGlobalEpoch = 2;
+
+// Epoch the reclaim thread waits for, 0 if it isn't waiting.
+static volatile uint64_t EpochReclaimTarget;
+
+static EVENT EpochReclaimEvent = { .type = SynchronizationEvent };
+
+static
+PEPOCH_PROCESSOR
+MspGetEpochProcessor(
+    void
+)
+
+{
+    uint32_t Cpu = MeGetCurrentProcessorNumber();
+
+    // Never happens after SMP initialization, fold into the last slot if it does.
+    if (Cpu >= MAX_CPUS) Cpu = MAX_CPUS - 1;
+    return &EpochProcessors[Cpu];
+}
+
+void
+MsEnterEpoch(
+    OUT PEPOCH_SECTION Section
+)
+
+/*++
+
+    Routine description:
+
+        Enters an epoch section, objects reachable inside of it are not freed until MsLeaveEpoch.
+
+    Arguments:
+
+        [OUT]   PEPOCH_SECTION Section - Caller allocated section, passed to MsLeaveEpoch.
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        Callable at any IRQL, the section may be preempted and may migrate to another processor.
+        Sections do not block writers, keep them short anyway, the reclaim thread waits for them.
+
+--*/
+
+{
+    for (;;) {
+        uint64_t Epoch = InterlockedFetchU64(&MsGlobalEpoch);
+        uint32_t Index = (uint32_t)(Epoch & 1);
+        PEPOCH_PROCESSOR Processor = MspGetEpochProcessor();
+
+        // Locked increment, full barrier, the reads of the protected structure cannot move above it.
+        InterlockedIncrementU64(&Processor->Enters[Index]);
+
+        // If the epoch moved while we were counting ourselves, we may have been missed by the advance, count again.
+        if (InterlockedFetchU64(&MsGlobalEpoch) == Epoch) {
+            Section->Index = Index;
+            return;
+        }
+
+        InterlockedIncrementU64(&Processor->Exits[Index]);
+    }
+}
+
+void
+MsLeaveEpoch(
+    IN PEPOCH_SECTION Section
+)
+
+/*++
+
+    Routine description:
+
+        Leaves an epoch section entered with MsEnterEpoch.
+
+    Arguments:
+
+        [IN]    PEPOCH_SECTION Section - The section.
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        Pointers read inside the section must not be used afterwards, unless a reference was taken.
+
+--*/
+
+{
+    InterlockedIncrementU64(&MspGetEpochProcessor()->Exits[Section->Index & 1]);
+}
+
+static
+bool
+MspTryAdvanceEpoch(
+    void
+)
+
+/*++
+
+    Routine description:
+
+        Advances the global epoch if every section that started in the previous epoch has ended.
+
+    Arguments:
+
+        None.
+
+    Return Values:
+
+        True if the global epoch was advanced (by us or concurrently), false if readers are still in the way.
+
+    Notes:
+
+        Lock-free, callable from interrupt context.
+
+--*/
+
+{
+    uint64_t Epoch = InterlockedFetchU64(&MsGlobalEpoch);
+    uint32_t Index = (uint32_t)((Epoch - 1) & 1);
+    uint64_t Enters = 0, Exits = 0;
+
+    // Exits are summed first, a section that ends between the two sums is then counted as still active (never the opposite).
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        Exits += InterlockedFetchU64(&EpochProcessors[i].Exits[Index]);
+    }
+
+    MmFullBarrier();
+
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        Enters += InterlockedFetchU64(&EpochProcessors[i].Enters[Index]);
+    }
+
+    if (Enters != Exits) return false;
+
+    InterlockedCompareExchangeU64(&MsGlobalEpoch, Epoch + 1, Epoch);
+    return true;
+}
+
+void
+MsEpochDefer(
+    IN PEPOCH_ENTRY Entry,
+    IN EPOCH_ROUTINE Routine
+)
+
+/*++
+
+    Routine description:
+
+        Defers a routine (usually a free) until no epoch section can still reference the object.
+
+    Arguments:
+
+        [IN]    PEPOCH_ENTRY Entry - Entry embedded in the retired object.
+        [IN]    EPOCH_ROUTINE Routine - Routine to call with Entry, at PASSIVE_LEVEL.
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        The object must already be unlinked from every lock-free structure.
+        Callable at IRQL <= DISPATCH_LEVEL.
+
+--*/
+
+{
+    PEPOCH_PROCESSOR Processor = MspGetEpochProcessor();
+    void* Old;
+
+    Entry->Routine = Routine;
+
+    // The unlink must be visible before the epoch is sampled, a reader that enters later can no longer find the object.
+    MmFullBarrier();
+    Entry->Epoch = InterlockedFetchU64(&MsGlobalEpoch);
+
+    do {
+        Old = (void*)Processor->Pending;
+        Entry->Next = (PEPOCH_ENTRY)Old;
+    } while (InterlockedCompareExchangePointer((volatile void* volatile*)&Processor->Pending, (void*)Entry, Old) != Old);
+
+    // The reclaim thread empties the lists, so it only needs waking for the first entry.
+    if (!Old) {
+        MsSetEvent(&EpochReclaimEvent);
+    }
+}
+
+bool
+MsEpochQuiescentState(
+    IN bool WakeReclaimer
+)
+
+/*++
+
+    Routine description:
+
+        Reports a quiescent point (context switch, timer tick), advances the epoch if the reclaim thread waits for it.
+
+    Arguments:
+
+        [IN]    bool WakeReclaimer - True if the caller may signal events (IRQL <= DISPATCH_LEVEL, not in an interrupt handler).
+
+    Return Values:
+
+        True if the reclaim thread's grace period is over.
+
+    Notes:
+
+        A single load when there is nothing to reclaim.
+
+--*/
+
+{
+    uint64_t Target = EpochReclaimTarget;
+    if (!Target) return false;
+
+    if (InterlockedFetchU64(&MsGlobalEpoch) < Target) {
+        MspTryAdvanceEpoch();
+        if (InterlockedFetchU64(&MsGlobalEpoch) < Target) return false;
+    }
+
+    // Only one waker per grace period.
+    if (WakeReclaimer && InterlockedCompareExchangeU64(&EpochReclaimTarget, 0, Target) == Target) {
+        MsSetEvent(&EpochReclaimEvent);
+    }
+
+    return true;
+}
+
+static
+void
+MspEpochReclaimThread(
+    void
+)
+
+/*++
+
+    Routine description:
+
+        Collects the deferred entries of every processor, waits out their grace period, then calls their routines.
+
+    Arguments:
+
+        None.
+
+    Return Values:
+
+        None, never returns.
+
+--*/
+
+{
+    for (;;) {
+        PEPOCH_ENTRY Head = NULL;
+        PEPOCH_ENTRY Tail = NULL;
+        uint64_t Newest = 0;
+
+        MsWaitForEvent(&EpochReclaimEvent);
+
+        // Steal every processor's list.
+        for (uint32_t i = 0; i < MAX_CPUS; i++) {
+            PEPOCH_ENTRY List = (PEPOCH_ENTRY)InterlockedExchangePointer((volatile void* volatile*)&EpochProcessors[i].Pending, NULL);
+
+            while (List) {
+                PEPOCH_ENTRY Next = List->Next;
+                if (List->Epoch > Newest) Newest = List->Epoch;
+
+                List->Next = NULL;
+                if (Tail) Tail->Next = List;
+                else Head = List;
+                Tail = List;
+
+                List = Next;
+            }
+        }
+
+        if (!Head) continue;
+
+        // Wait for two epoch advances past the newest entry, Schedule() wakes us when it happens.
+        while (InterlockedFetchU64(&MsGlobalEpoch) < Newest + 2) {
+            InterlockedExchangeU64(&EpochReclaimTarget, Newest + 2);
+            if (MsEpochQuiescentState(false)) {
+                InterlockedExchangeU64(&EpochReclaimTarget, 0);
+                break;
+            }
+
+            MsWaitForEvent(&EpochReclaimEvent);
+        }
+
+        while (Head) {
+            PEPOCH_ENTRY Entry = Head;
+            Head = Entry->Next;
+            Entry->Routine(Entry);
+        }
+
+        // New entries may have been deferred while we waited (their wake was consumed by the wait), look again.
+        MsSetEvent(&EpochReclaimEvent);
+    }
+}
+
+void
+MsInitializeEpochReclamation(
+    void
+)
+
+/*++
+
+    Routine description:
+
+        Creates the epoch reclaim thread.
+
+    Arguments:
+
+        None.
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        Entries deferred before this is called simply wait in their lists.
+
+--*/
+
+{
+    PETHREAD ReclaimThread = NULL;
+    MTSTATUS Status = PsCreateSystemThread((ThreadEntry)MspEpochReclaimThread, NULL, LOW_TIMESLICE_TICKS, &ReclaimThread);
+
+    if (MT_FAILURE(Status)) {
+        MeBugCheckEx(
+            PSWORKER_INIT_FAILED,
+            (void*)(uintptr_t)Status,
+            NULL,
+            NULL,
+            NULL
+        );
+    }
+
+    ReclaimThread->WorkerThread = true;
+}
@@ -7,6 +7,7 @@
 #include "../../includes/me.h"
 #include "../../includes/ps.h"
 #include "../../includes/mg.h"
+#include "../../includes/md.h"
 #include "../../assert.h"
 
 MTSTATUS 
@@ -32,6 +33,7 @@ MsSetEvent (
 
 {
     if (!event) return MT_INVALID_ADDRESS;
+    MD_TRACE(TraceEventSet, event, 0);
 
     // NOTE: (TODO) Can we use push locks here? Events should only be used in PASSIVE_LEVEL to APC_LEVEL IRQL contexts,
     // holding a lock to raise to DISPATCH_LEVEL just delays us furthermore..
@@ -141,6 +143,7 @@ MsWaitForEvent (
 {
     if (!event) return MT_INVALID_ADDRESS;
     assert((MeGetCurrentIrql() < DISPATCH_LEVEL), "Blocking function called with DISPATCH_LEVEL IRQL or Higher.");
+    MD_TRACE(TraceEventWait, event, 0);
     IRQL flags;
     PETHREAD curr = PsGetCurrentThread();
 
@@ -166,7 +169,7 @@ MsWaitForEvent (
     // Keep event lock held only for enqueue; after this we release and block.
     MsReleaseSpinlock(&event->lock, flags);
 #ifdef DEBUG
-    gop_printf(COLOR_PURPLE, "Sleeping current thread: %p\n", PsGetCurrentThread());
+    MdLog(LogLevelTrace, COLOR_PURPLE, "Sleeping current thread: %p\n", PsGetCurrentThread());
 #endif
     assert((MeGetCurrentIrql()) < DISPATCH_LEVEL);
     MsYieldExecution(&curr->InternalThread.TrapRegisters);
@@ -174,4 +177,3 @@ MsWaitForEvent (
     // When we resume here, the waker has already moved us to the ready queue, and we are now an active thread on the CPU.
     return MT_SUCCESS;
 }
-
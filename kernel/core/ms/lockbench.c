@@ -0,0 +1,196 @@
+/*++
+
+Module Name:
+
+    lockbench.c
+
+Purpose:
+
+    This translation unit contains the spinlock microbenchmark (enabled with MT_LOCK_BENCHMARK in behavior.h).
+
+Author:
+
+    slep (Matanel) 2025.
+
+Revision History:
+
+--*/
+
+#include "../../includes/ms.h"
+#include "../../includes/me.h"
+#include "../../includes/mm.h"
+#include "../../includes/mh.h"
+#include "../../includes/mg.h"
+#include "../../includes/ps.h"
+#include "../../intrinsics/atomic.h"
+
+#define LOCKBENCH_PAGE_ITERATIONS 20000
+#define LOCKBENCH_LOCK_ITERATIONS 100000
+
+typedef enum _LOCKBENCH_PHASE {
+    LockBenchPageAllocation,    // MiRequestPhysicalPage + MiReleasePhysicalPage (PFN database locks)
+    LockBenchTestAndSet,        // The same critical section under a SPINLOCK (before)
+    LockBenchQueued,            // The same critical section under a QUEUED_SPINLOCK (after)
+    LockBenchPhaseMax
+} LOCKBENCH_PHASE;
+
+static const char* LockBenchPhaseNames[LockBenchPhaseMax] = {
+    "Page allocation (queued PFN locks)",
+    "Test-and-set spinlock",
+    "Queued spinlock"
+};
+
+static volatile uint32_t LockBenchArrived[LockBenchPhaseMax];
+static volatile uint32_t LockBenchFinished;
+static volatile uint32_t LockBenchWorkers;
+static uint64_t LockBenchCycles[LockBenchPhaseMax][MAX_CPUS];
+static uint64_t LockBenchOps[LockBenchPhaseMax][MAX_CPUS];
+static EVENT LockBenchDoneEvent;
+
+static SPINLOCK LockBenchSpinlock;
+static QUEUED_SPINLOCK LockBenchQueuedLock;
+
+// The critical section both lock types protect, touches a couple of shared cache lines.
+static volatile uint64_t LockBenchShared[16];
+
+static
+void
+MspLockBenchBarrier(
+    IN LOCKBENCH_PHASE Phase
+)
+{
+    InterlockedIncrementU32((volatile uint32_t*)&LockBenchArrived[Phase]);
+    while (InterlockedFetchU32((volatile uint32_t*)&LockBenchArrived[Phase]) < LockBenchWorkers) {
+        __pause();
+    }
+}
+
+static
+void
+MspLockBenchWorker(
+    IN THREAD_PARAMETER Parameter
+)
+{
+    uint32_t Index = (uint32_t)(uintptr_t)Parameter;
+    uint64_t Start, Ops;
+
+    // Phase 1: page allocation.
+    MspLockBenchBarrier(LockBenchPageAllocation);
+    Ops = 0;
+    Start = __rdtsc();
+    for (uint32_t i = 0; i < LOCKBENCH_PAGE_ITERATIONS; i++) {
+        PAGE_INDEX Pfn = MiRequestPhysicalPage(PfnStateFree);
+        if (Pfn == PFN_ERROR) break;
+
+        // Make the page look like an unmapped active page, so it goes back to the standby list on release.
+        PPFN_ENTRY Entry = INDEX_TO_PPFN(Pfn);
+        Entry->State = PfnStateActive;
+        Entry->Descriptor.Mapping.PteAddress = NULL;
+        Entry->Descriptor.Mapping.Vad = NULL;
+
+        MiReleasePhysicalPage(Pfn);
+        Ops++;
+    }
+    LockBenchCycles[LockBenchPageAllocation][Index] = __rdtsc() - Start;
+    LockBenchOps[LockBenchPageAllocation][Index] = Ops;
+
+    // Phase 2: test-and-set spinlock.
+    MspLockBenchBarrier(LockBenchTestAndSet);
+    Start = __rdtsc();
+    for (uint32_t i = 0; i < LOCKBENCH_LOCK_ITERATIONS; i++) {
+        IRQL OldIrql;
+        MsAcquireSpinlock(&LockBenchSpinlock, &OldIrql);
+        for (uint32_t j = 0; j < 16; j += 8) LockBenchShared[j]++;
+        MsReleaseSpinlock(&LockBenchSpinlock, OldIrql);
+    }
+    LockBenchCycles[LockBenchTestAndSet][Index] = __rdtsc() - Start;
+    LockBenchOps[LockBenchTestAndSet][Index] = LOCKBENCH_LOCK_ITERATIONS;
+
+    // Phase 3: queued spinlock.
+    MspLockBenchBarrier(LockBenchQueued);
+    Start = __rdtsc();
+    for (uint32_t i = 0; i < LOCKBENCH_LOCK_ITERATIONS; i++) {
+        LOCK_QUEUE_HANDLE LockHandle;
+        MsAcquireInStackQueuedSpinlock(&LockBenchQueuedLock, &LockHandle);
+        for (uint32_t j = 0; j < 16; j += 8) LockBenchShared[j]++;
+        MsReleaseInStackQueuedSpinlock(&LockHandle);
+    }
+    LockBenchCycles[LockBenchQueued][Index] = __rdtsc() - Start;
+    LockBenchOps[LockBenchQueued][Index] = LOCKBENCH_LOCK_ITERATIONS;
+
+    // The last worker wakes the controller.
+    if (InterlockedIncrementU32((volatile uint32_t*)&LockBenchFinished) == LockBenchWorkers) {
+        MsSetEvent(&LockBenchDoneEvent);
+    }
+}
+
+void
+MsRunLockBenchmark(
+    IN THREAD_PARAMETER Parameter
+)
+
+/*++
+
+    Routine description:
+
+        Spinlock microbenchmark thread.
+        Starts one worker per processor, every worker hammers page allocation (the PFN database locks),
+        and then runs the same critical section under a test-and-set spinlock and a queued spinlock, so the two can be compared.
+
+    Arguments:
+
+        [IN]    THREAD_PARAMETER Parameter - Unused.
+
+    Return Values:
+
+        None, results are printed to the screen as operations per million TSC cycles (wall clock of the slowest worker).
+
+    Notes:
+
+        Must be started after SMP initialization, otherwise a single processor is measured.
+
+--*/
+
+{
+    UNREFERENCED_PARAMETER(Parameter);
+
+    LockBenchWorkers = MeGetActiveProcessorCount();
+    if (LockBenchWorkers > MAX_CPUS) LockBenchWorkers = MAX_CPUS;
+
+    LockBenchSpinlock.locked = 0;
+    LockBenchQueuedLock.Tail = NULL;
+    LockBenchFinished = 0;
+    for (uint32_t Phase = 0; Phase < LockBenchPhaseMax; Phase++) LockBenchArrived[Phase] = 0;
+
+    kmemset(&LockBenchDoneEvent, 0, sizeof(LockBenchDoneEvent));
+    LockBenchDoneEvent.type = SynchronizationEvent;
+
+    gop_printf(COLOR_CYAN, "[LOCKBENCH] Starting %u workers.\n", LockBenchWorkers);
+
+    for (uint32_t i = 0; i < LockBenchWorkers; i++) {
+        MTSTATUS Status = PsCreateSystemThread(MspLockBenchWorker, (THREAD_PARAMETER)(uintptr_t)i, DEFAULT_TIMESLICE_TICKS, NULL);
+        if (MT_FAILURE(Status)) {
+            gop_printf(COLOR_RED, "[LOCKBENCH] Failed to create worker %u: %x\n", i, Status);
+            if (i == 0) return;
+
+            // Continue with the workers we already have.
+            InterlockedExchangeU32((volatile uint32_t*)&LockBenchWorkers, i);
+            break;
+        }
+    }
+
+    MsWaitForEvent(&LockBenchDoneEvent);
+
+    for (uint32_t Phase = 0; Phase < LockBenchPhaseMax; Phase++) {
+        uint64_t TotalOps = 0;
+        uint64_t MaxCycles = 1;
+
+        for (uint32_t i = 0; i < LockBenchWorkers; i++) {
+            TotalOps += LockBenchOps[Phase][i];
+            if (LockBenchCycles[Phase][i] > MaxCycles) MaxCycles = LockBenchCycles[Phase][i];
+        }
+
+        gop_printf(COLOR_CYAN, "[LOCKBENCH] %s: %lu ops in %lu cycles (%lu ops/Mcycle)\n",
+            LockBenchPhaseNames[Phase], TotalOps, MaxCycles, (TotalOps * 1000000) / MaxCycles);
+    }
+}
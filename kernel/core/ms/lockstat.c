@@ -0,0 +1,281 @@
+/*++
+
+Module Name:
+
+    lockstat.c
+
+Purpose:
+
+    This translation unit contains the lock contention profiler (built with LOCKSTAT=1, which defines MT_LOCK_STATISTICS).
+
+Author:
+
+    slep (Matanel) 2025.
+
+Revision History:
+
+--*/
+
+#include "../../includes/ms.h"
+#include "../../includes/me.h"
+#include "../../includes/mh.h"
+#include "../../includes/mm.h"
+
+#ifdef MT_LOCK_STATISTICS
+
+// Every processor records into its own table, so the lock routines never share a cache line (or a lock) for statistics.
+typedef struct _LOCK_STATISTICS_TABLE {
+    LOCK_STATISTICS_ENTRY Entries[LOCK_STATISTICS_TABLE_SIZE];
+    uint64_t DroppedRecords;
+} __attribute__((aligned(64))) LOCK_STATISTICS_TABLE, *PLOCK_STATISTICS_TABLE;
+
+static LOCK_STATISTICS_TABLE LockStatTables[MAX_CPUS];
+
+static
+PLOCK_STATISTICS_ENTRY
+MspLookupLockStatEntry(
+    IN PLOCK_STATISTICS_TABLE Table,
+    IN uint64_t CallSite,
+    IN LOCK_STATISTICS_TYPE Type
+)
+
+/*++
+
+    Routine description:
+
+        Finds (or claims) the slot of a call site in a per-CPU table, open addressing with linear probing.
+
+    Arguments:
+
+        [IN]    PLOCK_STATISTICS_TABLE Table - The current processor's table.
+        [IN]    uint64_t CallSite - The call site.
+        [IN]    LOCK_STATISTICS_TYPE Type - The lock type.
+
+    Return Values:
+
+        Pointer to the entry, or NULL if the table is full.
+
+    Notes:
+
+        Interrupts must be disabled, the table is only ever written by its own processor.
+
+--*/
+
+{
+    uint32_t Index = (uint32_t)(((CallSite ^ Type) * 0x9E3779B97F4A7C15ULL) >> 32) & (LOCK_STATISTICS_TABLE_SIZE - 1);
+
+    for (uint32_t i = 0; i < LOCK_STATISTICS_TABLE_SIZE; i++) {
+        PLOCK_STATISTICS_ENTRY Entry = &Table->Entries[(Index + i) & (LOCK_STATISTICS_TABLE_SIZE - 1)];
+
+        if (Entry->CallSite == CallSite && Entry->Type == (uint32_t)Type) {
+            return Entry;
+        }
+
+        if (Entry->CallSite == 0) {
+            // Claim the slot, the type is written first so a reader never sees a half claimed slot with a valid site.
+            Entry->Type = Type;
+            __asm__ volatile("" ::: "memory");
+            Entry->CallSite = CallSite;
+            return Entry;
+        }
+    }
+
+    return NULL;
+}
+
+void
+MsLockStatRecordAcquire(
+    IN void* CallSite,
+    IN LOCK_STATISTICS_TYPE Type,
+    IN uint64_t SpinCycles,
+    IN bool Contended
+)
+
+/*++
+
+    Routine description:
+
+        Records a lock acquisition for a call site on the current processor.
+
+    Arguments:
+
+        [IN]    void* CallSite - Return address of the acquire routine.
+        [IN]    LOCK_STATISTICS_TYPE Type - The lock type.
+        [IN]    uint64_t SpinCycles - TSC cycles spent waiting for the lock.
+        [IN]    bool Contended - True if the lock wasn't free on the first try.
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        Called from the lock routines themselves, so it must not take any lock.
+
+--*/
+
+{
+    bool Enabled = MeDisableInterrupts();
+    uint32_t Cpu = MeGetCurrentProcessorNumber();
+
+    if (Cpu < MAX_CPUS) {
+        PLOCK_STATISTICS_TABLE Table = &LockStatTables[Cpu];
+        PLOCK_STATISTICS_ENTRY Entry = MspLookupLockStatEntry(Table, (uint64_t)(uintptr_t)CallSite, Type);
+
+        if (Entry) {
+            Entry->Acquires++;
+            if (Contended) Entry->Contended++;
+            Entry->SpinCycles += SpinCycles;
+            if (SpinCycles > Entry->MaxSpinCycles) Entry->MaxSpinCycles = SpinCycles;
+        }
+        else {
+            Table->DroppedRecords++;
+        }
+    }
+
+    MeEnableInterrupts(Enabled);
+}
+
+void
+MsLockStatRecordRelease(
+    IN void* CallSite,
+    IN LOCK_STATISTICS_TYPE Type,
+    IN uint64_t HoldCycles
+)
+
+/*++
+
+    Routine description:
+
+        Records the hold time of a lock, attributed to the call site that acquired it.
+
+    Arguments:
+
+        [IN]    void* CallSite - Call site stamped in the lock on acquire.
+        [IN]    LOCK_STATISTICS_TYPE Type - The lock type.
+        [IN]    uint64_t HoldCycles - TSC cycles between the acquire and this release.
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        The release may run on another processor than the acquire (sleeping locks), the entry is created there if needed.
+
+--*/
+
+{
+    // Locks that were initialized while held (or never stamped) have no site.
+    if (!CallSite) return;
+
+    bool Enabled = MeDisableInterrupts();
+    uint32_t Cpu = MeGetCurrentProcessorNumber();
+
+    if (Cpu < MAX_CPUS) {
+        PLOCK_STATISTICS_TABLE Table = &LockStatTables[Cpu];
+        PLOCK_STATISTICS_ENTRY Entry = MspLookupLockStatEntry(Table, (uint64_t)(uintptr_t)CallSite, Type);
+
+        if (Entry) {
+            Entry->HoldCycles += HoldCycles;
+            if (HoldCycles > Entry->MaxHoldCycles) Entry->MaxHoldCycles = HoldCycles;
+        }
+        else {
+            Table->DroppedRecords++;
+        }
+    }
+
+    MeEnableInterrupts(Enabled);
+}
+
+uint32_t
+MsSnapshotLockStatistics(
+    OUT PLOCK_STATISTICS_ENTRY Entries,
+    IN uint32_t MaxEntries,
+    OUT uint64_t* DroppedRecords
+)
+
+/*++
+
+    Routine description:
+
+        Merges the per-CPU tables into a single list of call sites, sorted by total spin cycles (most contended first).
+
+    Arguments:
+
+        [OUT]   PLOCK_STATISTICS_ENTRY Entries - Kernel buffer that receives the merged entries.
+        [IN]    uint32_t MaxEntries - Capacity of Entries.
+        [OUT]   uint64_t* DroppedRecords - Receives the records lost to full tables (and sites that didn't fit in Entries).
+
+    Return Values:
+
+        The amount of entries written.
+
+    Notes:
+
+        The tables are read without stopping the other processors, so the snapshot is not atomic, but every counter is.
+
+--*/
+
+{
+    uint32_t Count = 0;
+    uint64_t Dropped = 0;
+    uint32_t Processors = MeGetActiveProcessorCount();
+    if (Processors > MAX_CPUS) Processors = MAX_CPUS;
+
+    for (uint32_t Cpu = 0; Cpu < Processors; Cpu++) {
+        PLOCK_STATISTICS_TABLE Table = &LockStatTables[Cpu];
+        Dropped += Table->DroppedRecords;
+
+        for (uint32_t i = 0; i < LOCK_STATISTICS_TABLE_SIZE; i++) {
+            LOCK_STATISTICS_ENTRY Source = Table->Entries[i];
+            if (!Source.CallSite) continue;
+
+            // Find the merged entry of this site.
+            PLOCK_STATISTICS_ENTRY Target = NULL;
+            for (uint32_t j = 0; j < Count; j++) {
+                if (Entries[j].CallSite == Source.CallSite && Entries[j].Type == Source.Type) {
+                    Target = &Entries[j];
+                    break;
+                }
+            }
+
+            if (!Target) {
+                if (Count == MaxEntries) {
+                    Dropped += Source.Acquires;
+                    continue;
+                }
+
+                Target = &Entries[Count++];
+                kmemset(Target, 0, sizeof(*Target));
+                Target->CallSite = Source.CallSite;
+                Target->Type = Source.Type;
+            }
+
+            Target->Acquires += Source.Acquires;
+            Target->Contended += Source.Contended;
+            Target->SpinCycles += Source.SpinCycles;
+            Target->HoldCycles += Source.HoldCycles;
+            if (Source.MaxSpinCycles > Target->MaxSpinCycles) Target->MaxSpinCycles = Source.MaxSpinCycles;
+            if (Source.MaxHoldCycles > Target->MaxHoldCycles) Target->MaxHoldCycles = Source.MaxHoldCycles;
+        }
+    }
+
+    // Insertion sort, most spin cycles first.
+    for (uint32_t i = 1; i < Count; i++) {
+        LOCK_STATISTICS_ENTRY Key = Entries[i];
+        uint32_t j = i;
+
+        while (j > 0 && Entries[j - 1].SpinCycles < Key.SpinCycles) {
+            Entries[j] = Entries[j - 1];
+            j--;
+        }
+
+        Entries[j] = Key;
+    }
+
+    if (DroppedRecords) *DroppedRecords = Dropped;
+    return Count;
+}
+
+#endif
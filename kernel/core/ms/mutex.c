@@ -102,6 +102,8 @@ MsAcquireMutexObject (
 
     IRQL mflags;
     assert((MeGetCurrentIrql() < DISPATCH_LEVEL), "Blocking code called at DISPATCH_LEVEL or higher IRQL.");
+    uint64_t StartTsc = MsLockStatTimestamp();
+    bool Contended = false;
 
     for (;;) {
         MsAcquireSpinlock(&mut->lock, &mflags);
@@ -111,6 +113,7 @@ MsAcquireMutexObject (
             mut->locked = true;
             mut->ownerTid = currThread->TID;
             mut->ownerThread = currThread;
+            MsLockStatAcquired(mut, RETADDR(0), LockStatMutex, StartTsc, Contended);
             MsReleaseSpinlock(&mut->lock, mflags);
 #ifdef DEBUG
             gop_printf(COLOR_RED, "[MUTEX-DEBUG] Mutex successfully acquired by: %p. MUT: %p\n", currThread, mut);
@@ -123,6 +126,7 @@ MsAcquireMutexObject (
         gop_printf(COLOR_RED, "[MUTEX-DEBUG] Mutex busy, enqueuing: MUT: %p\n", mut);
 #endif
         /* Enqueue under the event lock inside MsWaitForEvent; release mut->lock first */
+        Contended = true;
         MsReleaseSpinlock(&mut->lock, mflags);
 
         MsWaitForEvent(&mut->SynchEvent);
@@ -166,6 +170,7 @@ MsReleaseMutexObject (
     }
 
     // Clear ownership while still holding the spinlock
+    MsLockStatReleasing(mut, LockStatMutex);
     mut->ownerTid = 0;
     mut->locked = false;
     mut->ownerThread = NULL;
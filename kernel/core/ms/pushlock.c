@@ -17,63 +17,342 @@ Revision History:
 --*/
 
 #include "../../includes/ms.h"
+#include "../../includes/me.h"
 #include "../../intrinsics/atomic.h"
 #include "../../includes/mm.h"
 
+/*++
+
+    Lock word layout:
+
+        Without waiters (PL_WAIT_BIT clear) the upper bits hold the amount of shared owners,
+        and PL_LOCK_BIT tells if the lock is owned exclusively.
+
+        With waiters (PL_WAIT_BIT set) the upper bits hold a pointer to the newest wait block (the head),
+        the head caches a pointer to the oldest wait block (the tail, Last), and the shared owner count is kept in the tail.
+        PL_LOCK_BIT is still used to tell if the lock is owned exclusively.
+
+        Waiters are granted the lock in FIFO order (from the tail), either a single exclusive waiter, or every consecutive shared waiter.
+
+        The wait chain itself is only modified while holding PL_WAKE_BIT (a bit lock inside the lock word), at DISPATCH_LEVEL.
+        Every fast path expects PL_WAKE_BIT to be clear, so while it is held, the lock word can only be changed by its holder.
+
+        Wait blocks are allocated on the stack of the waiter, so contended acquires never touch the pool.
+
+--*/
+
+// The maximum amount of iterations a waiter spins while the owner is running on another processor.
+#define PL_SPIN_LIMIT 1024
+
+extern PROCESSOR cpus[];
+
+static
+bool
+MspIsPushLockOwnerRunning(
+    IN PUSH_LOCK* Lock
+)
+
+/*++
+
+    Routine description:
+
+        Checks if the exclusive owner of the push lock is currently running on another processor.
+
+    Arguments:
+
+        [IN]    PUSH_LOCK* Lock - The push lock to check.
+
+    Return Values:
+
+        True if the owner is running on another processor, false otherwise (or if the lock has no exclusive owner).
+
+    Notes:
+
+        The owner is never dereferenced, it is only compared against the current thread of every processor,
+        so a stale owner pointer is harmless and only ends the spin early.
+
+--*/
+
+{
+    PITHREAD Owner = Lock->Owner;
+    if (!Owner) return false;
+
+    PPROCESSOR CurrentProcessor = MeGetCurrentProcessor();
+
+    for (uint32_t i = 0; i < MeGetActiveProcessorCount(); i++) {
+        if (&cpus[i] == CurrentProcessor) continue;
+        if (*(PITHREAD volatile*)&cpus[i].currentThread == Owner) return true;
+    }
+
+    return false;
+}
+
+static
+bool
+MspSpinOnPushLock(
+    IN PUSH_LOCK* Lock,
+    IN uint64_t BusyMask
+)
+
+/*++
+
+    Routine description:
+
+        Adaptively spins on the push lock before the caller goes to sleep.
+        The spin continues only while the owner of the lock is running on another processor (so it is likely to release it soon).
+
+    Arguments:
+
+        [IN]    PUSH_LOCK* Lock - The push lock to spin on.
+        [IN]    uint64_t BusyMask - The bits of the lock word that must be clear for the caller to acquire the lock.
+
+    Return Values:
+
+        True if the lock has been observed as available, false if the caller should go to sleep.
+
+--*/
+
+{
+    for (uint32_t Spin = 0; Spin < PL_SPIN_LIMIT; Spin++) {
+        if (!(*(volatile uint64_t*)&Lock->Value & BusyMask)) return true;
+        if (!MspIsPushLockOwnerRunning(Lock)) return false;
+        __pause();
+    }
+
+    return false;
+}
+
+static
+uint64_t
+MspLockWaitChain(
+    IN PUSH_LOCK* Lock,
+    OUT PIRQL OldIrql
+)
+
+/*++
+
+    Routine description:
+
+        Acquires the PL_WAKE_BIT of the push lock, giving the caller exclusive access to the lock word and the wait chain.
+
+    Arguments:
+
+        [IN]    PUSH_LOCK* Lock - The push lock.
+        [OUT]   PIRQL OldIrql - The IRQL before raising to DISPATCH_LEVEL.
+
+    Return Values:
+
+        The value of the lock word (without PL_WAKE_BIT).
+
+--*/
+
+{
+    // We must not be preempted while holding the bit, others spin on it.
+    MeRaiseIrql(DISPATCH_LEVEL, OldIrql);
+
+    while (true) {
+        uint64_t Value = *(volatile uint64_t*)&Lock->Value;
+
+        if (!(Value & PL_WAKE_BIT) &&
+            InterlockedCompareExchangeU64(&Lock->Value, Value | PL_WAKE_BIT, Value) == Value) {
+            return Value;
+        }
+
+        __pause();
+    }
+}
+
 static
 void
-MspSuspendPushLock(
+MspUnlockWaitChain(
     IN PUSH_LOCK* Lock,
+    IN uint64_t NewValue,
+    IN IRQL OldIrql
+)
+
+/*++
+
+    Routine description:
+
+        Publishes the new lock word and releases the PL_WAKE_BIT.
+
+    Arguments:
+
+        [IN]    PUSH_LOCK* Lock - The push lock.
+        [IN]    uint64_t NewValue - The new value of the lock word.
+        [IN]    IRQL OldIrql - The IRQL returned from MspLockWaitChain.
+
+    Return Values:
+
+        None.
+
+--*/
+
+{
+    InterlockedExchangeU64(&Lock->Value, NewValue & ~PL_WAKE_BIT);
+    MeLowerIrql(OldIrql);
+}
+
+static
+uint64_t
+MspPushWaitBlock(
+    IN uint64_t Value,
     IN PUSH_LOCK_WAIT_BLOCK* WaitBlock,
-    IN uint64_t CurrentValue
+    IN uint32_t Flags
 )
+
+/*++
+
+    Routine description:
+
+        Initializes the wait block and inserts it as the new head of the wait chain.
+
+    Arguments:
+
+        [IN]    uint64_t Value - The current lock word (wait chain must be locked).
+        [IN]    PUSH_LOCK_WAIT_BLOCK* WaitBlock - The wait block, on the waiter's stack.
+        [IN]    uint32_t Flags - PL_FLAGS_EXCLUSIVE or PL_FLAGS_SHARED.
+
+    Return Values:
+
+        The new lock word.
+
+--*/
+
 {
-    //  We use SynchronizationEvent because we want to wake 1 waiter at a time.
+    // We use SynchronizationEvent because only the releaser that grants us the lock signals it.
     WaitBlock->WakeEvent.type = SynchronizationEvent;
     WaitBlock->WakeEvent.signaled = false;
     WaitBlock->WakeEvent.lock.locked = 0;
+    WaitBlock->WakeEvent.waitingQueue.head = NULL;
+    WaitBlock->WakeEvent.waitingQueue.tail = NULL;
+    WaitBlock->WakeEvent.waitingQueue.lock.Tail = NULL;
 
-    // Initialize list head.
-    InitializeListHead((PDOUBLY_LINKED_LIST)&WaitBlock->WakeEvent.waitingQueue);
-
-    WaitBlock->Signaled = false;
+    WaitBlock->Flags = Flags;
+    WaitBlock->Previous = NULL;
     WaitBlock->ShareCount = 0;
 
-    // If the lock currently has readers (Shared Count > 0) and is not a pointer to a wait list yet,
-    // we must save that count so we don't lose track of those readers.
-    if ((CurrentValue & ~PL_FLAG_MASK) > 0 && !(CurrentValue & PL_WAIT_BIT)) {
-        WaitBlock->ShareCount = (uint32_t)(CurrentValue >> 4);
+    if (Value & PL_WAIT_BIT) {
+        // Link in front of the current head, and inherit its cached tail.
+        PUSH_LOCK_WAIT_BLOCK* Head = (PUSH_LOCK_WAIT_BLOCK*)(Value & ~PL_FLAG_MASK);
+        WaitBlock->Next = Head;
+        WaitBlock->Last = Head->Last;
+        Head->Previous = WaitBlock;
+    }
+    else {
+        // First waiter, we are both the head and the tail.
+        // The lock may currently have readers, we must save that count so we don't lose track of them.
+        WaitBlock->Next = NULL;
+        WaitBlock->Last = WaitBlock;
+        WaitBlock->ShareCount = (uint32_t)(Value >> 4);
     }
 
-    // Push waitblock to head of &Lock->Value
-    while (true) {
-        // If the Waiting bit is set, the value is a pointer to the current head
-        if (CurrentValue & PL_WAIT_BIT) {
-            WaitBlock->Next = (PUSH_LOCK_WAIT_BLOCK*)(CurrentValue & ~PL_FLAG_MASK);
-        }
-        else {
-            // No waiters yet. Next is NULL.
-            WaitBlock->Next = NULL;
-        }
+    return (uint64_t)WaitBlock | PL_WAIT_BIT | (Value & PL_LOCK_BIT);
+}
 
-        // Calculate new value: Pointer to Us | Waiting Bit | Lock Bit
-        // We keep the Lock Bit set to prevent new fast path acquires while we wait.
-        uint64_t NewValue = (uint64_t)WaitBlock | PL_WAIT_BIT | PL_LOCK_BIT;
+static
+uint64_t
+MspGrantPushLock(
+    IN uint64_t Value,
+    OUT PUSH_LOCK_WAIT_BLOCK** WakeList
+)
 
-        // Atomic Swap
-        uint64_t Result = InterlockedCompareExchangeU64(&Lock->Value, NewValue, CurrentValue);
+/*++
 
-        if (Result == CurrentValue) {
-            // Success
-            break;
-        }
+    Routine description:
+
+        Grants a free push lock to the oldest waiters, either a single exclusive waiter, or every consecutive shared waiter.
+
+    Arguments:
+
+        [IN]    uint64_t Value - The current lock word (wait chain must be locked, PL_WAIT_BIT must be set).
+        [OUT]   PUSH_LOCK_WAIT_BLOCK** WakeList - Receives the list of wait blocks to signal, linked through Next.
+
+    Return Values:
+
+        The new lock word.
+
+    Notes:
+
+        The caller must signal the wait blocks only after releasing the wait chain,
+        and must read Next before signaling, since the block is on a stack that is gone once the waiter runs.
+
+--*/
+
+{
+    PUSH_LOCK_WAIT_BLOCK* Head = (PUSH_LOCK_WAIT_BLOCK*)(Value & ~PL_FLAG_MASK);
+    PUSH_LOCK_WAIT_BLOCK* Tail = Head->Last;
+    PUSH_LOCK_WAIT_BLOCK* List = NULL;
+    uint32_t Granted = 0;
+    bool Exclusive = (Tail->Flags == PL_FLAGS_EXCLUSIVE);
+
+    do {
+        PUSH_LOCK_WAIT_BLOCK* Newer = Tail->Previous;
+        Tail->Next = List;
+        List = Tail;
+        Granted++;
+        Tail = Newer;
+    } while (!Exclusive && Tail && Tail->Flags == PL_FLAGS_SHARED);
+
+    *WakeList = List;
+
+    if (!Tail) {
+        // The chain is now empty.
+        return Exclusive ? PL_LOCK_BIT : ((uint64_t)Granted * PL_SHARE_INC);
+    }
 
-        // Failed (value changed by another core), retry.
-        CurrentValue = Result;
+    // Tail is the new oldest waiter, the head is still in the chain.
+    Tail->Next = NULL;
+    Tail->ShareCount = Exclusive ? 0 : Granted;
+    Head->Last = Tail;
+
+    return (uint64_t)Head | PL_WAIT_BIT | (Exclusive ? PL_LOCK_BIT : 0);
+}
+
+static
+void
+MspWakePushLockWaiters(
+    IN PUSH_LOCK_WAIT_BLOCK* WakeList
+)
+{
+    while (WakeList) {
+        PUSH_LOCK_WAIT_BLOCK* Next = WakeList->Next;
+        MsSetEvent(&WakeList->WakeEvent);
+        WakeList = Next;
     }
+}
 
-    // We are now in the queue. We wait for our WakeEvent to be signaled by the releaser.
-    MsWaitForEvent(&WaitBlock->WakeEvent);
+static
+void
+MspSetPushLockOwner(
+    IN PUSH_LOCK* Lock,
+    IN void* CallSite,
+    IN uint64_t StartTsc,
+    IN bool Contended
+)
+
+{
+    Lock->Owner = MeGetCurrentThread();
+    MsLockStatAcquired(Lock, CallSite, LockStatPushLock, StartTsc, Contended);
+}
+
+static
+void
+MspRecordSharedAcquire(
+    IN void* CallSite,
+    IN uint64_t StartTsc,
+    IN bool Contended
+)
+
+{
+    // Shared owners don't stamp the lock, only the wait is recorded.
+#ifdef MT_LOCK_STATISTICS
+    MsLockStatRecordAcquire(CallSite, LockStatPushLock, __rdtsc() - StartTsc, Contended);
+#else
+    UNREFERENCED_PARAMETER(CallSite);
+    UNREFERENCED_PARAMETER(StartTsc);
+    UNREFERENCED_PARAMETER(Contended);
+#endif
 }
 
 void
@@ -81,18 +360,38 @@ MsAcquirePushLockExclusive(
     IN PUSH_LOCK* Lock
 )
 {
-    // If nobody owns an exclusive lock, we return and set it to owned.
+    PUSH_LOCK_WAIT_BLOCK WaitBlock;
+    uint64_t Value;
+    IRQL OldIrql;
+    uint64_t StartTsc = MsLockStatTimestamp();
+
+    // If nobody owns the lock, we set it to owned.
     if (InterlockedCompareExchangeU64(&Lock->Value, PL_LOCK_BIT, 0) == 0) {
+        MspSetPushLockOwner(Lock, RETADDR(0), StartTsc, false);
+        return;
+    }
+
+    // Spin for a bit if the owner is running, it will probably release the lock soon.
+    if (MspSpinOnPushLock(Lock, ~0ULL) &&
+        InterlockedCompareExchangeU64(&Lock->Value, PL_LOCK_BIT, 0) == 0) {
+        MspSetPushLockOwner(Lock, RETADDR(0), StartTsc, true);
         return;
     }
 
-    // Allocate a wait block.
-    PUSH_LOCK_WAIT_BLOCK* WaitBlock = (PUSH_LOCK_WAIT_BLOCK*)MmAllocatePoolWithTag(NonPagedPool, sizeof(PUSH_LOCK_WAIT_BLOCK), 'tiaw');
-    if (!WaitBlock) return; // idk what to do here to be honest.
+    Value = MspLockWaitChain(Lock, &OldIrql);
 
-    // An exclusive lock is owned.., we just push to the waitblock.
-    WaitBlock->Flags = PL_FLAGS_EXCLUSIVE;
-    MspSuspendPushLock(Lock, WaitBlock, Lock->Value);
+    if (Value == 0) {
+        // Released while we were acquiring the chain.
+        MspUnlockWaitChain(Lock, PL_LOCK_BIT, OldIrql);
+        MspSetPushLockOwner(Lock, RETADDR(0), StartTsc, true);
+        return;
+    }
+
+    MspUnlockWaitChain(Lock, MspPushWaitBlock(Value, &WaitBlock, PL_FLAGS_EXCLUSIVE), OldIrql);
+
+    // The releaser hands the lock to us directly, when we wake up we own it.
+    MsWaitForEvent(&WaitBlock.WakeEvent);
+    MspSetPushLockOwner(Lock, RETADDR(0), StartTsc, true);
 }
 
 void
@@ -100,50 +399,29 @@ MsReleasePushLockExclusive(
     IN PUSH_LOCK* Lock
 )
 {
+    PUSH_LOCK_WAIT_BLOCK* WakeList = NULL;
     uint64_t Value, NewValue;
-    
+    IRQL OldIrql;
+
+    MsLockStatReleasing(Lock, LockStatPushLock);
+    Lock->Owner = NULL;
+
     // If the value is the bit, we just set to 0 (no waiters exist)
     if (InterlockedCompareExchangeU64(&Lock->Value, 0, PL_LOCK_BIT) == PL_LOCK_BIT) {
         return;
     }
 
-    // Waiters exist, we must release them.
-    while (true) {
-        Value = Lock->Value;
-
-        // If somebody cleared the lock bit but left waiters? (shouldn't happen in standard flow but safe to check)
-        if (!(Value & PL_WAIT_BIT)) {
-            InterlockedAndU64(&Lock->Value, ~PL_LOCK_BIT);
-            return;
-        }
+    Value = MspLockWaitChain(Lock, &OldIrql);
 
-        // Get the list head
-        PUSH_LOCK_WAIT_BLOCK* Head = (PUSH_LOCK_WAIT_BLOCK*)(Value & ~PL_FLAG_MASK);
-        
-        // Pop next item
-        PUSH_LOCK_WAIT_BLOCK* Next = Head->Next;
-
-        // Calculate New Value
-        // If Next is NULL, we clear the Waiting bit.
-        NewValue = (uint64_t)Next;
-        if (NewValue != 0) NewValue |= PL_WAIT_BIT;
-
-        // If ther waiter we are waking is an exclusive waiter, we can leave the bit, its an optimization.
-        if (Head->Flags == PL_FLAGS_EXCLUSIVE) {
-            NewValue |= PL_LOCK_BIT;
-        }
-
-        // Try to update the lock pointer
-        if (InterlockedCompareExchangeU64(&Lock->Value, NewValue, Value) == Value) {
-            // Wake the next waiter.
-            MsSetEvent(&Head->WakeEvent);
-            
-            // Free the waiters memory allocated.
-            MmFreePool(Head);
-
-            return;
-        }
+    if (!(Value & PL_WAIT_BIT)) {
+        // Somebody held the chain without queuing.
+        MspUnlockWaitChain(Lock, Value & ~PL_LOCK_BIT, OldIrql);
+        return;
     }
+
+    NewValue = MspGrantPushLock(Value & ~PL_LOCK_BIT, &WakeList);
+    MspUnlockWaitChain(Lock, NewValue, OldIrql);
+    MspWakePushLockWaiters(WakeList);
 }
 
 void
@@ -151,28 +429,44 @@ MsAcquirePushLockShared(
     IN PUSH_LOCK* Lock
 )
 {
-    uint64_t Value, NewValue;
+    PUSH_LOCK_WAIT_BLOCK WaitBlock;
+    uint64_t Value;
+    IRQL OldIrql;
+    bool Spun = false;
+    uint64_t StartTsc = MsLockStatTimestamp();
 
     while (true) {
-        Value = Lock->Value;
-
-        // If Locked (Bit 0) or Waiting (Bit 1) is set, we must wait.
-        // We just sleep.
-        if (Value & (PL_LOCK_BIT | PL_WAIT_BIT)) {
-            PUSH_LOCK_WAIT_BLOCK* WaitBlock = (PUSH_LOCK_WAIT_BLOCK*)MmAllocatePoolWithTag(NonPagedPool, sizeof(PUSH_LOCK_WAIT_BLOCK), 'tiaw');
-            if (!WaitBlock) return; // idk what to do here to be honest.
-            WaitBlock->Flags = PL_FLAGS_SHARED;
-            MspSuspendPushLock(Lock, WaitBlock, Value);
-            return;
+        Value = *(volatile uint64_t*)&Lock->Value;
+
+        // If Locked, Waiting (fairness for queued writers) or the chain is being modified, take the slow path.
+        if (Value & (PL_LOCK_BIT | PL_WAIT_BIT | PL_WAKE_BIT)) {
+            if (!Spun && MspSpinOnPushLock(Lock, PL_LOCK_BIT | PL_WAIT_BIT | PL_WAKE_BIT)) {
+                Spun = true;
+                continue;
+            }
+            break;
         }
 
         // Increment share count, no one is locking or waiting.
-        NewValue = Value + PL_SHARE_INC;
-
-        if (InterlockedCompareExchangeU64(&Lock->Value, NewValue, Value) == Value) {
+        if (InterlockedCompareExchangeU64(&Lock->Value, Value + PL_SHARE_INC, Value) == Value) {
+            MspRecordSharedAcquire(RETADDR(0), StartTsc, Spun);
             return;
         }
     }
+
+    Value = MspLockWaitChain(Lock, &OldIrql);
+
+    if (!(Value & (PL_LOCK_BIT | PL_WAIT_BIT))) {
+        MspUnlockWaitChain(Lock, Value + PL_SHARE_INC, OldIrql);
+        MspRecordSharedAcquire(RETADDR(0), StartTsc, true);
+        return;
+    }
+
+    MspUnlockWaitChain(Lock, MspPushWaitBlock(Value, &WaitBlock, PL_FLAGS_SHARED), OldIrql);
+
+    // When we wake up, we have been counted as a shared owner by the releaser.
+    MsWaitForEvent(&WaitBlock.WakeEvent);
+    MspRecordSharedAcquire(RETADDR(0), StartTsc, true);
 }
 
 void
@@ -180,37 +474,42 @@ MsReleasePushLockShared(
     IN PUSH_LOCK* Lock
 )
 {
+    PUSH_LOCK_WAIT_BLOCK* WakeList = NULL;
     uint64_t Value, NewValue;
+    IRQL OldIrql;
 
     while (true) {
-        Value = Lock->Value;
+        Value = *(volatile uint64_t*)&Lock->Value;
 
-        // Check if there are waiters
-        if (Value & PL_WAIT_BIT) {
-            // If someone is waiting, the Value is no longer a count of shared threads, but a pointer to setting the event to wake the exclusive waiter.
-            // If no more shares, we wake up the waiter and he acquires the exclusive lock.
-
-            PUSH_LOCK_WAIT_BLOCK* Head = (PUSH_LOCK_WAIT_BLOCK*)(Value & ~PL_FLAG_MASK);
-            PUSH_LOCK_WAIT_BLOCK* Last = Head;
-
-            // Find the end of the chain (TODO LAST PTR TO MAKE IT FASTER (HINT))
-            while (Last->Next != NULL) {
-                Last = Last->Next;
-            }
-
-            // Decrement the saved count in the wait block
-            if (InterlockedDecrementU32(&Last->ShareCount) == 0) {
-                // If we hit zero, we signal the writer that he can stop waiting for readers.
-                MsSetEvent(&Last->WakeEvent);
-            }
-            return;
+        // Waiters exist (or are being queued), the count is kept in the tail wait block.
+        if (Value & (PL_WAIT_BIT | PL_WAKE_BIT)) {
+            break;
         }
 
         // Decrement shared count.
-        NewValue = Value - PL_SHARE_INC;
-
-        if (InterlockedCompareExchangeU64(&Lock->Value, NewValue, Value) == Value) {
+        if (InterlockedCompareExchangeU64(&Lock->Value, Value - PL_SHARE_INC, Value) == Value) {
             return;
         }
     }
-}
\ No newline at end of file
+
+    Value = MspLockWaitChain(Lock, &OldIrql);
+
+    if (!(Value & PL_WAIT_BIT)) {
+        MspUnlockWaitChain(Lock, Value - PL_SHARE_INC, OldIrql);
+        return;
+    }
+
+    // O(1), the head caches the tail.
+    PUSH_LOCK_WAIT_BLOCK* Tail = ((PUSH_LOCK_WAIT_BLOCK*)(Value & ~PL_FLAG_MASK))->Last;
+
+    if (--Tail->ShareCount != 0) {
+        // Other readers still own the lock.
+        MspUnlockWaitChain(Lock, Value, OldIrql);
+        return;
+    }
+
+    // We were the last reader, hand the lock to the waiters.
+    NewValue = MspGrantPushLock(Value, &WakeList);
+    MspUnlockWaitChain(Lock, NewValue, OldIrql);
+    MspWakePushLockWaiters(WakeList);
+}
@@ -32,13 +32,17 @@ MsAcquireSpinlock (
 
 {
 	if (!lock) return;
+	uint64_t StartTsc = MsLockStatTimestamp();
+	bool Contended = false;
 	// spin until we grab the lock.
 	MeRaiseIrql(DISPATCH_LEVEL, OldIrql);
 	while (__sync_lock_test_and_set(&lock->locked, 1)) {
+		Contended = true;
 		__asm__ volatile("pause" ::: "memory"); /* x86 pause  CPU relax hint */
 	}
 	// Memory barrier to prevent instruction reordering
 	__asm__ volatile("" ::: "memory");
+	MsLockStatAcquired(lock, RETADDR(0), LockStatSpinlock, StartTsc, Contended);
 }
 
 void 
@@ -64,6 +68,7 @@ MsReleaseSpinlock (
 
 {
 	if (!lock) return;
+	MsLockStatReleasing(lock, LockStatSpinlock);
 	// Memory barrier before release
 	__asm__ volatile("" ::: "memory");
 	__sync_lock_release(&lock->locked);
@@ -88,12 +93,17 @@ MsAcquireSpinlockAtDpcLevel(
 		);
 	}
 	
+	uint64_t StartTsc = MsLockStatTimestamp();
+	bool Contended = false;
+
 	// Acquire the spinlock.
 	while (__sync_lock_test_and_set(&Lock->locked, 1)) {
+		Contended = true;
 		__asm__ volatile("pause" ::: "memory"); /* x86 pause  CPU relax hint */
 	}
 	// Memory barrier to prevent instruction reordering
 	__asm__ volatile("" ::: "memory");
+	MsLockStatAcquired(Lock, RETADDR(0), LockStatSpinlock, StartTsc, Contended);
 }
 
 void
@@ -115,8 +125,195 @@ MsReleaseSpinlockFromDpcLevel(
 	}
 
 	// Release the spinlock.
+	MsLockStatReleasing(Lock, LockStatSpinlock);
 	__asm__ volatile("" ::: "memory");
 	__sync_lock_release(&Lock->locked);
 }
 
+static
+void
+MspAcquireQueuedSpinlock(
+	IN PQUEUED_SPINLOCK Lock,
+	IN PQUEUED_SPINLOCK_NODE Node,
+	IN void* CallSite
+)
+
+{
+	PQUEUED_SPINLOCK_NODE Previous;
+	uint64_t StartTsc = MsLockStatTimestamp();
+
+	Node->Next = NULL;
+	Node->Waiting = 1;
+
+	// Become the new tail, if there was a tail before us, link behind it and wait for it to hand us the lock.
+	Previous = (PQUEUED_SPINLOCK_NODE)InterlockedExchangePointer((volatile void* volatile*)&Lock->Tail, Node);
+
+	if (Previous) {
+		Previous->Next = Node;
+		while (Node->Waiting) {
+			__asm__ volatile("pause" ::: "memory");
+		}
+	}
+
+	// Memory barrier to prevent instruction reordering
+	__asm__ volatile("" ::: "memory");
+	MsLockStatAcquired(Lock, CallSite, LockStatQueuedSpinlock, StartTsc, Previous != NULL);
+}
+
+void
+MsAcquireQueuedSpinlockAtDpcLevel(
+	IN PQUEUED_SPINLOCK Lock,
+	IN PQUEUED_SPINLOCK_NODE Node
+)
+
+/*++
+
+	Routine description : Acquires a queued (MCS) spinlock, the caller must already be at DISPATCH_LEVEL or above.
+
+	Arguments:
+
+		[IN]    Pointer to QUEUED_SPINLOCK object.
+		[IN]    Pointer to the caller's queue node, must stay valid until the lock is released.
+
+	Return Values:
+
+		None.
+
+	Notes:
+
+		Waiters are served in FIFO order, and each one spins only on its own node.
+
+--*/
+
+{
+	MspAcquireQueuedSpinlock(Lock, Node, RETADDR(0));
+}
+
+void
+MsReleaseQueuedSpinlockFromDpcLevel(
+	IN PQUEUED_SPINLOCK Lock,
+	IN PQUEUED_SPINLOCK_NODE Node
+)
+
+/*++
+
+	Routine description : Releases a queued (MCS) spinlock, handing it to the next waiter if there is one.
+
+	Arguments:
+
+		[IN]    Pointer to QUEUED_SPINLOCK object.
+		[IN]    Pointer to the node given to MsAcquireQueuedSpinlockAtDpcLevel.
+
+	Return Values:
+
+		None.
+
+--*/
+
+{
+	MsLockStatReleasing(Lock, LockStatQueuedSpinlock);
+
+	PQUEUED_SPINLOCK_NODE Next = Node->Next;
+
+	// Memory barrier before release
+	__asm__ volatile("" ::: "memory");
+
+	if (!Next) {
+		// No known successor, if we are still the tail, the lock becomes free.
+		if (InterlockedCompareExchangePointer((volatile void* volatile*)&Lock->Tail, NULL, Node) == Node) {
+			return;
+		}
+
+		// A waiter swapped the tail but hasn't linked itself to us yet.
+		while ((Next = Node->Next) == NULL) {
+			__asm__ volatile("pause" ::: "memory");
+		}
+	}
+
+	__atomic_store_n(&Next->Waiting, 0, __ATOMIC_RELEASE);
+}
+
+void
+MsAcquireInStackQueuedSpinlock(
+	IN PQUEUED_SPINLOCK Lock,
+	OUT PLOCK_QUEUE_HANDLE LockHandle
+)
+
+/*++
+
+	Routine description : Acquires a queued spinlock using a lock handle on the caller's stack, raises IRQL to DISPATCH_LEVEL.
+
+	Arguments:
+
+		[IN]    Pointer to QUEUED_SPINLOCK object.
+		[OUT]   Pointer to LOCK_QUEUE_HANDLE, must be kept until MsReleaseInStackQueuedSpinlock.
+
+	Return Values:
+
+		None.
+
+--*/
+
+{
+	MeRaiseIrql(DISPATCH_LEVEL, &LockHandle->OldIrql);
+	LockHandle->Lock = Lock;
+	MspAcquireQueuedSpinlock(Lock, &LockHandle->Node, RETADDR(0));
+}
+
+void
+MsReleaseInStackQueuedSpinlock(
+	IN PLOCK_QUEUE_HANDLE LockHandle
+)
+
+/*++
+
+	Routine description : Releases a queued spinlock acquired by MsAcquireInStackQueuedSpinlock, restores previous IRQL.
+
+	Arguments:
+
+		[IN]    Pointer to the LOCK_QUEUE_HANDLE given on acquire.
+
+	Return Values:
+
+		None.
+
+--*/
+
+{
+	MsReleaseQueuedSpinlockFromDpcLevel(LockHandle->Lock, &LockHandle->Node);
+	MeLowerIrql(LockHandle->OldIrql);
+}
+
+void
+MsAcquireInStackQueuedSpinlockAtDpcLevel(
+	IN PQUEUED_SPINLOCK Lock,
+	OUT PLOCK_QUEUE_HANDLE LockHandle
+)
+
+{
+	// Make sure we are at DPC level or above
+	if (MeGetCurrentIrql() < DISPATCH_LEVEL) {
+		// Bugcheck.
+		MeBugCheckEx(
+			IRQL_NOT_GREATER_OR_EQUAL,
+			(void*)Lock,
+			(void*)MeGetCurrentIrql(),
+			NULL,
+			NULL
+		);
+	}
+
+	LockHandle->Lock = Lock;
+	MspAcquireQueuedSpinlock(Lock, &LockHandle->Node, RETADDR(0));
+}
+
+void
+MsReleaseInStackQueuedSpinlockFromDpcLevel(
+	IN PLOCK_QUEUE_HANDLE LockHandle
+)
+
+{
+	MsReleaseQueuedSpinlockFromDpcLevel(LockHandle->Lock, &LockHandle->Node);
+}
+
 #endif
\ No newline at end of file
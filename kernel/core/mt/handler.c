@@ -19,6 +19,7 @@ Revision History:
 #include "../../includes/mt.h"
 #include "../../includes/me.h"
 #include "../../includes/ps.h"
+#include "../../includes/md.h"
 #include "../../mtstatus.h"
 
 extern SyscallHandler Ssdt[];
@@ -55,7 +56,7 @@ MtSyscallHandler(
     MeGetCurrentThread()->PreviousMode = UserMode;
 
     // Increment system call count (cool)
-    InterlockedIncrementU64((volatile uint64_t*)&MeGetCurrentProcessor()->SystemCallCount);
+    MeIncrementCounter(PerfCounterSystemCalls);
 
     // Just for future incase. (this must be kept here since after interrupts are enabled UserRsp could very much change)
     // DO NOT Access the RSP in PTRAP_FRAME, it does not exist.
@@ -89,6 +90,10 @@ MtSyscallHandler(
     uint64_t Arg5 = TrapFrame->r8;
     uint64_t Arg6 = TrapFrame->r9;
     
+    MD_TRACE(TraceEventSyscallEnter, SyscallNumber, 0);
+
     // Todo regular SSDT. (with limits, no direct indexing)
     *ReturnValue = Ssdt[SyscallNumber](Arg1, Arg2, Arg3, Arg4, Arg5, Arg6);
+
+    MD_TRACE(TraceEventSyscallExit, SyscallNumber, *ReturnValue);
 }
\ No newline at end of file
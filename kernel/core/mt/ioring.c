@@ -0,0 +1,328 @@
+/*++
+
+Module Name:
+
+    ioring.c
+
+Purpose:
+
+    This translation unit contains the I/O ring system calls (batched file and memory operations through shared rings).
+
+Author:
+
+    slep (Matanel) 2025.
+
+Revision History:
+
+--*/
+
+#include "../../includes/mt.h"
+#include "../../includes/mm.h"
+#include "../../includes/ps.h"
+#include "../../includes/ms.h"
+#include "../../includes/exception.h"
+#include "../../assert.h"
+
+//
+// Layout of a ring (one allocation in the process, read/write):
+//
+//      IO_RING_HEADER                  (SqOffset = sizeof(IO_RING_HEADER))
+//      IO_RING_SQE[SqEntries]
+//      IO_RING_CQE[CqEntries]          (CqOffset, cache line aligned, CqEntries = 2 * SqEntries)
+//
+// Entries are executed in order by MtSubmitIoRing, in the context of the submitting thread, through the
+// regular system call routines (so every handle, buffer and access check is the same as a direct call).
+// The kernel never trusts the indices in the header, it keeps SqHead and CqTail in the EPROCESS and only
+// publishes them, every access to the ring itself is guarded (user mode may unmap or scribble on it anytime).
+//
+// A completion is only written into a free slot, when the completion ring is full, submission stops and the
+// remaining entries stay queued for the next call.
+//
+
+static
+uint32_t
+MtpIoRingCqOffset(
+    IN uint32_t SqEntries
+)
+
+{
+    return (uint32_t)ALIGN_UP(sizeof(IO_RING_HEADER) + (size_t)SqEntries * sizeof(IO_RING_SQE), 64);
+}
+
+static
+MTSTATUS
+MtpExecuteIoRingEntry(
+    IN PIO_RING_SQE Sqe,
+    IN PIO_RING_CQE Cqe
+)
+
+/*++
+
+    Routine description:
+
+        Executes a single submission entry.
+
+    Arguments:
+
+        [IN]    PIO_RING_SQE Sqe - Kernel copy of the submission entry.
+        [IN]    PIO_RING_CQE Cqe - The completion entry in the ring (user memory), its Result is written directly.
+
+    Return Values:
+
+        The status of the operation, stored in the completion.
+
+--*/
+
+{
+    void* Result = (void*)&Cqe->Result;
+
+    switch (Sqe->Operation) {
+    case IoRingOpNop:
+        return MT_SUCCESS;
+
+    case IoRingOpRead:
+        return MtReadFile(Sqe->Handle, Sqe->Offset, (void*)(uintptr_t)Sqe->Buffer, (size_t)Sqe->Length, (size_t*)Result);
+
+    case IoRingOpWrite:
+        return MtWriteFile(Sqe->Handle, Sqe->Offset, (void*)(uintptr_t)Sqe->Buffer, (size_t)Sqe->Length, (size_t*)Result);
+
+    case IoRingOpOpen:
+        return MtCreateFile((const char*)(uintptr_t)Sqe->Buffer, (ACCESS_MASK)Sqe->Offset, (PHANDLE)Result);
+
+    case IoRingOpClose:
+        return MtClose(Sqe->Handle);
+
+    case IoRingOpAllocate:
+        // Result was preset to the requested base address.
+        return MtAllocateVirtualMemory(MtCurrentProcess(), (void**)Result, (size_t)Sqe->Length, (uint8_t)Sqe->Offset);
+
+    default:
+        return MT_INVALID_PARAM;
+    }
+}
+
+MTSTATUS
+MtCreateIoRing(
+    IN uint32_t Entries,
+    OUT void** RingBase
+)
+
+/*++
+
+    Routine description:
+
+        System call that creates the I/O ring of the current process.
+
+    Arguments:
+
+        [IN]    uint32_t Entries - Submission entries, rounded up to a power of 2 (at most IO_RING_MAX_ENTRIES).
+        [OUT]   void** RingBase - Receives the address of the ring (IO_RING_HEADER).
+
+    Return Values:
+
+        MT_SUCCESS on success.
+        MT_INVALID_PARAM - Entries is 0 or too large.
+        MT_ALREADY_EXISTS - The process already has a ring.
+        Other MTSTATUS codes on allocation or invalid buffer failures.
+
+    Notes:
+
+        The ring is a regular allocation of the process, it is released with the address space.
+
+--*/
+
+{
+    assert(MeGetCurrentIrql() <= APC_LEVEL);
+    MTSTATUS Status;
+    PRIVILEGE_MODE PreviousMode = MeGetPreviousMode();
+    PEPROCESS Process = PsGetCurrentProcess();
+
+    if (!Entries || Entries > IO_RING_MAX_ENTRIES) return MT_INVALID_PARAM;
+
+    uint32_t SqEntries = 1;
+    while (SqEntries < Entries) SqEntries <<= 1;
+    uint32_t CqEntries = SqEntries * 2;
+    uint32_t CqOffset = MtpIoRingCqOffset(SqEntries);
+    size_t Size = (size_t)CqOffset + (size_t)CqEntries * sizeof(IO_RING_CQE);
+
+    if (PreviousMode == UserMode) {
+        Status = ProbeForRead(RingBase, sizeof(void*), _Alignof(void*));
+        if (MT_FAILURE(Status)) return Status;
+    }
+
+    MsAcquirePushLockExclusive(&Process->IoRingLock);
+
+    if (Process->IoRing) {
+        Status = MT_ALREADY_EXISTS;
+        goto Cleanup;
+    }
+
+    // Let the VAD code choose the address, it writes it back through RingBase.
+    Status = MT_SUCCESS;
+    try {
+        *RingBase = NULL;
+    } except{
+        Status = GetExceptionCode();
+    } end_try;
+    if (MT_FAILURE(Status)) goto Cleanup;
+
+    Status = MmAllocateVirtualMemory(Process, RingBase, Size, VAD_FLAG_READ | VAD_FLAG_WRITE);
+    if (MT_FAILURE(Status)) goto Cleanup;
+
+    PIO_RING_HEADER Ring = NULL;
+    try {
+        Ring = (PIO_RING_HEADER)*RingBase;
+    } except{
+        Status = GetExceptionCode();
+    } end_try;
+    if (MT_FAILURE(Status)) goto Cleanup;
+
+    // Another thread may have rewritten RingBase in between, never register an address we didn't validate.
+    // The allocation is page aligned, anything else is not the ring we just allocated.
+    if (((uintptr_t)Ring & (VirtualPageSize - 1)) != 0) {
+        Status = MT_INVALID_PARAM;
+        goto Cleanup;
+    }
+
+    if (PreviousMode == UserMode) {
+        Status = ProbeForRead(Ring, Size, _Alignof(IO_RING_HEADER));
+        if (MT_FAILURE(Status)) goto Cleanup;
+    }
+
+    // The pages are demand zero, only the geometry has to be filled in.
+    try {
+        Ring->SqEntries = SqEntries;
+        Ring->CqEntries = CqEntries;
+        Ring->SqOffset = sizeof(IO_RING_HEADER);
+        Ring->CqOffset = CqOffset;
+    } except{
+        Status = GetExceptionCode();
+    } end_try;
+    if (MT_FAILURE(Status)) goto Cleanup;
+
+    Process->IoRingSqEntries = SqEntries;
+    Process->IoRingSqHead = 0;
+    Process->IoRingCqTail = 0;
+    Process->IoRing = Ring;
+
+Cleanup:
+    MsReleasePushLockExclusive(&Process->IoRingLock);
+    return Status;
+}
+
+MTSTATUS
+MtSubmitIoRing(
+    IN uint32_t ToSubmit,
+    _Out_Opt uint32_t* Submitted
+)
+
+/*++
+
+    Routine description:
+
+        System call that executes the queued entries of the current process's I/O ring and posts their completions.
+
+    Arguments:
+
+        [IN]    uint32_t ToSubmit - Maximum number of entries to execute.
+        [OUT OPTIONAL] uint32_t* Submitted - Receives the number of entries executed (each one has a completion).
+
+    Return Values:
+
+        MT_SUCCESS - The entries were executed, check each completion's Status.
+        MT_INVALID_STATE - The process has no ring (MtCreateIoRing).
+        Other MTSTATUS codes if the ring itself became inaccessible.
+
+    Notes:
+
+        Stops early when the submission ring is empty or the completion ring is full.
+        Entries run synchronously, every completion is posted when this returns.
+
+--*/
+
+{
+    assert(MeGetCurrentIrql() <= APC_LEVEL);
+    MTSTATUS Status = MT_SUCCESS;
+    PRIVILEGE_MODE PreviousMode = MeGetPreviousMode();
+    PEPROCESS Process = PsGetCurrentProcess();
+    uint32_t Done = 0;
+
+    if (Submitted && PreviousMode == UserMode) {
+        Status = ProbeForRead(Submitted, sizeof(uint32_t), _Alignof(uint32_t));
+        if (MT_FAILURE(Status)) return Status;
+    }
+
+    MsAcquirePushLockExclusive(&Process->IoRingLock);
+
+    PIO_RING_HEADER Ring = Process->IoRing;
+    if (!Ring) {
+        Status = MT_INVALID_STATE;
+        goto Cleanup;
+    }
+
+    uint32_t SqMask = Process->IoRingSqEntries - 1;
+    uint32_t CqEntries = Process->IoRingSqEntries * 2;
+    PIO_RING_SQE SqBase = (PIO_RING_SQE)((uint8_t*)Ring + sizeof(IO_RING_HEADER));
+    PIO_RING_CQE CqBase = (PIO_RING_CQE)((uint8_t*)Ring + MtpIoRingCqOffset(Process->IoRingSqEntries));
+
+    while (Done < ToSubmit) {
+        uint32_t SqTail = 0;
+        uint32_t CqHead = 0;
+
+        try {
+            SqTail = Ring->SqTail;
+            CqHead = Ring->CqHead;
+        } except{
+            Status = GetExceptionCode();
+        } end_try;
+        if (MT_FAILURE(Status)) break;
+
+        // Nothing queued, or no room for the completion.
+        if (Process->IoRingSqHead == SqTail) break;
+        if (Process->IoRingCqTail - CqHead >= CqEntries) break;
+
+        IO_RING_SQE Sqe = { 0 };
+        PIO_RING_CQE Cqe = &CqBase[Process->IoRingCqTail & (CqEntries - 1)];
+
+        // Copy the entry first, user mode may keep changing it while it executes.
+        try {
+            Sqe = SqBase[Process->IoRingSqHead & SqMask];
+            Cqe->Result = (Sqe.Operation == IoRingOpAllocate) ? Sqe.Buffer : 0;
+        } except{
+            Status = GetExceptionCode();
+        } end_try;
+        if (MT_FAILURE(Status)) break;
+
+        MTSTATUS EntryStatus = MtpExecuteIoRingEntry(&Sqe, Cqe);
+
+        Process->IoRingSqHead++;
+        Process->IoRingCqTail++;
+        Done++;
+
+        // Publish the completion before the new tail (x86 keeps stores in order).
+        try {
+            Cqe->UserData = Sqe.UserData;
+            Cqe->Status = EntryStatus;
+            Cqe->Reserved = 0;
+            __asm__ volatile("" ::: "memory");
+            Ring->SqHead = Process->IoRingSqHead;
+            Ring->CqTail = Process->IoRingCqTail;
+        } except{
+            Status = GetExceptionCode();
+        } end_try;
+        if (MT_FAILURE(Status)) break;
+    }
+
+Cleanup:
+    MsReleasePushLockExclusive(&Process->IoRingLock);
+
+    if (Submitted) {
+        try {
+            *Submitted = Done;
+        } except{
+            return GetExceptionCode();
+        } end_try;
+    }
+
+    return Status;
+}
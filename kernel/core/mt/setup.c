@@ -47,6 +47,15 @@ SYSCALL_INIT_ENTRY SyscallTable[] = {
     {.Num = 5, .Handler = MtCreateFile},
     {.Num = 6, .Handler = MtClose},
     {.Num = 7, .Handler = MtTerminateThread},
+    {.Num = 8, .Handler = MtQueryLockStatistics},
+    {.Num = 9, .Handler = MtControlTrace},
+    {.Num = 10, .Handler = MtControlProfile},
+    {.Num = 11, .Handler = MtQueryProfile},
+    {.Num = 12, .Handler = MtQuerySystemInformation},
+    {.Num = 13, .Handler = MtCreateIoRing},
+    {.Num = 14, .Handler = MtSubmitIoRing},
+    {.Num = 15, .Handler = MtReadFileScatter},
+    {.Num = 16, .Handler = MtWriteFileGather},
 };
 
 bool SyscallsAlreadyInitialized = false;
@@ -23,6 +23,8 @@ Revision History:
 #include "../../includes/mg.h"
 #include "../../includes/exception.h"
 #include "../../includes/fs.h"
+#include "../../includes/ms.h"
+#include "../../includes/md.h"
 #include "../../assert.h"
 
 MTSTATUS
@@ -156,12 +158,15 @@ MtOpenProcess(
         if (MT_FAILURE(Status)) return Status;
     }
 
-    // Retrieve the process.
+    // Retrieve the process (referenced).
     PEPROCESS Process = PsLookupProcessByProcessId(ProcessId);
     if (!Process) return MT_NOT_FOUND;
 
     HANDLE OutHandleBefore;
     Status = ObOpenObjectByPointer((void*)Process, PsProcessType, DesiredAccess, &OutHandleBefore);
+
+    // The handle holds its own reference now.
+    ObDereferenceObject(Process);
     if (MT_FAILURE(Status)) return Status;
 
     // Attempt to write to user memory
@@ -228,28 +233,153 @@ MtTerminateProcess(
     return Status;
 }
 
+//
+// File data moves between the caller's buffer and the file system in chunks of at most MT_IO_CHUNK_SIZE bytes,
+// through a staging buffer owned by the calling thread (allocated on its first file I/O, freed with the thread).
+// Peak memory per I/O is one chunk, no matter how large the request is.
+//
+// User buffers are always staged, the file system and the disk driver (DMA by virtual to physical translation)
+// must never touch user memory directly, there is no way to keep those pages resident yet.
+// Kernel mode callers transfer straight to and from their own buffer.
+//
+// The chunk is placed at the file offset's position within a sector, so every whole sector of the file lands
+// on a 512 byte aligned address in the staging buffer and is read or written by DMA without the sector bounce.
+//
+
+#define MT_IO_CHUNK_SIZE (64 * 1024)
+#define MT_IO_SECTOR_SIZE 512
+
+static
+void*
+MtpGetStagingBuffer(
+    void
+)
+
+{
+    PETHREAD Thread = PsGetCurrentThread();
+
+    if (!Thread->IoStagingBuffer) {
+        Thread->IoStagingBuffer = MmAllocatePoolWithTag(NonPagedPool, MT_IO_CHUNK_SIZE + MT_IO_SECTOR_SIZE, 'gtsI'); // Istg
+    }
+
+    return Thread->IoStagingBuffer;
+}
+
+static
 MTSTATUS
-MtReadFile(
-    IN HANDLE FileHandle,
+MtpTransferFile(
+    IN PFILE_OBJECT FileObject,
     IN uint64_t FileOffset,
-    OUT void* Buffer,
-    IN size_t BufferSize,
-    _Out_Opt size_t* BytesRead
+    IN void* Buffer,
+    IN size_t Length,
+    IN bool Write,
+    OUT size_t* Transferred
 )
 
 /*++
 
     Routine description:
 
-        System call for file reading.
+        Reads or writes one caller buffer, chunk by chunk.
 
     Arguments:
 
-        [IN] HANDLE FileHandle - The handle of the file opened from MtCreateFile.
-        [IN] uint64_t FileOffset - File offset in bytes to start reading from.
-        [OUT] void* Buffer - The buffer to store read bytes in.
-        [IN] size_t BufferSize - The size of the buffer in bytes.
-        [OUT OPTIONAL] size_t* BytesRead - Optionally supply a pointer to store how many bytes were read to the buffer given.
+        [IN]    PFILE_OBJECT FileObject - The referenced file.
+        [IN]    uint64_t FileOffset - File offset in bytes of the first byte.
+        [IN]    void* Buffer - The caller's buffer (already probed if it came from user mode).
+        [IN]    size_t Length - Size of the buffer in bytes.
+        [IN]    bool Write - True to write the buffer to the file, false to read the file into it.
+        [OUT]   size_t* Transferred - Receives the number of bytes moved, valid on failure too.
+
+    Return Values:
+
+        MT_SUCCESS if the whole buffer was transferred, or the file ended (short read).
+        The file system status, or the exception code of a faulting user buffer, otherwise.
+
+--*/
+
+{
+    MTSTATUS Status = MT_SUCCESS;
+    size_t Done = 0;
+
+    *Transferred = 0;
+
+    if (MeGetPreviousMode() == KernelMode) {
+        // Kernel buffers are resident, no staging needed.
+        if (Write) Status = FsWriteFile(FileObject, FileOffset, Buffer, Length, Transferred);
+        else Status = FsReadFile(FileObject, FileOffset, Buffer, Length, Transferred);
+        return Status;
+    }
+
+    uint8_t* Staging = (uint8_t*)MtpGetStagingBuffer();
+    if (!Staging) return MT_NO_MEMORY;
+
+    while (Done < Length) {
+        size_t Want = Length - Done;
+        if (Want > MT_IO_CHUNK_SIZE) Want = MT_IO_CHUNK_SIZE;
+
+        uint64_t Offset = FileOffset + Done;
+        uint8_t* Chunk = Staging + (Offset % MT_IO_SECTOR_SIZE);
+        uint8_t* UserChunk = (uint8_t*)Buffer + Done;
+        size_t Moved = 0;
+
+        if (Write) {
+            try {
+                kmemcpy(Chunk, UserChunk, Want);
+            } except{
+                Status = GetExceptionCode();
+            } end_try;
+            if (MT_FAILURE(Status)) break;
+
+            Status = FsWriteFile(FileObject, Offset, Chunk, Want, &Moved);
+        }
+        else {
+            Status = FsReadFile(FileObject, Offset, Chunk, Want, &Moved);
+
+            if (Moved) {
+                MTSTATUS CopyStatus = MT_SUCCESS;
+                try {
+                    kmemcpy(UserChunk, Chunk, Moved);
+                } except{
+                    CopyStatus = GetExceptionCode();
+                } end_try;
+
+                if (MT_FAILURE(CopyStatus)) {
+                    Status = CopyStatus;
+                    break;
+                }
+            }
+        }
+
+        Done += Moved;
+        if (MT_FAILURE(Status) || Moved < Want) break;
+    }
+
+    *Transferred = Done;
+    return Status;
+}
+
+static
+MTSTATUS
+MtpReferenceFileForTransfer(
+    IN HANDLE FileHandle,
+    IN bool Write,
+    _Out_Opt size_t* Transferred,
+    OUT PFILE_OBJECT* FileObject
+)
+
+/*++
+
+    Routine description:
+
+        References the file of a read/write system call and probes its optional count pointer.
+
+    Arguments:
+
+        [IN]    HANDLE FileHandle - The handle of the file opened from MtCreateFile.
+        [IN]    bool Write - True for MT_FILE_WRITE_DATA, false for MT_FILE_READ_DATA.
+        [IN OPTIONAL] size_t* Transferred - The caller's count pointer, if any.
+        [OUT]   PFILE_OBJECT* FileObject - Receives the referenced file object.
 
     Return Values:
 
@@ -258,123 +388,119 @@ MtReadFile(
 --*/
 
 {
-    // We must be at IRQL that is less or equal than APC_LEVEL (so we can bring in pageable memory, both for user memory and kernel memory)
-    assert(MeGetCurrentIrql() <= APC_LEVEL);
-    // Attempt reference of handle.
-    MTSTATUS Status;
-    PFILE_OBJECT FileObject;
-    PRIVILEGE_MODE PreviousMode = MeGetPreviousMode();
-    Status = ObReferenceObjectByHandle(
+    MTSTATUS Status = ObReferenceObjectByHandle(
         FileHandle,
-        MT_FILE_READ_DATA,
+        Write ? MT_FILE_WRITE_DATA : MT_FILE_READ_DATA,
         FsFileType,
-        (void**)&FileObject,
+        (void**)FileObject,
         NULL
     );
     if (MT_FAILURE(Status)) return Status;
 
-    // Before everything, lets probe the buffer given. (if we came from user mode that is)
-    if (PreviousMode == UserMode) {
-        Status = ProbeForRead(Buffer, BufferSize, _Alignof(char));
+    if (Transferred && MeGetPreviousMode() == UserMode) {
+        Status = ProbeForRead(Transferred, sizeof(size_t), _Alignof(size_t));
         if (MT_FAILURE(Status)) {
-            // Invalid buffer.
-            ObDereferenceObject(FileObject);
+            ObDereferenceObject(*FileObject);
             return Status;
         }
     }
 
-    if (BytesRead && PreviousMode == UserMode) {
-        Status = ProbeForRead(BytesRead, sizeof(size_t), _Alignof(size_t));
-        if (MT_FAILURE(Status)) {
-            // Invalid buffer
-            ObDereferenceObject(FileObject);
-            return Status;
-        }
-    }
+    return MT_SUCCESS;
+}
 
-    // Create a paged pool large enough for the buffer size given.
-    void* KernelBuffer = MmAllocatePoolWithTag(PagedPool, BufferSize, 'fubk'); // kbuf
-    if (!KernelBuffer) {
-        ObDereferenceObject(FileObject);
-        return MT_NO_MEMORY;
-    }
+static
+MTSTATUS
+MtpCompleteTransfer(
+    IN PFILE_OBJECT FileObject,
+    IN bool UseFilePointer,
+    IN uint64_t FileOffset,
+    IN MTSTATUS Status,
+    IN size_t Total,
+    _Out_Opt size_t* Transferred
+)
 
-    size_t KernelBytesRead = 0;
+/*++
 
-    // Call the FS layer.
-    Status = FsReadFile(
-        FileObject,
-        FileOffset,
-        KernelBuffer,
-        BufferSize,
-        &KernelBytesRead
-    );
+    Routine description:
 
-    // If we got EOF we dont return a full failure, and we still copy the data.
-    // Else, we got a failure and we free and return.
-    if (MT_FAILURE(Status) && KernelBytesRead == 0) {
-        MmFreePool(KernelBuffer);
-        ObDereferenceObject(FileObject);
-        return Status;
-    }
+        Finishes a read/write system call, advances the file pointer, reports the count and drops the file reference.
+        The count is reported on failure too, a transfer that fails midway still moved (and advanced past) Total bytes.
 
-    // Write back to user buffer based on bytes read.
-    try {
-        kmemcpy(Buffer, KernelBuffer, KernelBytesRead);
-    } except{
-        // Exception gotten on copying to user buffer, we abort and return failure.
-        MmFreePool(KernelBuffer);
-        ObDereferenceObject(FileObject);
-        return GetExceptionCode();
-    } end_try;
+    Arguments:
+
+        [IN]    PFILE_OBJECT FileObject - The referenced file, dereferenced here.
+        [IN]    bool UseFilePointer - The call used (and now advances) FileObject->CurrentOffset.
+        [IN]    uint64_t FileOffset - File offset the transfer started at.
+        [IN]    MTSTATUS Status - Status of the transfer.
+        [IN]    size_t Total - Bytes transferred.
+        [OUT OPTIONAL] size_t* Transferred - The caller's count pointer (probed).
 
-    // Free the kernel buffer now.
-    MmFreePool(KernelBuffer);
+    Return Values:
+
+        The status of the transfer, kept on a partial transfer (the count tells how far it got).
+        The exception code if the count pointer faults.
+
+--*/
+
+{
+    // File pointer calls on the same file object from several threads must be serialized by the caller.
+    if (UseFilePointer && (MT_SUCCEEDED(Status) || Total)) FileObject->CurrentOffset = FileOffset + Total;
+
+    ObDereferenceObject(FileObject);
 
-    if (BytesRead) {
-        // Write back how many bytes we read.
+    if (Transferred) {
         try {
-            *BytesRead = KernelBytesRead;
+            *Transferred = Total;
         } except{
-                // Exception gotten on copying to user bytes read, BUT we successfully written everything to the buffer
-                // We return last exception code still, their problem.
-                ObDereferenceObject(FileObject);
-                return GetExceptionCode();
+            // The data was transferred, but the count pointer is bad, their problem.
+            return GetExceptionCode();
         } end_try;
     }
 
-    // Everything's good, dereference object, return to caller.
-    ObDereferenceObject(FileObject);
-    return MT_SUCCESS;
+    return Status;
 }
 
 MTSTATUS
-MtWriteFile(
+MtReadFile(
     IN HANDLE FileHandle,
     IN uint64_t FileOffset,
-    IN void* Buffer,
+    OUT void* Buffer,
     IN size_t BufferSize,
-    _Out_Opt size_t* BytesWritten
+    _Out_Opt size_t* BytesRead
 )
 
+/*++
+
+    Routine description:
+
+        System call for file reading.
+
+    Arguments:
+
+        [IN] HANDLE FileHandle - The handle of the file opened from MtCreateFile.
+        [IN] uint64_t FileOffset - File offset in bytes to start reading from, or MT_FILE_USE_FILE_POINTER to read at (and advance) the file pointer.
+        [OUT] void* Buffer - The buffer to store read bytes in.
+        [IN] size_t BufferSize - The size of the buffer in bytes.
+        [OUT OPTIONAL] size_t* BytesRead - Optionally supply a pointer to store how many bytes were read to the buffer given.
+
+    Return Values:
+
+        Various MTSTATUS Status codes.
+        A read that fails midway (like MT_FAT32_EOF at the end of the file) keeps its status, BytesRead still receives the bytes read.
+
+--*/
+
 {
     // We must be at IRQL that is less or equal than APC_LEVEL (so we can bring in pageable memory, both for user memory and kernel memory)
     assert(MeGetCurrentIrql() <= APC_LEVEL);
-    // Attempt reference of handle.
     MTSTATUS Status;
     PFILE_OBJECT FileObject;
-    PRIVILEGE_MODE PreviousMode = MeGetPreviousMode();
-    Status = ObReferenceObjectByHandle(
-        FileHandle,
-        MT_FILE_WRITE_DATA,
-        FsFileType,
-        (void**)&FileObject,
-        NULL
-    );
+
+    Status = MtpReferenceFileForTransfer(FileHandle, false, BytesRead, &FileObject);
     if (MT_FAILURE(Status)) return Status;
 
     // Before everything, lets probe the buffer given. (if we came from user mode that is)
-    if (PreviousMode == UserMode) {
+    if (MeGetPreviousMode() == UserMode) {
         Status = ProbeForRead(Buffer, BufferSize, _Alignof(char));
         if (MT_FAILURE(Status)) {
             // Invalid buffer.
@@ -383,70 +509,71 @@ MtWriteFile(
         }
     }
 
-    if (BytesWritten && PreviousMode == UserMode) {
-        Status = ProbeForRead(BytesWritten, sizeof(size_t), _Alignof(size_t));
-        if (MT_FAILURE(Status)) {
-            // Invalid buffer
-            ObDereferenceObject(FileObject);
-            return Status;
-        }
-    }
+    bool UseFilePointer = (FileOffset == MT_FILE_USE_FILE_POINTER);
+    if (UseFilePointer) FileOffset = FileObject->CurrentOffset;
 
-    // Create a paged pool large enough for the buffer size given.
-    void* KernelBuffer = MmAllocatePoolWithTag(PagedPool, BufferSize, 'fubk'); // kbuf
-    if (!KernelBuffer) {
-        ObDereferenceObject(FileObject);
-        return MT_NO_MEMORY;
-    }
+    size_t Total;
+    Status = MtpTransferFile(FileObject, FileOffset, Buffer, BufferSize, false, &Total);
 
-    // Begin copying from user buffer to kernel buffer.
-    try {
-        kmemcpy(KernelBuffer, Buffer, BufferSize);
-    } except{
-        // Access violation while copying from user buffer.
-        // We return last exception code still, their problem.
-        ObDereferenceObject(FileObject);
-        MmFreePool(KernelBuffer);
-        return GetExceptionCode();
-    } end_try;
+    return MtpCompleteTransfer(FileObject, UseFilePointer, FileOffset, Status, Total, BytesRead);
+}
 
-    size_t KernelBytesWritten = 0;
+MTSTATUS
+MtWriteFile(
+    IN HANDLE FileHandle,
+    IN uint64_t FileOffset,
+    IN void* Buffer,
+    IN size_t BufferSize,
+    _Out_Opt size_t* BytesWritten
+)
 
-    // Call the FS layer.
-    Status = FsWriteFile(
-        FileObject,
-        FileOffset,
-        KernelBuffer,
-        BufferSize,
-        &KernelBytesWritten
-    );
+/*++
 
-    // If we got EOF we dont return a full failure, and we still copy the data.
-    // Else, we got a failure and we free and return.
-    if (MT_FAILURE(Status) && KernelBytesWritten == 0) {
-        MmFreePool(KernelBuffer);
-        ObDereferenceObject(FileObject);
-        return Status;
-    }
+    Routine description:
 
-    // Free the kernel buffer now.
-    MmFreePool(KernelBuffer);
+        System call for file writing.
 
-    if (BytesWritten) {
-        // Write back how many bytes we read.
-        try {
-            *BytesWritten = KernelBytesWritten;
-        } except{
-            // Exception gotten on copying to user bytes read, BUT we successfully written everything to the buffer
-            // We return last exception code still, their problem.
+    Arguments:
+
+        [IN] HANDLE FileHandle - The handle of the file opened from MtCreateFile.
+        [IN] uint64_t FileOffset - File offset in bytes to start writing at, or MT_FILE_USE_FILE_POINTER to write at (and advance) the file pointer.
+        [IN] void* Buffer - The data to write.
+        [IN] size_t BufferSize - The size of the buffer in bytes.
+        [OUT OPTIONAL] size_t* BytesWritten - Optionally supply a pointer to store how many bytes were written.
+
+    Return Values:
+
+        Various MTSTATUS Status codes.
+        A write that fails midway (like MT_FAT32_CLUSTERS_FULL) keeps its status, BytesWritten still receives the bytes written.
+
+--*/
+
+{
+    // We must be at IRQL that is less or equal than APC_LEVEL (so we can bring in pageable memory, both for user memory and kernel memory)
+    assert(MeGetCurrentIrql() <= APC_LEVEL);
+    MTSTATUS Status;
+    PFILE_OBJECT FileObject;
+
+    Status = MtpReferenceFileForTransfer(FileHandle, true, BytesWritten, &FileObject);
+    if (MT_FAILURE(Status)) return Status;
+
+    // Before everything, lets probe the buffer given. (if we came from user mode that is)
+    if (MeGetPreviousMode() == UserMode) {
+        Status = ProbeForRead(Buffer, BufferSize, _Alignof(char));
+        if (MT_FAILURE(Status)) {
+            // Invalid buffer.
             ObDereferenceObject(FileObject);
-            return GetExceptionCode();
-        } end_try;
+            return Status;
+        }
     }
 
-    // Everything's good, dereference object, return to caller.
-    ObDereferenceObject(FileObject);
-    return MT_SUCCESS;
+    bool UseFilePointer = (FileOffset == MT_FILE_USE_FILE_POINTER);
+    if (UseFilePointer) FileOffset = FileObject->CurrentOffset;
+
+    size_t Total;
+    Status = MtpTransferFile(FileObject, FileOffset, Buffer, BufferSize, true, &Total);
+
+    return MtpCompleteTransfer(FileObject, UseFilePointer, FileOffset, Status, Total, BytesWritten);
 }
 
 MTSTATUS 
@@ -556,4 +683,708 @@ MtTerminateThread(
 
     // Call internal function.
     return PsTerminateThread(Thread, ExitStatus);
+}
+
+MTSTATUS
+MtQueryLockStatistics(
+    OUT void* Buffer,
+    IN size_t BufferSize,
+    _Out_Opt size_t* ReturnLength
+)
+
+/*++
+
+    Routine description:
+
+        System call that returns the lock contention statistics, merged over all processors.
+
+    Arguments:
+
+        [OUT] void* Buffer - Receives a LOCK_STATISTICS_INFORMATION, followed by the entries, most contended call site first.
+        [IN] size_t BufferSize - The size of the buffer in bytes, may be 0 to only query the required length.
+        [OUT OPTIONAL] size_t* ReturnLength - Optionally receives the size in bytes needed for every entry.
+
+    Return Values:
+
+        MT_SUCCESS - Every entry was copied.
+        MT_BUFFER_TOO_SMALL - The buffer couldn't hold every entry, the ones that fit (the most contended) were still copied if the header fit.
+        MT_NOT_IMPLEMENTED - The kernel wasn't built with LOCKSTAT=1.
+        Other MTSTATUS codes on invalid buffers.
+
+--*/
+
+{
+#ifndef MT_LOCK_STATISTICS
+    UNREFERENCED_PARAMETER(Buffer);
+    UNREFERENCED_PARAMETER(BufferSize);
+    UNREFERENCED_PARAMETER(ReturnLength);
+    return MT_NOT_IMPLEMENTED;
+#else
+    assert(MeGetCurrentIrql() <= APC_LEVEL);
+    MTSTATUS Status;
+    PRIVILEGE_MODE PreviousMode = MeGetPreviousMode();
+
+    // Probe the buffers given.
+    if (BufferSize && PreviousMode == UserMode) {
+        Status = ProbeForRead(Buffer, BufferSize, _Alignof(uint64_t));
+        if (MT_FAILURE(Status)) return Status;
+    }
+
+    if (ReturnLength && PreviousMode == UserMode) {
+        Status = ProbeForRead(ReturnLength, sizeof(size_t), _Alignof(size_t));
+        if (MT_FAILURE(Status)) return Status;
+    }
+
+    // Every active processor can contribute a full table of distinct sites at most.
+    uint32_t Capacity = MeGetActiveProcessorCount() * LOCK_STATISTICS_TABLE_SIZE;
+    PLOCK_STATISTICS_ENTRY KernelEntries = MmAllocatePoolWithTag(PagedPool, Capacity * sizeof(LOCK_STATISTICS_ENTRY), 'tskl'); // lkst
+    if (!KernelEntries) return MT_NO_MEMORY;
+
+    uint64_t Dropped = 0;
+    uint32_t Count = MsSnapshotLockStatistics(KernelEntries, Capacity, &Dropped);
+    size_t Required = sizeof(LOCK_STATISTICS_INFORMATION) + (size_t)Count * sizeof(LOCK_STATISTICS_ENTRY);
+    uint32_t Copied = 0;
+
+    if (BufferSize >= sizeof(LOCK_STATISTICS_INFORMATION)) {
+        size_t Fits = (BufferSize - sizeof(LOCK_STATISTICS_INFORMATION)) / sizeof(LOCK_STATISTICS_ENTRY);
+        Copied = (Fits < Count) ? (uint32_t)Fits : Count;
+
+        PLOCK_STATISTICS_INFORMATION Information = (PLOCK_STATISTICS_INFORMATION)Buffer;
+        try {
+            Information->NumberOfEntries = Copied;
+            Information->TotalEntries = Count;
+            Information->DroppedRecords = Dropped;
+            kmemcpy(Information->Entries, KernelEntries, (size_t)Copied * sizeof(LOCK_STATISTICS_ENTRY));
+        } except{
+            // Exception gotten on copying to user buffer, we abort and return failure.
+            MmFreePool(KernelEntries);
+            return GetExceptionCode();
+        } end_try;
+    }
+
+    MmFreePool(KernelEntries);
+
+    if (ReturnLength) {
+        try {
+            *ReturnLength = Required;
+        } except{
+            return GetExceptionCode();
+        } end_try;
+    }
+
+    return (BufferSize >= Required) ? MT_SUCCESS : MT_BUFFER_TOO_SMALL;
+#endif
+}
+
+MTSTATUS
+MtControlTrace(
+    IN uint32_t Operation,
+    _In_Opt const char* Path
+)
+
+/*++
+
+    Routine description:
+
+        System call that starts, stops or dumps the kernel trace (static tracepoints, see trace.c).
+
+    Arguments:
+
+        [IN] uint32_t Operation - TRACE_CONTROL value.
+        [IN OPTIONAL] const char* Path - Full path of the dump file, for TraceControlDump only.
+
+    Return Values:
+
+        MT_SUCCESS on success.
+        MT_INVALID_PARAM - Unknown operation, or no path given to a dump.
+        Other MTSTATUS codes on allocation, invalid buffer or file system failures.
+
+--*/
+
+{
+    assert(MeGetCurrentIrql() <= APC_LEVEL);
+    MTSTATUS Status;
+    PRIVILEGE_MODE PreviousMode = MeGetPreviousMode();
+    char KernelPath[MAX_PATH];
+
+    switch (Operation) {
+    case TraceControlStart:
+        return MdStartTrace();
+
+    case TraceControlStop:
+        MdStopTrace();
+        return MT_SUCCESS;
+
+    case TraceControlDump:
+        if (!Path) return MT_INVALID_PARAM;
+
+        if (PreviousMode == UserMode) {
+            Status = ProbeForRead(Path, MAX_PATH, _Alignof(char));
+            if (MT_FAILURE(Status)) return Status;
+        }
+
+        try {
+            // Ensures null termination.
+            kstrncpy(KernelPath, Path, MAX_PATH);
+        } except{
+            return GetExceptionCode();
+        } end_try;
+
+        return MdDumpTrace(KernelPath);
+
+    default:
+        return MT_INVALID_PARAM;
+    }
+}
+
+MTSTATUS
+MtControlProfile(
+    IN uint32_t Operation,
+    IN uint32_t Source,
+    IN uint64_t Interval,
+    _In_Opt const char* Path
+)
+
+/*++
+
+    Routine description:
+
+        System call that starts, stops or dumps the sampling profiler (see profile.c).
+
+    Arguments:
+
+        [IN] uint32_t Operation - PROFILE_CONTROL value.
+        [IN] uint32_t Source - PROFILE_SOURCE value, for ProfileControlStart only.
+        [IN] uint64_t Interval - Clock ticks or core cycles per sample (0 for the default), for ProfileControlStart only.
+        [IN OPTIONAL] const char* Path - Full path of the dump file, for ProfileControlDump only.
+
+    Return Values:
+
+        MT_SUCCESS on success.
+        MT_INVALID_PARAM - Unknown operation or source, or no path given to a dump.
+        Other MTSTATUS codes on allocation, invalid buffer or file system failures.
+
+--*/
+
+{
+    assert(MeGetCurrentIrql() <= APC_LEVEL);
+    MTSTATUS Status;
+    PRIVILEGE_MODE PreviousMode = MeGetPreviousMode();
+    char KernelPath[MAX_PATH];
+
+    switch (Operation) {
+    case ProfileControlStart:
+        return MdStartProfile((PROFILE_SOURCE)Source, Interval);
+
+    case ProfileControlStop:
+        MdStopProfile();
+        return MT_SUCCESS;
+
+    case ProfileControlDump:
+        if (!Path) return MT_INVALID_PARAM;
+
+        if (PreviousMode == UserMode) {
+            Status = ProbeForRead(Path, MAX_PATH, _Alignof(char));
+            if (MT_FAILURE(Status)) return Status;
+        }
+
+        try {
+            // Ensures null termination.
+            kstrncpy(KernelPath, Path, MAX_PATH);
+        } except{
+            return GetExceptionCode();
+        } end_try;
+
+        return MdDumpProfile(KernelPath);
+
+    default:
+        return MT_INVALID_PARAM;
+    }
+}
+
+MTSTATUS
+MtQueryProfile(
+    OUT void* Buffer,
+    IN size_t BufferSize,
+    _Out_Opt size_t* ReturnLength
+)
+
+/*++
+
+    Routine description:
+
+        System call that returns the sampling profiler entries of every processor.
+
+    Arguments:
+
+        [OUT] void* Buffer - Receives a PROFILE_INFORMATION, followed by the entries.
+        [IN] size_t BufferSize - The size of the buffer in bytes, may be 0 to only query the required length.
+        [OUT OPTIONAL] size_t* ReturnLength - Optionally receives the size in bytes needed for every entry.
+
+    Return Values:
+
+        MT_SUCCESS - Every entry was copied.
+        MT_BUFFER_TOO_SMALL - The buffer couldn't hold every entry, the ones that fit were still copied if the header fit.
+        Other MTSTATUS codes on invalid buffers.
+
+    Notes:
+
+        The profiler may keep running, the entries are then a snapshot (stop it first for exact totals).
+
+--*/
+
+{
+    assert(MeGetCurrentIrql() <= APC_LEVEL);
+    MTSTATUS Status;
+    PRIVILEGE_MODE PreviousMode = MeGetPreviousMode();
+
+    // Probe the buffers given.
+    if (BufferSize && PreviousMode == UserMode) {
+        Status = ProbeForRead(Buffer, BufferSize, _Alignof(uint64_t));
+        if (MT_FAILURE(Status)) return Status;
+    }
+
+    if (ReturnLength && PreviousMode == UserMode) {
+        Status = ProbeForRead(ReturnLength, sizeof(size_t), _Alignof(size_t));
+        if (MT_FAILURE(Status)) return Status;
+    }
+
+    PROFILE_DUMP_HEADER Header;
+    MdQueryProfileHeader(&Header);
+
+    uint32_t Total = Header.EntryCount;
+    size_t Required = sizeof(PROFILE_INFORMATION) + (size_t)Total * sizeof(PROFILE_ENTRY);
+
+    if (BufferSize >= sizeof(PROFILE_INFORMATION)) {
+        size_t Fits = (BufferSize - sizeof(PROFILE_INFORMATION)) / sizeof(PROFILE_ENTRY);
+        PPROFILE_INFORMATION Information = (PPROFILE_INFORMATION)Buffer;
+
+        // Copied in chunks through the kernel stack, the tables are only read under the profiler's mutex.
+        PROFILE_ENTRY Chunk[16];
+        uint64_t Cursor = 0;
+        uint32_t Copied = 0;
+
+        while (Copied < Fits) {
+            uint32_t Want = (Fits - Copied < 16) ? (uint32_t)(Fits - Copied) : 16;
+            uint32_t Read = MdReadProfileEntries(&Cursor, Chunk, Want);
+            if (!Read) break;
+
+            try {
+                kmemcpy(&Information->Entries[Copied], Chunk, (size_t)Read * sizeof(PROFILE_ENTRY));
+            } except{
+                // Exception gotten on copying to user buffer, we abort and return failure.
+                return GetExceptionCode();
+            } end_try;
+
+            Copied += Read;
+        }
+
+        // Entries created since the header was taken may have been copied too.
+        if (Copied > Total) Total = Copied;
+        Header.EntryCount = Copied;
+
+        try {
+            Information->Header = Header;
+            Information->TotalEntries = Total;
+            Information->Reserved = 0;
+        } except{
+            return GetExceptionCode();
+        } end_try;
+    }
+
+    if (ReturnLength) {
+        try {
+            *ReturnLength = Required;
+        } except{
+            return GetExceptionCode();
+        } end_try;
+    }
+
+    return (BufferSize >= Required) ? MT_SUCCESS : MT_BUFFER_TOO_SMALL;
+}
+MTSTATUS
+MtQuerySystemInformation(
+    IN uint32_t InformationClass,
+    OUT void* Buffer,
+    IN size_t BufferSize,
+    _Out_Opt size_t* ReturnLength
+)
+
+/*++
+
+    Routine description:
+
+        System call that returns system wide information and statistics, selected by an information class.
+
+    Arguments:
+
+        [IN] uint32_t InformationClass - SYSTEM_INFORMATION_CLASS value.
+        [OUT] void* Buffer - Receives the structure of the class (see mt.h).
+        [IN] size_t BufferSize - The size of the buffer in bytes, may be 0 to only query the required length.
+        [OUT OPTIONAL] size_t* ReturnLength - Optionally receives the size in bytes the class needs.
+
+    Return Values:
+
+        MT_SUCCESS - The information was copied.
+        MT_INVALID_PARAM - Unknown information class.
+        MT_BUFFER_TOO_SMALL - The buffer couldn't hold the information, nothing was copied.
+        Other MTSTATUS codes on invalid buffers.
+
+    Notes:
+
+        Counters are read without stopping their processors, cheap enough to sample every second.
+
+--*/
+
+{
+    assert(MeGetCurrentIrql() <= APC_LEVEL);
+    MTSTATUS Status;
+    PRIVILEGE_MODE PreviousMode = MeGetPreviousMode();
+
+    if (InformationClass >= SystemInformationClassMax) return MT_INVALID_PARAM;
+
+    // Probe the buffers given.
+    if (BufferSize && PreviousMode == UserMode) {
+        Status = ProbeForRead(Buffer, BufferSize, _Alignof(uint64_t));
+        if (MT_FAILURE(Status)) return Status;
+    }
+
+    if (ReturnLength && PreviousMode == UserMode) {
+        Status = ProbeForRead(ReturnLength, sizeof(size_t), _Alignof(size_t));
+        if (MT_FAILURE(Status)) return Status;
+    }
+
+    uint32_t Processors = MdGetCounterProcessorCount();
+    uint32_t Types = 0;
+    size_t Required;
+
+    switch (InformationClass) {
+    case SystemBasicInformation:
+        Required = sizeof(SYSTEM_BASIC_INFORMATION);
+        break;
+    case SystemCounterInformation:
+        Required = sizeof(SYSTEM_COUNTER_INFORMATION) + PerfCounterMax * sizeof(uint64_t);
+        break;
+    case SystemProcessorCounterInformation:
+        Required = sizeof(SYSTEM_COUNTER_INFORMATION) + (size_t)Processors * PerfCounterMax * sizeof(uint64_t);
+        break;
+    case SystemCounterNameInformation:
+        Required = sizeof(SYSTEM_COUNTER_NAME_INFORMATION) + PerfCounterMax * SYSTEM_COUNTER_NAME_LENGTH;
+        break;
+    case SystemMemoryInformation:
+        Required = sizeof(SYSTEM_MEMORY_INFORMATION);
+        break;
+    case SystemProcessorDpcInformation:
+        Required = sizeof(SYSTEM_PROCESSOR_DPC_INFORMATION) + (size_t)Processors * sizeof(SYSTEM_PROCESSOR_DPC_ENTRY);
+        break;
+    default:
+        Types = ObQueryObjectTypes(0, NULL, 0);
+        Required = sizeof(SYSTEM_OBJECT_TYPE_INFORMATION) + (size_t)Types * sizeof(SYSTEM_OBJECT_TYPE_ENTRY);
+        break;
+    }
+
+    if (ReturnLength) {
+        try {
+            *ReturnLength = Required;
+        } except{
+            return GetExceptionCode();
+        } end_try;
+    }
+
+    if (BufferSize < Required) return MT_BUFFER_TOO_SMALL;
+
+    // Every class is staged on the stack (a processor or a small chunk at a time), then copied to the caller.
+    uint64_t Values[PerfCounterMax];
+
+    switch (InformationClass) {
+    case SystemBasicInformation: {
+        SYSTEM_BASIC_INFORMATION Basic = { 0 };
+        Basic.NumberOfProcessors = Processors;
+        Basic.PageSize = VirtualPageSize;
+        Basic.NumberOfPhysicalPages = PfnDatabase.TotalPageCount;
+        Basic.NumberOfCounters = PerfCounterMax;
+
+        try {
+            *(PSYSTEM_BASIC_INFORMATION)Buffer = Basic;
+        } except{
+            return GetExceptionCode();
+        } end_try;
+        break;
+    }
+
+    case SystemCounterInformation:
+    case SystemProcessorCounterInformation: {
+        PSYSTEM_COUNTER_INFORMATION Information = (PSYSTEM_COUNTER_INFORMATION)Buffer;
+        bool Summed = (InformationClass == SystemCounterInformation);
+
+        for (uint32_t i = 0; i < (Summed ? 1 : Processors); i++) {
+            MdReadCounters(Summed ? MD_ALL_PROCESSORS : i, Values);
+
+            try {
+                kmemcpy(&Information->Values[(size_t)i * PerfCounterMax], Values, sizeof(Values));
+            } except{
+                return GetExceptionCode();
+            } end_try;
+        }
+
+        try {
+            Information->NumberOfProcessors = Processors;
+            Information->NumberOfCounters = PerfCounterMax;
+        } except{
+            return GetExceptionCode();
+        } end_try;
+        break;
+    }
+
+    case SystemCounterNameInformation: {
+        PSYSTEM_COUNTER_NAME_INFORMATION Information = (PSYSTEM_COUNTER_NAME_INFORMATION)Buffer;
+        char Name[SYSTEM_COUNTER_NAME_LENGTH];
+
+        for (uint32_t i = 0; i < PerfCounterMax; i++) {
+            kmemset(Name, 0, sizeof(Name));
+            kstrncpy(Name, MdGetCounterName((PERF_COUNTER)i), sizeof(Name));
+
+            try {
+                kmemcpy(Information->Names[i], Name, sizeof(Name));
+            } except{
+                return GetExceptionCode();
+            } end_try;
+        }
+
+        try {
+            Information->NumberOfCounters = PerfCounterMax;
+            Information->Reserved = 0;
+        } except{
+            return GetExceptionCode();
+        } end_try;
+        break;
+    }
+
+    case SystemMemoryInformation: {
+        SYSTEM_MEMORY_INFORMATION Memory;
+        Memory.TotalPages = PfnDatabase.TotalPageCount;
+        Memory.AvailablePages = PfnDatabase.AvailablePages;
+        Memory.FreePages = PfnDatabase.FreePageList.Count;
+        Memory.ZeroedPages = PfnDatabase.ZeroedPageList.Count;
+        Memory.StandbyPages = PfnDatabase.StandbyPageList.Count;
+        Memory.ModifiedPages = PfnDatabase.ModifiedPageList.Count;
+        Memory.BadPages = PfnDatabase.BadPageList.Count;
+        Memory.ReservedPages = PfnDatabase.TotalReserved;
+
+        try {
+            *(PSYSTEM_MEMORY_INFORMATION)Buffer = Memory;
+        } except{
+            return GetExceptionCode();
+        } end_try;
+        break;
+    }
+
+    case SystemProcessorDpcInformation: {
+        PSYSTEM_PROCESSOR_DPC_INFORMATION Information = (PSYSTEM_PROCESSOR_DPC_INFORMATION)Buffer;
+
+        for (uint32_t i = 0; i < Processors; i++) {
+            PPROCESSOR Cpu = MeGetProcessorBlock((uint8_t)i);
+            SYSTEM_PROCESSOR_DPC_ENTRY Entry;
+
+            Entry.Processor = i;
+            Entry.DpcQueueDepth = Cpu->DpcData.DpcQueueDepth;
+            Entry.DpcCount = Cpu->DpcData.DpcCount;
+            Entry.MaximumDpcQueueDepth = Cpu->MaximumDpcQueueDepth;
+            Entry.MinimumDpcRate = Cpu->MinimumDpcRate;
+            Entry.DpcRequestRate = Cpu->DpcRequestRate;
+
+            try {
+                Information->Processors[i] = Entry;
+            } except{
+                return GetExceptionCode();
+            } end_try;
+        }
+
+        try {
+            Information->NumberOfProcessors = Processors;
+            Information->Reserved = 0;
+        } except{
+            return GetExceptionCode();
+        } end_try;
+        break;
+    }
+
+    default: {
+        PSYSTEM_OBJECT_TYPE_INFORMATION Information = (PSYSTEM_OBJECT_TYPE_INFORMATION)Buffer;
+        SYSTEM_OBJECT_TYPE_ENTRY Chunk[8];
+        uint32_t Copied = 0;
+
+        // Types created after the length was computed are left out.
+        while (Copied < Types) {
+            uint32_t Want = (Types - Copied < 8) ? Types - Copied : 8;
+            uint32_t Total = ObQueryObjectTypes(Copied, Chunk, Want);
+            uint32_t Read = (Total > Copied) ? Total - Copied : 0;
+            if (Read > Want) Read = Want;
+            if (!Read) break;
+
+            try {
+                kmemcpy(&Information->Types[Copied], Chunk, (size_t)Read * sizeof(SYSTEM_OBJECT_TYPE_ENTRY));
+            } except{
+                return GetExceptionCode();
+            } end_try;
+
+            Copied += Read;
+        }
+
+        try {
+            Information->NumberOfTypes = Copied;
+            Information->Reserved = 0;
+        } except{
+            return GetExceptionCode();
+        } end_try;
+        break;
+    }
+    }
+
+    return MT_SUCCESS;
+}
+
+static
+MTSTATUS
+MtpTransferFileVectored(
+    IN HANDLE FileHandle,
+    IN uint64_t FileOffset,
+    IN const IO_VECTOR* Vectors,
+    IN uint32_t VectorCount,
+    IN bool Write,
+    _Out_Opt size_t* Transferred
+)
+
+/*++
+
+    Routine description:
+
+        Common part of MtReadFileScatter and MtWriteFileGather.
+
+    Arguments:
+
+        See MtReadFileScatter.
+
+    Return Values:
+
+        Various MTSTATUS Status codes.
+
+--*/
+
+{
+    assert(MeGetCurrentIrql() <= APC_LEVEL);
+    MTSTATUS Status;
+    PFILE_OBJECT FileObject;
+    PRIVILEGE_MODE PreviousMode = MeGetPreviousMode();
+
+    if (!VectorCount || VectorCount > MT_MAX_IO_VECTORS) return MT_INVALID_PARAM;
+
+    if (PreviousMode == UserMode) {
+        Status = ProbeForRead(Vectors, (size_t)VectorCount * sizeof(IO_VECTOR), _Alignof(IO_VECTOR));
+        if (MT_FAILURE(Status)) return Status;
+    }
+
+    Status = MtpReferenceFileForTransfer(FileHandle, Write, Transferred, &FileObject);
+    if (MT_FAILURE(Status)) return Status;
+
+    bool UseFilePointer = (FileOffset == MT_FILE_USE_FILE_POINTER);
+    if (UseFilePointer) FileOffset = FileObject->CurrentOffset;
+
+    size_t Total = 0;
+
+    for (uint32_t i = 0; i < VectorCount; i++) {
+        IO_VECTOR Vector = { 0 };
+
+        // One vector at a time, the array is never copied whole.
+        try {
+            Vector = Vectors[i];
+        } except{
+            Status = GetExceptionCode();
+        } end_try;
+        if (MT_FAILURE(Status)) break;
+
+        if (!Vector.Length) continue;
+
+        if (PreviousMode == UserMode) {
+            Status = ProbeForRead(Vector.Buffer, Vector.Length, _Alignof(char));
+            if (MT_FAILURE(Status)) break;
+        }
+
+        size_t Moved;
+        Status = MtpTransferFile(FileObject, FileOffset + Total, Vector.Buffer, Vector.Length, Write, &Moved);
+        Total += Moved;
+
+        // A short transfer (end of file) ends the whole request, the next vectors would leave a hole.
+        if (MT_FAILURE(Status) || Moved < Vector.Length) break;
+    }
+
+    return MtpCompleteTransfer(FileObject, UseFilePointer, FileOffset, Status, Total, Transferred);
+}
+
+MTSTATUS
+MtReadFileScatter(
+    IN HANDLE FileHandle,
+    IN uint64_t FileOffset,
+    IN const IO_VECTOR* Vectors,
+    IN uint32_t VectorCount,
+    _Out_Opt size_t* BytesRead
+)
+
+/*++
+
+    Routine description:
+
+        System call that reads a contiguous file range into several buffers, in order.
+
+    Arguments:
+
+        [IN] HANDLE FileHandle - The handle of the file opened from MtCreateFile.
+        [IN] uint64_t FileOffset - File offset in bytes to start reading from, or MT_FILE_USE_FILE_POINTER.
+        [IN] const IO_VECTOR* Vectors - The buffers, filled one after another.
+        [IN] uint32_t VectorCount - Number of vectors (at most MT_MAX_IO_VECTORS).
+        [OUT OPTIONAL] size_t* BytesRead - Optionally receives the total number of bytes read.
+
+    Return Values:
+
+        Various MTSTATUS Status codes.
+        A read that fails midway keeps its status, BytesRead still receives the bytes read.
+
+--*/
+
+{
+    return MtpTransferFileVectored(FileHandle, FileOffset, Vectors, VectorCount, false, BytesRead);
+}
+
+MTSTATUS
+MtWriteFileGather(
+    IN HANDLE FileHandle,
+    IN uint64_t FileOffset,
+    IN const IO_VECTOR* Vectors,
+    IN uint32_t VectorCount,
+    _Out_Opt size_t* BytesWritten
+)
+
+/*++
+
+    Routine description:
+
+        System call that writes several buffers, in order, to a contiguous file range.
+
+    Arguments:
+
+        [IN] HANDLE FileHandle - The handle of the file opened from MtCreateFile.
+        [IN] uint64_t FileOffset - File offset in bytes to start writing at, or MT_FILE_USE_FILE_POINTER.
+        [IN] const IO_VECTOR* Vectors - The buffers, written one after another.
+        [IN] uint32_t VectorCount - Number of vectors (at most MT_MAX_IO_VECTORS).
+        [OUT OPTIONAL] size_t* BytesWritten - Optionally receives the total number of bytes written.
+
+    Return Values:
+
+        Various MTSTATUS Status codes.
+        A write that fails midway keeps its status, BytesWritten still receives the bytes written.
+
+--*/
+
+{
+    return MtpTransferFileVectored(FileHandle, FileOffset, Vectors, VectorCount, true, BytesWritten);
 }
\ No newline at end of file
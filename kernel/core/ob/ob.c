@@ -56,7 +56,8 @@ void ObInitialize (
     InitializeListHead(&ObTypeDirectoryList);
     // Initialize the DPC here, not at the ObpDefer function, as it would overwrite.
     /// FIXME, This is currently unused.
-    MeInitializeDpc(&ObpReaperDpc, ReapOb, NULL, MEDIUM_PRIORITY);
+    // Object deletion chains are long, they run at PASSIVE_LEVEL once the threaded DPC threads exist.
+    MeInitializeThreadedDpc(&ObpReaperDpc, ReapOb, NULL, MEDIUM_PRIORITY);
 }
 
 MTSTATUS ObCreateObjectType(
@@ -114,6 +115,52 @@ MTSTATUS ObCreateObjectType(
     return MT_SUCCESS;
 }
 
+uint32_t
+ObQueryObjectTypes(
+    IN uint32_t Skip,
+    OUT PSYSTEM_OBJECT_TYPE_ENTRY Entries,
+    IN uint32_t Count
+)
+
+/*++
+
+    Routine description:
+
+        Copies the name and statistics of the object types, in creation order.
+
+    Arguments:
+
+        [IN]    uint32_t Skip - Number of types to skip, lets callers copy in chunks.
+        [OUT]   PSYSTEM_OBJECT_TYPE_ENTRY Entries - Receives up to Count entries, must be non paged (copied under ObGlobalLock).
+        [IN]    uint32_t Count - The capacity of Entries.
+
+    Return Values:
+
+        The total number of object types.
+
+--*/
+
+{
+    uint32_t Index = 0;
+    IRQL oldIrql;
+
+    MsAcquireSpinlock(&ObGlobalLock, &oldIrql);
+
+    for (PDOUBLY_LINKED_LIST Entry = ObTypeDirectoryList.Flink; Entry != &ObTypeDirectoryList; Entry = Entry->Flink, Index++) {
+        if (Index < Skip || Index - Skip >= Count) continue;
+
+        POBJECT_TYPE Type = CONTAINING_RECORD(Entry, OBJECT_TYPE, TypeList);
+        PSYSTEM_OBJECT_TYPE_ENTRY Out = &Entries[Index - Skip];
+
+        kmemcpy(Out->Name, Type->Name, sizeof(Out->Name));
+        Out->TotalNumberOfObjects = Type->TotalNumberOfObjects;
+        Out->TotalNumberOfHandles = Type->TotalNumberOfHandles;
+    }
+
+    MsReleaseSpinlock(&ObGlobalLock, oldIrql);
+    return Index;
+}
+
 MTSTATUS
 ObCreateObject(
     IN POBJECT_TYPE ObjectType,
@@ -359,9 +406,8 @@ ObReferenceObjectByHandle(
             }
         }
 
-        if (MT_FAILURE(Status)) {
-            return Status;
-        }
+        // Pseudo handles never reach the handle table.
+        return Status;
     }
 
 
@@ -369,10 +415,17 @@ ObReferenceObjectByHandle(
     PEPROCESS Process = PsGetCurrentProcess();
     if (!Process || !Process->ObjectTable) return MT_INVALID_HANDLE;
 
+    // The lookup is lock-free, the object can only be trusted until we leave the epoch section, so we reference it inside.
+    EPOCH_SECTION Section;
+    MsEnterEpoch(&Section);
+
     // Lookup in the handle table.
-    PHANDLE_TABLE_ENTRY OutHandleEntry = NULL;
+    HANDLE_TABLE_ENTRY OutHandleEntry;
     void* RetrievedObject = HtGetObject(Process->ObjectTable, Handle, &OutHandleEntry);
-    if (!RetrievedObject) return MT_INVALID_HANDLE;
+    if (!RetrievedObject) {
+        Status = MT_INVALID_HANDLE;
+        goto Leave;
+    }
 
     // Get the header.
     POBJECT_HEADER Header = OBJECT_TO_OBJECT_HEADER(RetrievedObject);
@@ -380,23 +433,33 @@ ObReferenceObjectByHandle(
     // Lets check if the type matches
     if (DesiredType && Header->Type != DesiredType) {
         // Invalid type.
-        return MT_TYPE_MISMATCH;
+        Status = MT_TYPE_MISMATCH;
+        goto Leave;
     }
 
     // Remove the invalid access masks.
-    DesiredAccess = DesiredAccess & DesiredType->TypeInfo.ValidAccessRights;
+    if (DesiredType) DesiredAccess = DesiredAccess & DesiredType->TypeInfo.ValidAccessRights;
 
     // Check access.
-    if ((OutHandleEntry->GrantedAccess & DesiredAccess) != DesiredAccess) {
+    if ((OutHandleEntry.GrantedAccess & DesiredAccess) != DesiredAccess) {
         // Access is invalid.
-        return MT_ACCESS_DENIED;
+        Status = MT_ACCESS_DENIED;
+        goto Leave;
+    }
+
+    // Wow!! It is all good!!, reference it (fails if the handle was closed and the object is being deleted).
+    if (!ObReferenceObject(RetrievedObject)) {
+        Status = MT_OBJECT_DELETED;
+        goto Leave;
     }
 
-    // Wow!! It is all good!!, reference it.
-    ObReferenceObject(RetrievedObject);
     *Object = RetrievedObject;
-    if (HandleInformation) *HandleInformation = *OutHandleEntry;
-    return MT_SUCCESS;
+    if (HandleInformation) *HandleInformation = OutHandleEntry;
+    Status = MT_SUCCESS;
+
+Leave:
+    MsLeaveEpoch(&Section);
+    return Status;
 }
 
 MTSTATUS
@@ -526,6 +589,32 @@ ObpDeferObjectDeletion(
     }
 }
 
+static
+void
+ObpFreeObjectHeader(
+    IN PEPOCH_ENTRY EpochEntry
+)
+
+/*++
+
+    Routine description:
+
+       Frees the memory of a deleted object, called by the epoch reclaim thread.
+
+    Arguments:
+
+        [IN]    PEPOCH_ENTRY EpochEntry - The object header's epoch entry.
+
+    Return Values:
+
+        None.
+
+--*/
+
+{
+    MmFreePool(CONTAINING_RECORD(EpochEntry, OBJECT_HEADER, EpochEntry));
+}
+
 void ObDeleteObject(
     IN POBJECT_HEADER Header
 )
@@ -546,9 +635,8 @@ void ObDeleteObject(
 
     // Update Stats
     InterlockedDecrementU32((volatile uint32_t*)&Type->TotalNumberOfObjects);
-    // Free Memory
-    gop_printf(COLOR_RED, "Freeing the header\n");
-    MmFreePool(Header);
+    // Free Memory (once no lock-free handle/CID lookup can still be looking at the header)
+    MsEpochDefer(&Header->EpochEntry, ObpFreeObjectHeader);
 }
 
 void ObDereferenceObject(
@@ -127,12 +127,24 @@ PsLookupProcessByProcessId(
 
     Return Values:
 
-        Pointer to Process associated with the PID, or NULL if none.
+        Referenced pointer to Process associated with the PID, or NULL if none (or it is being deleted).
+
+    Notes:
+
+        The caller must dereference the process with ObDereferenceObject.
 
 --*/
 
 {
-    return HtGetObject(PspCidTable, ProcessId, NULL);
+    EPOCH_SECTION Section;
+    MsEnterEpoch(&Section);
+
+    // Lock-free lookup, the process is only safe to touch inside the section unless we reference it.
+    PEPROCESS Process = HtGetObject(PspCidTable, ProcessId, NULL);
+    if (Process && !ObReferenceObject(Process)) Process = NULL;
+
+    MsLeaveEpoch(&Section);
+    return Process;
 }
 
 PETHREAD
@@ -152,12 +164,24 @@ PsLookupThreadByThreadId(
 
     Return Values:
 
-        Pointer to Thread associated with the TID, or NULL if none.
+        Referenced pointer to Thread associated with the TID, or NULL if none (or it is being deleted).
+
+    Notes:
+
+        The caller must dereference the thread with ObDereferenceObject.
 
 --*/
 
 {
-    return HtGetObject(PspCidTable, ThreadId, NULL);
+    EPOCH_SECTION Section;
+    MsEnterEpoch(&Section);
+
+    // Lock-free lookup, the thread is only safe to touch inside the section unless we reference it.
+    PETHREAD Thread = HtGetObject(PspCidTable, ThreadId, NULL);
+    if (Thread && !ObReferenceObject(Thread)) Thread = NULL;
+
+    MsLeaveEpoch(&Section);
+    return Thread;
 }
 
 void
@@ -25,7 +25,6 @@
 
 #define MTDLL_TARGET_ENTRY "LdrInitializeProcess"
 #define MTDLL_PATH "mtdll.mtdll" // root dir
-#define MAX_EXPORTED_FUNC_NAME 256
 extern EPROCESS SystemProcess;
 
 uintptr_t MmSystemRangeStart = PhysicalMemoryOffset; // Changed to PhysicalMemoryOffset, since thats where actual stuff like hypermap, phys to virt, and more happen.
@@ -52,129 +51,23 @@ GetBaseName(const char* fullpath, char* out, size_t outsz) {
     return true;
 }
 
-static 
-int
-ReadStringFromFile(PFILE_OBJECT FileObject, uint64_t off, char* buf, size_t buf_len)
-{
-    size_t got = 0;
-    MTSTATUS st;
-
-    if (buf_len == 0) return -1;
-
-    // Read up to buf - 1 bytes (so we leave room for null term)
-    st = FsReadFile(FileObject, off, buf, buf_len - 1, &got);
-    if (MT_FAILURE(st)) return -1;
-
-    /* Ensure NUL termination */
-    buf[got >= (buf_len - 1) ? (buf_len - 1) : got] = '\0';
-
-    // If null term isnt present, we need a larger buffer.
-    if (kmemchr(buf, '\0', got) == NULL) return -1;
-
-    return 0;
-}
-
-// This finds LdrInitializeProcess inside of the MTDLL Export table.
+// This finds LdrInitializeProcess inside of the MTDLL Export table (hashed once, by the image cache).
 static
 void*
 PspFindMtdllEntry(
     IN PFILE_OBJECT MtdllObject
 )
 {
-    MTE_HEADER hdr;
-    size_t br;
-    MTSTATUS st;
-
-    // Read MTE header
-    st = FsReadFile(MtdllObject, 0, &hdr, sizeof(hdr), &br);
-    if (MT_FAILURE(st) || br < sizeof(hdr)) return NULL;
-
-    if (hdr.Magic[0] != 'M' || hdr.Magic[1] != 'T' || hdr.Magic[2] != 'E' || hdr.Magic[3] != '\0') {
-        return NULL;
-    }
-
-    // Null checks
-    if (hdr.exports_rva == 0 || hdr.exports_size < sizeof(MT_EXPORT_ENTRY)) return NULL;
-
-    size_t max_entries = hdr.exports_size / sizeof(MT_EXPORT_ENTRY);
-    if (max_entries == 0) return NULL;
-
-    MT_EXPORT_ENTRY entry;
-    char namebuf[MAX_EXPORTED_FUNC_NAME];
-
-    for (size_t i = 0; i < max_entries; ++i) {
-        uint64_t entry_off = hdr.exports_rva + (uint64_t)(i * sizeof(MT_EXPORT_ENTRY));
-
-        /* read the single MTEXPORT_ENTRY from file */
-        st = FsReadFile(MtdllObject, entry_off, &entry, sizeof(entry), &br);
-        if (MT_FAILURE(st) || br < sizeof(entry)) {
-            break;
-        }
-
-
-        // The entry on disk is ALREADY an RVA.
-        uint64_t name_rva_calculated = entry.name_rva;
-
-        if (name_rva_calculated == 0) continue;
-
-        // Safety check: Ensure RVA is within file bounds (optional but recommended)
-        if (name_rva_calculated >= MtdllObject->FileSize) continue;
-
-        // Read string using the calculated RVA/Offset
-        if (ReadStringFromFile(MtdllObject, name_rva_calculated, namebuf, sizeof(namebuf)) != 0) {
-            continue;
-        }
-
-        // String compare with the export we want.
-        if (kstrcmp(namebuf, MTDLL_TARGET_ENTRY) == 0) {
-            // Return the RVA now.
-            return (void*)(uintptr_t)(entry.func_rva);
-        }
-    }
-
-    return NULL; /* not found */
-}
-
-static
-MTSTATUS
-PspRelocateImage(
-    IN void* ImageBase,
-    IN MTE_HEADER* Header
-)
-{
-    // Calculate the difference between where it is and where it wants to be
-    int64_t delta = (uintptr_t)ImageBase - (uintptr_t)Header->PreferredImageBase;
-
-    // If loaded at preferred address, no work needed
-    if (delta == 0) return MT_SUCCESS;
-
-    // null check
-    if (Header->reloc_rva == 0 || Header->reloc_size == 0) {
-        // Warning: Loaded at wrong address but no relocations found? 
-        // Code might crash, but technically not a failure of this function.
-        return MT_SUCCESS;
-    }
+    PMM_IMAGE Image;
+    uint64_t FuncRva = 0;
 
-    // Point to the relocation table
-    Rela* reloc_table = (Rela*)((uintptr_t)ImageBase + Header->reloc_rva);
-    size_t count = Header->reloc_size / sizeof(Rela);
+    if (MT_FAILURE(MmReferenceImage(MtdllObject, &Image))) return NULL;
 
-    // Iterate and Fix
-    for (size_t i = 0; i < count; i++) {
-        Rela* entry = &reloc_table[i];
+    MTSTATUS st = MmFindImageExport(Image, MTDLL_TARGET_ENTRY, &FuncRva);
+    MmDereferenceImage(Image);
 
-        // We only care about R_X86_64_RELATIVE (Type 8)
-        if ((entry->r_info & 0xFFFFFFFF) == R_X86_64_RELATIVE) {
-
-            // Pointer to the address we need to fix
-            uintptr_t* target_ptr = (uintptr_t*)((uintptr_t)ImageBase + entry->r_offset);
-
-            // Apply the fix: NewBase + Addend
-            *target_ptr = (uintptr_t)ImageBase + entry->r_addend;
-        }
-    }
-
-    return MT_SUCCESS;
+    if (MT_FAILURE(st)) return NULL; /* not found */
+    return (void*)(uintptr_t)FuncRva;
 }
 
 MTSTATUS
@@ -292,30 +185,8 @@ PsCreateProcess(
     // Neat assertion.
     assert(MtdllEntrypoint == MtdllBase, "Entrypoint does not match MTDLL Base, mtdll file corruption, or incorrect linking.");
 
-    APC_STATE RelocApcState;
-    MeAttachProcess(&Process->InternalProcess, &RelocApcState);
+    // No relocation here, MmMapViewOfSection returns the view relocated for MtdllBase (from the image cache).
 
-    // Read header from the loaded memory
-    MTE_HEADER* LoadedHeader = (MTE_HEADER*)MtdllBase;
-
-    // Perform Relocations
-    // We wrap this in a try/except because we are touching user memory
-    try {
-        // Verify magic in memory just in case
-        if (LoadedHeader->Magic[0] == 'M' && LoadedHeader->Magic[1] == 'T' && LoadedHeader->Magic[2] == 'E') {
-            // Check to relocate ONLY IF the base address isnt the preferred image base.
-            if (LoadedHeader->PreferredImageBase != (uint64_t)MtdllBase) {
-                PspRelocateImage(MtdllBase, LoadedHeader);
-            }
-        }
-    } except{
-         Status = GetExceptionCode();
-    } end_try;
-
-    MeDetachProcess(&RelocApcState);
-
-    if (MT_FAILURE(Status)) goto CleanupWithRef;
-    
     // Actual LdrInitializeProcess of MTDLL.
     void* MtdllInitializeProcess = (void*)((uintptr_t)MtdllBase + (uintptr_t)MtdllInitializeProcessRva);
 
@@ -360,6 +231,10 @@ PsCreateProcess(
     // MmpDeleteSection closes the file handle.
     if (MT_FAILURE(Status)) goto CleanupWithRef;
 
+    // Reserve the shared user data page (time, tick count).
+    Status = MmMapSharedUserData(Process);
+    if (MT_FAILURE(Status)) goto CleanupWithRef;
+
     // Create PEB.
     PMTDLL_BASIC_TYPES BasicTypes = NULL;
     Status = MmCreatePeb(Process, (void**)&Process->Peb, (void**)&BasicTypes);
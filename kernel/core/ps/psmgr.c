@@ -18,6 +18,7 @@ Revision History:
 
 #include "../../includes/ps.h"
 #include "../../includes/ob.h"
+#include "../../includes/md.h"
 
 // Explanation for future me or anything going over my kernel.
 // Instead of creating processes and deleting them when exiting, we use an object manager
@@ -106,10 +107,11 @@ PsInitializeSystem(
     }
     else if (Phase == PS_PHASE_INITIALIZE_WORKER_THREADS) {
         PsInitializeWorkerThreads();
+        MsInitializeEpochReclamation();
+        MdInitializeLogging();
         return MT_SUCCESS;
     }
     else {
         MeBugCheck(INVALID_INITIALIZATION_PHASE);
     }
 }
-
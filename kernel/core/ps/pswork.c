@@ -51,11 +51,10 @@ static void PsStackDeleterThread(void) {
             PSTACK_REAPER_ENTRY cur = head;
             head = cur->Next;
 
-            // free the kernel stack safely from this thread's stack
-            MiFreeKernelStack(cur->StackBase, cur->IsLarge);
-
-            // free the node
-            MmFreePool(cur);
+            // free the kernel stack safely from this thread's stack (the node lives on it, copy it out first)
+            void* StackBase = cur->StackBase;
+            bool IsLarge = cur->IsLarge;
+            MiFreeKernelStack(StackBase, IsLarge);
         }
 
         // Loop back to wait for more work, if there is work, i work, on fridays, i work, saturdays - work too.
@@ -64,12 +63,8 @@ static void PsStackDeleterThread(void) {
 
 void PsDeferKernelStackDeletion(void* StackBase, bool IsLarge)
 {
-    PSTACK_REAPER_ENTRY node = MmAllocatePoolWithTag(NonPagedPool, sizeof(STACK_REAPER_ENTRY), 'rSpR');
-    if (!node) {
-        // We dont have a node to put in the deferred list, we must free the stack now to not let the system die on us.
-        MiFreeKernelStack(StackBase, IsLarge);
-        return;
-    }
+    // The stack is still mapped and unused, the node goes at its top (no allocation, callable at DISPATCH_LEVEL).
+    PSTACK_REAPER_ENTRY node = (PSTACK_REAPER_ENTRY)((uintptr_t)StackBase - sizeof(STACK_REAPER_ENTRY));
 
     node->StackBase = StackBase;
     node->IsLarge = IsLarge;
@@ -114,4 +109,3 @@ void PsInitializeWorkerThreads(void) {
     // Set it as a worker thread.
     StackThread->WorkerThread = true;
 }
-
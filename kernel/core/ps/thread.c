@@ -83,10 +83,14 @@ PsCreateThread(
     Thread->PID = ParentProcess->PID;
 
     // Create a new stack for the thread's kernel environment.
-    Thread->InternalThread.KernelStack = MiCreateKernelStack(false);
+    Thread->InternalThread.KernelStack = MmAllocateKernelStack(false);
     Thread->InternalThread.IsLargeStack = false;
     if (!Thread->InternalThread.KernelStack) goto CleanupWithRef;
 
+    // Allocate the FPU/SSE/AVX save area, loaded lazily on the thread's first use of the registers.
+    Status = MeAllocateExtendedState(&Thread->InternalThread);
+    if (MT_FAILURE(Status)) goto CleanupWithRef;
+
     // Create user mode stack. 
     void* BaseAddress = NULL;
     size_t StackSize = MI_DEFAULT_USER_STACK_SIZE;
@@ -210,7 +214,7 @@ MTSTATUS PsCreateSystemThread(ThreadEntry entry, THREAD_PARAMETER parameter, Tim
 
     // Create stack
     bool LargeStack = false;
-    void* stackStart = MiCreateKernelStack(LargeStack);
+    void* stackStart = MmAllocateKernelStack(LargeStack);
 
     if (!stackStart) {
         // free thread
@@ -317,16 +321,25 @@ PsDeleteThread(
     // Free TID.
     PsFreeCid(Thread->TID);
 
-    // Free its stack.
-    if (IsKernelThread) {
-        PsDeferKernelStackDeletion(Thread->InternalThread.KernelStack, Thread->InternalThread.IsLargeStack);
+    // Free its stack (nothing runs on it anymore, it goes back to the stack cache).
+    if (Thread->InternalThread.KernelStack) {
+        MmFreeKernelStack(Thread->InternalThread.KernelStack, Thread->InternalThread.IsLargeStack);
     }
-    else {
-        // Dereference the parent process, and free its kernel stack..
-        PsDeferKernelStackDeletion(Thread->InternalThread.KernelStack, Thread->InternalThread.IsLargeStack);
+
+    if (!IsKernelThread) {
+        // Dereference the parent process.
         ObDereferenceObject(Thread->ParentProcess);
     }
 
+    // Free its extended state area (user threads only).
+    MeFreeExtendedState(&Thread->InternalThread);
+
+    // Free its file I/O staging buffer, if it ever did file I/O.
+    if (Thread->IoStagingBuffer) {
+        MmFreePool(Thread->IoStagingBuffer);
+        Thread->IoStagingBuffer = NULL;
+    }
+
     // When we reach here, the function returns, and the ETHREAD is deleted.
 }
 
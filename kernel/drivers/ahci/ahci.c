@@ -8,6 +8,7 @@
 #include "../../assert.h"
 #include "../../includes/mg.h"
 #include "../../includes/mm.h"
+#include "../../includes/md.h"
 
 #ifdef REMINDER
 _Static_assert(false, "Reminder: AHCI, and other DMA stuff DEAL WITH PHYSICAL ADDRESSES ONLY! not virtual, so supply to them the translated addresses.");
@@ -291,6 +292,8 @@ bool ahci_initialized = false;
 
 MTSTATUS ahci_init(void) {
     if (ahci_initialized) { return MT_SUCCESS; } // gop_printf(COLOR_RED, "AHCI Initialization got called again when already init.\n"); return MT_SUCCESS; }
+    // No controller (e.g booting from the RAM disk only)
+    if (boot_info_local.AhciCount == 0) { return MT_AHCI_INIT_FAILED; }
     // Use BootInfo PCI BARs.
     for (size_t i = 0; i < boot_info_local.AhciCount; i++) {
         uint64_t base = boot_info_local.AhciBarBases[i];
@@ -407,6 +410,9 @@ MTSTATUS ahci_read_sector(BLOCK_DEVICE* dev, uint32_t lba, void* buf, size_t byt
     __asm__ volatile("sfence; mfence" ::: "memory");
 
     // 9. Start Command
+    MD_TRACE(TraceEventDiskSubmit, lba, bytes);
+    MeIncrementCounter(PerfCounterDiskReads);
+    MeAddCounter(PerfCounterDiskReadBytes, bytes);
     p->ci = (1u << slot);
 
     // 10. Wait for Completion
@@ -414,6 +420,7 @@ MTSTATUS ahci_read_sector(BLOCK_DEVICE* dev, uint32_t lba, void* buf, size_t byt
     while (p->ci & (1u << slot)) {
         if (++spin >= TIMEOUT) break;
     }
+    MD_TRACE(TraceEventDiskComplete, lba, (spin >= TIMEOUT) ? ~0ULL : p->tfd);
 
     // 11. Error Checking
     if ((spin >= TIMEOUT) || (p->tfd & ((1 << 7) | (1 << 0)))) {
@@ -522,6 +529,9 @@ MTSTATUS ahci_write_sector(BLOCK_DEVICE* dev, uint32_t lba, const void* buf, siz
     __asm__ volatile("sfence; mfence" ::: "memory");
 
     /* Issue */
+    MD_TRACE(TraceEventDiskSubmit, lba, bytes | (1ULL << 63));
+    MeIncrementCounter(PerfCounterDiskWrites);
+    MeAddCounter(PerfCounterDiskWriteBytes, bytes);
     p->ci = (1u << slot);
 
     /* Wait */
@@ -530,6 +540,7 @@ MTSTATUS ahci_write_sector(BLOCK_DEVICE* dev, uint32_t lba, const void* buf, siz
     while (p->ci & (1u << slot)) {
         if (++spin >= TIMEOUT) break;
     }
+    MD_TRACE(TraceEventDiskComplete, lba, (spin >= TIMEOUT) ? ~0ULL : p->tfd);
 
     if (spin >= TIMEOUT) {
 #ifdef AHCI_DEBUG_PRINT
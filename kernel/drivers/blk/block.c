@@ -14,13 +14,14 @@ static BLOCK_DEVICE* devices[MAX_BLK_DEV];
 extern GOP_PARAMS gop_local;
 static int device_count = 0;
 
-void register_block_device(BLOCK_DEVICE* dev) {
+int register_block_device(BLOCK_DEVICE* dev) {
     // print the index were about to use and the device pointer
 #ifdef DEBUG
     gop_printf(0xFFFFFF00, "Registering block #%d at %llx\n", device_count, (unsigned long long)(uintptr_t)dev);
 #endif
     if (device_count < MAX_BLK_DEV) {
-        devices[device_count++] = dev;
+        devices[device_count] = dev;
+        return device_count++;
     }
     else {
         // too many!
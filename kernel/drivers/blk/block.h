@@ -20,8 +20,8 @@ typedef struct _BLOCK_DEVICE {
     void* dev_data;
 } BLOCK_DEVICE;
 
-/* Register a block device so `get_block_device()` can find it */
-void register_block_device(BLOCK_DEVICE* dev);
+/* Register a block device so `get_block_device()` can find it, returns its index */
+int register_block_device(BLOCK_DEVICE* dev);
 
 /* Get the "n" registered device (0, 1, ...), or NULL if out of range. */
 BLOCK_DEVICE* get_block_device(int index);
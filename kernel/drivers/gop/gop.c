@@ -26,98 +26,171 @@ static inline bool gop_params_valid(const GOP_PARAMS* gop) {
     return true;
 }
 
-static inline void plot_pixel(GOP_PARAMS* gop, uint32_t x, uint32_t y, uint32_t color) {
-    if (x >= gop->Width || y >= gop->Height) return;
-
-    // Safety: Calculate offset in uint64 to prevent overflow before casting back
-    uint64_t offset = (uint64_t)y * gop->PixelsPerScanLine + x;
-    if (offset * 4 >= gop->FrameBufferSize) return; 
-
-    uint32_t* fb = (uint32_t*)(uintptr_t)gop->FrameBufferBase;
-    fb[offset] = color;
-}
-
 static inline uint32_t char_width(void) { return  8 * FONT_SCALE; }
 static inline uint32_t line_height(void) { return 16 * FONT_SCALE; }
 
 bool gop_bold_enabled = false; // default
-uint32_t cursor_x = 0, cursor_y = 0;
+uint32_t cursor_x = 0, cursor_y = 0; // In pixels, the console works in cells (cursor / char size)
 extern GOP_PARAMS gop_local;
 
-static void draw_char(GOP_PARAMS* gop, char c_, uint32_t x, uint32_t y, uint32_t color) {
-    uint8_t c = (uint8_t)c_;
-    if (!gop_params_valid(gop)) return;
-
-    // Fallback for non-printable chars
-    if (c > 0x7F) c = '?';
-
-    const uint8_t* bitmap = font8x16[c];
-    for (int row = 0; row < 16; row++) {
-        uint8_t bits = bitmap[row];
-        for (int col = 0; col < 8; col++) {
-            if (!(bits & (1 << (7 - col)))) continue;
-
-            // Draw with scaling
-            for (int dy = 0; dy < FONT_SCALE; dy++) {
-                for (int dx = 0; dx < FONT_SCALE; dx++) {
-                    uint32_t px = x + col * FONT_SCALE + dx;
-                    uint32_t py = y + row * FONT_SCALE + dy;
-
-                    if (gop_bold_enabled) {
-                        // Safe bold plotting
-                        plot_pixel(gop, px, py, color);
-                        plot_pixel(gop, px + 1, py, color);
-                    }
-                    else {
-                        plot_pixel(gop, px, py, color);
-                    }
+//
+// Text goes into a character-cell grid in RAM, whose rows form a ring, so a scroll of the grid is an index change.
+// gop_printf then renders only the dirty rows, a scanline at a time into a RAM line, which is copied out to the
+// (write combined) framebuffer with string stores.
+// The framebuffer is read back only to scroll, the visible rows are moved up in place and only the new bottom row is drawn
+// (video memory reads are uncached, but re-rendering every glyph of the screen per line of output costs more).
+//
+// The grid is static, so it works from the first print (before the pool exists), sized for a 3840x2160 screen.
+//
+
+#define CONSOLE_MAX_COLUMNS 480
+#define CONSOLE_MAX_ROWS    135
+#define CONSOLE_MAX_WIDTH   (CONSOLE_MAX_COLUMNS * 8)
+
+#define CONSOLE_CELL_BOLD   0x1
+
+typedef struct _CONSOLE_CELL {
+    uint32_t Color;
+    char Char;
+    uint8_t Flags;
+    uint16_t Reserved;
+} CONSOLE_CELL;
+
+typedef struct _CONSOLE {
+    uint32_t Columns;                           // Visible columns (0 until the first use)
+    uint32_t Rows;                              // Visible rows
+    uint32_t Top;                               // Ring slot of the first visible row
+    uint32_t Background;                        // Color of empty cells, set by gop_clear_screen
+    bool Dirty[CONSOLE_MAX_ROWS];               // Per visible row, must be rendered on the next flush
+    CONSOLE_CELL Cells[CONSOLE_MAX_ROWS][CONSOLE_MAX_COLUMNS];
+} CONSOLE;
+
+static CONSOLE Console;
+static uint32_t ConsoleLine[CONSOLE_MAX_WIDTH]; // One scanline, rendered before being copied to the framebuffer
+
+static inline bool console_ready(GOP_PARAMS* gop) {
+    if (Console.Columns) return true;
+    if (!gop_params_valid(gop)) return false;
+
+    uint32_t columns = gop->Width / char_width();
+    uint32_t rows = gop->Height / line_height();
+    if (!columns || !rows) return false;
+
+    Console.Columns = (columns < CONSOLE_MAX_COLUMNS) ? columns : CONSOLE_MAX_COLUMNS;
+    Console.Rows = (rows < CONSOLE_MAX_ROWS) ? rows : CONSOLE_MAX_ROWS;
+    Console.Top = 0;
+    return true;
+}
+
+static inline CONSOLE_CELL* console_row(uint32_t row) {
+    uint32_t slot = Console.Top + row;
+    if (slot >= Console.Rows) slot -= Console.Rows;
+    return Console.Cells[slot];
+}
+
+static void console_clear_row(uint32_t row) {
+    CONSOLE_CELL* cells = console_row(row);
+    for (uint32_t col = 0; col < Console.Columns; col++) {
+        cells[col].Char = ' ';
+        cells[col].Flags = 0;
+    }
+    Console.Dirty[row] = true;
+}
+
+static void console_render_row(GOP_PARAMS* gop, uint32_t row) {
+    const CONSOLE_CELL* cells = console_row(row);
+    uint32_t* fb = (uint32_t*)(uintptr_t)gop->FrameBufferBase;
+    uint32_t width = Console.Columns * char_width();
+
+    for (uint32_t line = 0; line < line_height(); line++) {
+        uint32_t glyph_row = line / FONT_SCALE;
+
+        for (uint32_t x = 0; x < width; x++) ConsoleLine[x] = Console.Background;
+
+        for (uint32_t col = 0; col < Console.Columns; col++) {
+            uint8_t c = (uint8_t)cells[col].Char;
+            if (c == ' ' || c == 0) continue;
+
+            // Fallback for non-printable chars
+            if (c > 0x7F) c = '?';
+
+            uint8_t bits = font8x16[c][glyph_row];
+            if (!bits) continue;
+
+            uint32_t color = cells[col].Color;
+            uint32_t x0 = col * char_width();
+            for (uint32_t bit = 0; bit < 8; bit++) {
+                if (!(bits & (1 << (7 - bit)))) continue;
+
+                for (uint32_t dx = 0; dx < FONT_SCALE; dx++) {
+                    uint32_t px = x0 + bit * FONT_SCALE + dx;
+                    ConsoleLine[px] = color;
+                    // Bold spills a pixel to the right (into the next cell, like it always did).
+                    if ((cells[col].Flags & CONSOLE_CELL_BOLD) && px + 1 < width) ConsoleLine[px + 1] = color;
                 }
             }
         }
-    }
-}
 
-static void draw_string(GOP_PARAMS* gop, const char* s, uint32_t x, uint32_t y, uint32_t color) {
-    while (*s) {
-        draw_char(gop, *s, x, y, color);
-        x += char_width();
-        s++;
+        uint64_t offset = (uint64_t)(row * line_height() + line) * gop->PixelsPerScanLine;
+        if ((offset + width) * 4 > gop->FrameBufferSize) break;
+        kmemcpy(&fb[offset], ConsoleLine, (size_t)width * sizeof(uint32_t));
     }
 }
 
-static void fb_memmove32(uint32_t* dest, uint32_t* src, size_t count) {
-    if (dest < src) {
-        for (size_t i = 0; i < count; i++) dest[i] = src[i];
-    }
-    else if (dest > src) {
-        for (size_t i = count; i-- > 0; ) dest[i] = src[i];
+static void console_flush(GOP_PARAMS* gop) {
+    if (!Console.Columns || !gop_params_valid(gop)) return;
+
+    for (uint32_t row = 0; row < Console.Rows; row++) {
+        if (!Console.Dirty[row]) continue;
+        Console.Dirty[row] = false;
+        console_render_row(gop, row);
     }
 }
 
 static void gop_scroll(GOP_PARAMS* gop) {
-    if (!gop_params_valid(gop)) return;
+    // The old top row becomes the new bottom row.
+    Console.Top = (Console.Top + 1 < Console.Rows) ? Console.Top + 1 : 0;
 
-    uint32_t* fb = (uint32_t*)(uintptr_t)gop->FrameBufferBase;
-    uint32_t  stride = gop->PixelsPerScanLine;
-    uint32_t  h = gop->Height;
-    uint32_t  w = gop->Width;
-    uint32_t  lines = line_height();
+    // Rows still pending a render will be drawn at their new place anyway, the copy only helps if one of them is clean.
+    bool copy = false;
+    for (uint32_t row = 1; row < Console.Rows; row++) {
+        if (!Console.Dirty[row]) copy = true;
+        Console.Dirty[row - 1] = Console.Dirty[row];
+    }
+
+    uint32_t width = Console.Columns * char_width();
+    uint32_t lines = Console.Rows * line_height();
+    if (lines <= line_height() || !gop_params_valid(gop) ||
+        ((uint64_t)(lines - 1) * gop->PixelsPerScanLine + width) * 4 > gop->FrameBufferSize) {
+        copy = false;
+    }
 
-    if (gop->Height <= lines) return;
+    if (copy) {
+        // Move the visible rows up a text line, a scanline at a time (the source and destination never overlap).
+        uint32_t* fb = (uint32_t*)(uintptr_t)gop->FrameBufferBase;
+        for (uint32_t y = line_height(); y < lines; y++) {
+            uint64_t offset = (uint64_t)y * gop->PixelsPerScanLine;
+            kmemcpy(&fb[offset - (uint64_t)line_height() * gop->PixelsPerScanLine], &fb[offset], (size_t)width * sizeof(uint32_t));
+        }
+    }
+    else {
+        for (uint32_t row = 0; row < Console.Rows; row++) Console.Dirty[row] = true;
+    }
 
-    size_t count = (h - lines) * (size_t)stride;
-    fb_memmove32(&fb[0], &fb[lines * stride], count);
+    // Only the new bottom row has to be drawn.
+    console_clear_row(Console.Rows - 1);
 
-    // clear bottom
-    for (uint32_t yy = h - lines; yy < h; yy++)
-        for (uint32_t xx = 0; xx < w; xx++)
-            fb[yy * stride + xx] = 0;
+    cursor_y = (cursor_y >= line_height()) ? (cursor_y - line_height()) : 0;
+}
 
-    cursor_y = (cursor_y >= lines) ? (cursor_y - lines) : 0;
+static void gop_newline(GOP_PARAMS* gop) {
+    cursor_x = 0;
+    cursor_y += line_height();
+    if (cursor_y / line_height() >= Console.Rows) gop_scroll(gop);
 }
 
 static void gop_put_char(GOP_PARAMS* gop, char c, uint32_t color) {
-    if (!gop_params_valid(gop)) return;
+    if (!console_ready(gop)) return;
 
     if (c == '\b') {
         if (cursor_x >= char_width()) {
@@ -126,21 +199,17 @@ static void gop_put_char(GOP_PARAMS* gop, char c, uint32_t color) {
         else {
             if (cursor_y >= line_height()) {
                 cursor_y -= line_height();
-                cursor_x = gop->Width - char_width();
+                cursor_x = (Console.Columns - 1) * char_width();
             }
         }
         // Clear cell
-        for (uint32_t yy = cursor_y; yy < cursor_y + line_height(); yy++) {
-            for (uint32_t xx = cursor_x; xx < cursor_x + char_width(); xx++) {
-                plot_pixel(gop, xx, yy, 0); // Clear with black/bg
-            }
-        }
+        uint32_t row = cursor_y / line_height();
+        console_row(row)[cursor_x / char_width()].Char = ' ';
+        Console.Dirty[row] = true;
         return;
     }
     if (c == '\n') {
-        cursor_x = 0;
-        cursor_y += line_height();
-        if (cursor_y + line_height() > gop->Height) gop_scroll(gop);
+        gop_newline(gop);
         return;
     }
     if (c == '\r') {
@@ -148,15 +217,21 @@ static void gop_put_char(GOP_PARAMS* gop, char c, uint32_t color) {
         return;
     }
 
-    draw_char(gop, c, cursor_x, cursor_y, color);
+    // The cursor may have been moved by hand (bugcheck), keep it inside the grid.
+    if (cursor_y / line_height() >= Console.Rows) cursor_y = (Console.Rows - 1) * line_height();
+    if (cursor_x / char_width() >= Console.Columns) gop_newline(gop);
+
+    uint32_t row = cursor_y / line_height();
+    CONSOLE_CELL* cell = &console_row(row)[cursor_x / char_width()];
+    cell->Char = c;
+    cell->Color = color;
+    cell->Flags = gop_bold_enabled ? CONSOLE_CELL_BOLD : 0;
+    Console.Dirty[row] = true;
+
     cursor_x += char_width();
 
     // Wrap text
-    if (cursor_x + char_width() > gop->Width) {
-        cursor_x = 0;
-        cursor_y += line_height();
-        if (cursor_y + line_height() > gop->Height) gop_scroll(gop);
-    }
+    if (cursor_x / char_width() >= Console.Columns) gop_newline(gop);
 }
 
 static void gop_puts(GOP_PARAMS* gop, const char* s, uint32_t color) {
@@ -223,9 +298,23 @@ static void gop_print_hex_minimal(GOP_PARAMS* gop, uint64_t val, uint32_t color)
 extern GOP_PARAMS gop_local;
 
 void gop_clear_screen(GOP_PARAMS* gop, uint32_t color) {
-    for (uint32_t y = 0; y < gop->Height; y++)
-        for (uint32_t x = 0; x < gop->Width; x++)
-            plot_pixel(gop, x, y, color);
+    if (!console_ready(gop)) return;
+
+    uint32_t* fb = (uint32_t*)(uintptr_t)gop->FrameBufferBase;
+    uint32_t width = (gop->Width < CONSOLE_MAX_WIDTH) ? gop->Width : CONSOLE_MAX_WIDTH;
+
+    for (uint32_t x = 0; x < width; x++) ConsoleLine[x] = color;
+    for (uint32_t y = 0; y < gop->Height; y++) {
+        uint64_t offset = (uint64_t)y * gop->PixelsPerScanLine;
+        if ((offset + width) * 4 > gop->FrameBufferSize) break;
+        kmemcpy(&fb[offset], ConsoleLine, (size_t)width * sizeof(uint32_t));
+    }
+
+    // The screen now matches an empty grid.
+    Console.Background = color;
+    Console.Top = 0;
+    for (uint32_t row = 0; row < Console.Rows; row++) console_clear_row(row);
+    for (uint32_t row = 0; row < Console.Rows; row++) Console.Dirty[row] = false;
 }
 
 static inline void buf_put_char(char* buf, size_t size, size_t* written, char c) {
@@ -719,6 +808,7 @@ void gop_printf(uint32_t color, const char* fmt, ...) {
     }
 
     va_end(ap);
+    console_flush(gop);
     release_tmp_lock(&gop_lock);
     if (prev_if) __sti();
 }
@@ -0,0 +1,70 @@
+/*
+ * PROJECT:      MatanelOS Kernel
+ * LICENSE:      GPLv3
+ * PURPOSE:      Boot RAM disk driver (a disk image loaded into memory by the bootloader).
+ */
+
+#include "ramdisk.h"
+#include "../../includes/efi.h"
+#include "../../includes/mm.h"
+#include "../../includes/me.h"
+#include "../../includes/mg.h"
+
+//
+// The bootloader loads \ramdisk.img from the ESP into EfiLoaderData pages (never handed out by the PFN database)
+// below 4 GiB and passes it in BOOT_INFO. The image is laid out like the boot disk (FAT32 partition at LBA 2048),
+// so the FAT32 driver mounts it unchanged. Reads and writes are plain copies, writes are lost at shutdown.
+//
+
+typedef struct _RAMDISK_CTX {
+    uint8_t* base;
+    uint64_t size;
+} RAMDISK_CTX;
+
+static RAMDISK_CTX ramdisk_ctx;
+static BLOCK_DEVICE ramdisk_bdev;
+
+static bool ramdisk_range_valid(RAMDISK_CTX* ctx, uint32_t lba, size_t bytes) {
+    if (bytes == 0 || (bytes % RAMDISK_SECTOR_SIZE != 0)) return false;
+
+    uint64_t offset = (uint64_t)lba * RAMDISK_SECTOR_SIZE;
+    return offset < ctx->size && bytes <= ctx->size - offset;
+}
+
+MTSTATUS ramdisk_read_sector(BLOCK_DEVICE* dev, uint32_t lba, void* buf, size_t bytes) {
+    RAMDISK_CTX* ctx = (RAMDISK_CTX*)dev->dev_data;
+    if (!buf || !ramdisk_range_valid(ctx, lba, bytes)) return MT_INVALID_PARAM;
+
+    kmemcpy(buf, ctx->base + (uint64_t)lba * RAMDISK_SECTOR_SIZE, bytes);
+    return MT_SUCCESS;
+}
+
+MTSTATUS ramdisk_write_sector(BLOCK_DEVICE* dev, uint32_t lba, const void* buf, size_t bytes) {
+    RAMDISK_CTX* ctx = (RAMDISK_CTX*)dev->dev_data;
+    if (!buf || !ramdisk_range_valid(ctx, lba, bytes)) return MT_INVALID_PARAM;
+
+    kmemcpy(ctx->base + (uint64_t)lba * RAMDISK_SECTOR_SIZE, buf, bytes);
+    return MT_SUCCESS;
+}
+
+MTSTATUS ramdisk_init(int* device_index) {
+    if (!boot_info_local.RamDiskBase || boot_info_local.RamDiskSize < RAMDISK_SECTOR_SIZE) return MT_NOT_FOUND;
+
+    // Whole sectors only, a trailing partial one is ignored.
+    uint64_t size = boot_info_local.RamDiskSize & ~(uint64_t)(RAMDISK_SECTOR_SIZE - 1);
+
+    // It's regular RAM, map it write back.
+    void* base = MmMapIoSpace((uintptr_t)boot_info_local.RamDiskBase, (size_t)size, MmCached);
+    if (!base) return MT_NO_MEMORY;
+
+    ramdisk_ctx.base = (uint8_t*)base;
+    ramdisk_ctx.size = size;
+
+    ramdisk_bdev.read_sector = ramdisk_read_sector;
+    ramdisk_bdev.write_sector = ramdisk_write_sector;
+    ramdisk_bdev.dev_data = &ramdisk_ctx;
+
+    *device_index = register_block_device(&ramdisk_bdev);
+    gop_printf(COLOR_LIME, "RAMDISK | %llu KiB at %p\n", (unsigned long long)(size / 1024), base);
+    return MT_SUCCESS;
+}
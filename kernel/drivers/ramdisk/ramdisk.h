@@ -0,0 +1,44 @@
+/*
+ * PROJECT:      MatanelOS Kernel
+ * LICENSE:      GPLv3
+ * PURPOSE:      Boot RAM disk driver types and functions.
+ */
+
+#ifndef X86_DRIVER_RAMDISK_H
+#define X86_DRIVER_RAMDISK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "../blk/block.h"
+#include "../../mtstatus.h"
+
+// Sector size of the RAM disk, the same as the AHCI disks (FAT32 reads in multiples of it).
+#define RAMDISK_SECTOR_SIZE 512
+
+/// <summary>
+/// Map the RAM disk loaded by the bootloader (BOOT_INFO RamDiskBase/RamDiskSize) and register it as a BLOCK_DEVICE.
+/// </summary>
+/// <param name="device_index">Receives the block device index (for get_block_device / fat32_init).</param>
+/// <returns>MT_SUCCESS, MT_NOT_FOUND if the bootloader didn't load one, MT_NO_MEMORY if it couldn't be mapped.</returns>
+MTSTATUS ramdisk_init(int* device_index);
+
+/// <summary>
+/// Read bytes (a multiple of the sector size) starting at the given LBA of the RAM disk.
+/// </summary>
+/// <param name="dev">Takes the BLOCK_DEVICE device pointer (on register_block_device)</param>
+/// <param name="lba">LBA to read from.</param>
+/// <param name="buf">Return buffer to place the data read.</param>
+/// <returns>MT_SUCCESS, or MT_INVALID_PARAM if the range isn't inside the disk.</returns>
+MTSTATUS ramdisk_read_sector(BLOCK_DEVICE* dev, uint32_t lba, void* buf, size_t bytes);
+
+/// <summary>
+/// Write bytes (a multiple of the sector size) starting at the given LBA of the RAM disk.
+/// </summary>
+/// <param name="dev">Takes the BLOCK_DEVICE device pointer (on register_block_device)</param>
+/// <param name="lba">LBA to write to.</param>
+/// <param name="buf">The buffer to write to the specified LBA.</param>
+/// <returns>MT_SUCCESS, or MT_INVALID_PARAM if the range isn't inside the disk.</returns>
+MTSTATUS ramdisk_write_sector(BLOCK_DEVICE* dev, uint32_t lba, const void* buf, size_t bytes);
+
+#endif
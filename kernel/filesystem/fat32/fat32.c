@@ -1026,6 +1026,33 @@ static uint32_t extract_dir_cluster(const char* filename) {
 	return cluster;
 }
 
+// The seek hint packs the index of a cluster in the file (high half) with its cluster number (low half), so it is read and written in a single store.
+#define FAT32_SEEK_HINT(index, cluster) (((uint64_t)(index) << 32) | (uint32_t)(cluster))
+
+// Find the cluster holding FileOffset, starting from the file's seek hint when it lies at or before it (sequential chunks walk a single link).
+static MTSTATUS fat32_seek_cluster(PFILE_OBJECT FileObject, uint64_t FileOffset, uint32_t cluster_size, uint32_t* out_cluster, uint32_t* out_index) {
+	uint32_t current_cluster = (uint32_t)(uintptr_t)FileObject->FsContext;
+	uint32_t current_index = 0;
+	uint32_t target_index = (uint32_t)(FileOffset / cluster_size);
+
+	uint64_t hint = InterlockedFetchU64(&FileObject->FsSeekHint);
+	if ((uint32_t)hint >= 2 && (uint32_t)(hint >> 32) <= target_index) {
+		current_index = (uint32_t)(hint >> 32);
+		current_cluster = (uint32_t)hint;
+	}
+
+	for (; current_index < target_index; current_index++) {
+		current_cluster = fat32_read_fat(current_cluster);
+		if (current_cluster >= FAT32_EOC_MIN) {
+			return MT_FAT32_EOF;
+		}
+	}
+
+	*out_cluster = current_cluster;
+	*out_index = current_index;
+	return MT_SUCCESS;
+}
+
 MTSTATUS fat32_read_file(
 	IN PFILE_OBJECT FileObject,
 	IN uint64_t FileOffset,
@@ -1042,15 +1069,9 @@ MTSTATUS fat32_read_file(
 	uint32_t cluster_size = bytes_per_sector * sectors_per_cluster;
 
 	// Walk the FAT chain until we reach thee desired cluster of the file offset.
-	uint32_t current_cluster = (uint32_t)(uintptr_t)FileObject->FsContext;
-	uint32_t clusters_to_skip = FileOffset / cluster_size;
-
-	for (uint32_t i = 0; i < clusters_to_skip; i++) {
-		current_cluster = fat32_read_fat(current_cluster);
-		if (current_cluster >= FAT32_EOC_MIN) {
-			return MT_FAT32_EOF;
-		}
-	}
+	uint32_t current_cluster, current_index;
+	MTSTATUS seek_status = fat32_seek_cluster(FileObject, FileOffset, cluster_size, &current_cluster, &current_index);
+	if (MT_FAILURE(seek_status)) return seek_status;
 
 	// FileOffset is good, we can set it in the file object.
 	FileObject->CurrentOffset = FileOffset;
@@ -1108,17 +1129,23 @@ MTSTATUS fat32_read_file(
 		// if the new offset is directly at a cluster boundary (end of cluster) we cannot read it since it would go to a different cluster..
 		// We need to read the next cluster and use it.
 		if (bytes_left > 0 && (current_file_offset % cluster_size) == 0) {
-			current_cluster = fat32_read_fat(current_cluster);
+			uint32_t next_cluster = fat32_read_fat(current_cluster);
 
 			// Check for EOF (End of Chain)
-			if (current_cluster >= FAT32_EOC_MIN) {
+			if (next_cluster >= FAT32_EOC_MIN) {
 				// Technically an error if we expected more data but hit EOF
 				status = MT_FAT32_EOF;
 				break;
 			}
+
+			current_cluster = next_cluster;
+			current_index++;
 		}
 	}
 
+	// The next chunk of a sequential read starts here.
+	InterlockedExchangeU64(&FileObject->FsSeekHint, FAT32_SEEK_HINT(current_index, current_cluster));
+
 	// 4. Cleanup and Return
 	if (IntermediateBuffer) {
 		MmFreePool(IntermediateBuffer);
@@ -1404,18 +1431,10 @@ MTSTATUS fat32_write_file(
 		FileObject->FsContext = (void*)(uintptr_t)first_cluster;
 	}
 
-	// Seek to the correct cluster based on FileOffset
-	uint32_t current_cluster = (uint32_t)(uintptr_t)FileObject->FsContext;
-	uint32_t clusters_to_skip = FileOffset / cluster_size;
-
-	for (uint32_t i = 0; i < clusters_to_skip; i++) {
-		current_cluster = fat32_read_fat(current_cluster);
-
-		// Looks like we hit EOF.
-		if (current_cluster >= FAT32_EOC_MIN) {
-			return MT_FAT32_EOF;
-		}
-	}
+	// Seek to the correct cluster based on FileOffset (returns EOF if we hit it).
+	uint32_t current_cluster, current_index;
+	status = fat32_seek_cluster(FileObject, FileOffset, cluster_size, &current_cluster, &current_index);
+	if (MT_FAILURE(status)) return status;
 
 	// Intermediate buffer use exactly like in fat32_read_file
 	void* IntermediateBuffer = MmAllocatePoolWithTag(NonPagedPool, bytes_per_sector, 'BTAF');
@@ -1491,11 +1510,13 @@ MTSTATUS fat32_write_file(
 				// Just follow the existing chain (overwriting existing file data)
 				current_cluster = next_cluster;
 			}
+			current_index++;
 		}
 	}
 
 	// Update the file object state before return
 	FileObject->CurrentOffset = current_file_offset;
+	InterlockedExchangeU64(&FileObject->FsSeekHint, FAT32_SEEK_HINT(current_index, current_cluster));
 
 	// If we extended the file we update the size in the object
 	if (current_file_offset > FileObject->FileSize) {
@@ -2136,6 +2157,8 @@ static MTSTATUS fat32_open_file(
 	FileObject->FileSize = entry.file_size;
 	// The initial cluster of the file.
 	FileObject->FsContext = (void*)(uintptr_t)file_cluster;
+	// No transfer yet, the first one walks from the initial cluster.
+	FileObject->FsSeekHint = 0;
 	// Flags describing what the hell is this!
 	// Currently, none, this also means its a file since the dir bit isnt set.
 	FileObject->Flags = MT_FOF_NONE;
@@ -8,6 +8,7 @@
 #include "../../includes/ob.h"
 
 #include "../../drivers/ahci/ahci.h"
+#include "../../drivers/ramdisk/ramdisk.h"
 #include "../fat32/fat32.h"
 #include "../../includes/macros.h"
 
@@ -79,21 +80,25 @@ void FsDeleteObject(
 }
 
 MTSTATUS FsInitialize(void) {
+	// A RAM disk loaded by the bootloader is the root if there is one, the AHCI disks are then optional.
+	int root_device = MAIN_FS_DEVICE;
+	bool ramdisk = MT_SUCCEEDED(ramdisk_init(&root_device));
+
 	// First initialize other FS Related stuff (FAT32, AHCI, etc..)
 	MTSTATUS status = ahci_init();
-	if (MT_FAILURE(status)) {
+	if (MT_FAILURE(status) && !ramdisk) {
 		gop_printf(COLOR_RED, "AHCI | Status failure: %x", status);
 		FREEZE();
 		return status;
 	}
-	// Mount FAT32 on MAIN_FS_DEVICE
-	status = fat32_driver.init(MAIN_FS_DEVICE);
+	// Mount FAT32 on the root device
+	status = fat32_driver.init((uint8_t)root_device);
 	if (MT_FAILURE(status)) {
 		gop_printf(COLOR_RED, "FAT32 | Status failure: %x", status);
 		FREEZE();
 		return status;
 	}
-	mounted_fs[mount_count++] = (MOUNTED_FS){ .driver = &fat32_driver, .device_id = MAIN_FS_DEVICE, .mount_point = "/"};
+	mounted_fs[mount_count++] = (MOUNTED_FS){ .driver = &fat32_driver, .device_id = (uint8_t)root_device, .mount_point = "/"};
 
 	// Create type initializer for FILE_OBJECT.
 	OBJECT_TYPE_INITIALIZER ObjectTypeInitializer;
@@ -141,6 +146,9 @@ MTSTATUS FsWriteFile(
 	MOUNTED_FS* fs = vfs_find_fs_for_path(FileObject->FileName);
 	if (!fs || !fs->driver || !fs->driver->WriteFile) return MT_NOT_IMPLEMENTED;
 
+	// Images parsed from the old contents are dropped.
+	MmInvalidateImage(FileObject->FileName);
+
 	return fs->driver->WriteFile(FileObject, FileOffset, Buffer, BufferSize, BytesWritten);
 }
 
@@ -152,6 +160,8 @@ MTSTATUS FsDeleteFile(
 	MOUNTED_FS* fs = vfs_find_fs_for_path(FileObject->FileName);
 	if (!fs || !fs->driver || !fs->driver->DeleteFile) return MT_NOT_IMPLEMENTED;
 
+	MmInvalidateImage(FileObject->FileName);
+
 	return fs->driver->DeleteFile(FileObject);
 }
 
@@ -27,7 +27,15 @@ Revision History:
 
 //#define MT_NO_PREEMPTION // Uncomment to force cooperative scheduling (yielding only, no forceful context switch).
 
-//#define PERFORMANCE_ANALYTICS // Uncomment to increment performance analytics global fields (like hyperspace mappings done, etc.)
+//#define MT_LOCK_BENCHMARK // Uncomment to run the spinlock microbenchmark thread (page allocation, test-and-set vs queued spinlocks) after SMP initialization.
+
+//#define MT_LOG_FILE "/mtlog.txt" // Uncomment to append the kernel log (MdLog records) to this file on the FAT32 volume.
+
+//#define MT_MEMORY_BENCHMARK // Uncomment to run the memory primitives microbenchmark thread (kmemcpy/kmemset variants, non-temporal page zero/copy, bytes per cycle).
+
+//#define MT_SELF_TESTS // Uncomment to run the kernel self test thread (threaded DPCs, user buffer faults in system calls) after SMP initialization.
+
+//#define MT_LARGE_PAGE_BENCHMARK // Uncomment to run the user large page benchmark thread (1 GiB sequential touch, 4 KiB vs 2 MiB pages, faults and cycles).
 
 // Other Behavioural Macros TODO: 
 // POOL_TAGGING (debug pool allocs)
@@ -59,12 +59,16 @@ typedef struct _BOOT_INFO {
     uint64_t AhciBarBases[32];
     uint64_t KernelStackTop;
     uintptr_t Pml4Phys;
+    uint16_t TssSelector;
     uintptr_t AcpiRsdpPhys;
+    uint64_t RamDiskBase;       // Physical address of \ramdisk.img from the ESP, 0 if there is none.
+    uint64_t RamDiskSize;       // In bytes.
 } BOOT_INFO, *PBOOT_INFO;
 
 #ifndef _MSC_VER 
-_Static_assert(sizeof(BOOT_INFO) == 352, "Size of BOOT_INFO doesn't equal 344 bytes. Update the struct.");
+_Static_assert(sizeof(BOOT_INFO) == 376, "Size of BOOT_INFO doesn't equal 376 bytes. Update the struct.");
 _Static_assert(offsetof(BOOT_INFO, KernelStackTop) == 0x148, "KernelStackTop isnt 0x148");
+_Static_assert(offsetof(BOOT_INFO, AcpiRsdpPhys) == 0x160, "AcpiRsdpPhys isnt 0x160 (must match the bootloader).");
 #endif
 
 /*
@@ -77,8 +81,11 @@ AhciCount           : offset 0x40   (64)
 AhciBarBases        : offset 0x48   (72) 
 KernelStackTop      : offset 0x148  (328)
 Pml4Phys            : offset 0x150  (336)
-AcpiRsdpPhys        : offset 0x158  (352)
-sizeof(BOOT_INFO)   : 352 (0x160)
+TssSelector         : offset 0x158  (344)
+AcpiRsdpPhys        : offset 0x160  (352)
+RamDiskBase         : offset 0x168  (360)
+RamDiskSize         : offset 0x170  (368)
+sizeof(BOOT_INFO)   : 376 (0x178)
 */
 
 // Memory types (we only need ConventionalMemory here)
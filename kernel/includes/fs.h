@@ -103,6 +103,10 @@ typedef struct _FILE_OBJECT {
     // Filesystem-specific context (e. first cluster number of file/dir in our FAT32)
     void* FsContext;
 
+    // Filesystem-specific seek hint, where the last transfer stopped (e. cluster index and cluster number packed in our FAT32), 0 if none.
+    // Lets a large transfer split in chunks resume the chain walk instead of restarting it from the first cluster.
+    volatile uint64_t FsSeekHint;
+
     // Size of the file in bytes
     uint64_t FileSize;
 
@@ -52,6 +52,9 @@ typedef struct _HANDLE_TABLE {
     uint32_t FirstFreeHandle;    // Index of first free handle, or 0 if none.
     uint32_t NextHandleNeedingPool;
     uint32_t HandleCount;
+
+    // Lookups are lock-free, the table memory is freed once every epoch section ended.
+    EPOCH_ENTRY EpochEntry;
 } HANDLE_TABLE, *PHANDLE_TABLE;
 
 // --------------- TYPE DEFINES ---------------
@@ -67,7 +70,7 @@ void*
 HtGetObject(
     IN  PHANDLE_TABLE Table,
     IN  HANDLE Handle,
-    _Out_Opt PHANDLE_TABLE_ENTRY* OutEntry
+    _Out_Opt PHANDLE_TABLE_ENTRY OutEntry
 );
 
 MTSTATUS
@@ -75,7 +78,7 @@ HtClose(
     IN HANDLE Handle
 );
 
-void
+void*
 HtDeleteHandle(
     PHANDLE_TABLE Table,
     HANDLE Handle
@@ -62,4 +62,273 @@ MTSTATUS MdSetHardwareBreakpoint(DebugCallback CallbackFunction, void* Breakpoin
 MTSTATUS MdClearHardwareBreakpointByIndex(int index);
 MTSTATUS MdClearHardwareBreakpointByAddress(void* BreakpointAddress);
 int find_available_debug_reg(void);
+
+// Shared by the trace and profile controls.
+
+void
+MdAcquireControlMutex(
+	IN PMUTEX ControlMutex,
+	IN volatile uint32_t* Initialized
+);
+
+MTSTATUS
+MdWriteDumpFile(
+	IN struct _FILE_OBJECT* FileObject,
+	IN OUT uint64_t* Offset,
+	IN void* Data,
+	IN size_t Length
+);
+
+// module: log.c
+
+typedef enum _LOG_LEVEL {
+	LogLevelTrace,
+	LogLevelInfo,
+	LogLevelWarning,
+	LogLevelError,
+} LOG_LEVEL;
+
+// Arguments are captured as 64 bit values, formatted later by the drain thread.
+#define LOG_MAX_ARGUMENTS 6
+
+#define MD_LOG_ARGUMENT_COUNT_(_0, _1, _2, _3, _4, _5, _6, N, ...) N
+#define MD_LOG_ARGUMENT_COUNT(...) MD_LOG_ARGUMENT_COUNT_(_0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+
+// Never blocks, callable at any IRQL. The format (and %s arguments) must stay valid until drained, use string literals.
+#define MdLog(Level, Color, Format, ...) \
+	MdLogWrite((Level), (Color), (Format), MD_LOG_ARGUMENT_COUNT(__VA_ARGS__), ##__VA_ARGS__)
+
+void
+MdLogWrite(
+	IN LOG_LEVEL Level,
+	IN uint32_t Color,
+	IN const char* Format,
+	IN uint32_t ArgumentCount,
+	...
+);
+
+void
+MdInitializeLogging(
+	void
+);
+
+MTSTATUS
+MdSetLogFile(
+	IN const char* Path
+);
+
+void
+MdLogQuiescentState(
+	void
+);
+
+uint64_t
+MdGetLogDropCount(
+	void
+);
+
+// module: trace.c
+
+typedef enum _TRACE_EVENT {
+	TraceEventSwitchOut = 1,		// Arguments: TID, PID of the thread leaving the processor
+	TraceEventSwitchIn,				// Arguments: TID, PID of the thread entering the processor
+	TraceEventFaultEnter,			// Arguments: faulting address, error code
+	TraceEventFaultExit,			// Arguments: MTSTATUS
+	TraceEventSyscallEnter,			// Arguments: system call number
+	TraceEventSyscallExit,			// Arguments: system call number, return value
+	TraceEventDpcQueue,				// Arguments: DPC, deferred routine
+	TraceEventDpcRetireStart,
+	TraceEventDpcRetireEnd,
+	TraceEventWait,					// Arguments: event
+	TraceEventSet,					// Arguments: event
+	TraceEventDiskSubmit,			// Arguments: LBA, bytes | write << 63
+	TraceEventDiskComplete,			// Arguments: LBA, port task file data (~0 on timeout)
+	TraceEventMax
+} TRACE_EVENT;
+
+typedef struct _TRACE_RECORD {
+	uint64_t Timestamp;				// TSC
+	uint16_t Event;					// TRACE_EVENT
+	uint16_t Processor;
+	uint32_t Thread;				// TID of the current thread (0 before threads exist)
+	uint64_t Arguments[2];
+} TRACE_RECORD, *PTRACE_RECORD;
+
+_Static_assert(sizeof(TRACE_RECORD) == 32, "The trace dump format (tools/trace2json) depends on this.");
+
+// Dump file layout: TRACE_DUMP_HEADER, then for every processor a TRACE_DUMP_PROCESSOR followed by its records (oldest first).
+#define TRACE_DUMP_MAGIC 'RTTM' // MTTR
+#define TRACE_DUMP_VERSION 1
+
+typedef struct _TRACE_DUMP_HEADER {
+	uint32_t Magic;
+	uint16_t Version;
+	uint16_t RecordSize;
+	uint64_t TscFrequency;			// In Hz, 0 if the processor doesn't report it
+	uint32_t ProcessorCount;
+	uint32_t Reserved;
+} TRACE_DUMP_HEADER;
+
+typedef struct _TRACE_DUMP_PROCESSOR {
+	uint32_t Processor;
+	uint32_t RecordCount;
+	uint64_t Overwritten;			// Records lost to the ring wrapping
+} TRACE_DUMP_PROCESSOR;
+
+typedef enum _TRACE_CONTROL {
+	TraceControlStart,
+	TraceControlStop,
+	TraceControlDump,				// Stops the trace, writes every buffer to a file
+} TRACE_CONTROL;
+
+extern volatile bool MdTraceEnabled;
+
+void
+MdTraceWrite(
+	IN TRACE_EVENT Event,
+	IN uint64_t Argument1,
+	IN uint64_t Argument2
+);
+
+// Static tracepoint, a single load and a not taken branch while tracing is stopped.
+#define MD_TRACE(Event, Argument1, Argument2) \
+	do { \
+		if (unlikely(MdTraceEnabled)) MdTraceWrite((Event), (uint64_t)(Argument1), (uint64_t)(Argument2)); \
+	} while (0)
+
+MTSTATUS
+MdStartTrace(
+	void
+);
+
+void
+MdStopTrace(
+	void
+);
+
+MTSTATUS
+MdDumpTrace(
+	IN const char* Path
+);
+
+// module: profile.c
+
+typedef enum _PROFILE_SOURCE {
+	ProfileSourceTimer,				// Every Interval clock ticks (MiLapicInterrupt)
+	ProfileSourceCycles,			// Every Interval unhalted core cycles, performance counter overflow NMI (architectural PMU only)
+} PROFILE_SOURCE;
+
+typedef enum _PROFILE_CONTROL {
+	ProfileControlStart,			// Discards previous samples
+	ProfileControlStop,
+	ProfileControlDump,				// Stops the profiler, writes every entry to a file
+} PROFILE_CONTROL;
+
+#define PROFILE_STACK_DEPTH 8
+
+// A distinct (stack, IRQL, process) sampled on a processor.
+typedef struct _PROFILE_ENTRY {
+	uint64_t Hits;					// 0 for a free slot
+	uint64_t Frames[PROFILE_STACK_DEPTH]; // Frames[0] is the interrupted RIP, then return addresses (kernel mode only)
+	uint32_t Process;				// PID
+	uint32_t Thread;				// TID of the last sample
+	uint16_t Processor;
+	uint8_t Irql;					// The interrupted IRQL
+	uint8_t Depth;					// Valid entries in Frames
+	uint8_t UserMode;
+	uint8_t Reserved[11];
+} PROFILE_ENTRY, *PPROFILE_ENTRY;
+
+_Static_assert(sizeof(PROFILE_ENTRY) == 96, "The profile dump format (tools/profsym) depends on this.");
+
+// Dump file layout: PROFILE_DUMP_HEADER, then EntryCount entries of every processor.
+#define PROFILE_DUMP_MAGIC 'FRPM' // MPRF
+#define PROFILE_DUMP_VERSION 1
+
+typedef struct _PROFILE_DUMP_HEADER {
+	uint32_t Magic;
+	uint16_t Version;
+	uint16_t EntrySize;
+	uint32_t Source;				// PROFILE_SOURCE actually used
+	uint32_t EntryCount;
+	uint64_t Interval;
+	uint64_t TotalSamples;			// Samples recorded in the entries
+	uint64_t DroppedSamples;		// Samples lost to full tables (or taken while another sample ran)
+} PROFILE_DUMP_HEADER, *PPROFILE_DUMP_HEADER;
+
+// Returned by MtQueryProfile, the header has the dump layout.
+typedef struct _PROFILE_INFORMATION {
+	PROFILE_DUMP_HEADER Header;		// EntryCount is the number of entries copied
+	uint32_t TotalEntries;
+	uint32_t Reserved;
+	PROFILE_ENTRY Entries[];
+} PROFILE_INFORMATION, *PPROFILE_INFORMATION;
+
+void
+MdProfileClockTick(
+	IN PTRAP_FRAME TrapFrame,
+	IN IRQL InterruptedIrql
+);
+
+bool
+MdProfileInterrupt(
+	IN PTRAP_FRAME TrapFrame
+);
+
+MTSTATUS
+MdStartProfile(
+	IN PROFILE_SOURCE Source,
+	IN uint64_t Interval
+);
+
+void
+MdStopProfile(
+	void
+);
+
+MTSTATUS
+MdDumpProfile(
+	IN const char* Path
+);
+
+void
+MdQueryProfileHeader(
+	OUT PPROFILE_DUMP_HEADER Header
+);
+
+uint32_t
+MdReadProfileEntries(
+	IN OUT uint64_t* Cursor,
+	OUT PPROFILE_ENTRY Entries,
+	IN uint32_t Count
+);
+
+// module: counters.c
+
+// MdReadCounters processor number, sums every processor.
+#define MD_ALL_PROCESSORS 0xFFFFFFFFU
+
+uint32_t
+MdGetCounterProcessorCount(
+	void
+);
+
+const char*
+MdGetCounterName(
+	IN PERF_COUNTER Counter
+);
+
+void
+MdReadCounters(
+	IN uint32_t Processor,
+	OUT uint64_t* Values
+);
+
+// module: selftest.c
+
+void
+MdRunSelfTests(
+	IN void* Parameter
+);
+
 #endif
\ No newline at end of file
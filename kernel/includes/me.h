@@ -134,7 +134,8 @@ typedef enum _BUGCHECK_CODES {
 	INVALID_PROCESS_ATTACH_ATTEMPT,
 	CRITICAL_PROCESS_DIED,
 	WORKER_THREAD_ATTEMPTED_TERMINATION,
-	ATTEMPTED_EXECUTE_OF_NOEXECUTE_MEMORY
+	ATTEMPTED_EXECUTE_OF_NOEXECUTE_MEMORY,
+	HYPERSPACE_INIT_FAILURE
 } BUGCHECK_CODES;
 
 // ------------------ STRUCTURES ------------------
@@ -216,6 +217,12 @@ typedef struct _DPC {
 
 	// Determines to which CPU this DPC is supposed to be executed on, this allows multiple re-entracy.
 	uint8_t CpuNumber; // 0xFF means current CPU, else its per lapic id.
+
+	// Runs in the processor's threaded DPC thread at PASSIVE_LEVEL (MeInitializeThreadedDpc).
+	bool Threaded;
+
+	// TSC when queued, for the latency histogram.
+	uint64_t QueueTime;
 } DPC, *PDPC;
 
 typedef enum _CPU_FLAGS {
@@ -233,6 +240,58 @@ typedef struct _DPC_DATA {
 	volatile uint32_t DpcCount; // Statistics
 } DPC_DATA, *PDPC_DATA;
 
+// DPC histograms (PROCESSOR), bucket N counts [2^N, 2^(N+1)) microseconds, bucket 0 also counts 0, the last one everything above.
+#define DPC_HISTOGRAM_BUCKETS 16
+
+// Per processor event counters (see counters.c), only ever incremented by the owning processor, summed when read.
+// Append only, user mode monitors index the values by these numbers.
+typedef enum _PERF_COUNTER {
+	PerfCounterContextSwitches,
+	PerfCounterSystemCalls,
+	PerfCounterClockInterrupts,
+	PerfCounterPageFaults,
+	PerfCounterFaultDirtyUpdates,		// Present kernel PTE, a write set its dirty bit
+	PerfCounterFaultDemandZero,
+	PerfCounterFaultTransition,			// Soft faults, the page was taken back from the standby list
+	PerfCounterFaultFileBacked,			// Hard faults, the page was read from the file of the VAD
+	PerfCounterFaultAccessViolations,
+	PerfCounterIpiSentStop,				// IPIs sent, PerfCounterIpiSentStop + CPU_ACTION
+	PerfCounterIpiSentPrintId,
+	PerfCounterIpiSentTlbShootdown,
+	PerfCounterIpiSentWriteDebugRegisters,
+	PerfCounterIpiSentClearDebugRegisters,
+	PerfCounterIpiSentFlushCr3,
+	PerfCounterIpiReceivedStop,			// IPIs handled, PerfCounterIpiReceivedStop + CPU_ACTION
+	PerfCounterIpiReceivedPrintId,
+	PerfCounterIpiReceivedTlbShootdown,
+	PerfCounterIpiReceivedWriteDebugRegisters,
+	PerfCounterIpiReceivedClearDebugRegisters,
+	PerfCounterIpiReceivedFlushCr3,
+	PerfCounterDpcsQueued,
+	PerfCounterDpcsRun,
+	PerfCounterDiskReads,
+	PerfCounterDiskWrites,
+	PerfCounterDiskReadBytes,
+	PerfCounterDiskWriteBytes,
+	PerfCounterPoolAllocations,			// Non paged, from the per processor lookaside pools
+	PerfCounterPoolLargeAllocations,	// Non paged, whole pages
+	PerfCounterPagedPoolAllocations,
+	PerfCounterPoolFrees,
+	PerfCounterHyperspaceMappings,
+	PerfCounterDirectMappings,			// MiMapPageInHyperspace calls served by the direct map
+	PerfCounterFaultLargePage,			// User faults mapped with a 2 MiB page
+	PerfCounterLargePageFallbacks,		// Eligible faults that found the large page pool empty (mapped 4 KiB)
+	PerfCounterLargePageSplits,			// User large pages remapped with 4 KiB PTEs
+	PerfCounterStackCacheHits,			// Kernel stacks reused from the stack cache
+	PerfCounterStackCacheMisses,		// Kernel stacks created (the cache and the depot were empty)
+	PerfCounterCrossCallsQueued,		// Cross calls queued to other processors (one per target)
+	PerfCounterCrossCallInterrupts,		// IPIs sent for them, the rest rode along with an IPI already pending
+	PerfCounterMax
+} PERF_COUNTER;
+
+_Static_assert(PerfCounterIpiSentFlushCr3 - PerfCounterIpiSentStop == CPU_ACTION_FLUSH_CR3, "IPI counters must follow CPU_ACTION.");
+_Static_assert(PerfCounterIpiReceivedFlushCr3 - PerfCounterIpiReceivedStop == CPU_ACTION_FLUSH_CR3, "IPI counters must follow CPU_ACTION.");
+
 typedef struct _APC {
 	uint8_t unsetupped;
 } APC, *PAPC;
@@ -274,6 +333,9 @@ typedef struct _ITHREAD {
 	enum _PRIVILEGE_MODE PreviousMode;					   // Previous mode of the thread (used to indicate whether it called a kernel service in kernel mode, or in user mode)			
 	struct _APC_STATE ApcState;							   // Current thread's APC State.
 	struct _WAIT_BLOCK WaitBlock;						   // Wait block of the current thread, defines a list of which events the thread is waiting on (mutex event, general sleeping)
+	void* ExtendedState;								   // 64 byte aligned XSAVE (FXSAVE) area for the FPU/SSE/AVX registers, NULL for system threads.
+	void* ExtendedStateAllocation;						   // Pool allocation backing ExtendedState.
+	uint32_t ExtendedStateProcessor;					   // Processor ID + 1 whose registers last loaded ExtendedState, 0 if none.
 } ITHREAD, *PITHREAD;
 
 // Note to self: Re-organize this to match more of the KPRCB style, that style is way more consistent across the board (Separates between scheduler and Processor, yada yada)
@@ -296,20 +358,24 @@ typedef struct _PROCESSOR {
 	uint64_t* gdt; // A pointer to the current GDT of the CPU (set in the CPUs AP entry), does not include BSP GDT.
 	struct _DPC* CurrentDeferredRoutine; // Current deferred routine that is executed by the CPU.
 	struct _ETHREAD* idleThread; // Idle thread for the current CPU.
-	volatile uint64_t MailboxLock; // 0 = Free, 1 = Locked by a sender
-	volatile uint64_t IpiSeq;
-	volatile enum _CPU_ACTION IpiAction; // IPI Action specified in the function.
-	volatile IPI_PARAMS IpiParameter; // Optional parameter for IPI's, usually used for functions, primarily TLB Shootdowns.
+	PSINGLE_LINKED_LIST volatile CrossCallQueue; // Lock free queue of cross calls to this processor (pushed by senders, drained by its IPI, see xcall.c)
 	volatile uint32_t* LapicAddressVirt; // Virtual address of the Local APIC MMIO Address (mapped)
 	uintptr_t LapicAddressPhys; // Physical address of the Local APIC MMIO
+	bool X2ApicEnabled; // The Local APIC of this processor is in x2APIC mode (registers are MSRs, see apic.c)
 
 	/* Statically Special Allocated DPCs */
 	struct _DPC TimerExpirationDPC;
 	struct _DPC	ReaperDPC;
+	struct _DPC ThreadedDpcKick;         // Wakes ThreadedDpcThread, queued to this processor with the first threaded DPC
 	/* End Statically Special Allocated DPCs */
 
 	// Additional DPC Fields
 	DPC_DATA DpcData;					 // The main DPC queue
+	DPC_DATA ThreadedDpcData;			 // Threaded DPCs, run at PASSIVE_LEVEL by ThreadedDpcThread
+	struct _ETHREAD* ThreadedDpcThread;  // NULL until MeStartThreadedDpcThreads, threaded DPCs run as normal ones until then
+	EVENT ThreadedDpcEvent;
+	uint64_t DpcLatencyHistogram[DPC_HISTOGRAM_BUCKETS]; // Queued to started
+	uint64_t DpcRuntimeHistogram[DPC_HISTOGRAM_BUCKETS]; // Started to returned
 	volatile bool DpcRoutineActive;      // TRUE if inside MeRetireDPCs
 	volatile uint32_t TimerRequest;      // Non-zero if timers need processing (unused)
 	uintptr_t TimerHand;                 // Context for timer expiration (unused)
@@ -340,11 +406,45 @@ typedef struct _PROCESSOR {
 	// Zombie Thread (for deferred reference deletion)
 	PITHREAD ZombieThread;
 
+	// Kernel stacks of deleted threads, indexed by LargeStack (see MmAllocateKernelStack).
+	MM_STACK_CACHE KernelStackCache[2];
+
 	// Syscall data
 	uint64_t UserRsp; // User saved RSP during syscall handling.
-	uint64_t SystemCallCount; // Counter of system call that have been executed in the system. (including invalid ones)
+
+	// Lazy extended state (FPU/SSE/AVX) switching
+	struct _ITHREAD* ExtendedStateOwner; // Thread whose extended state is loaded in the registers (may be stale if it ran elsewhere since, see ExtendedStateProcessor)
+	bool ExtendedStateLive; // CR0.TS is clear, the owner may have modified its registers since they were loaded.
+
+	// Event counters (PERF_COUNTER), see MeAddCounter.
+	volatile uint64_t PerfCounters[PerfCounterMax];
 } PROCESSOR, *PPROCESSOR;
 
+// Used by MeSaveExtendedState/MeRestoreExtendedState (kernel SIMD sections).
+typedef struct _EXTENDED_STATE_SAVE {
+	IRQL OldIrql;
+} EXTENDED_STATE_SAVE, *PEXTENDED_STATE_SAVE;
+
+// Mapped read only into every process at MM_SHARED_USER_DATA_VA (see systime.c), user mode reads time without a system call.
+// Readers retry while Sequence is odd or changed during the read (seqlock, processor 0 is the only writer).
+#define SHARED_USER_DATA_VERSION 1
+#define SHARED_USER_DATA_TSC_INVARIANT (1U << 0) // The TSC runs at a constant rate (CPUID 0x80000007 EDX bit 8)
+
+typedef struct _SHARED_USER_DATA {
+	volatile uint32_t Sequence;
+	uint32_t Version;
+	volatile uint64_t TickCount;		// Clock interrupts since boot
+	volatile uint64_t InterruptTime;	// Time since boot in 100ns units, as of the last clock interrupt
+	uint64_t TscFrequency;				// In Hz
+	uint64_t TscScale;					// 100ns units per TSC cycle, 32.32 fixed point (0 if the frequency is unknown)
+	uint64_t TscBase;					// TSC value at SystemTimeBase
+	uint64_t SystemTimeBase;			// UTC time at TscBase, 100ns units since 1970-01-01
+	uint32_t TickInterval;				// Clock interrupt period in 100ns units
+	uint32_t NumberOfProcessors;
+	uint32_t PageSize;
+	uint32_t Flags;						// SHARED_USER_DATA_*
+} SHARED_USER_DATA, *PSHARED_USER_DATA;
+
 // ------------------ FUNCTIONS ------------------
 
 
@@ -373,6 +473,23 @@ MeGetCurrentProcessor (void)
 	return (PPROCESSOR)__readgsqword(0); // Only works because we have a self pointer at offset 0 in the struct.
 }
 
+FORCEINLINE
+void
+MeAddCounter(
+	IN PERF_COUNTER Counter,
+	IN uint64_t Value
+)
+
+// Description: Adds to an event counter of the current processor. A single gs relative add, an interrupt or a migration
+// cannot split it, and only this processor writes the slot, so no lock prefix is needed. Callable at any IRQL.
+
+{
+	uint64_t Offset = offsetof(PROCESSOR, PerfCounters) + (uint64_t)Counter * sizeof(uint64_t);
+	__asm__ volatile("addq %1, %%gs:(%0)" :: "r"(Offset), "r"(Value) : "cc");
+}
+
+#define MeIncrementCounter(Counter) MeAddCounter((Counter), 1)
+
 FORCEINLINE
 void
 MeAcquireSchedulerLock(void)
@@ -497,6 +614,47 @@ MeInitializeProcessor(
 	IN bool AreYouAP
 );
 
+void
+MeAllocateProcessorResources(
+	IN PPROCESSOR CPU
+);
+
+void
+MeInitializeExtendedState(
+	void
+);
+
+MTSTATUS
+MeAllocateExtendedState(
+	IN PITHREAD Thread
+);
+
+void
+MeFreeExtendedState(
+	IN PITHREAD Thread
+);
+
+void
+MeSwitchExtendedState(
+	IN PITHREAD PreviousThread,
+	IN PITHREAD NextThread
+);
+
+bool
+MeHandleExtendedStateFault(
+	void
+);
+
+void
+MeSaveExtendedState(
+	OUT PEXTENDED_STATE_SAVE Save
+);
+
+void
+MeRestoreExtendedState(
+	IN PEXTENDED_STATE_SAVE Save
+);
+
 void
 MeRaiseIrql(
 	IN IRQL NewIrql,
@@ -527,6 +685,19 @@ MeInitializeDpc(
 	IN DPC_PRIORITY DeferredPriority
 );
 
+void
+MeInitializeThreadedDpc(
+	IN PDPC DpcAllocated,
+	IN PDEFERRED_ROUTINE DeferredRoutine,
+	IN void* DeferredContext,
+	IN DPC_PRIORITY DeferredPriority
+);
+
+void
+MeStartThreadedDpcThreads(
+	void
+);
+
 bool
 MeInsertQueueDpc(
 	IN PDPC Dpc,
@@ -598,4 +769,15 @@ MeAreInterruptsEnabled(
 // smp.c
 PPROCESSOR MeGetProcessorBlock(uint8_t ProcessorNumber);
 
+// systime.c
+void
+MeInitializeSharedUserData(
+	IN uint32_t ClockFrequency
+);
+
+void
+MeUpdateSharedUserData(
+	void
+);
+
 #endif
\ No newline at end of file
@@ -399,6 +399,21 @@ typedef struct _IPI_PARAMS {
     struct _PAGE_PARAMETERS pageParams;
 } IPI_PARAMS;
 
+// Context of MhExecuteCpuAction (MhSendActionToCpusAndWait).
+typedef struct _CPU_ACTION_REQUEST {
+    CPU_ACTION Action;
+    IPI_PARAMS Parameter;
+} CPU_ACTION_REQUEST, *PCPU_ACTION_REQUEST;
+
+// Cross calls (xcall.c), bit N of a PROCESSOR_MASK is cpus[N].
+typedef uint64_t PROCESSOR_MASK;
+typedef void (*PCROSS_CALL_ROUTINE)(void* Context);
+
+#define CROSS_CALL_ASYNCHRONOUS 0x1 // Return once queued, don't wait for the targets to run it.
+#define CROSS_CALL_DEFERRED     0x2 // Asynchronous, held back from the targets until the next non deferred cross call or MhFlushCrossCalls.
+
+#define LAPIC_ICR_DEST_ALL_BUT_SELF (3U << 18) // ICR destination shorthand, every processor but the sender.
+
 // ------------------ MACROS ------------------
 #define AP_TRAMP_PHYS 0x7000ULL
 #define AP_TRAMP_SIZE 0x1000UL   // single page
@@ -446,8 +461,37 @@ typedef struct _IPI_PARAMS {
 /// ------------------ FUNCTIONS ------------------
 
 void APMain(void);
-void MhInitializeSMP(uint8_t* apic_list, uint32_t cpu_count, uint32_t lapicAddress);
+void MhInitializeSMP(uint32_t* apic_list, uint32_t cpu_count, uint32_t lapicAddress);
+// Called by an AP when it reaches APMain (online false) and when it is ready to schedule (online true).
+void MhApCheckIn(uint32_t index, bool online);
 void MhSendActionToCpusAndWait(CPU_ACTION action, IPI_PARAMS parameter);
+// Runs a CPU_ACTION_REQUEST on the current processor (the cross call routine of MhSendActionToCpusAndWait).
+void MhExecuteCpuAction(void* Context);
+
+// module: xcall.c
+
+void
+MhCrossCall(
+    IN PROCESSOR_MASK Targets,
+    IN PCROSS_CALL_ROUTINE Routine,
+    IN void* Context,
+    IN uint32_t Flags
+);
+
+void
+MhFlushCrossCalls(
+    void
+);
+
+void
+MhRetireCrossCalls(
+    void
+);
+
+PROCESSOR_MASK
+MhGetOnlineProcessorMask(
+    void
+);
 
 extern int smp_cpu_count;
 extern bool smpInitialized;
@@ -462,17 +506,27 @@ void lapic_init_cpu(void);                    // call once on BSP early
 void lapic_enable(void);
 uint32_t lapic_mmio_read(uint32_t off);
 void lapic_mmio_write(uint32_t off, uint32_t val);
+// Register access in the current mode (x2APIC MSRs or xAPIC MMIO), offsets are the xAPIC ones.
+uint32_t lapic_read(uint32_t off);
+void lapic_write(uint32_t off, uint32_t val);
+// The APIC ID of the current processor (32 bits in x2APIC mode).
+uint32_t lapic_get_id(void);
+// True if the Local APICs run in x2APIC mode (decided by the first lapic_enable on the BSP).
+bool lapic_is_x2apic(void);
 void lapic_eoi(void);
+// Routes performance counter overflows to the NMI (enable), or masks them.
+void lapic_set_perfmon_nmi(bool enable);
 // lapic spurious interrupt vector, protects against faulty interrupts.
 void lapic_init_siv(void);
 // send IPI to APIC id 
 // apic_id - APICId of the CPU.
 // vector - IDT Vector number
 // flags - specified cpu flags, 0 for none.
-void lapic_send_ipi(uint8_t apic_id, uint8_t vector, uint32_t flags);
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector, uint32_t flags);
 int init_lapic_timer(uint32_t hz);           // calibrate + start periodic timer at `hz` (returns 0 on success)
 void pit_sleep_ms(uint32_t ms);
 void lapic_timer_calibrate(void);
+uint64_t lapic_tsc_frequency(void);         // TSC frequency in Hz, measured against the PIT by lapic_timer_calibrate (0 before)
 
 extern bool checkcpuid(void);
 
@@ -512,6 +566,7 @@ MhHandleInterrupt (
 
 void MiLapicInterrupt(
 	bool schedulerEnabled,
+	IRQL InterruptedIrql,
 	PTRAP_FRAME trap
 );
 
@@ -519,7 +574,6 @@ void MiBreakpoint(
 	PTRAP_FRAME trap
 );
 
-NORETURN
 void
 MiNonMaskableInterrupt(
 	PTRAP_FRAME trap
@@ -617,7 +671,7 @@ MhRequestSoftwareInterrupt(
 );
 
 MTSTATUS MhInitializeACPI(void);
-MTSTATUS MhParseLAPICs(uint8_t* buffer, size_t maxCPUs, uint32_t* cpuCount, uint32_t* lapicAddress);
+MTSTATUS MhParseLAPICs(uint32_t* buffer, size_t maxCPUs, uint32_t* cpuCount, uint32_t* lapicAddress);
 
 void
 MhRebootComputer(
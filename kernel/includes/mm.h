@@ -56,6 +56,19 @@ static inline int MiConvertVaToPml4Offset(uint64_t va) {
 #define PhysicalMemoryOffset 0xffff880000000000ULL // Defines the offset in arithmetic for quick mapping
 #define RECURSIVE_INDEX 0x1FF
 
+// Large pages
+#define MI_LARGE_PAGE_SIZE (2ULL * 1024 * 1024)          // 2 MiB, PDE with PAGE_PS
+#define MI_HUGE_PAGE_SIZE (1ULL * 1024 * 1024 * 1024)    // 1 GiB, PDPTE with PAGE_PS (CPUID.80000001h:EDX.Page1GB)
+#define MI_LARGE_PAGE_FRAMES (MI_LARGE_PAGE_SIZE / PhysicalFrameSize) // Frames in a large page run.
+
+// Direct map of physical memory (usable RAM only, see MiInitializeDirectMap), physical address X is at MI_DIRECT_MAP_BASE + X.
+#define MI_DIRECT_MAP_BASE 0xffff900000000000ULL
+#define MI_DIRECT_MAP_SIZE (64ULL * 1024 * 1024 * 1024 * 1024) // 64 TiB
+#define MI_DIRECT_MAP_END (MI_DIRECT_MAP_BASE + MI_DIRECT_MAP_SIZE)
+
+// Per-CPU hyperspace slots (fallback for frames outside of the direct map), processor 0 keeps the boot slot at PhysicalMemoryOffset.
+#define MI_HYPERSPACE_BASE MI_DIRECT_MAP_END
+
 #ifndef __INTELLISENSE__
 #ifndef __OFFSET_GENERATOR__
 /* Convert a PFN index to a PPFN_ENTRY pointer */
@@ -244,6 +257,14 @@ do {                                                                        \
 #define MI_GUARD_PAGE_PROTECTION (1ULL << 17)
 #define MI_DEFAULT_USER_STACK_SIZE 0x100000 // 1 MiB
 
+// Kernel stack cache (mmproc.c), per processor and size, spilling to a global depot.
+#define MI_STACK_CACHE_DEPTH 8              // Stacks kept by a processor, half of them move to/from the depot at once.
+#define MI_STACK_DEPOT_DEPTH 64             // Stacks kept by the depot, the rest are deleted.
+#define MI_STACK_CACHE_LOW_MEMORY 4096      // Available pages under which stacks are deleted instead of cached (and the depot is trimmed).
+
+// Image cache (image.c)
+#define MM_IMAGE_NAME_LENGTH 128
+
 // Barriers
 
 // Prevents CPU Reordering as well as the MmBarrier functionality.
@@ -288,7 +309,8 @@ typedef enum _PFN_FLAGS {
     PFN_FLAG_NONPAGED = (1U << 0),    // This PFN holds a nonpaged virtual address (not backed by a file), BIT 3 must NOT be set if this bit is active.
     PFN_FLAG_COPY_ON_WRITE = (1U << 1), // This is a COW page
     PFN_FLAG_MAPPED_FILE = (1U << 2), // Backed by a file (not swap)
-    PFN_FLAG_LOCKED_FOR_IO = (1U << 3)  // Page is pinned for DMA, etc.
+    PFN_FLAG_LOCKED_FOR_IO = (1U << 3),  // Page is pinned for DMA, etc.
+    PFN_FLAG_LARGE_PAGE = (1U << 4)     // Part of a 2 MiB run (in the large page pool, or mapped by a user PDE), the first frame of the run holds the list entry and mapping.
 } PFN_FLAGS;
 
 typedef enum _VAD_FLAGS {
@@ -301,6 +323,7 @@ typedef enum _VAD_FLAGS {
     VAD_FLAG_COPY_ON_WRITE = (1U << 5), // Allocation comes from a shared physical memory address(s), this can be shared between executables.
     VAD_FLAG_RESERVED = (1U << 6), // Allocation WILL NOT happen if this flag is set, it takes precedence.
     VAD_FLAG_GUARD_PAGE = (1U << 7), // This allocation signifies a guard page, if a memory operation is performed on this page, an MT_GUARD_PAGE_VIOLATION exception is raised, and the page turns to a normal stack page.
+    VAD_FLAG_SHARED_USER_DATA = (1U << 8), // The shared user data page, faults map the kernel's frame (read only) instead of a new page.
 } VAD_FLAGS;
 
 typedef enum _PAGE_FLAGS {
@@ -487,16 +510,22 @@ typedef struct _PFN_ENTRY {
     } Descriptor;
 } PFN_ENTRY, *PPFN_ENTRY;
 
+// Kernel stacks ready for reuse, linked through their tops (each stack keeps the next one's top just below its own).
+typedef struct _MM_STACK_CACHE {
+    void* Head;
+    uint32_t Count;
+} MM_STACK_CACHE, *PMM_STACK_CACHE;
+
 typedef struct _MM_PFN_LIST {
     struct _DOUBLY_LINKED_LIST ListEntry;       // List Head
     volatile uint64_t Count;                    // Number of pages in this list.
-    SPINLOCK PfnListLock;                       // Spinlock for each PFN List to ensure atomicity.
+    QUEUED_SPINLOCK PfnListLock;                // Queued spinlock for each PFN List to ensure atomicity.
 } MM_PFN_LIST;
 
 typedef struct _MM_PFN_DATABASE {
     PPFN_ENTRY PfnEntries;  // Pointer to base of the PFN_ENTRY array.
     size_t TotalPageCount;  // Total count of pages in the PFN database.
-    SPINLOCK PfnDatabaseLock; // Global spinlock for adding/popping memory.
+    QUEUED_SPINLOCK PfnDatabaseLock; // Global queued spinlock for adding/popping memory.
 
     // Page lists
     MM_PFN_LIST FreePageList;   // Pages with garbage data.
@@ -504,9 +533,10 @@ typedef struct _MM_PFN_DATABASE {
     MM_PFN_LIST StandbyPageList; // Clean pages, candidates for reuse. (used for loading processes fast)
     MM_PFN_LIST ModifiedPageList; // Dirty pages, must be written to disk for backing.
     MM_PFN_LIST BadPageList;    // List of bad memory pages
+    MM_PFN_LIST LargePageList;  // Free 2 MiB aligned runs, linked by their first frame (Count is in runs).
 
     // Statistics
-    volatile size_t AvailablePages; // Free + Zeroed + Standby
+    volatile size_t AvailablePages; // Free + Zeroed + Standby + the large page pool
     volatile size_t TotalReserved;  // Kernel, drivers, etc.
 } MM_PFN_DATABASE;
 
@@ -523,12 +553,25 @@ typedef struct _MMVAD {
     // Height of the node in the tree.
     int Height;
 
+    // Span of the subtree rooted here, and the largest free gap between its VADs (MiFindGap skips subtrees that can't fit).
+    uintptr_t SubtreeStartVa;
+    uintptr_t SubtreeEndVa;
+    uintptr_t MaxGap;
+
     // If VAD_FLAG_MAPPED_FILE bit is set.
     struct _FILE_OBJECT* File;            // FILE_OBJECT Ptr.
     uint64_t FileOffset;    // Offset into the file this region starts in. (in bytes, so compute arithemetic with addresses and not pages!!)
 
+    // Mapped images fault their pages from the image cache instead of the file (the VAD holds a reference).
+    struct _MM_IMAGE* Image;
+    const uint8_t* ImageContents; // Image->Contents, or its copy relocated for this VAD's base.
+
     // Pointer to owner process.
     struct _EPROCESS* OwningProcess;
+
+    // VADs are freed through the epoch, MiFindVad walks the tree lock-free.
+    EPOCH_ENTRY EpochEntry;
+    bool Unlinked; // Set (inside the VadSequence update) when removed from the tree, a stale Process->VadHint is rejected on it.
 } MMVAD, *PMMVAD;
 
 typedef struct _POOL_HEADER
@@ -609,9 +652,45 @@ typedef struct _MM_SUBSECTION {
     uint32_t IsDemandZero;  // 1 for .bss (no file backing), 0 for .text/.data
 } MM_SUBSECTION, * PMM_SUBSECTION;
 
+// An export of a cached image, slot of an open addressing hash table (NameOffset 0 = empty).
+typedef struct _MM_IMAGE_EXPORT {
+    uint32_t Hash;
+    uint32_t NameOffset;    // Into MM_IMAGE.Contents, NUL terminated.
+    uint64_t FuncRva;
+} MM_IMAGE_EXPORT, *PMM_IMAGE_EXPORT;
+
+// An R_X86_64_RELATIVE relocation of a cached image (*(Base + Rva) = Base + Addend).
+typedef struct _MM_IMAGE_RELOCATION {
+    uint64_t Rva;
+    int64_t Addend;
+} MM_IMAGE_RELOCATION, *PMM_IMAGE_RELOCATION;
+
+// An executable/DLL file parsed once and kept in memory (image.c), shared by its sections and VADs.
+typedef struct _MM_IMAGE {
+    DOUBLY_LINKED_LIST ListEntry;       // MiImageCacheList, unlinked once invalidated.
+    volatile uint64_t ReferenceCount;   // The cache list, sections and VADs.
+    char FileName[MM_IMAGE_NAME_LENGTH];
+    uint64_t FileSize;
+    MTE_HEADER Header;
+
+    uint8_t* Contents;                  // The whole file, as on disk (relocated for Header.PreferredImageBase).
+
+    // Copy of Contents relocated for the first other base it was mapped at, created once and never changed.
+    uint8_t* RelocatedContents;
+    uintptr_t RelocatedBase;
+
+    PMM_IMAGE_EXPORT Exports;
+    uint32_t ExportMask;                // Slots - 1 (power of 2).
+
+    PMM_IMAGE_RELOCATION Relocations;
+    size_t RelocationCount;
+    bool RelocationsInFile;             // Every target is inside the file (a relocated copy can be made).
+} MM_IMAGE, *PMM_IMAGE;
+
 // Represents the loaded Executable/DLL
 typedef struct _MM_SECTION {
     struct _FILE_OBJECT* FileObject;
+    PMM_IMAGE Image;                    // Referenced.
     uintptr_t PreferredBase;
     MM_SUBSECTION WholeFileSection;
 
@@ -630,6 +709,7 @@ extern MM_PFN_DATABASE PfnDatabase; // Database defined in 'pfn.c'
 // Global Externals for signals & constants.
 extern bool MmPfnDatabaseInitialized;
 extern PAGE_INDEX MmHighestPfn;
+extern bool MmLargePagesEnabled;
 extern uintptr_t MmSystemRangeStart;
 extern uintptr_t MmHighestUserAddress;
 extern uintptr_t MmUserStartAddress;
@@ -645,46 +725,183 @@ extern uint64_t MmTotalUsableMemory;
 #define USER_VA_END 0x00007FFFFFFFFFFF
 #define USER_VA_START 0x10000
 
+// The shared user data page (SHARED_USER_DATA), same address in every process.
+#define MM_SHARED_USER_DATA_VA 0x7FFE0000ULL
+
 // general functions
 uint64_t* pml4_from_recursive(void);
 
-// Memory Set.
+//
+// The memory primitives are inlined into their callers on purpose: user buffers are copied with them inside try/except,
+// and a fault is only handled when its RIP is inside the caller's try range (__ex_table), so the faulting
+// string instruction must be emitted in the caller, not in an out of line routine.
+// MiInitializeMemoryRoutines (memory.c) picks between the ERMS/FSRM string instructions and the qword routines.
+//
+
+// Below this length REP MOVSB/STOSB startup costs more than the copy itself (without FSRM).
+#define MI_STRING_THRESHOLD     128
+
+typedef uint64_t __attribute__((may_alias, aligned(1))) UNALIGNED_UINT64;
+
+extern bool MiErmsAvailable;
+extern bool MiFsrmAvailable;
+
 FORCEINLINE
-void* 
-kmemset (
+bool
+MiIsStringOperationPreferred(
+    IN size_t Length
+)
+
+/*++
+
+    Routine description:
+
+        Returns whether REP MOVSB/STOSB beat the qword routines for a length on this processor.
+
+    Arguments:
+
+        [IN]    size_t Length - The length of the operation in bytes.
+
+    Return Values:
+
+        True if the byte string instructions should be used.
+
+--*/
+
+{
+    return MiFsrmAvailable || (MiErmsAvailable && Length >= MI_STRING_THRESHOLD);
+}
+
+FORCEINLINE
+void
+MiCopyMemoryString(
+    IN void* Destination,
+    IN const void* Source,
+    IN size_t Length
+)
+
+{
+    __asm__ volatile(
+        "rep movsb"
+        : "+D"(Destination), "+S"(Source), "+c"(Length)
+        :
+        : "memory"
+        );
+}
+
+FORCEINLINE
+void
+MiCopyMemoryQword(
+    IN void* Destination,
+    IN const void* Source,
+    IN size_t Length
+)
+
+{
+    size_t Qwords = Length / sizeof(uint64_t);
+    size_t Bytes = Length % sizeof(uint64_t);
+
+    __asm__ volatile(
+        "rep movsq\n\t"
+        "movq %3, %%rcx\n\t"
+        "rep movsb"
+        : "+D"(Destination), "+S"(Source), "+c"(Qwords)
+        : "r"(Bytes)
+        : "memory"
+        );
+}
+
+FORCEINLINE
+void
+MiSetMemoryString(
+    IN void* Destination,
+    IN uint8_t Value,
+    IN size_t Length
+)
+
+{
+    __asm__ volatile(
+        "rep stosb"
+        : "+D"(Destination), "+c"(Length)
+        : "a"(Value)
+        : "memory"
+        );
+}
+
+FORCEINLINE
+void
+MiSetMemoryQword(
+    IN void* Destination,
+    IN uint8_t Value,
+    IN size_t Length
+)
+
+{
+    uint64_t Pattern = (uint64_t)Value * 0x0101010101010101ULL;
+    size_t Qwords = Length / sizeof(uint64_t);
+    size_t Bytes = Length % sizeof(uint64_t);
+
+    __asm__ volatile(
+        "rep stosq\n\t"
+        "movq %2, %%rcx\n\t"
+        "rep stosb"
+        : "+D"(Destination), "+c"(Qwords)
+        : "r"(Bytes), "a"(Pattern)
+        : "memory"
+        );
+}
+
+FORCEINLINE
+void*
+kmemset(
     void* dest, int64_t val, uint64_t len
-) 
+)
+
 {
-    uint8_t* ptr = dest;
-    for (size_t i = 0; i < (size_t)len; i++) {
-        ptr[i] = (uint8_t)val;
+    if (MiIsStringOperationPreferred(len)) {
+        MiSetMemoryString(dest, (uint8_t)val, len);
+    }
+    else {
+        MiSetMemoryQword(dest, (uint8_t)val, len);
     }
+
     return dest;
 }
 
-// Memory copy  
 FORCEINLINE
-void* 
+void*
 kmemcpy(
     void* dest, const void* src, size_t len
-) 
+)
+
 {
-    uint8_t* d = (uint8_t*)dest;
-    const uint8_t* s = (const uint8_t*)src;
-    for (size_t i = 0; i < len; i++) d[i] = s[i];
+    if (MiIsStringOperationPreferred(len)) {
+        MiCopyMemoryString(dest, src, len);
+    }
+    else {
+        MiCopyMemoryQword(dest, src, len);
+    }
+
     return dest;
 }
 
 FORCEINLINE
-int 
+int
 kmemcmp(
     const void* s1, const void* s2, size_t n
-) 
+)
+
 {
     const uint8_t* p1 = (const uint8_t*)s1;
     const uint8_t* p2 = (const uint8_t*)s2;
+    size_t i = 0;
 
-    for (size_t i = 0; i < n; i++) {
+    // Skip the equal qwords, the first differing byte is then found below.
+    while (i + sizeof(uint64_t) <= n && *(const UNALIGNED_UINT64*)(p1 + i) == *(const UNALIGNED_UINT64*)(p2 + i)) {
+        i += sizeof(uint64_t);
+    }
+
+    for (; i < n; i++) {
         if (p1[i] != p2[i])
             return (int)(p1[i] - p2[i]);
     }
@@ -778,6 +995,38 @@ MiIsValidPfn(
     return Pfn <= MmHighestPfn;
 }
 
+// module: memory.c
+
+void
+MiInitializeMemoryRoutines(
+    void
+);
+
+void
+MiZeroPage(
+    IN void* PageVa
+);
+
+void
+MiCopyPage(
+    IN void* DestinationPageVa,
+    IN const void* SourcePageVa
+);
+
+// module: membench.c
+
+void
+MmRunMemoryBenchmark(
+    IN void* Parameter
+);
+
+// module: lpbench.c
+
+void
+MmRunLargePageBenchmark(
+    IN void* Parameter
+);
+
 // module: pfn.c
 
 MTSTATUS
@@ -812,6 +1061,16 @@ MiUnlinkPageFromList(
     PPFN_ENTRY pfn
 );
 
+PAGE_INDEX
+MiRequestLargePage(
+    void
+);
+
+void
+MiReleaseLargePage(
+    IN  PAGE_INDEX PfnIndex
+);
+
 // module: map.c
 
 void
@@ -844,6 +1103,14 @@ MiGetPtePointer(
     IN  uintptr_t va
 );
 
+MTSTATUS
+MiMapKernelLargePage(
+    IN  uintptr_t va,
+    IN  uint64_t PhysicalAddress,
+    IN  uint64_t PageSize,
+    IN  uint64_t Flags
+);
+
 uintptr_t
 MiTranslatePteToVa(
     IN PMMPTE pte
@@ -875,6 +1142,26 @@ MmIsAddressPresent(
     IN  uintptr_t VirtualAddress
 );
 
+bool
+MiIsAddressMapped(
+    IN  uintptr_t VirtualAddress
+);
+
+PMMPTE
+MiGetLargePdePointer(
+    IN  uintptr_t va
+);
+
+bool
+MiSplitLargePage(
+    IN  uintptr_t va
+);
+
+bool
+MiUnmapLargePage(
+    IN  uintptr_t va
+);
+
 // module: hypermap.c
 
 MUST_USE_RESULT
@@ -886,9 +1173,20 @@ MiMapPageInHyperspace(
 
 void
 MiUnmapHyperSpaceMap(
+    IN  void* MappedAddress,
     IN  IRQL OldIrql
 );
 
+void
+MiInitializeHyperspace(
+    void
+);
+
+MTSTATUS
+MiInitializeDirectMap(
+    IN PBOOT_INFO BootInfo
+);
+
 // module: pool.c
 
 MTSTATUS
@@ -925,6 +1223,23 @@ MiFreeKernelStack(
     IN bool LargeStack
 );
 
+MUST_USE_RESULT
+void*
+MmAllocateKernelStack(
+    IN  bool LargeStack
+);
+
+void
+MmFreeKernelStack(
+    IN void* AllocatedStackTop,
+    IN bool LargeStack
+);
+
+void
+MmTrimKernelStackCache(
+    void
+);
+
 MTSTATUS
 MmCreateProcessAddressSpace(
     OUT void** DirectoryTable
@@ -956,6 +1271,18 @@ MmCreateTeb(
     OUT void** OutTeb
 );
 
+void*
+MmCreateSharedUserData(
+    void
+);
+
+MTSTATUS
+MmMapSharedUserData(
+    IN PEPROCESS Process
+);
+
+extern PAGE_INDEX MiSharedUserDataPfn;
+
 // module: vad.c
 
 MTSTATUS
@@ -1087,6 +1414,37 @@ MmInitSections(
     void
 );
 
+// module: image.c
+
+MTSTATUS
+MmReferenceImage(
+    IN struct _FILE_OBJECT* FileObject,
+    OUT PMM_IMAGE* Image
+);
+
+void
+MmDereferenceImage(
+    IN PMM_IMAGE Image
+);
+
+MTSTATUS
+MmFindImageExport(
+    IN PMM_IMAGE Image,
+    IN const char* Name,
+    OUT uint64_t* FuncRva
+);
+
+void
+MmInvalidateImage(
+    IN const char* FileName
+);
+
+const uint8_t*
+MiGetImageContents(
+    IN PMM_IMAGE Image,
+    IN uintptr_t BaseAddress
+);
+
 // module: section.c
 
 MTSTATUS
@@ -25,6 +25,9 @@ Revision History:
 #include "../mtstatus.h"
 #include "annotations.h"
 #include "core.h"
+#ifdef MT_LOCK_STATISTICS
+#include "../intrinsics/intrin.h"
+#endif
 
 // ------------------ STRUCTURES ------------------
 
@@ -35,8 +38,38 @@ Revision History:
  */
 typedef struct _SPINLOCK {
     volatile uint32_t locked; /* 0 = unlocked, 1 = locked */
+#ifdef MT_LOCK_STATISTICS
+    void* AcquireSite;        /* call site of the current owner */
+    uint64_t AcquireTsc;      /* TSC when the current owner got the lock */
+#endif
 } SPINLOCK, *PSPINLOCK;
 
+/**
+ * QUEUED_SPINLOCK - MCS queued spinlock.
+ *
+ * Waiters queue up in FIFO order, each one spins on its own QUEUED_SPINLOCK_NODE,
+ * so a release only touches the cache line of the next waiter instead of every spinning processor.
+ * The node must stay valid until the lock is released, it usually lives on the stack inside a LOCK_QUEUE_HANDLE.
+ */
+typedef struct _QUEUED_SPINLOCK_NODE {
+    struct _QUEUED_SPINLOCK_NODE* volatile Next; /* next waiter in the queue */
+    volatile uint32_t Waiting;                   /* 1 while the owner hasn't handed us the lock */
+} QUEUED_SPINLOCK_NODE, *PQUEUED_SPINLOCK_NODE;
+
+typedef struct _QUEUED_SPINLOCK {
+    struct _QUEUED_SPINLOCK_NODE* volatile Tail; /* last waiter (or owner), NULL = unlocked */
+#ifdef MT_LOCK_STATISTICS
+    void* AcquireSite;
+    uint64_t AcquireTsc;
+#endif
+} QUEUED_SPINLOCK, *PQUEUED_SPINLOCK;
+
+typedef struct _LOCK_QUEUE_HANDLE {
+    QUEUED_SPINLOCK_NODE Node;
+    PQUEUED_SPINLOCK Lock;
+    IRQL OldIrql;
+} LOCK_QUEUE_HANDLE, *PLOCK_QUEUE_HANDLE;
+
 /**
 * Rundown Reference Protection.
 *
@@ -52,7 +85,7 @@ typedef struct _RUNDOWN_REF {
 typedef struct _Queue {
     PETHREAD head;
     PETHREAD tail;
-    SPINLOCK lock;
+    QUEUED_SPINLOCK lock;
 } Queue;
 
 /**
@@ -86,6 +119,10 @@ typedef struct _MUTEX {
     bool locked;        /* fast-check boolean (protected by lock) */
     struct _SPINLOCK lock;      /* protects ownerTid/locked and wait list */
     struct _ETHREAD* ownerThread; /* pointer to current thread that holds the mutex */
+#ifdef MT_LOCK_STATISTICS
+    void* AcquireSite;
+    uint64_t AcquireTsc;
+#endif
 } MUTEX, *PMUTEX;
 
 typedef struct _PUSH_LOCK {
@@ -100,19 +137,23 @@ typedef struct _PUSH_LOCK {
         uint64_t Value;
         void* Pointer;
     };
+    struct _ITHREAD* volatile Owner; // Exclusive owner, only used as a hint for adaptive spinning (NULL when shared or free)
+#ifdef MT_LOCK_STATISTICS
+    void* AcquireSite;   // Exclusive acquisitions only, shared hold times are not tracked
+    uint64_t AcquireTsc;
+#endif
 } PUSH_LOCK;
 
+// Wait blocks live on the waiter's stack, the low 4 bits of their address are used as the PUSH_LOCK flags.
 typedef struct _PUSH_LOCK_WAIT_BLOCK {
-    union {
-        struct _PUSH_LOCK_WAIT_BLOCK* Next; // Links to the next waiter in the stack
-        struct _PUSH_LOCK_WAIT_BLOCK* Last; // Only used if this is the Head node (optimization)
-    };
+    struct _PUSH_LOCK_WAIT_BLOCK* Next;     // Links to the next (older) waiter, towards the tail
+    struct _PUSH_LOCK_WAIT_BLOCK* Previous; // Links to the previous (newer) waiter, towards the head
+    struct _PUSH_LOCK_WAIT_BLOCK* Last;     // Only valid in the head block, cached tail (oldest waiter) for O(1) wakeup
 
     EVENT WakeEvent;     // The event the thread sleeps on
     uint32_t Flags;      // 1 = Exclusive, 2 = Shared
-    uint32_t ShareCount; // If we interrupt readers, we save their count here
-    bool Signaled;       // Optimization to avoid touching the Event if not needed
-} PUSH_LOCK_WAIT_BLOCK, * PPUSH_LOCK_WAIT_BLOCK;
+    uint32_t ShareCount; // Only valid in the tail block, the amount of shared owners the lock currently has
+} __attribute__((aligned(16))) PUSH_LOCK_WAIT_BLOCK, * PPUSH_LOCK_WAIT_BLOCK;
 
 #define PL_FLAGS_EXCLUSIVE 0x1
 #define PL_FLAGS_SHARED    0x2
@@ -120,10 +161,72 @@ typedef struct _PUSH_LOCK_WAIT_BLOCK {
 // Bit definitions for the PUSH_LOCK->Value
 #define PL_LOCK_BIT        0x1     // Bit 0: Locked Exclusive
 #define PL_WAIT_BIT        0x2     // Bit 1: There are waiters
-#define PL_WAKE_BIT        0x4     // Bit 2: Waking (optimization)
+#define PL_WAKE_BIT        0x4     // Bit 2: Wait chain is being modified (bit lock)
 #define PL_FLAG_MASK       0xF     // Bottom 4 bits are flags
 #define PL_SHARE_INC       0x10    // Shared count starts at Bit 4
 
+/**
+ * Lock contention statistics (build with LOCKSTAT=1, which defines MT_LOCK_STATISTICS).
+ *
+ * Every acquire is attributed to the return address of the lock routine (the call site),
+ * hold time is attributed to the call site that acquired the lock.
+ * For push locks and mutexes, "spin" cycles are the cycles spent waiting, including sleeping.
+ */
+typedef enum _LOCK_STATISTICS_TYPE {
+    LockStatSpinlock,
+    LockStatQueuedSpinlock,
+    LockStatPushLock,
+    LockStatMutex,
+    LockStatTypeMax
+} LOCK_STATISTICS_TYPE;
+
+typedef struct _LOCK_STATISTICS_ENTRY {
+    uint64_t CallSite;       // Return address of the acquire routine, 0 = free slot
+    uint32_t Type;           // LOCK_STATISTICS_TYPE
+    uint32_t Reserved;
+    uint64_t Acquires;       // Times the lock was acquired from this site
+    uint64_t Contended;      // Times the lock wasn't free on the first try
+    uint64_t SpinCycles;     // Total TSC cycles spent waiting for the lock
+    uint64_t MaxSpinCycles;
+    uint64_t HoldCycles;     // Total TSC cycles the lock was held (from this acquire site)
+    uint64_t MaxHoldCycles;
+} LOCK_STATISTICS_ENTRY, *PLOCK_STATISTICS_ENTRY;
+
+// The buffer format returned by MtQueryLockStatistics.
+typedef struct _LOCK_STATISTICS_INFORMATION {
+    uint32_t NumberOfEntries;   // Entries copied into Entries[]
+    uint32_t TotalEntries;      // Distinct call sites recorded (sorted by SpinCycles, most contended first)
+    uint64_t DroppedRecords;    // Records lost because a per-CPU table was full
+    LOCK_STATISTICS_ENTRY Entries[];
+} LOCK_STATISTICS_INFORMATION, *PLOCK_STATISTICS_INFORMATION;
+
+#define LOCK_STATISTICS_TABLE_SIZE 128 // Per-CPU call site slots, must be a power of 2
+
+#ifdef MT_LOCK_STATISTICS
+#define MsLockStatTimestamp() __rdtsc()
+#else
+#define MsLockStatTimestamp() 0ULL
+#endif
+
+/**
+ * Epoch based reclamation.
+ *
+ * Lock-free readers run inside an epoch section (MsEnterEpoch/MsLeaveEpoch), writers stay serialized by their own lock,
+ * unlink an object and hand it to MsEpochDefer, which calls the routine once every section that could still see the object has ended.
+ */
+struct _EPOCH_ENTRY;
+typedef void (*EPOCH_ROUTINE)(struct _EPOCH_ENTRY* Entry);
+
+typedef struct _EPOCH_ENTRY {
+    struct _EPOCH_ENTRY* Next;  // Link in the deferred list
+    uint64_t Epoch;             // Global epoch when the object was retired
+    EPOCH_ROUTINE Routine;      // Frees the object (called at PASSIVE_LEVEL, from the reclaim thread)
+} EPOCH_ENTRY, *PEPOCH_ENTRY;
+
+typedef struct _EPOCH_SECTION {
+    uint32_t Index;             // Which counter pair (epoch parity) the section was accounted in
+} EPOCH_SECTION, *PEPOCH_SECTION;
+
 // ------------------ FUNCTIONS ------------------
 
 //#ifndef MT_UP
@@ -198,6 +301,112 @@ MsReleaseSpinlockFromDpcLevel(
     IN PSPINLOCK Lock
 );
 
+void
+MsAcquireQueuedSpinlockAtDpcLevel(
+    IN PQUEUED_SPINLOCK Lock,
+    IN PQUEUED_SPINLOCK_NODE Node
+);
+
+void
+MsReleaseQueuedSpinlockFromDpcLevel(
+    IN PQUEUED_SPINLOCK Lock,
+    IN PQUEUED_SPINLOCK_NODE Node
+);
+
+void
+MsAcquireInStackQueuedSpinlock(
+    IN PQUEUED_SPINLOCK Lock,
+    OUT PLOCK_QUEUE_HANDLE LockHandle
+);
+
+void
+MsReleaseInStackQueuedSpinlock(
+    IN PLOCK_QUEUE_HANDLE LockHandle
+);
+
+void
+MsAcquireInStackQueuedSpinlockAtDpcLevel(
+    IN PQUEUED_SPINLOCK Lock,
+    OUT PLOCK_QUEUE_HANDLE LockHandle
+);
+
+void
+MsReleaseInStackQueuedSpinlockFromDpcLevel(
+    IN PLOCK_QUEUE_HANDLE LockHandle
+);
+
+void
+MsRunLockBenchmark(
+    IN void* Parameter
+);
+
+void
+MsEnterEpoch(
+    OUT PEPOCH_SECTION Section
+);
+
+void
+MsLeaveEpoch(
+    IN PEPOCH_SECTION Section
+);
+
+void
+MsEpochDefer(
+    IN PEPOCH_ENTRY Entry,
+    IN EPOCH_ROUTINE Routine
+);
+
+bool
+MsEpochQuiescentState(
+    IN bool WakeReclaimer
+);
+
+void
+MsInitializeEpochReclamation(
+    void
+);
+
+#ifdef MT_LOCK_STATISTICS
+void
+MsLockStatRecordAcquire(
+    IN void* CallSite,
+    IN LOCK_STATISTICS_TYPE Type,
+    IN uint64_t SpinCycles,
+    IN bool Contended
+);
+
+void
+MsLockStatRecordRelease(
+    IN void* CallSite,
+    IN LOCK_STATISTICS_TYPE Type,
+    IN uint64_t HoldCycles
+);
+
+uint32_t
+MsSnapshotLockStatistics(
+    OUT PLOCK_STATISTICS_ENTRY Entries,
+    IN uint32_t MaxEntries,
+    OUT uint64_t* DroppedRecords
+);
+#endif
+
+#ifdef MT_LOCK_STATISTICS
+// Called right after a lock was acquired, records the wait and stamps the lock for the hold time.
+#define MsLockStatAcquired(Lock, Site, Type, StartTsc, WasContended) do {           \
+        uint64_t _LockStatNow = __rdtsc();                                          \
+        MsLockStatRecordAcquire((Site), (Type), _LockStatNow - (StartTsc), (WasContended)); \
+        (Lock)->AcquireSite = (Site);                                               \
+        (Lock)->AcquireTsc = _LockStatNow;                                          \
+    } while (0)
+
+// Called right before a lock is released (while it is still owned).
+#define MsLockStatReleasing(Lock, Type) \
+    MsLockStatRecordRelease((Lock)->AcquireSite, (Type), __rdtsc() - (Lock)->AcquireTsc)
+#else
+#define MsLockStatAcquired(Lock, Site, Type, StartTsc, WasContended) ((void)(Site), (void)(StartTsc), (void)(WasContended))
+#define MsLockStatReleasing(Lock, Type) ((void)0)
+#endif
+
 void
 MsAcquirePushLockExclusive(
     IN PUSH_LOCK* Lock
@@ -36,6 +36,142 @@ typedef enum _USER_ALLOCATION_TYPE {
     PAGE_NOACCESS = 0x50 // NONE.
 } USER_ALLOCATION_TYPE;
 
+// Pass as the FileOffset of the file read/write calls to use (and advance) the file object's CurrentOffset.
+#define MT_FILE_USE_FILE_POINTER ((uint64_t)-1)
+
+// Vectored file I/O (MtReadFileScatter, MtWriteFileGather).
+#define MT_MAX_IO_VECTORS 1024
+
+typedef struct _IO_VECTOR {
+    void* Buffer;
+    size_t Length;
+} IO_VECTOR, *PIO_VECTOR;
+
+// MtQuerySystemInformation classes, append only.
+typedef enum _SYSTEM_INFORMATION_CLASS {
+    SystemBasicInformation,             // SYSTEM_BASIC_INFORMATION
+    SystemCounterInformation,           // SYSTEM_COUNTER_INFORMATION, Values[Counter] summed over every processor
+    SystemProcessorCounterInformation,  // SYSTEM_COUNTER_INFORMATION, Values[Processor * NumberOfCounters + Counter]
+    SystemCounterNameInformation,       // SYSTEM_COUNTER_NAME_INFORMATION
+    SystemMemoryInformation,            // SYSTEM_MEMORY_INFORMATION
+    SystemProcessorDpcInformation,      // SYSTEM_PROCESSOR_DPC_INFORMATION
+    SystemObjectTypeInformation,        // SYSTEM_OBJECT_TYPE_INFORMATION
+    SystemInformationClassMax
+} SYSTEM_INFORMATION_CLASS;
+
+#define SYSTEM_COUNTER_NAME_LENGTH 32
+
+typedef struct _SYSTEM_BASIC_INFORMATION {
+    uint32_t NumberOfProcessors;
+    uint32_t PageSize;
+    uint64_t NumberOfPhysicalPages;     // Pages in the PFN database
+    uint32_t NumberOfCounters;          // PERF_COUNTER values this kernel keeps
+    uint32_t Reserved;
+} SYSTEM_BASIC_INFORMATION, *PSYSTEM_BASIC_INFORMATION;
+
+typedef struct _SYSTEM_COUNTER_INFORMATION {
+    uint32_t NumberOfProcessors;
+    uint32_t NumberOfCounters;
+    uint64_t Values[];
+} SYSTEM_COUNTER_INFORMATION, *PSYSTEM_COUNTER_INFORMATION;
+
+typedef struct _SYSTEM_COUNTER_NAME_INFORMATION {
+    uint32_t NumberOfCounters;
+    uint32_t Reserved;
+    char Names[][SYSTEM_COUNTER_NAME_LENGTH];
+} SYSTEM_COUNTER_NAME_INFORMATION, *PSYSTEM_COUNTER_NAME_INFORMATION;
+
+// In pages.
+typedef struct _SYSTEM_MEMORY_INFORMATION {
+    uint64_t TotalPages;
+    uint64_t AvailablePages;            // Free + Zeroed + Standby
+    uint64_t FreePages;
+    uint64_t ZeroedPages;
+    uint64_t StandbyPages;
+    uint64_t ModifiedPages;
+    uint64_t BadPages;
+    uint64_t ReservedPages;
+} SYSTEM_MEMORY_INFORMATION, *PSYSTEM_MEMORY_INFORMATION;
+
+typedef struct _SYSTEM_PROCESSOR_DPC_ENTRY {
+    uint32_t Processor;
+    uint32_t DpcQueueDepth;
+    uint32_t DpcCount;                  // DPCs queued since boot
+    uint32_t MaximumDpcQueueDepth;
+    uint32_t MinimumDpcRate;
+    uint32_t DpcRequestRate;
+} SYSTEM_PROCESSOR_DPC_ENTRY, *PSYSTEM_PROCESSOR_DPC_ENTRY;
+
+typedef struct _SYSTEM_PROCESSOR_DPC_INFORMATION {
+    uint32_t NumberOfProcessors;
+    uint32_t Reserved;
+    SYSTEM_PROCESSOR_DPC_ENTRY Processors[];
+} SYSTEM_PROCESSOR_DPC_INFORMATION, *PSYSTEM_PROCESSOR_DPC_INFORMATION;
+
+typedef struct _SYSTEM_OBJECT_TYPE_ENTRY {
+    char Name[32];
+    uint32_t TotalNumberOfObjects;
+    uint32_t TotalNumberOfHandles;
+} SYSTEM_OBJECT_TYPE_ENTRY, *PSYSTEM_OBJECT_TYPE_ENTRY;
+
+typedef struct _SYSTEM_OBJECT_TYPE_INFORMATION {
+    uint32_t NumberOfTypes;
+    uint32_t Reserved;
+    SYSTEM_OBJECT_TYPE_ENTRY Types[];
+} SYSTEM_OBJECT_TYPE_INFORMATION, *PSYSTEM_OBJECT_TYPE_INFORMATION;
+
+//
+// I/O rings (ioring.c), a submission and a completion ring in user memory shared with the kernel.
+// User mode fills entries and advances SqTail, MtSubmitIoRing executes them and posts completions at CqTail.
+// One kernel entry per batch, instead of one per operation.
+//
+
+#define IO_RING_MAX_ENTRIES 4096
+
+typedef enum _IO_RING_OPERATION {
+    IoRingOpNop,
+    IoRingOpRead,           // MtReadFile(Handle, Offset, Buffer, Length), Result = bytes read
+    IoRingOpWrite,          // MtWriteFile(Handle, Offset, Buffer, Length), Result = bytes written
+    IoRingOpOpen,           // MtCreateFile(Buffer = path, Offset = ACCESS_MASK), Result = handle
+    IoRingOpClose,          // MtClose(Handle)
+    IoRingOpAllocate,       // MtAllocateVirtualMemory(Buffer = base or 0, Length, Offset = USER_ALLOCATION_TYPE), Result = base
+    IoRingOpMax
+} IO_RING_OPERATION;
+
+typedef struct _IO_RING_SQE {
+    uint32_t Operation;     // IO_RING_OPERATION
+    HANDLE Handle;
+    uint64_t Offset;
+    uint64_t Buffer;
+    uint64_t Length;
+    uint64_t UserData;      // Copied to the completion untouched
+} IO_RING_SQE, *PIO_RING_SQE;
+
+typedef struct _IO_RING_CQE {
+    uint64_t UserData;
+    uint64_t Result;
+    MTSTATUS Status;
+    uint32_t Reserved;
+} IO_RING_CQE, *PIO_RING_CQE;
+
+// At the start of the ring, the entries follow at SqOffset and CqOffset.
+// The kernel keeps its own SqHead and CqTail, the copies here are only published for user mode.
+typedef struct _IO_RING_HEADER {
+    // Written by the kernel.
+    volatile uint32_t SqHead;
+    volatile uint32_t CqTail;
+    uint32_t SqEntries;
+    uint32_t CqEntries;
+    uint32_t SqOffset;
+    uint32_t CqOffset;
+    uint8_t Reserved0[40];
+
+    // Written by user mode (own cache line).
+    volatile uint32_t SqTail;
+    volatile uint32_t CqHead;
+    uint8_t Reserved1[56];
+} IO_RING_HEADER, *PIO_RING_HEADER;
+
 void
 MtSetupSyscall(
     void
@@ -104,4 +240,70 @@ MtTerminateThread(
     IN MTSTATUS ExitStatus
 );
 
+MTSTATUS
+MtQueryLockStatistics(
+    OUT void* Buffer,
+    IN size_t BufferSize,
+    _Out_Opt size_t* ReturnLength
+);
+
+MTSTATUS
+MtControlTrace(
+    IN uint32_t Operation,
+    _In_Opt const char* Path
+);
+
+MTSTATUS
+MtControlProfile(
+    IN uint32_t Operation,
+    IN uint32_t Source,
+    IN uint64_t Interval,
+    _In_Opt const char* Path
+);
+
+MTSTATUS
+MtQueryProfile(
+    OUT void* Buffer,
+    IN size_t BufferSize,
+    _Out_Opt size_t* ReturnLength
+);
+
+MTSTATUS
+MtQuerySystemInformation(
+    IN uint32_t InformationClass,
+    OUT void* Buffer,
+    IN size_t BufferSize,
+    _Out_Opt size_t* ReturnLength
+);
+
+MTSTATUS
+MtCreateIoRing(
+    IN uint32_t Entries,
+    OUT void** RingBase
+);
+
+MTSTATUS
+MtSubmitIoRing(
+    IN uint32_t ToSubmit,
+    _Out_Opt uint32_t* Submitted
+);
+
+MTSTATUS
+MtReadFileScatter(
+    IN HANDLE FileHandle,
+    IN uint64_t FileOffset,
+    IN const IO_VECTOR* Vectors,
+    IN uint32_t VectorCount,
+    _Out_Opt size_t* BytesRead
+);
+
+MTSTATUS
+MtWriteFileGather(
+    IN HANDLE FileHandle,
+    IN uint64_t FileOffset,
+    IN const IO_VECTOR* Vectors,
+    IN uint32_t VectorCount,
+    _Out_Opt size_t* BytesWritten
+);
+
 #endif
\ No newline at end of file
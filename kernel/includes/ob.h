@@ -61,6 +61,7 @@ typedef struct _OBJECT_HEADER {
     };
     POBJECT_TYPE Type;  // Pointer to type definition.
     uint32_t Flags;
+    EPOCH_ENTRY EpochEntry; // The header is freed through the epoch, lock-free lookups may still try to reference the object.
 } __attribute__((aligned(16))) OBJECT_HEADER, *POBJECT_HEADER;
 _Static_assert(sizeof(OBJECT_HEADER) % 16 == 0, "OBJECT_HEADER must be 16-byte aligned");
 
@@ -151,4 +152,13 @@ void ObDeleteObject(
     IN POBJECT_HEADER Header
 );
 
+struct _SYSTEM_OBJECT_TYPE_ENTRY;
+
+uint32_t
+ObQueryObjectTypes(
+    IN uint32_t Skip,
+    OUT struct _SYSTEM_OBJECT_TYPE_ENTRY* Entries,
+    IN uint32_t Count
+);
+
 #endif
\ No newline at end of file
@@ -128,6 +128,7 @@ typedef struct _TEB {
     PPEB ProcessEnvironmentBlock; // Pointer to this thread's process's PEB.
     int32_t LastErrorValue; // The last error that the thread's has done in an operation (failed function, illegal instruction)
     int32_t LastStatusValue; // Internal MTSTATUS Values.
+    void* HeapCache; // mtdll's per thread heap cache (heap.c), NULL until the thread's first allocation.
 } TEB, *PTEB;
 
 typedef struct _MT_MODULE_INFO {
@@ -177,6 +178,15 @@ typedef struct _EPROCESS {
     // VAD (todo process quota)
     struct _MMVAD* VadRoot; // The Root of the VAD for the process. (used to find free virtual addresses spaces in the process, and information about them)
     PUSH_LOCK VadLock; // The push lock to ensure VAD atomicity.
+    volatile uint64_t VadSequence; // Odd while the VAD tree is being modified (under VadLock), lock-free lookups retry when it changes.
+    struct _MMVAD* VadHint; // Last VAD found by MiFindVad (faults come in runs on the same VAD), cleared before the VAD is freed.
+
+    // I/O ring (ioring.c), registered by MtCreateIoRing, lives until the address space is deleted.
+    struct _IO_RING_HEADER* IoRing; // User address of the ring, NULL if none was created.
+    uint32_t IoRingSqEntries; // The kernel's copies, user mode can't move them under us.
+    uint32_t IoRingSqHead;
+    uint32_t IoRingCqTail;
+    PUSH_LOCK IoRingLock; // Serializes ring creation and submissions.
 } EPROCESS, *PEPROCESS;
 
 typedef struct _ETHREAD {
@@ -199,6 +209,8 @@ typedef struct _ETHREAD {
     MTSTATUS LastStatus; // The last status set by violation.
     bool SystemThread; // Is this thread a system thread?
     bool WorkerThread; // is this thread a worker thread?
+    void* IoStagingBuffer; // Bounce buffer of the file system calls (systemcalls.c), allocated on first use, freed with the thread.
+    uint32_t PinnedProcessor; // Processor ID + 1 the thread stays on (work stealing skips it), 0 if none.
     /* TODO: priority, affinity, wait list, etc. */
 } ETHREAD, *PETHREAD;
 
@@ -385,8 +397,8 @@ void
 MeEnqueueThreadWithLock(
     Queue* queue, PETHREAD thread)
 {
-    IRQL flags;
-    MsAcquireSpinlock(&queue->lock, &flags);
+    LOCK_QUEUE_HANDLE LockHandle;
+    MsAcquireInStackQueuedSpinlock(&queue->lock, &LockHandle);
 
     // Initialize the new node's links using the SCHEDULER entry
     thread->SchedulerListEntry.Flink = NULL;
@@ -406,7 +418,7 @@ MeEnqueueThreadWithLock(
     // Update tail to be the new thread
     queue->tail = thread;
 
-    MsReleaseSpinlock(&queue->lock, flags);
+    MsReleaseInStackQueuedSpinlock(&LockHandle);
 }
 
 // Dequeues the head thread from the queue with spinlock protection.
@@ -414,11 +426,11 @@ FORCEINLINE
 PETHREAD
 MeDequeueThreadWithLock(Queue* q)
 {
-    IRQL flags;
-    MsAcquireSpinlock(&q->lock, &flags);
+    LOCK_QUEUE_HANDLE LockHandle;
+    MsAcquireInStackQueuedSpinlock(&q->lock, &LockHandle);
 
     if (!q->head) {
-        MsReleaseSpinlock(&q->lock, flags);
+        MsReleaseInStackQueuedSpinlock(&LockHandle);
         return NULL;
     }
 
@@ -443,7 +455,7 @@ MeDequeueThreadWithLock(Queue* q)
     t->SchedulerListEntry.Flink = NULL;
     t->SchedulerListEntry.Blink = NULL;
 
-    MsReleaseSpinlock(&q->lock, flags);
+    MsReleaseInStackQueuedSpinlock(&LockHandle);
     return t;
 }
 
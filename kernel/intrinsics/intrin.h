@@ -25,6 +25,13 @@
 #define IA32_CSTAR 0xC0000083
 #define IA32_FMASK 0xC0000084
 
+// Architectural performance monitoring (CPUID leaf 0xA)
+#define IA32_PMC0 0xC1
+#define IA32_PERFEVTSEL0 0x186
+#define IA32_PERF_GLOBAL_STATUS 0x38E
+#define IA32_PERF_GLOBAL_CTRL 0x38F
+#define IA32_PERF_GLOBAL_OVF_CTRL 0x390
+
 #ifndef UNREFERENCED_PARAMETER
 #define UNREFERENCED_PARAMETER(x) (void)(x)
 #endif
@@ -281,6 +288,23 @@ FORCEINLINE uint64_t __rdtsc(void) {
     return ((uint64_t)hi << 32) | lo;
 }
 
+// Clear CR0.TS (Task Switched), FPU/SSE/AVX instructions stop raising #NM.
+FORCEINLINE void __clts(void) {
+    __asm__ volatile ("clts" ::: "memory");
+}
+
+FORCEINLINE uint64_t __xgetbv(uint32_t xcr) {
+    uint32_t lo, hi;
+    __asm__ volatile ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(xcr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+FORCEINLINE void __xsetbv(uint32_t xcr, uint64_t value) {
+    uint32_t lo = value & 0xFFFFFFFF;
+    uint32_t hi = value >> 32;
+    __asm__ volatile ("xsetbv" : : "c"(xcr), "a"(lo), "d"(hi) : "memory");
+}
+
 #ifdef DEBUG
 
 // GDB Func to CLI and STI
@@ -86,6 +86,8 @@ void init_boot_info(BOOT_INFO* boot_info) {
     boot_info_local.KernelStackTop = boot_info->KernelStackTop;
     boot_info_local.Pml4Phys = boot_info->Pml4Phys;
     boot_info_local.AcpiRsdpPhys = boot_info->AcpiRsdpPhys;
+    boot_info_local.RamDiskBase = boot_info->RamDiskBase;
+    boot_info_local.RamDiskSize = boot_info->RamDiskSize;
 }
 
 static inline bool interrupts_enabled(void) {
@@ -143,7 +145,7 @@ static void MeCreateInitialUserModeProcess(void) {
 }
 
 // All CPUs
-uint8_t apic_list[MAX_CPUS];
+uint32_t apic_list[MAX_CPUS];
 uint32_t cpu_count = 0;
 uint32_t lapicAddress;
 bool smpInitialized;
@@ -295,6 +297,13 @@ void kernel_main(BOOT_INFO* boot_info) {
         MeBugCheck(FILESYSTEM_PANIC);
     }
 
+#ifdef MT_LOG_FILE
+    status = MdSetLogFile(MT_LOG_FILE);
+    if (MT_FAILURE(status)) {
+        gop_printf(COLOR_YELLOW, "Could not open the log file %s: %x\n", MT_LOG_FILE, status);
+    }
+#endif
+
     /* SYSTEM IS FULLY INITIALIZED. (except SMP and APIC) */
 
     void* buf = MmAllocatePoolWithTag(NonPagedPool, 64, 'buf1');
@@ -331,10 +340,11 @@ void kernel_main(BOOT_INFO* boot_info) {
     lapic_init_cpu();
     lapic_enable(); // call again.
     lapic_timer_calibrate();
+    MeInitializeSharedUserData(100); // Before the clock starts ticking (and the initial process is created)
     init_lapic_timer(100); // 10ms, must be called before other APs
 #ifndef MT_UP
     /* Enable SMP */
-    status = MhParseLAPICs((uint8_t*)apic_list, MAX_CPUS, &cpu_count, &lapicAddress);
+    status = MhParseLAPICs(apic_list, MAX_CPUS, &cpu_count, &lapicAddress);
     if (MT_FAILURE(status)) {
         gop_printf(COLOR_RED, "**[MTSTATUS-FAILURE]** ParseLAPICs status returned: %x, continuing in UP mode.\n", status);
         // 1 CPU Present in the system
@@ -347,6 +357,19 @@ void kernel_main(BOOT_INFO* boot_info) {
     }
 #else
     gop_printf(COLOR_RED, "System configured to run in UP mode.\n");
+#endif
+    MeStartThreadedDpcThreads(); // After the APs are online, one per processor.
+#ifdef MT_LOCK_BENCHMARK
+    PsCreateSystemThread((ThreadEntry)MsRunLockBenchmark, NULL, DEFAULT_TIMESLICE_TICKS, NULL);
+#endif
+#ifdef MT_MEMORY_BENCHMARK
+    PsCreateSystemThread((ThreadEntry)MmRunMemoryBenchmark, NULL, DEFAULT_TIMESLICE_TICKS, NULL);
+#endif
+#ifdef MT_LARGE_PAGE_BENCHMARK
+    PsCreateSystemThread((ThreadEntry)MmRunLargePageBenchmark, NULL, DEFAULT_TIMESLICE_TICKS, NULL);
+#endif
+#ifdef MT_SELF_TESTS
+    PsCreateSystemThread((ThreadEntry)MdRunSelfTests, NULL, DEFAULT_TIMESLICE_TICKS, NULL);
 #endif
     // __sti(); STI Call commented out, this is what caused the scheduler assertion to fail, and guess how much time it took to debug? 2 days
     // Thread creations (including idle threads) must come with the IF flag set.
@@ -34,6 +34,7 @@ typedef int32_t MTSTATUS;
 #define MT_TYPE_MISMATCH		((MTSTATUS)0xC0000012L)
 #define MT_OBJECT_DELETED		((MTSTATUS)0xC0000013L)
 #define MT_INVALID_HANDLE		((MTSTATUS)0xC0000014L)
+#define MT_BUFFER_TOO_SMALL		((MTSTATUS)0xC0000015L)
 
 //
 // ==========================
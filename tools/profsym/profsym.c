@@ -0,0 +1,299 @@
+/*++
+
+Module Name:
+
+    profsym.c
+
+Purpose:
+
+    Host tool, symbolizes a kernel profile dump (MtControlProfile(ProfileControlDump, ...)) against build/kernel.elf.
+    Prints the hottest functions, or folded stacks (-f) for flamegraph.pl / speedscope.
+
+    Usage: profsym [-e build/kernel.elf] [-n Top] [-f] profile.bin
+
+Author:
+
+    slep (Matanel) 2025.
+
+Revision History:
+
+--*/
+
+#include <elf.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// The dump format, must match kernel/includes/md.h (module: profile.c).
+//
+
+#define PROFILE_DUMP_MAGIC 0x4652504DU // 'MPRF'
+#define PROFILE_DUMP_VERSION 1
+#define PROFILE_STACK_DEPTH 8
+
+typedef struct _PROFILE_ENTRY {
+    uint64_t Hits;
+    uint64_t Frames[PROFILE_STACK_DEPTH];
+    uint32_t Process;
+    uint32_t Thread;
+    uint16_t Processor;
+    uint8_t Irql;
+    uint8_t Depth;
+    uint8_t UserMode;
+    uint8_t Reserved[11];
+} PROFILE_ENTRY;
+
+typedef struct _PROFILE_DUMP_HEADER {
+    uint32_t Magic;
+    uint16_t Version;
+    uint16_t EntrySize;
+    uint32_t Source;
+    uint32_t EntryCount;
+    uint64_t Interval;
+    uint64_t TotalSamples;
+    uint64_t DroppedSamples;
+} PROFILE_DUMP_HEADER;
+
+typedef struct _SYMBOL {
+    uint64_t Address;
+    uint64_t Size;
+    const char* Name;
+} SYMBOL;
+
+typedef struct _FUNCTION_HITS {
+    const char* Name;
+    uint64_t Address;               // For unknown addresses (no symbol)
+    uint64_t Hits;
+} FUNCTION_HITS;
+
+static SYMBOL* Symbols;
+static size_t SymbolCount;
+
+static int CompareSymbols(const void* A, const void* B) {
+    const SYMBOL* Sa = (const SYMBOL*)A;
+    const SYMBOL* Sb = (const SYMBOL*)B;
+    return (Sa->Address < Sb->Address) ? -1 : (Sa->Address > Sb->Address);
+}
+
+static int CompareHits(const void* A, const void* B) {
+    const FUNCTION_HITS* Ha = (const FUNCTION_HITS*)A;
+    const FUNCTION_HITS* Hb = (const FUNCTION_HITS*)B;
+    return (Ha->Hits > Hb->Hits) ? -1 : (Ha->Hits < Hb->Hits);
+}
+
+static void* ReadWholeFile(const char* Path, size_t* Size) {
+    FILE* File = fopen(Path, "rb");
+    if (!File) {
+        perror(Path);
+        return NULL;
+    }
+
+    fseek(File, 0, SEEK_END);
+    long Length = ftell(File);
+    fseek(File, 0, SEEK_SET);
+
+    void* Data = malloc(Length > 0 ? (size_t)Length : 1);
+    if (!Data || fread(Data, 1, (size_t)Length, File) != (size_t)Length) {
+        fprintf(stderr, "%s: read failed\n", Path);
+        fclose(File);
+        free(Data);
+        return NULL;
+    }
+
+    fclose(File);
+    *Size = (size_t)Length;
+    return Data;
+}
+
+static int LoadSymbols(const char* Path) {
+    size_t Size;
+    uint8_t* Image = ReadWholeFile(Path, &Size);
+    if (!Image) return -1;
+
+    Elf64_Ehdr* Header = (Elf64_Ehdr*)Image;
+    if (Size < sizeof(*Header) || memcmp(Header->e_ident, ELFMAG, SELFMAG) || Header->e_ident[EI_CLASS] != ELFCLASS64) {
+        fprintf(stderr, "%s: not an ELF64 image\n", Path);
+        return -1;
+    }
+
+    Elf64_Shdr* Sections = (Elf64_Shdr*)(Image + Header->e_shoff);
+
+    for (int i = 0; i < Header->e_shnum; i++) {
+        if (Sections[i].sh_type != SHT_SYMTAB) continue;
+
+        Elf64_Sym* Table = (Elf64_Sym*)(Image + Sections[i].sh_offset);
+        size_t Count = Sections[i].sh_size / sizeof(Elf64_Sym);
+        const char* Strings = (const char*)(Image + Sections[Sections[i].sh_link].sh_offset);
+
+        Symbols = calloc(Count, sizeof(SYMBOL));
+        if (!Symbols) return -1;
+
+        for (size_t j = 0; j < Count; j++) {
+            uint8_t Type = ELF64_ST_TYPE(Table[j].st_info);
+
+            // Functions, and the assembly labels (no type) that live in sections.
+            if (Type != STT_FUNC && Type != STT_NOTYPE) continue;
+            if (!Table[j].st_value || Table[j].st_shndx == SHN_UNDEF || Table[j].st_shndx >= SHN_LORESERVE) continue;
+            if (!Strings[Table[j].st_name]) continue;
+
+            Symbols[SymbolCount].Address = Table[j].st_value;
+            Symbols[SymbolCount].Size = Table[j].st_size;
+            Symbols[SymbolCount].Name = Strings + Table[j].st_name;
+            SymbolCount++;
+        }
+        break;
+    }
+
+    if (!SymbolCount) {
+        fprintf(stderr, "%s: no symbol table (stripped?)\n", Path);
+        return -1;
+    }
+
+    qsort(Symbols, SymbolCount, sizeof(SYMBOL), CompareSymbols);
+    return 0;
+}
+
+static const SYMBOL* FindSymbol(uint64_t Address) {
+    size_t Low = 0, High = SymbolCount;
+
+    // Last symbol at or below Address.
+    while (Low < High) {
+        size_t Middle = (Low + High) / 2;
+        if (Symbols[Middle].Address <= Address) Low = Middle + 1;
+        else High = Middle;
+    }
+
+    if (!Low) return NULL;
+
+    const SYMBOL* Symbol = &Symbols[Low - 1];
+    if (Symbol->Size && Address >= Symbol->Address + Symbol->Size) return NULL;
+    return Symbol;
+}
+
+// Writes the function name of a frame, or its address.
+static void FrameName(const PROFILE_ENTRY* Entry, uint32_t Index, char* Buffer, size_t Length) {
+    uint64_t Address = Entry->Frames[Index];
+
+    // Return addresses point after the call, look the call itself up.
+    uint64_t Lookup = Index ? Address - 1 : Address;
+    const SYMBOL* Symbol = Entry->UserMode ? NULL : FindSymbol(Lookup);
+
+    if (Symbol) snprintf(Buffer, Length, "%s", Symbol->Name);
+    else snprintf(Buffer, Length, "%s0x%llx", Entry->UserMode ? "user:" : "", (unsigned long long)Address);
+}
+
+static void Usage(void) {
+    fprintf(stderr, "usage: profsym [-e kernel.elf] [-n Top] [-f] profile.bin\n");
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    const char* ElfPath = NULL;
+    const char* InputPath = NULL;
+    int Folded = 0;
+    size_t Top = 30;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-e")) {
+            if (++i >= argc) Usage();
+            ElfPath = argv[i];
+        }
+        else if (!strcmp(argv[i], "-n")) {
+            if (++i >= argc) Usage();
+            Top = (size_t)strtoul(argv[i], NULL, 0);
+        }
+        else if (!strcmp(argv[i], "-f")) Folded = 1;
+        else if (!InputPath) InputPath = argv[i];
+        else Usage();
+    }
+
+    if (!InputPath) Usage();
+    if (ElfPath && LoadSymbols(ElfPath)) return 1;
+
+    size_t Size;
+    uint8_t* Dump = ReadWholeFile(InputPath, &Size);
+    if (!Dump) return 1;
+
+    PROFILE_DUMP_HEADER* Header = (PROFILE_DUMP_HEADER*)Dump;
+    if (Size < sizeof(*Header) || Header->Magic != PROFILE_DUMP_MAGIC) {
+        fprintf(stderr, "%s: not a profile dump\n", InputPath);
+        return 1;
+    }
+
+    if (Header->Version != PROFILE_DUMP_VERSION || Header->EntrySize != sizeof(PROFILE_ENTRY)) {
+        fprintf(stderr, "%s: unsupported dump version %u (entry size %u)\n", InputPath, Header->Version, Header->EntrySize);
+        return 1;
+    }
+
+    size_t Count = Header->EntryCount;
+    if (sizeof(*Header) + Count * sizeof(PROFILE_ENTRY) > Size) {
+        fprintf(stderr, "%s: truncated dump\n", InputPath);
+        return 1;
+    }
+
+    const PROFILE_ENTRY* Entries = (const PROFILE_ENTRY*)(Dump + sizeof(*Header));
+    char Name[256];
+
+    if (Folded) {
+        // Root first, one line per entry, flamegraph.pl merges identical stacks.
+        for (size_t i = 0; i < Count; i++) {
+            const PROFILE_ENTRY* Entry = &Entries[i];
+            uint32_t Depth = (Entry->Depth && Entry->Depth <= PROFILE_STACK_DEPTH) ? Entry->Depth : 1;
+
+            printf("pid %u;irql %u", Entry->Process, Entry->Irql);
+            for (uint32_t j = Depth; j-- > 0; ) {
+                FrameName(Entry, j, Name, sizeof(Name));
+                printf(";%s", Name);
+            }
+            printf(" %llu\n", (unsigned long long)Entry->Hits);
+        }
+        return 0;
+    }
+
+    // Self time per function (the interrupted RIP).
+    FUNCTION_HITS* Functions = calloc(Count ? Count : 1, sizeof(FUNCTION_HITS));
+    size_t FunctionCount = 0;
+    uint64_t UserHits = 0;
+    uint64_t Total = 0;
+
+    for (size_t i = 0; i < Count; i++) {
+        const PROFILE_ENTRY* Entry = &Entries[i];
+        const SYMBOL* Symbol = Entry->UserMode ? NULL : FindSymbol(Entry->Frames[0]);
+
+        Total += Entry->Hits;
+        if (Entry->UserMode) UserHits += Entry->Hits;
+
+        size_t j;
+        for (j = 0; j < FunctionCount; j++) {
+            if (Symbol ? Functions[j].Name == Symbol->Name : (!Functions[j].Name && Functions[j].Address == Entry->Frames[0])) break;
+        }
+
+        if (j == FunctionCount) {
+            Functions[j].Name = Symbol ? Symbol->Name : NULL;
+            Functions[j].Address = Entry->Frames[0];
+            FunctionCount++;
+        }
+        Functions[j].Hits += Entry->Hits;
+    }
+
+    qsort(Functions, FunctionCount, sizeof(FUNCTION_HITS), CompareHits);
+
+    printf("source: %s, interval %llu, %llu samples (%llu dropped), %zu distinct stacks, %.1f%% in user mode\n\n",
+        Header->Source ? "cycles" : "timer", (unsigned long long)Header->Interval, (unsigned long long)Header->TotalSamples,
+        (unsigned long long)Header->DroppedSamples, Count, Total ? 100.0 * (double)UserHits / (double)Total : 0.0);
+
+    printf("%10s %7s  %s\n", "samples", "%", "function");
+    for (size_t i = 0; i < FunctionCount && i < Top; i++) {
+        if (Functions[i].Name) snprintf(Name, sizeof(Name), "%s", Functions[i].Name);
+        else snprintf(Name, sizeof(Name), "0x%llx", (unsigned long long)Functions[i].Address);
+
+        printf("%10llu %6.2f%%  %s\n", (unsigned long long)Functions[i].Hits,
+            Total ? 100.0 * (double)Functions[i].Hits / (double)Total : 0.0, Name);
+    }
+
+    free(Functions);
+    free(Dump);
+    return 0;
+}
@@ -0,0 +1,361 @@
+/*++
+
+Module Name:
+
+    trace2json.c
+
+Purpose:
+
+    Host tool, converts a kernel trace dump (MtControlTrace(TraceControlDump, ...)) to the Chrome trace event format,
+    viewable in chrome://tracing or https://ui.perfetto.dev.
+
+    Usage: trace2json [-f TscMHz] trace.bin [trace.json]
+
+Author:
+
+    slep (Matanel) 2025.
+
+Revision History:
+
+--*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// The dump format, must match kernel/includes/md.h (module: trace.c).
+//
+
+#define TRACE_DUMP_MAGIC 0x5254544DU // 'MTTR'
+#define TRACE_DUMP_VERSION 1
+
+enum {
+    TraceEventSwitchOut = 1,
+    TraceEventSwitchIn,
+    TraceEventFaultEnter,
+    TraceEventFaultExit,
+    TraceEventSyscallEnter,
+    TraceEventSyscallExit,
+    TraceEventDpcQueue,
+    TraceEventDpcRetireStart,
+    TraceEventDpcRetireEnd,
+    TraceEventWait,
+    TraceEventSet,
+    TraceEventDiskSubmit,
+    TraceEventDiskComplete,
+};
+
+typedef struct _TRACE_RECORD {
+    uint64_t Timestamp;
+    uint16_t Event;
+    uint16_t Processor;
+    uint32_t Thread;
+    uint64_t Arguments[2];
+} TRACE_RECORD;
+
+typedef struct _TRACE_DUMP_HEADER {
+    uint32_t Magic;
+    uint16_t Version;
+    uint16_t RecordSize;
+    uint64_t TscFrequency;
+    uint32_t ProcessorCount;
+    uint32_t Reserved;
+} TRACE_DUMP_HEADER;
+
+typedef struct _TRACE_DUMP_PROCESSOR {
+    uint32_t Processor;
+    uint32_t RecordCount;
+    uint64_t Overwritten;
+} TRACE_DUMP_PROCESSOR;
+
+// The kernel's MAX_CPUS.
+#define MAX_PROCESSORS 32
+// Threads whose process is remembered (from the switch records), above that they are shown under PID 0.
+#define MAX_THREADS 4096
+
+// Chrome trace ids, processor tracks live under a process of their own.
+#define CPU_TRACK_PID 0
+
+typedef struct _RUNNING_SLICE {
+    int Valid;
+    uint32_t Thread;
+    uint32_t Process;
+    uint64_t Start;
+} RUNNING_SLICE;
+
+static double TicksPerMicrosecond;
+static uint64_t FirstTimestamp;
+static uint32_t ThreadProcess[MAX_THREADS];
+static int FirstEvent = 1;
+
+static int CompareRecords(const void* A, const void* B) {
+    const TRACE_RECORD* Ra = (const TRACE_RECORD*)A;
+    const TRACE_RECORD* Rb = (const TRACE_RECORD*)B;
+
+    if (Ra->Timestamp != Rb->Timestamp) return (Ra->Timestamp < Rb->Timestamp) ? -1 : 1;
+    if (Ra->Processor != Rb->Processor) return (Ra->Processor < Rb->Processor) ? -1 : 1;
+    return 0;
+}
+
+static double Microseconds(uint64_t Timestamp) {
+    return (double)(Timestamp - FirstTimestamp) / TicksPerMicrosecond;
+}
+
+static void BeginEvent(FILE* Out) {
+    fputs(FirstEvent ? "\n  " : ",\n  ", Out);
+    FirstEvent = 0;
+}
+
+// Events of thread 0 (before threads exist, or an idle loop without a TID) go to the processor's track.
+static void Track(const TRACE_RECORD* Record, uint32_t* Pid, uint32_t* Tid) {
+    if (!Record->Thread) {
+        *Pid = CPU_TRACK_PID;
+        *Tid = Record->Processor;
+        return;
+    }
+
+    *Pid = (Record->Thread < MAX_THREADS) ? ThreadProcess[Record->Thread] + 1 : 1; // +1, 0 is the processor tracks
+    *Tid = Record->Thread;
+}
+
+static void EmitDuration(FILE* Out, const TRACE_RECORD* Record, char Phase, const char* Name, const char* Args) {
+    uint32_t Pid, Tid;
+    Track(Record, &Pid, &Tid);
+
+    BeginEvent(Out);
+    fprintf(Out, "{\"name\":\"%s\",\"cat\":\"kernel\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%u,\"tid\":%u,\"args\":{%s}}",
+        Name, Phase, Microseconds(Record->Timestamp), Pid, Tid, Args ? Args : "");
+}
+
+static void EmitInstant(FILE* Out, const TRACE_RECORD* Record, const char* Name, const char* Args) {
+    uint32_t Pid, Tid;
+    Track(Record, &Pid, &Tid);
+
+    BeginEvent(Out);
+    fprintf(Out, "{\"name\":\"%s\",\"cat\":\"kernel\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%u,\"tid\":%u,\"args\":{%s}}",
+        Name, Microseconds(Record->Timestamp), Pid, Tid, Args ? Args : "");
+}
+
+static void EmitSlice(FILE* Out, uint32_t Processor, const RUNNING_SLICE* Slice, uint64_t End) {
+    BeginEvent(Out);
+    fprintf(Out, "{\"name\":\"TID %u (PID %u)\",\"cat\":\"sched\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%u,\"tid\":%u,\"args\":{}}",
+        Slice->Thread, Slice->Process, Microseconds(Slice->Start), Microseconds(End) - Microseconds(Slice->Start), CPU_TRACK_PID, Processor);
+}
+
+static void EmitMetadata(FILE* Out, uint32_t ProcessorCount) {
+    BeginEvent(Out);
+    fprintf(Out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":\"Processors\"}}", CPU_TRACK_PID);
+
+    for (uint32_t i = 0; i < ProcessorCount; i++) {
+        BeginEvent(Out);
+        fprintf(Out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"CPU %u\"}}", CPU_TRACK_PID, i, i);
+    }
+}
+
+static void Usage(void) {
+    fprintf(stderr, "usage: trace2json [-f TscMHz] trace.bin [trace.json]\n");
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    double OverrideMhz = 0;
+    const char* InputPath = NULL;
+    const char* OutputPath = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-f")) {
+            if (++i >= argc) Usage();
+            OverrideMhz = atof(argv[i]);
+            if (OverrideMhz <= 0) Usage();
+        }
+        else if (!InputPath) InputPath = argv[i];
+        else if (!OutputPath) OutputPath = argv[i];
+        else Usage();
+    }
+
+    if (!InputPath) Usage();
+
+    FILE* In = fopen(InputPath, "rb");
+    if (!In) {
+        perror(InputPath);
+        return 1;
+    }
+
+    TRACE_DUMP_HEADER Header;
+    if (fread(&Header, sizeof(Header), 1, In) != 1 || Header.Magic != TRACE_DUMP_MAGIC) {
+        fprintf(stderr, "%s: not a trace dump\n", InputPath);
+        return 1;
+    }
+
+    if (Header.Version != TRACE_DUMP_VERSION || Header.RecordSize != sizeof(TRACE_RECORD)) {
+        fprintf(stderr, "%s: unsupported dump version %u (record size %u)\n", InputPath, Header.Version, Header.RecordSize);
+        return 1;
+    }
+
+    if (OverrideMhz > 0) {
+        TicksPerMicrosecond = OverrideMhz;
+    }
+    else if (Header.TscFrequency) {
+        TicksPerMicrosecond = (double)Header.TscFrequency / 1e6;
+    }
+    else {
+        fprintf(stderr, "warning: the dump has no TSC frequency, assuming 1000 MHz (use -f)\n");
+        TicksPerMicrosecond = 1000.0;
+    }
+
+    // Read every processor's records, then merge them by timestamp.
+    TRACE_RECORD* Records = NULL;
+    size_t Count = 0;
+    uint32_t ProcessorCount = (Header.ProcessorCount < MAX_PROCESSORS) ? Header.ProcessorCount : MAX_PROCESSORS;
+
+    for (uint32_t i = 0; i < Header.ProcessorCount; i++) {
+        TRACE_DUMP_PROCESSOR Descriptor;
+        if (fread(&Descriptor, sizeof(Descriptor), 1, In) != 1) {
+            fprintf(stderr, "%s: truncated dump\n", InputPath);
+            return 1;
+        }
+
+        if (Descriptor.Overwritten) {
+            fprintf(stderr, "note: CPU %u wrapped, its %llu oldest records were lost\n",
+                Descriptor.Processor, (unsigned long long)Descriptor.Overwritten);
+        }
+
+        TRACE_RECORD* Grown = realloc(Records, (Count + Descriptor.RecordCount) * sizeof(TRACE_RECORD));
+        if (!Grown && Descriptor.RecordCount) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+        if (Grown) Records = Grown;
+
+        if (fread(Records + Count, sizeof(TRACE_RECORD), Descriptor.RecordCount, In) != Descriptor.RecordCount) {
+            fprintf(stderr, "%s: truncated dump\n", InputPath);
+            return 1;
+        }
+        Count += Descriptor.RecordCount;
+    }
+    fclose(In);
+
+    qsort(Records, Count, sizeof(TRACE_RECORD), CompareRecords);
+    FirstTimestamp = Count ? Records[0].Timestamp : 0;
+
+    // The processes of the threads are only known from the switch records, learn them before emitting anything.
+    for (size_t i = 0; i < Count; i++) {
+        const TRACE_RECORD* Record = &Records[i];
+        if ((Record->Event == TraceEventSwitchIn || Record->Event == TraceEventSwitchOut) && Record->Arguments[0] < MAX_THREADS) {
+            ThreadProcess[Record->Arguments[0]] = (uint32_t)Record->Arguments[1];
+        }
+    }
+
+    FILE* Out = OutputPath ? fopen(OutputPath, "w") : stdout;
+    if (!Out) {
+        perror(OutputPath);
+        return 1;
+    }
+
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", Out);
+    EmitMetadata(Out, ProcessorCount);
+
+    RUNNING_SLICE Running[MAX_PROCESSORS];
+    memset(Running, 0, sizeof(Running));
+
+    char Args[160];
+
+    for (size_t i = 0; i < Count; i++) {
+        const TRACE_RECORD* Record = &Records[i];
+        uint32_t Cpu = Record->Processor;
+        if (Cpu >= MAX_PROCESSORS) continue;
+
+        switch (Record->Event) {
+        case TraceEventSwitchOut:
+            if (Running[Cpu].Valid) EmitSlice(Out, Cpu, &Running[Cpu], Record->Timestamp);
+            Running[Cpu].Valid = 0;
+            break;
+        case TraceEventSwitchIn:
+            Running[Cpu].Valid = 1;
+            Running[Cpu].Thread = (uint32_t)Record->Arguments[0];
+            Running[Cpu].Process = (uint32_t)Record->Arguments[1];
+            Running[Cpu].Start = Record->Timestamp;
+            break;
+        case TraceEventFaultEnter:
+            snprintf(Args, sizeof(Args), "\"address\":\"0x%llx\",\"error\":\"0x%llx\"",
+                (unsigned long long)Record->Arguments[0], (unsigned long long)Record->Arguments[1]);
+            EmitDuration(Out, Record, 'B', "page fault", Args);
+            break;
+        case TraceEventFaultExit:
+            snprintf(Args, sizeof(Args), "\"status\":\"0x%llx\"", (unsigned long long)(uint32_t)Record->Arguments[0]);
+            EmitDuration(Out, Record, 'E', "page fault", Args);
+            break;
+        case TraceEventSyscallEnter:
+            snprintf(Args, sizeof(Args), "\"number\":%llu", (unsigned long long)Record->Arguments[0]);
+            EmitDuration(Out, Record, 'B', "syscall", Args);
+            break;
+        case TraceEventSyscallExit:
+            snprintf(Args, sizeof(Args), "\"number\":%llu,\"return\":\"0x%llx\"",
+                (unsigned long long)Record->Arguments[0], (unsigned long long)Record->Arguments[1]);
+            EmitDuration(Out, Record, 'E', "syscall", Args);
+            break;
+        case TraceEventDpcRetireStart:
+            EmitDuration(Out, Record, 'B', "retire DPCs", NULL);
+            break;
+        case TraceEventDpcRetireEnd:
+            EmitDuration(Out, Record, 'E', "retire DPCs", NULL);
+            break;
+        case TraceEventDpcQueue:
+            snprintf(Args, sizeof(Args), "\"dpc\":\"0x%llx\",\"routine\":\"0x%llx\"",
+                (unsigned long long)Record->Arguments[0], (unsigned long long)Record->Arguments[1]);
+            EmitInstant(Out, Record, "queue DPC", Args);
+            break;
+        case TraceEventWait:
+            snprintf(Args, sizeof(Args), "\"event\":\"0x%llx\"", (unsigned long long)Record->Arguments[0]);
+            EmitInstant(Out, Record, "wait for event", Args);
+            break;
+        case TraceEventSet:
+            snprintf(Args, sizeof(Args), "\"event\":\"0x%llx\"", (unsigned long long)Record->Arguments[0]);
+            EmitInstant(Out, Record, "set event", Args);
+            break;
+        case TraceEventDiskSubmit: {
+            int Write = (Record->Arguments[1] >> 63) != 0;
+            BeginEvent(Out);
+            fprintf(Out, "{\"name\":\"disk %s\",\"cat\":\"disk\",\"ph\":\"b\",\"id\":\"0x%llx\",\"ts\":%.3f,\"pid\":%u,\"tid\":%u,"
+                "\"args\":{\"lba\":%llu,\"bytes\":%llu}}",
+                Write ? "write" : "read", (unsigned long long)Record->Arguments[0], Microseconds(Record->Timestamp), CPU_TRACK_PID, Cpu,
+                (unsigned long long)Record->Arguments[0], (unsigned long long)(Record->Arguments[1] & ~(1ULL << 63)));
+            break;
+        }
+        case TraceEventDiskComplete: {
+            // The async slice is matched by cat/id/name, find the submit's direction.
+            const char* Direction = "read";
+            for (size_t j = i; j-- > 0; ) {
+                if (Records[j].Event == TraceEventDiskSubmit && Records[j].Arguments[0] == Record->Arguments[0]) {
+                    if (Records[j].Arguments[1] >> 63) Direction = "write";
+                    break;
+                }
+            }
+            BeginEvent(Out);
+            fprintf(Out, "{\"name\":\"disk %s\",\"cat\":\"disk\",\"ph\":\"e\",\"id\":\"0x%llx\",\"ts\":%.3f,\"pid\":%u,\"tid\":%u,"
+                "\"args\":{\"tfd\":\"0x%llx\"}}",
+                Direction, (unsigned long long)Record->Arguments[0], Microseconds(Record->Timestamp), CPU_TRACK_PID, Cpu,
+                (unsigned long long)Record->Arguments[1]);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    // Threads still running when the trace stopped.
+    if (Count) {
+        for (uint32_t Cpu = 0; Cpu < MAX_PROCESSORS; Cpu++) {
+            if (Running[Cpu].Valid) EmitSlice(Out, Cpu, &Running[Cpu], Records[Count - 1].Timestamp);
+        }
+    }
+
+    fputs("\n]}\n", Out);
+    if (Out != stdout) fclose(Out);
+
+    fprintf(stderr, "%zu records converted\n", Count);
+    free(Records);
+    return 0;
+}
@@ -111,6 +111,7 @@ typedef int32_t MTSTATUS;
 #define MT_TYPE_MISMATCH		((MTSTATUS)0xC0000012L)
 #define MT_OBJECT_DELETED		((MTSTATUS)0xC0000013L)
 #define MT_INVALID_HANDLE		((MTSTATUS)0xC0000014L)
+#define MT_BUFFER_TOO_SMALL		((MTSTATUS)0xC0000015L)
 
 //
 // ==========================
@@ -237,6 +238,104 @@ typedef enum _USER_ALLOCATION_TYPE {
 	PAGE_READONLY = 0x40 // PRESENT | NX
 } USER_ALLOCATION_TYPE;
 
+// HeapAlloc / HeapReAlloc flags.
+#define HEAP_ZERO_MEMORY 0x00000008
+
+// Lock contention statistics (kernel built with LOCKSTAT=1), returned by MtQueryLockStatistics.
+typedef enum _LOCK_STATISTICS_TYPE {
+    LockStatSpinlock,
+    LockStatQueuedSpinlock,
+    LockStatPushLock,
+    LockStatMutex,
+    LockStatTypeMax
+} LOCK_STATISTICS_TYPE;
+
+typedef struct _LOCK_STATISTICS_ENTRY {
+    uint64_t CallSite;       // Kernel return address of the acquire routine
+    uint32_t Type;           // LOCK_STATISTICS_TYPE
+    uint32_t Reserved;
+    uint64_t Acquires;
+    uint64_t Contended;
+    uint64_t SpinCycles;     // TSC cycles spent waiting (including sleeping, for push locks and mutexes)
+    uint64_t MaxSpinCycles;
+    uint64_t HoldCycles;     // TSC cycles held, attributed to the acquire site
+    uint64_t MaxHoldCycles;
+} LOCK_STATISTICS_ENTRY, *PLOCK_STATISTICS_ENTRY;
+
+typedef struct _LOCK_STATISTICS_INFORMATION {
+    uint32_t NumberOfEntries;   // Entries copied into Entries[]
+    uint32_t TotalEntries;      // Distinct call sites recorded
+    uint64_t DroppedRecords;
+    LOCK_STATISTICS_ENTRY Entries[];
+} LOCK_STATISTICS_INFORMATION, *PLOCK_STATISTICS_INFORMATION;
+
+// Pass as FileOffset to use (and advance) the file pointer instead of an explicit offset.
+#define MT_FILE_USE_FILE_POINTER ((uint64_t)-1)
+
+// Vectored file I/O (ReadFileScatter, WriteFileGather).
+#define MT_MAX_IO_VECTORS 1024
+
+typedef struct _IO_VECTOR {
+    void* Buffer;
+    size_t Length;
+} IO_VECTOR, *PIO_VECTOR;
+
+// I/O ring, submission and completion rings shared with the kernel (MtCreateIoRing, MtSubmitIoRing), must match kernel/includes/mt.h.
+#define IO_RING_MAX_ENTRIES 4096
+
+typedef enum _IO_RING_OPERATION {
+    IoRingOpNop,
+    IoRingOpRead,           // Handle, Offset, Buffer, Length -> Result = bytes read
+    IoRingOpWrite,          // Handle, Offset, Buffer, Length -> Result = bytes written
+    IoRingOpOpen,           // Buffer = path, Offset = ACCESS_MASK -> Result = handle
+    IoRingOpClose,          // Handle
+    IoRingOpAllocate,       // Buffer = base or 0, Length, Offset = USER_ALLOCATION_TYPE -> Result = base
+    IoRingOpMax
+} IO_RING_OPERATION;
+
+typedef struct _IO_RING_SQE {
+    uint32_t Operation;     // IO_RING_OPERATION
+    HANDLE Handle;
+    uint64_t Offset;
+    uint64_t Buffer;
+    uint64_t Length;
+    uint64_t UserData;      // Copied to the completion untouched
+} IO_RING_SQE, *PIO_RING_SQE;
+
+typedef struct _IO_RING_CQE {
+    uint64_t UserData;
+    uint64_t Result;
+    MTSTATUS Status;
+    uint32_t Reserved;
+} IO_RING_CQE, *PIO_RING_CQE;
+
+typedef struct _IO_RING_HEADER {
+    // Written by the kernel.
+    volatile uint32_t SqHead;
+    volatile uint32_t CqTail;
+    uint32_t SqEntries;
+    uint32_t CqEntries;
+    uint32_t SqOffset;
+    uint32_t CqOffset;
+    uint8_t Reserved0[40];
+
+    // Written by user mode.
+    volatile uint32_t SqTail;
+    volatile uint32_t CqHead;
+    uint8_t Reserved1[56];
+} IO_RING_HEADER, *PIO_RING_HEADER;
+
+// Filled by CreateIoRing, pass it to the other IoRing functions.
+typedef struct _IO_RING {
+    PIO_RING_HEADER Header;
+    PIO_RING_SQE Sqes;
+    PIO_RING_CQE Cqes;
+    uint32_t SqMask;
+    uint32_t CqMask;
+    uint32_t SqTail;        // Entries handed out by IoRingGetSqe, published by SubmitIoRing
+    uint32_t Reserved;
+} IO_RING, *PIO_RING;
+
 extern char* (*strchr)(const char* s, int c);
 extern char* (*strncat)(char* dest, const char* src, size_t max_len);
 extern int   (*strncmp)(const char* s1, const char* s2, size_t length);
@@ -273,6 +372,31 @@ extern void* (*VirtualAllocEx)(
     IN USER_ALLOCATION_TYPE AllocationType
     );
 
+// Process heap, blocks up to 32 KiB come from a per thread cache (no system call).
+extern void* (*HeapAlloc)(
+    IN size_t Size,
+    IN uint32_t Flags
+    );
+
+extern bool (*HeapFree)(
+    IN void* Block
+    );
+
+extern size_t (*HeapSize)(
+    IN void* Block
+    );
+
+extern void* (*HeapReAlloc)(
+    _In_Opt void* Block,
+    IN size_t Size,
+    IN uint32_t Flags
+    );
+
+extern void* (*malloc)(size_t Size);
+extern void* (*calloc)(size_t Count, size_t Size);
+extern void* (*realloc)(void* Block, size_t Size);
+extern void (*free)(void* Block);
+
 extern HANDLE(*CreateFile)(
     IN  const char* FileName,
     IN  ACCESS_MASK DesiredAccess
@@ -280,7 +404,7 @@ extern HANDLE(*CreateFile)(
 
 extern bool (*WriteFile)(
     IN HANDLE FileHandle,
-    IN uint32_t FileOffset,
+    IN uint64_t FileOffset,
     IN void* Buffer,
     IN size_t BufferSize,
     _Out_Opt size_t* BytesWritten
@@ -288,8 +412,111 @@ extern bool (*WriteFile)(
 
 extern bool (*ReadFile)(
     IN HANDLE FileHandle,
-    IN uint32_t FileOffset,
+    IN uint64_t FileOffset,
     OUT void* Buffer,
     IN size_t BufferSize,
     _Out_Opt size_t* BytesRead
+    );
+
+extern bool (*ReadFileScatter)(
+    IN HANDLE FileHandle,
+    IN uint64_t FileOffset,
+    IN const IO_VECTOR* Vectors,
+    IN uint32_t VectorCount,
+    _Out_Opt size_t* BytesRead
+    );
+
+extern bool (*WriteFileGather)(
+    IN HANDLE FileHandle,
+    IN uint64_t FileOffset,
+    IN const IO_VECTOR* Vectors,
+    IN uint32_t VectorCount,
+    _Out_Opt size_t* BytesWritten
+    );
+
+extern bool (*QueryLockStatistics)(
+    OUT void* Buffer,
+    IN size_t BufferSize,
+    _Out_Opt size_t* ReturnLength
+    );
+
+extern bool (*DumpLockStatistics)(
+    IN HANDLE FileHandle
+    );
+
+extern bool (*StartTrace)(
+    void
+    );
+
+extern bool (*StopTrace)(
+    void
+    );
+
+extern bool (*DumpTrace)(
+    IN const char* Path
+    );
+
+extern bool (*StartProfile)(
+    IN uint32_t Source,
+    IN uint64_t Interval
+    );
+
+extern bool (*StopProfile)(
+    void
+    );
+
+extern bool (*DumpProfile)(
+    IN const char* Path
+    );
+
+extern bool (*QueryProfile)(
+    OUT void* Buffer,
+    IN size_t BufferSize,
+    _Out_Opt size_t* ReturnLength
+    );
+
+extern bool (*QuerySystemInformation)(
+    IN uint32_t InformationClass,
+    OUT void* Buffer,
+    IN size_t BufferSize,
+    _Out_Opt size_t* ReturnLength
+    );
+
+// Time, read from the shared user data page (no system call).
+// In milliseconds since boot, advances with the clock interrupt.
+extern uint64_t (*GetTickCount)(
+    void
+    );
+
+extern bool (*QueryPerformanceCounter)(
+    OUT uint64_t* Counter
+    );
+
+extern bool (*QueryPerformanceFrequency)(
+    OUT uint64_t* Frequency
+    );
+
+// In 100ns units since 1970-01-01 (UTC).
+extern bool (*GetSystemTime)(
+    OUT uint64_t* SystemTime
+    );
+
+// I/O rings, batched file and memory operations (one kernel entry per SubmitIoRing).
+extern bool (*CreateIoRing)(
+    IN uint32_t Entries,
+    OUT PIO_RING Ring
+    );
+
+extern PIO_RING_SQE (*IoRingGetSqe)(
+    IN PIO_RING Ring
+    );
+
+extern bool (*SubmitIoRing)(
+    IN PIO_RING Ring,
+    _Out_Opt uint32_t* Submitted
+    );
+
+extern bool (*IoRingGetCompletion)(
+    IN PIO_RING Ring,
+    OUT PIO_RING_CQE Completion
     );
\ No newline at end of file
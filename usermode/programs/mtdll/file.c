@@ -40,7 +40,7 @@ CreateFile(
 bool
 WriteFile(
     IN HANDLE FileHandle,
-    IN uint32_t FileOffset,
+    IN uint64_t FileOffset,
     IN void* Buffer,
     IN size_t BufferSize,
     _Out_Opt size_t* BytesWritten
@@ -57,7 +57,7 @@ WriteFile(
 bool
 ReadFile(
     IN HANDLE FileHandle,
-    IN uint32_t FileOffset,
+    IN uint64_t FileOffset,
     OUT void* Buffer,
     IN size_t BufferSize,
     _Out_Opt size_t* BytesRead
@@ -67,5 +67,38 @@ ReadFile(
     // Call kernel, retrieve status.
     MTSTATUS Status = MtReadFile(FileHandle, FileOffset, Buffer, BufferSize, BytesRead);
 
+    return MT_SUCCEEDED(Status);
+}
+
+
+bool
+ReadFileScatter(
+    IN HANDLE FileHandle,
+    IN uint64_t FileOffset,
+    IN const IO_VECTOR* Vectors,
+    IN uint32_t VectorCount,
+    _Out_Opt size_t* BytesRead
+)
+
+{
+    // Call kernel, one system call for every buffer.
+    MTSTATUS Status = MtReadFileScatter(FileHandle, FileOffset, Vectors, VectorCount, BytesRead);
+
+    return MT_SUCCEEDED(Status);
+}
+
+bool
+WriteFileGather(
+    IN HANDLE FileHandle,
+    IN uint64_t FileOffset,
+    IN const IO_VECTOR* Vectors,
+    IN uint32_t VectorCount,
+    _Out_Opt size_t* BytesWritten
+)
+
+{
+    // Call kernel, one system call for every buffer.
+    MTSTATUS Status = MtWriteFileGather(FileHandle, FileOffset, Vectors, VectorCount, BytesWritten);
+
     return MT_SUCCEEDED(Status);
 }
\ No newline at end of file
@@ -0,0 +1,865 @@
+/*++
+
+Module Name:
+
+    heap.c
+
+Purpose:
+
+    This translation unit contains the process heap (HeapAlloc, HeapFree, HeapReAlloc and the malloc family).
+
+    Usage:
+        char* Buffer = HeapAlloc(128, HEAP_ZERO_MEMORY);
+        Buffer = HeapReAlloc(Buffer, 256, 0);
+        HeapFree(Buffer);
+
+Author:
+
+    slep (Matanel) 2025.
+
+Revision History:
+
+--*/
+
+#include "includes/mtdll.h"
+#include "includes/exports.h"
+
+//
+// Small blocks (up to HEAP_SMALL_MAX) come in HEAP_CLASS_COUNT size classes, every 16 bytes up to 128, then 4 classes
+// per power of 2. A segment (HEAP_SEGMENT_SIZE, aligned to its size) holds blocks of a single class, so a block finds
+// its class through the header at the start of its segment. Segments are reserved HEAP_SEGMENT_RESERVE at a time,
+// their pages are demand zero, a segment only costs memory for the blocks that were actually carved out of it.
+//
+// Every thread keeps a cache of free blocks per class off its TEB (TEB.HeapCache), allocating and freeing is a pop
+// or a push on it. An empty bin takes a batch of blocks from the central list of the class, a bin that grew past
+// twice the batch gives a batch back, so blocks freed by one thread end up serving the others. The central list keeps
+// full batches linked by their first block, a transfer in either direction is a single link under the class lock.
+//
+// Large blocks get segments of their own (a run of them above HEAP_SEGMENT_SIZE) through VirtualAlloc. mtdll has no
+// call that releases virtual memory, so freed segments are kept and reused (by both small classes and large blocks).
+//
+
+#define HEAP_SEGMENT_SHIFT      20
+#define HEAP_SEGMENT_SIZE       (1ULL << HEAP_SEGMENT_SHIFT)
+#define HEAP_SEGMENT_RESERVE    16                      // Segments per VirtualAlloc
+#define HEAP_SEGMENT_MAGIC      0x5041454845534D54ULL   // 'TMSEHEAP'
+#define HEAP_SMALL_MAX          (32 * 1024)
+#define HEAP_CLASS_COUNT        40
+#define HEAP_MAX_BATCH          32
+#define HEAP_MIN_BATCH          4
+#define HEAP_LARGE_MAX          (1ULL << 47)
+
+typedef enum _HEAP_SEGMENT_KIND {
+    HeapSegmentSmall = 1,
+    HeapSegmentLarge,
+} HEAP_SEGMENT_KIND;
+
+typedef struct _HEAP_SEGMENT {
+    uint64_t Magic;
+    uint32_t Kind;                  // HEAP_SEGMENT_KIND
+    uint32_t Class;                 // Small, size class of every block in the segment
+    size_t Capacity;                // Large, usable bytes after the header
+    size_t Segments;                // Number of HEAP_SEGMENT_SIZE segments covered
+    struct _HEAP_SEGMENT* Next;     // Free segment and free large block lists
+    uint8_t Reserved[24];
+} HEAP_SEGMENT, *PHEAP_SEGMENT;
+
+// Blocks start right after the header, it keeps them 16 byte aligned.
+_Static_assert(sizeof(HEAP_SEGMENT) == 64, "The segment header is a cache line.");
+
+typedef struct _HEAP_FREE_BLOCK {
+    struct _HEAP_FREE_BLOCK* Next;          // Next block of the bin or batch
+    struct _HEAP_FREE_BLOCK* NextBatch;     // Central batch list, only in the first block of a batch
+} HEAP_FREE_BLOCK, *PHEAP_FREE_BLOCK;
+
+typedef struct _HEAP_CENTRAL_CLASS {
+    volatile uint32_t Lock;
+    uint32_t LooseCount;
+    PHEAP_FREE_BLOCK Batches;       // Full batches (HeappBatchSize blocks each)
+    PHEAP_FREE_BLOCK Loose;         // Leftovers of partial transfers
+    uint8_t* Carve;                 // Uncarved part of the class's current segment
+    uint8_t* CarveEnd;
+} __attribute__((aligned(64))) HEAP_CENTRAL_CLASS, *PHEAP_CENTRAL_CLASS;
+
+typedef struct _HEAP_CACHE_BIN {
+    PHEAP_FREE_BLOCK Head;
+    uint32_t Count;
+    uint32_t Reserved;
+} HEAP_CACHE_BIN, *PHEAP_CACHE_BIN;
+
+typedef struct _HEAP_THREAD_CACHE {
+    HEAP_CACHE_BIN Bins[HEAP_CLASS_COUNT];
+} HEAP_THREAD_CACHE, *PHEAP_THREAD_CACHE;
+
+static HEAP_CENTRAL_CLASS HeapCentral[HEAP_CLASS_COUNT];
+
+// Reserved and freed segments, and freed large blocks above a segment.
+static volatile uint32_t HeapSegmentLock;
+static PHEAP_SEGMENT HeapFreeSegments;
+static uint8_t* HeapReserve;
+static uint8_t* HeapReserveEnd;
+static PHEAP_SEGMENT HeapFreeLarge;
+
+static
+inline
+void
+HeappAcquireLock(
+    IN volatile uint32_t* Lock
+)
+
+{
+    while (__atomic_exchange_n(Lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(Lock, __ATOMIC_RELAXED)) {
+            __asm__ volatile("pause");
+        }
+    }
+}
+
+static
+inline
+void
+HeappReleaseLock(
+    IN volatile uint32_t* Lock
+)
+
+{
+    __atomic_store_n(Lock, 0, __ATOMIC_RELEASE);
+}
+
+static
+void
+HeappZero(
+    IN void* Destination,
+    IN size_t Length
+)
+
+{
+    uint64_t* Qwords = (uint64_t*)Destination;
+    for (size_t i = 0; i < Length / 8; i++) Qwords[i] = 0;
+
+    uint8_t* Bytes = (uint8_t*)Destination;
+    for (size_t i = Length & ~7ULL; i < Length; i++) Bytes[i] = 0;
+}
+
+static
+void
+HeappCopy(
+    IN void* Destination,
+    IN const void* Source,
+    IN size_t Length
+)
+
+{
+    uint8_t* Dst = (uint8_t*)Destination;
+    const uint8_t* Src = (const uint8_t*)Source;
+
+    // Blocks are 16 byte aligned, copy by qwords.
+    for (size_t i = 0; i < Length / 8; i++) ((uint64_t*)Dst)[i] = ((const uint64_t*)Src)[i];
+    for (size_t i = Length & ~7ULL; i < Length; i++) Dst[i] = Src[i];
+}
+
+static
+inline
+uint32_t
+HeappSizeToClass(
+    IN size_t Size
+)
+
+// Size must be at most HEAP_SMALL_MAX.
+{
+    if (Size <= 128) return Size ? (uint32_t)((Size + 15) / 16 - 1) : 0;
+
+    size_t Last = Size - 1;
+    uint32_t Shift = 63 - (uint32_t)__builtin_clzll(Last);
+
+    return 8 + (Shift - 7) * 4 + (uint32_t)((Last >> (Shift - 2)) & 3);
+}
+
+static
+inline
+size_t
+HeappClassSize(
+    IN uint32_t Class
+)
+
+{
+    if (Class < 8) return (size_t)(Class + 1) * 16;
+
+    size_t Base = 128ULL << ((Class - 8) / 4);
+    return Base + ((Class - 8) % 4 + 1) * (Base / 4);
+}
+
+static
+inline
+uint32_t
+HeappBatchSize(
+    IN uint32_t Class
+)
+
+{
+    size_t Batch = 16384 / HeappClassSize(Class);
+
+    if (Batch > HEAP_MAX_BATCH) return HEAP_MAX_BATCH;
+    if (Batch < HEAP_MIN_BATCH) return HEAP_MIN_BATCH;
+    return (uint32_t)Batch;
+}
+
+static
+inline
+PHEAP_SEGMENT
+HeappBlockToSegment(
+    IN void* Block
+)
+
+{
+    PHEAP_SEGMENT Segment = (PHEAP_SEGMENT)((uintptr_t)Block & ~(HEAP_SEGMENT_SIZE - 1));
+
+    if ((uintptr_t)Block & 15) return NULL;
+    if (Segment->Magic != HEAP_SEGMENT_MAGIC) return NULL;
+    return Segment;
+}
+
+static
+PHEAP_SEGMENT
+HeappAllocateSegments(
+    IN size_t Count
+)
+
+/*++
+
+    Routine description:
+
+        Allocates a run of segments.
+
+    Arguments:
+
+        [IN]    size_t Count - Number of consecutive HEAP_SEGMENT_SIZE segments.
+
+    Return Values:
+
+        The first segment (aligned to HEAP_SEGMENT_SIZE, header not initialized), NULL on failure.
+
+    Notes:
+
+        Single segments come from the free segments or the current reservation, runs are reserved on their own.
+
+--*/
+
+{
+    uint8_t* Base;
+
+    if (Count > 1) {
+        // The extra segment covers the alignment.
+        Base = (uint8_t*)VirtualAlloc(NULL, (Count + 1) * HEAP_SEGMENT_SIZE, PAGE_READWRITE);
+        if (!Base) return NULL;
+
+        return (PHEAP_SEGMENT)(((uintptr_t)Base + HEAP_SEGMENT_SIZE - 1) & ~(HEAP_SEGMENT_SIZE - 1));
+    }
+
+    HeappAcquireLock(&HeapSegmentLock);
+
+    PHEAP_SEGMENT Segment = HeapFreeSegments;
+    if (Segment) {
+        HeapFreeSegments = Segment->Next;
+        HeappReleaseLock(&HeapSegmentLock);
+        return Segment;
+    }
+
+    if (HeapReserve == HeapReserveEnd) {
+        Base = (uint8_t*)VirtualAlloc(NULL, (HEAP_SEGMENT_RESERVE + 1) * HEAP_SEGMENT_SIZE, PAGE_READWRITE);
+        if (!Base) {
+            HeappReleaseLock(&HeapSegmentLock);
+            return NULL;
+        }
+
+        HeapReserve = (uint8_t*)(((uintptr_t)Base + HEAP_SEGMENT_SIZE - 1) & ~(HEAP_SEGMENT_SIZE - 1));
+        HeapReserveEnd = HeapReserve + HEAP_SEGMENT_RESERVE * HEAP_SEGMENT_SIZE;
+    }
+
+    Segment = (PHEAP_SEGMENT)HeapReserve;
+    HeapReserve += HEAP_SEGMENT_SIZE;
+
+    HeappReleaseLock(&HeapSegmentLock);
+    return Segment;
+}
+
+static
+uint32_t
+HeappCarve(
+    IN PHEAP_CENTRAL_CLASS Central,
+    IN uint32_t Class,
+    IN uint32_t Count,
+    OUT PHEAP_FREE_BLOCK* Chain
+)
+
+// Class lock held, carves up to Count blocks and links them into a chain.
+{
+    size_t Size = HeappClassSize(Class);
+
+    if (Central->Carve + Size > Central->CarveEnd) {
+        PHEAP_SEGMENT Segment = HeappAllocateSegments(1);
+        if (!Segment) return 0;
+
+        Segment->Kind = HeapSegmentSmall;
+        Segment->Class = Class;
+        Segment->Capacity = 0;
+        Segment->Segments = 1;
+        Segment->Next = NULL;
+        Segment->Magic = HEAP_SEGMENT_MAGIC;
+
+        Central->Carve = (uint8_t*)(Segment + 1);
+        Central->CarveEnd = (uint8_t*)Segment + HEAP_SEGMENT_SIZE;
+    }
+
+    PHEAP_FREE_BLOCK Head = NULL;
+    uint32_t Carved = 0;
+
+    while (Carved < Count && Central->Carve + Size <= Central->CarveEnd) {
+        PHEAP_FREE_BLOCK Block = (PHEAP_FREE_BLOCK)Central->Carve;
+        Central->Carve += Size;
+
+        Block->Next = Head;
+        Head = Block;
+        Carved++;
+    }
+
+    *Chain = Head;
+    return Carved;
+}
+
+static
+uint32_t
+HeappTakeCentral(
+    IN uint32_t Class,
+    IN uint32_t Count,
+    OUT PHEAP_FREE_BLOCK* Chain
+)
+
+/*++
+
+    Routine description:
+
+        Takes free blocks of a class from the central list.
+
+    Arguments:
+
+        [IN]    uint32_t Class - The size class.
+        [IN]    uint32_t Count - Maximum number of blocks (at most the batch size of the class).
+        [OUT]   PHEAP_FREE_BLOCK* Chain - Receives the blocks, linked through Next.
+
+    Return Values:
+
+        Number of blocks taken, 0 if the heap is out of memory.
+
+--*/
+
+{
+    PHEAP_CENTRAL_CLASS Central = &HeapCentral[Class];
+    uint32_t Batch = HeappBatchSize(Class);
+    uint32_t Taken = 0;
+    PHEAP_FREE_BLOCK Head = NULL;
+
+    HeappAcquireLock(&Central->Lock);
+
+    if (Central->Batches && Count >= Batch) {
+        // Whole batch, a single unlink.
+        Head = Central->Batches;
+        Central->Batches = Head->NextBatch;
+        Taken = Batch;
+    }
+    else if (Central->Loose || Central->Batches) {
+        if (!Central->Loose) {
+            // Break a batch up, the leftovers become loose.
+            Central->Loose = Central->Batches;
+            Central->Batches = Central->Loose->NextBatch;
+            Central->LooseCount = Batch;
+        }
+
+        while (Taken < Count && Central->Loose) {
+            PHEAP_FREE_BLOCK Block = Central->Loose;
+            Central->Loose = Block->Next;
+            Central->LooseCount--;
+
+            Block->Next = Head;
+            Head = Block;
+            Taken++;
+        }
+    }
+    else {
+        Taken = HeappCarve(Central, Class, Count, &Head);
+    }
+
+    HeappReleaseLock(&Central->Lock);
+
+    *Chain = Head;
+    return Taken;
+}
+
+static
+void
+HeappGiveCentral(
+    IN uint32_t Class,
+    IN PHEAP_FREE_BLOCK Head,
+    IN PHEAP_FREE_BLOCK Tail,
+    IN uint32_t Count
+)
+
+/*++
+
+    Routine description:
+
+        Returns free blocks of a class to the central list.
+
+    Arguments:
+
+        [IN]    uint32_t Class - The size class.
+        [IN]    PHEAP_FREE_BLOCK Head - First block of the chain.
+        [IN]    PHEAP_FREE_BLOCK Tail - Last block of the chain.
+        [IN]    uint32_t Count - Number of blocks in the chain.
+
+    Return Values:
+
+        None.
+
+--*/
+
+{
+    PHEAP_CENTRAL_CLASS Central = &HeapCentral[Class];
+
+    HeappAcquireLock(&Central->Lock);
+
+    if (Count == HeappBatchSize(Class)) {
+        Tail->Next = NULL;
+        Head->NextBatch = Central->Batches;
+        Central->Batches = Head;
+    }
+    else {
+        Tail->Next = Central->Loose;
+        Central->Loose = Head;
+        Central->LooseCount += Count;
+    }
+
+    HeappReleaseLock(&Central->Lock);
+}
+
+static
+PHEAP_THREAD_CACHE
+HeappGetThreadCache(
+    void
+)
+
+// The current thread's cache, created on first use, NULL if it couldn't be (the central lists are used directly).
+{
+    PTEB Teb = MtCurrentTeb();
+    if (!Teb) return NULL;
+
+    PHEAP_THREAD_CACHE Cache = (PHEAP_THREAD_CACHE)Teb->HeapCache;
+    if (Cache) return Cache;
+
+    PHEAP_FREE_BLOCK Block;
+    if (!HeappTakeCentral(HeappSizeToClass(sizeof(HEAP_THREAD_CACHE)), 1, &Block)) return NULL;
+
+    Cache = (PHEAP_THREAD_CACHE)Block;
+    HeappZero(Cache, sizeof(HEAP_THREAD_CACHE));
+    Teb->HeapCache = Cache;
+    return Cache;
+}
+
+static
+void*
+HeappAllocateSmall(
+    IN uint32_t Class
+)
+
+{
+    PHEAP_THREAD_CACHE Cache = HeappGetThreadCache();
+    PHEAP_FREE_BLOCK Block;
+
+    if (!Cache) {
+        return HeappTakeCentral(Class, 1, &Block) ? Block : NULL;
+    }
+
+    PHEAP_CACHE_BIN Bin = &Cache->Bins[Class];
+
+    Block = Bin->Head;
+    if (Block) {
+        Bin->Head = Block->Next;
+        Bin->Count--;
+        return Block;
+    }
+
+    // Empty bin, refill it with a batch (the first block is ours).
+    uint32_t Taken = HeappTakeCentral(Class, HeappBatchSize(Class), &Block);
+    if (!Taken) return NULL;
+
+    Bin->Head = Block->Next;
+    Bin->Count = Taken - 1;
+    return Block;
+}
+
+static
+void
+HeappFreeSmall(
+    IN uint32_t Class,
+    IN void* Block
+)
+
+{
+    PHEAP_THREAD_CACHE Cache = HeappGetThreadCache();
+    PHEAP_FREE_BLOCK Free = (PHEAP_FREE_BLOCK)Block;
+
+    if (!Cache) {
+        HeappGiveCentral(Class, Free, Free, 1);
+        return;
+    }
+
+    PHEAP_CACHE_BIN Bin = &Cache->Bins[Class];
+    uint32_t Batch = HeappBatchSize(Class);
+
+    Free->Next = Bin->Head;
+    Bin->Head = Free;
+    Bin->Count++;
+
+    if (Bin->Count < 2 * Batch) return;
+
+    // Give the most recently freed batch back, the older (colder) half stays.
+    PHEAP_FREE_BLOCK Tail = Bin->Head;
+    for (uint32_t i = 1; i < Batch; i++) Tail = Tail->Next;
+
+    PHEAP_FREE_BLOCK Head = Bin->Head;
+    Bin->Head = Tail->Next;
+    Bin->Count -= Batch;
+
+    HeappGiveCentral(Class, Head, Tail, Batch);
+}
+
+static
+void*
+HeappAllocateLarge(
+    IN size_t Size
+)
+
+{
+    size_t Segments = (Size + sizeof(HEAP_SEGMENT) + HEAP_SEGMENT_SIZE - 1) >> HEAP_SEGMENT_SHIFT;
+    PHEAP_SEGMENT Segment = NULL;
+
+    if (Segments > 1) {
+        // Best fit among the freed large blocks.
+        HeappAcquireLock(&HeapSegmentLock);
+
+        PHEAP_SEGMENT* Best = NULL;
+        for (PHEAP_SEGMENT* Link = &HeapFreeLarge; *Link; Link = &(*Link)->Next) {
+            if ((*Link)->Segments < Segments) continue;
+            if (!Best || (*Link)->Segments < (*Best)->Segments) Best = Link;
+            if ((*Link)->Segments == Segments) break;
+        }
+
+        if (Best) {
+            Segment = *Best;
+            *Best = Segment->Next;
+            Segments = Segment->Segments;
+        }
+
+        HeappReleaseLock(&HeapSegmentLock);
+    }
+
+    if (!Segment) {
+        Segment = HeappAllocateSegments(Segments);
+        if (!Segment) return NULL;
+    }
+
+    Segment->Kind = HeapSegmentLarge;
+    Segment->Class = 0;
+    Segment->Capacity = (Segments << HEAP_SEGMENT_SHIFT) - sizeof(HEAP_SEGMENT);
+    Segment->Segments = Segments;
+    Segment->Next = NULL;
+    Segment->Magic = HEAP_SEGMENT_MAGIC;
+
+    return Segment + 1;
+}
+
+static
+void
+HeappFreeLarge(
+    IN PHEAP_SEGMENT Segment
+)
+
+{
+    HeappAcquireLock(&HeapSegmentLock);
+
+    if (Segment->Segments == 1) {
+        // A plain segment again, small classes may carve it.
+        Segment->Magic = 0;
+        Segment->Next = HeapFreeSegments;
+        HeapFreeSegments = Segment;
+    }
+    else {
+        Segment->Next = HeapFreeLarge;
+        HeapFreeLarge = Segment;
+    }
+
+    HeappReleaseLock(&HeapSegmentLock);
+}
+
+static
+size_t
+HeappUsableSize(
+    IN PHEAP_SEGMENT Segment
+)
+
+{
+    return (Segment->Kind == HeapSegmentSmall) ? HeappClassSize(Segment->Class) : Segment->Capacity;
+}
+
+void*
+HeapAlloc(
+    IN size_t Size,
+    IN uint32_t Flags
+)
+
+/*++
+
+    Routine description:
+
+        Allocates a block from the process heap.
+
+    Arguments:
+
+        [IN]    size_t Size - Number of bytes, 0 allocates the smallest block.
+        [IN]    uint32_t Flags - HEAP_ZERO_MEMORY to zero the first Size bytes of the block.
+
+    Return Values:
+
+        The block (16 byte aligned), NULL on failure.
+
+    Notes:
+
+        Blocks up to 32 KiB come from the calling thread's cache, larger ones from their own segments.
+
+--*/
+
+{
+    void* Block;
+
+    if (Size <= HEAP_SMALL_MAX) {
+        Block = HeappAllocateSmall(HeappSizeToClass(Size));
+    }
+    else {
+        // More than the user address space (and the rounding can't overflow).
+        if (Size > HEAP_LARGE_MAX) return NULL;
+        Block = HeappAllocateLarge(Size);
+    }
+
+    // Blocks are reused, they are only zero the first time.
+    // Only what was asked for, the rest of a large block's segments stays untouched (demand zero pages aren't faulted in).
+    if (Block && (Flags & HEAP_ZERO_MEMORY)) HeappZero(Block, Size);
+
+    return Block;
+}
+
+bool
+HeapFree(
+    IN void* Block
+)
+
+/*++
+
+    Routine description:
+
+        Frees a block of the process heap.
+
+    Arguments:
+
+        [IN]    void* Block - The block, NULL is ignored.
+
+    Return Values:
+
+        True on success, false if the block wasn't allocated by the heap.
+
+--*/
+
+{
+    if (!Block) return true;
+
+    PHEAP_SEGMENT Segment = HeappBlockToSegment(Block);
+    if (!Segment) return false;
+
+    if (Segment->Kind == HeapSegmentSmall) {
+        HeappFreeSmall(Segment->Class, Block);
+    }
+    else {
+        if (Block != (void*)(Segment + 1)) return false;
+        HeappFreeLarge(Segment);
+    }
+
+    return true;
+}
+
+size_t
+HeapSize(
+    IN void* Block
+)
+
+/*++
+
+    Routine description:
+
+        Retrieves the usable size of a block of the process heap.
+
+    Arguments:
+
+        [IN]    void* Block - The block.
+
+    Return Values:
+
+        The number of bytes that may be used (at least the size it was allocated with), 0 if the block isn't valid.
+
+--*/
+
+{
+    if (!Block) return 0;
+
+    PHEAP_SEGMENT Segment = HeappBlockToSegment(Block);
+    if (!Segment) return 0;
+
+    return HeappUsableSize(Segment);
+}
+
+void*
+HeapReAlloc(
+    _In_Opt void* Block,
+    IN size_t Size,
+    IN uint32_t Flags
+)
+
+/*++
+
+    Routine description:
+
+        Resizes a block of the process heap.
+
+    Arguments:
+
+        [IN OPTIONAL]   void* Block - The block, NULL allocates a new one.
+        [IN]    size_t Size - The new size in bytes.
+        [IN]    uint32_t Flags - HEAP_ZERO_MEMORY to zero the bytes from the block's old usable size up to Size.
+
+    Return Values:
+
+        The resized block (it may have moved, the old one is then freed), NULL on failure (the old block is untouched).
+
+--*/
+
+{
+    if (!Block) return HeapAlloc(Size, Flags);
+
+    PHEAP_SEGMENT Segment = HeappBlockToSegment(Block);
+    if (!Segment) return NULL;
+
+    size_t Usable = HeappUsableSize(Segment);
+
+    // Same class, or a large block that still fits (and isn't small now).
+    if (Segment->Kind == HeapSegmentSmall && Size <= HEAP_SMALL_MAX && HeappSizeToClass(Size) == Segment->Class) return Block;
+    if (Segment->Kind == HeapSegmentLarge && Size <= Usable && Size > HEAP_SMALL_MAX) return Block;
+
+    void* NewBlock = HeapAlloc(Size, 0);
+    if (!NewBlock) return NULL;
+
+    size_t NewUsable = HeappUsableSize(HeappBlockToSegment(NewBlock));
+
+    HeappCopy(NewBlock, Block, (Usable < NewUsable) ? Usable : NewUsable);
+    if ((Flags & HEAP_ZERO_MEMORY) && Size > Usable) {
+        HeappZero((uint8_t*)NewBlock + Usable, Size - Usable);
+    }
+
+    HeapFree(Block);
+    return NewBlock;
+}
+
+void
+HeapReleaseThreadCache(
+    void
+)
+
+/*++
+
+    Routine description:
+
+        Returns the current thread's cached blocks to the central lists and frees its cache.
+
+    Arguments:
+
+        None.
+
+    Return Values:
+
+        None.
+
+    Notes:
+
+        Called when the thread terminates itself, the next allocation of the thread creates a new cache.
+
+--*/
+
+{
+    PTEB Teb = MtCurrentTeb();
+    if (!Teb || !Teb->HeapCache) return;
+
+    PHEAP_THREAD_CACHE Cache = (PHEAP_THREAD_CACHE)Teb->HeapCache;
+    Teb->HeapCache = NULL;
+
+    for (uint32_t Class = 0; Class < HEAP_CLASS_COUNT; Class++) {
+        PHEAP_CACHE_BIN Bin = &Cache->Bins[Class];
+        if (!Bin->Count) continue;
+
+        PHEAP_FREE_BLOCK Tail = Bin->Head;
+        while (Tail->Next) Tail = Tail->Next;
+
+        HeappGiveCentral(Class, Bin->Head, Tail, Bin->Count);
+    }
+
+    // The cache is a heap block itself, HeapFree would create a new cache for it.
+    PHEAP_FREE_BLOCK Block = (PHEAP_FREE_BLOCK)Cache;
+    HeappGiveCentral(HeappSizeToClass(sizeof(HEAP_THREAD_CACHE)), Block, Block, 1);
+}
+
+void*
+malloc(
+    IN size_t Size
+)
+
+{
+    return HeapAlloc(Size, 0);
+}
+
+void*
+calloc(
+    IN size_t Count,
+    IN size_t Size
+)
+
+{
+    size_t Total;
+    if (__builtin_mul_overflow(Count, Size, &Total)) return NULL;
+
+    return HeapAlloc(Total, HEAP_ZERO_MEMORY);
+}
+
+void*
+realloc(
+    _In_Opt void* Block,
+    IN size_t Size
+)
+
+{
+    return HeapReAlloc(Block, Size, 0);
+}
+
+void
+free(
+    _In_Opt void* Block
+)
+
+{
+    HeapFree(Block);
+}
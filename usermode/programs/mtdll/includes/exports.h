@@ -69,6 +69,58 @@ void* VirtualAllocEx(
 	IN USER_ALLOCATION_TYPE AllocationType
 );
 
+// module: heap.c
+
+void*
+HeapAlloc(
+	IN size_t Size,
+	IN uint32_t Flags
+);
+
+bool
+HeapFree(
+	IN void* Block
+);
+
+size_t
+HeapSize(
+	IN void* Block
+);
+
+void*
+HeapReAlloc(
+	_In_Opt void* Block,
+	IN size_t Size,
+	IN uint32_t Flags
+);
+
+void
+HeapReleaseThreadCache(
+	void
+);
+
+void*
+malloc(
+	IN size_t Size
+);
+
+void*
+calloc(
+	IN size_t Count,
+	IN size_t Size
+);
+
+void*
+realloc(
+	_In_Opt void* Block,
+	IN size_t Size
+);
+
+void
+free(
+	_In_Opt void* Block
+);
+
 // module: file.c
 
 HANDLE
@@ -80,7 +132,7 @@ CreateFile(
 bool
 WriteFile(
 	IN HANDLE FileHandle,
-	IN uint32_t FileOffset,
+	IN uint64_t FileOffset,
 	IN void* Buffer,
 	IN size_t BufferSize,
 	_Out_Opt size_t* BytesWritten
@@ -89,12 +141,145 @@ WriteFile(
 bool
 ReadFile(
 	IN HANDLE FileHandle,
-	IN uint32_t FileOffset,
+	IN uint64_t FileOffset,
 	OUT void* Buffer,
 	IN size_t BufferSize,
 	_Out_Opt size_t* BytesRead
 );
 
+bool
+ReadFileScatter(
+	IN HANDLE FileHandle,
+	IN uint64_t FileOffset,
+	IN const IO_VECTOR* Vectors,
+	IN uint32_t VectorCount,
+	_Out_Opt size_t* BytesRead
+);
+
+bool
+WriteFileGather(
+	IN HANDLE FileHandle,
+	IN uint64_t FileOffset,
+	IN const IO_VECTOR* Vectors,
+	IN uint32_t VectorCount,
+	_Out_Opt size_t* BytesWritten
+);
+
+// module: lockstat.c
+
+bool
+QueryLockStatistics(
+	OUT void* Buffer,
+	IN size_t BufferSize,
+	_Out_Opt size_t* ReturnLength
+);
+
+bool
+DumpLockStatistics(
+	IN HANDLE FileHandle
+);
+
+// module: trace.c
+
+bool
+StartTrace(
+	void
+);
+
+bool
+StopTrace(
+	void
+);
+
+bool
+DumpTrace(
+	IN const char* Path
+);
+
+// module: profile.c
+
+bool
+StartProfile(
+	IN uint32_t Source,
+	IN uint64_t Interval
+);
+
+bool
+StopProfile(
+	void
+);
+
+bool
+DumpProfile(
+	IN const char* Path
+);
+
+bool
+QueryProfile(
+	OUT void* Buffer,
+	IN size_t BufferSize,
+	_Out_Opt size_t* ReturnLength
+);
+
+// module: sysinfo.c
+
+bool
+QuerySystemInformation(
+	IN uint32_t InformationClass,
+	OUT void* Buffer,
+	IN size_t BufferSize,
+	_Out_Opt size_t* ReturnLength
+);
+
+
+// module: time.c
+
+uint64_t
+GetTickCount(
+	void
+);
+
+bool
+QueryPerformanceCounter(
+	OUT uint64_t* Counter
+);
+
+bool
+QueryPerformanceFrequency(
+	OUT uint64_t* Frequency
+);
+
+bool
+GetSystemTime(
+	OUT uint64_t* SystemTime
+);
+
+
+// module: ioring.c
+
+bool
+CreateIoRing(
+	IN uint32_t Entries,
+	OUT PIO_RING Ring
+);
+
+PIO_RING_SQE
+IoRingGetSqe(
+	IN PIO_RING Ring
+);
+
+bool
+SubmitIoRing(
+	IN PIO_RING Ring,
+	_Out_Opt uint32_t* Submitted
+);
+
+bool
+IoRingGetCompletion(
+	IN PIO_RING Ring,
+	OUT PIO_RING_CQE Completion
+);
+
 
 // module: procldr.c
 
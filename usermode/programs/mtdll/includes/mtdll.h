@@ -145,6 +145,306 @@ typedef enum _USER_ALLOCATION_TYPE {
     PAGE_READONLY = 0x40 // PRESENT | NX
 } USER_ALLOCATION_TYPE;
 
+// Lock contention statistics (kernel built with LOCKSTAT=1), returned by MtQueryLockStatistics.
+typedef enum _LOCK_STATISTICS_TYPE {
+    LockStatSpinlock,
+    LockStatQueuedSpinlock,
+    LockStatPushLock,
+    LockStatMutex,
+    LockStatTypeMax
+} LOCK_STATISTICS_TYPE;
+
+typedef struct _LOCK_STATISTICS_ENTRY {
+    uint64_t CallSite;       // Kernel return address of the acquire routine
+    uint32_t Type;           // LOCK_STATISTICS_TYPE
+    uint32_t Reserved;
+    uint64_t Acquires;
+    uint64_t Contended;
+    uint64_t SpinCycles;     // TSC cycles spent waiting (including sleeping, for push locks and mutexes)
+    uint64_t MaxSpinCycles;
+    uint64_t HoldCycles;     // TSC cycles held, attributed to the acquire site
+    uint64_t MaxHoldCycles;
+} LOCK_STATISTICS_ENTRY, *PLOCK_STATISTICS_ENTRY;
+
+typedef struct _LOCK_STATISTICS_INFORMATION {
+    uint32_t NumberOfEntries;   // Entries copied into Entries[]
+    uint32_t TotalEntries;      // Distinct call sites recorded
+    uint64_t DroppedRecords;
+    LOCK_STATISTICS_ENTRY Entries[];
+} LOCK_STATISTICS_INFORMATION, *PLOCK_STATISTICS_INFORMATION;
+
+// Operations of MtControlTrace (kernel static tracepoints, the dump is converted by tools/trace2json).
+typedef enum _TRACE_CONTROL {
+    TraceControlStart,
+    TraceControlStop,
+    TraceControlDump,
+} TRACE_CONTROL;
+
+// Sampling profiler (MtControlProfile, MtQueryProfile), the dump is symbolized by tools/profsym.
+typedef enum _PROFILE_SOURCE {
+    ProfileSourceTimer,         // Every Interval clock ticks
+    ProfileSourceCycles,        // Every Interval core cycles (performance counter NMI), falls back to the timer
+} PROFILE_SOURCE;
+
+typedef enum _PROFILE_CONTROL {
+    ProfileControlStart,
+    ProfileControlStop,
+    ProfileControlDump,
+} PROFILE_CONTROL;
+
+#define PROFILE_STACK_DEPTH 8
+
+typedef struct _PROFILE_ENTRY {
+    uint64_t Hits;
+    uint64_t Frames[PROFILE_STACK_DEPTH]; // Interrupted RIP, then kernel return addresses
+    uint32_t Process;
+    uint32_t Thread;            // TID of the last sample
+    uint16_t Processor;
+    uint8_t Irql;
+    uint8_t Depth;              // Valid entries in Frames
+    uint8_t UserMode;
+    uint8_t Reserved[11];
+} PROFILE_ENTRY, *PPROFILE_ENTRY;
+
+typedef struct _PROFILE_INFORMATION {
+    uint32_t Magic;
+    uint16_t Version;
+    uint16_t EntrySize;
+    uint32_t Source;            // PROFILE_SOURCE actually used
+    uint32_t NumberOfEntries;   // Entries copied into Entries[]
+    uint64_t Interval;
+    uint64_t TotalSamples;
+    uint64_t DroppedSamples;
+    uint32_t TotalEntries;
+    uint32_t Reserved;
+    PROFILE_ENTRY Entries[];
+} PROFILE_INFORMATION, *PPROFILE_INFORMATION;
+
+// Kernel event counters, kept per processor (SystemProcessorCounterInformation) and summed (SystemCounterInformation).
+// Append only, newer kernels may report more (NumberOfCounters), SystemCounterNameInformation names them.
+typedef enum _PERF_COUNTER {
+    PerfCounterContextSwitches,
+    PerfCounterSystemCalls,
+    PerfCounterClockInterrupts,
+    PerfCounterPageFaults,
+    PerfCounterFaultDirtyUpdates,
+    PerfCounterFaultDemandZero,
+    PerfCounterFaultTransition,
+    PerfCounterFaultFileBacked,
+    PerfCounterFaultAccessViolations,
+    PerfCounterIpiSentStop,
+    PerfCounterIpiSentPrintId,
+    PerfCounterIpiSentTlbShootdown,
+    PerfCounterIpiSentWriteDebugRegisters,
+    PerfCounterIpiSentClearDebugRegisters,
+    PerfCounterIpiSentFlushCr3,
+    PerfCounterIpiReceivedStop,
+    PerfCounterIpiReceivedPrintId,
+    PerfCounterIpiReceivedTlbShootdown,
+    PerfCounterIpiReceivedWriteDebugRegisters,
+    PerfCounterIpiReceivedClearDebugRegisters,
+    PerfCounterIpiReceivedFlushCr3,
+    PerfCounterDpcsQueued,
+    PerfCounterDpcsRun,
+    PerfCounterDiskReads,
+    PerfCounterDiskWrites,
+    PerfCounterDiskReadBytes,
+    PerfCounterDiskWriteBytes,
+    PerfCounterPoolAllocations,
+    PerfCounterPoolLargeAllocations,
+    PerfCounterPagedPoolAllocations,
+    PerfCounterPoolFrees,
+    PerfCounterHyperspaceMappings,
+    PerfCounterDirectMappings,
+    PerfCounterFaultLargePage,
+    PerfCounterLargePageFallbacks,
+    PerfCounterLargePageSplits,
+    PerfCounterStackCacheHits,
+    PerfCounterStackCacheMisses,
+    PerfCounterCrossCallsQueued,
+    PerfCounterCrossCallInterrupts,
+    PerfCounterMax
+} PERF_COUNTER;
+
+// MtQuerySystemInformation classes.
+typedef enum _SYSTEM_INFORMATION_CLASS {
+    SystemBasicInformation,             // SYSTEM_BASIC_INFORMATION
+    SystemCounterInformation,           // SYSTEM_COUNTER_INFORMATION, Values[Counter] summed over every processor
+    SystemProcessorCounterInformation,  // SYSTEM_COUNTER_INFORMATION, Values[Processor * NumberOfCounters + Counter]
+    SystemCounterNameInformation,       // SYSTEM_COUNTER_NAME_INFORMATION
+    SystemMemoryInformation,            // SYSTEM_MEMORY_INFORMATION
+    SystemProcessorDpcInformation,      // SYSTEM_PROCESSOR_DPC_INFORMATION
+    SystemObjectTypeInformation,        // SYSTEM_OBJECT_TYPE_INFORMATION
+} SYSTEM_INFORMATION_CLASS;
+
+#define SYSTEM_COUNTER_NAME_LENGTH 32
+
+typedef struct _SYSTEM_BASIC_INFORMATION {
+    uint32_t NumberOfProcessors;
+    uint32_t PageSize;
+    uint64_t NumberOfPhysicalPages;
+    uint32_t NumberOfCounters;
+    uint32_t Reserved;
+} SYSTEM_BASIC_INFORMATION, *PSYSTEM_BASIC_INFORMATION;
+
+typedef struct _SYSTEM_COUNTER_INFORMATION {
+    uint32_t NumberOfProcessors;
+    uint32_t NumberOfCounters;
+    uint64_t Values[];
+} SYSTEM_COUNTER_INFORMATION, *PSYSTEM_COUNTER_INFORMATION;
+
+typedef struct _SYSTEM_COUNTER_NAME_INFORMATION {
+    uint32_t NumberOfCounters;
+    uint32_t Reserved;
+    char Names[][SYSTEM_COUNTER_NAME_LENGTH];
+} SYSTEM_COUNTER_NAME_INFORMATION, *PSYSTEM_COUNTER_NAME_INFORMATION;
+
+// In pages.
+typedef struct _SYSTEM_MEMORY_INFORMATION {
+    uint64_t TotalPages;
+    uint64_t AvailablePages;
+    uint64_t FreePages;
+    uint64_t ZeroedPages;
+    uint64_t StandbyPages;
+    uint64_t ModifiedPages;
+    uint64_t BadPages;
+    uint64_t ReservedPages;
+} SYSTEM_MEMORY_INFORMATION, *PSYSTEM_MEMORY_INFORMATION;
+
+typedef struct _SYSTEM_PROCESSOR_DPC_ENTRY {
+    uint32_t Processor;
+    uint32_t DpcQueueDepth;
+    uint32_t DpcCount;
+    uint32_t MaximumDpcQueueDepth;
+    uint32_t MinimumDpcRate;
+    uint32_t DpcRequestRate;
+} SYSTEM_PROCESSOR_DPC_ENTRY, *PSYSTEM_PROCESSOR_DPC_ENTRY;
+
+typedef struct _SYSTEM_PROCESSOR_DPC_INFORMATION {
+    uint32_t NumberOfProcessors;
+    uint32_t Reserved;
+    SYSTEM_PROCESSOR_DPC_ENTRY Processors[];
+} SYSTEM_PROCESSOR_DPC_INFORMATION, *PSYSTEM_PROCESSOR_DPC_INFORMATION;
+
+typedef struct _SYSTEM_OBJECT_TYPE_ENTRY {
+    char Name[32];
+    uint32_t TotalNumberOfObjects;
+    uint32_t TotalNumberOfHandles;
+} SYSTEM_OBJECT_TYPE_ENTRY, *PSYSTEM_OBJECT_TYPE_ENTRY;
+
+typedef struct _SYSTEM_OBJECT_TYPE_INFORMATION {
+    uint32_t NumberOfTypes;
+    uint32_t Reserved;
+    SYSTEM_OBJECT_TYPE_ENTRY Types[];
+} SYSTEM_OBJECT_TYPE_INFORMATION, *PSYSTEM_OBJECT_TYPE_INFORMATION;
+
+// Read only page mapped by the kernel into every process (time.c), must match kernel/includes/me.h.
+// Retry while Sequence is odd or changed during the read.
+#define SHARED_USER_DATA_ADDRESS 0x7FFE0000ULL
+#define SHARED_USER_DATA_VERSION 1
+#define SHARED_USER_DATA_TSC_INVARIANT (1U << 0)
+
+typedef struct _SHARED_USER_DATA {
+    volatile uint32_t Sequence;
+    uint32_t Version;
+    volatile uint64_t TickCount;        // Clock interrupts since boot
+    volatile uint64_t InterruptTime;    // Time since boot in 100ns units, as of the last clock interrupt
+    uint64_t TscFrequency;              // In Hz
+    uint64_t TscScale;                  // 100ns units per TSC cycle, 32.32 fixed point (0 if the frequency is unknown)
+    uint64_t TscBase;                   // TSC value at SystemTimeBase
+    uint64_t SystemTimeBase;            // UTC time at TscBase, 100ns units since 1970-01-01
+    uint32_t TickInterval;              // Clock interrupt period in 100ns units
+    uint32_t NumberOfProcessors;
+    uint32_t PageSize;
+    uint32_t Flags;                     // SHARED_USER_DATA_*
+} SHARED_USER_DATA, *PSHARED_USER_DATA;
+
+#define SharedUserData ((const SHARED_USER_DATA*)SHARED_USER_DATA_ADDRESS)
+
+// Pass as FileOffset to use (and advance) the file pointer instead of an explicit offset.
+#define MT_FILE_USE_FILE_POINTER ((uint64_t)-1)
+
+// Vectored file I/O (ReadFileScatter, WriteFileGather).
+#define MT_MAX_IO_VECTORS 1024
+
+typedef struct _IO_VECTOR {
+    void* Buffer;
+    size_t Length;
+} IO_VECTOR, *PIO_VECTOR;
+
+// I/O ring, submission and completion rings shared with the kernel (MtCreateIoRing, MtSubmitIoRing), must match kernel/includes/mt.h.
+#define IO_RING_MAX_ENTRIES 4096
+
+typedef enum _IO_RING_OPERATION {
+    IoRingOpNop,
+    IoRingOpRead,           // Handle, Offset, Buffer, Length -> Result = bytes read
+    IoRingOpWrite,          // Handle, Offset, Buffer, Length -> Result = bytes written
+    IoRingOpOpen,           // Buffer = path, Offset = ACCESS_MASK -> Result = handle
+    IoRingOpClose,          // Handle
+    IoRingOpAllocate,       // Buffer = base or 0, Length, Offset = USER_ALLOCATION_TYPE -> Result = base
+    IoRingOpMax
+} IO_RING_OPERATION;
+
+typedef struct _IO_RING_SQE {
+    uint32_t Operation;     // IO_RING_OPERATION
+    HANDLE Handle;
+    uint64_t Offset;
+    uint64_t Buffer;
+    uint64_t Length;
+    uint64_t UserData;      // Copied to the completion untouched
+} IO_RING_SQE, *PIO_RING_SQE;
+
+typedef struct _IO_RING_CQE {
+    uint64_t UserData;
+    uint64_t Result;
+    MTSTATUS Status;
+    uint32_t Reserved;
+} IO_RING_CQE, *PIO_RING_CQE;
+
+typedef struct _IO_RING_HEADER {
+    // Written by the kernel.
+    volatile uint32_t SqHead;
+    volatile uint32_t CqTail;
+    uint32_t SqEntries;
+    uint32_t CqEntries;
+    uint32_t SqOffset;
+    uint32_t CqOffset;
+    uint8_t Reserved0[40];
+
+    // Written by user mode.
+    volatile uint32_t SqTail;
+    volatile uint32_t CqHead;
+    uint8_t Reserved1[56];
+} IO_RING_HEADER, *PIO_RING_HEADER;
+
+// Filled by CreateIoRing, pass it to the other IoRing functions.
+typedef struct _IO_RING {
+    PIO_RING_HEADER Header;
+    PIO_RING_SQE Sqes;
+    PIO_RING_CQE Cqes;
+    uint32_t SqMask;
+    uint32_t CqMask;
+    uint32_t SqTail;        // Entries handed out by IoRingGetSqe, published by SubmitIoRing
+    uint32_t Reserved;
+} IO_RING, *PIO_RING;
+
+// HeapAlloc / HeapReAlloc flags.
+#define HEAP_ZERO_MEMORY 0x00000008
+
+// The TEB of the current thread, GS base is set to it by LdrInitializeThread (and kept per thread by the kernel).
+static
+inline
+PTEB
+MtCurrentTeb(
+    void
+)
+
+{
+    PTEB Teb;
+    __asm__ volatile("rdgsbase %0" : "=r"(Teb));
+    return Teb;
+}
+
 // System calls. (TODO mtdll.mtdll, funny name)
 MTSTATUS
 MtAllocateVirtualMemory(
@@ -201,4 +501,70 @@ MTSTATUS
 MtTerminateThread(
     IN HANDLE ThreadHandle,
     IN MTSTATUS ExitStatus
+);
+
+MTSTATUS
+MtQueryLockStatistics(
+    OUT void* Buffer,
+    IN size_t BufferSize,
+    _Out_Opt size_t* ReturnLength
+);
+
+MTSTATUS
+MtControlTrace(
+    IN uint32_t Operation,
+    _In_Opt const char* Path
+);
+
+MTSTATUS
+MtControlProfile(
+    IN uint32_t Operation,
+    IN uint32_t Source,
+    IN uint64_t Interval,
+    _In_Opt const char* Path
+);
+
+MTSTATUS
+MtQueryProfile(
+    OUT void* Buffer,
+    IN size_t BufferSize,
+    _Out_Opt size_t* ReturnLength
+);
+
+MTSTATUS
+MtQuerySystemInformation(
+    IN uint32_t InformationClass,
+    OUT void* Buffer,
+    IN size_t BufferSize,
+    _Out_Opt size_t* ReturnLength
+);
+
+MTSTATUS
+MtCreateIoRing(
+    IN uint32_t Entries,
+    OUT void** RingBase
+);
+
+MTSTATUS
+MtSubmitIoRing(
+    IN uint32_t ToSubmit,
+    _Out_Opt uint32_t* Submitted
+);
+
+MTSTATUS
+MtReadFileScatter(
+    IN HANDLE FileHandle,
+    IN uint64_t FileOffset,
+    IN const IO_VECTOR* Vectors,
+    IN uint32_t VectorCount,
+    _Out_Opt size_t* BytesRead
+);
+
+MTSTATUS
+MtWriteFileGather(
+    IN HANDLE FileHandle,
+    IN uint64_t FileOffset,
+    IN const IO_VECTOR* Vectors,
+    IN uint32_t VectorCount,
+    _Out_Opt size_t* BytesWritten
 );
\ No newline at end of file
@@ -55,6 +55,7 @@ typedef struct _TEB {
     PPEB ProcessEnvironmentBlock; // Pointer to this thread's process's PEB.
     int32_t LastErrorValue; // The last error that the thread's has done in an operation (failed function, illegal instruction)
     int32_t LastStatusValue; // Internal MTSTATUS Values.
+    void* HeapCache; // Per thread heap cache (heap.c), NULL until the thread's first allocation.
 } TEB, * PTEB;
 
 typedef void* THREAD_PARAMETER;
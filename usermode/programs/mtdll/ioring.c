@@ -0,0 +1,186 @@
+/*++
+
+Module Name:
+
+    ioring.c
+
+Purpose:
+
+    This translation unit contains the standard library functions for I/O rings (batched file and memory operations).
+
+    Usage:
+        IO_RING Ring;
+        CreateIoRing(64, &Ring);
+        PIO_RING_SQE Sqe = IoRingGetSqe(&Ring);     // Fill Operation, Handle, Buffer...
+        SubmitIoRing(&Ring, NULL);                  // One system call for every entry queued
+        IO_RING_CQE Cqe;
+        while (IoRingGetCompletion(&Ring, &Cqe)) ...
+
+Author:
+
+    slep (Matanel) 2025.
+
+Revision History:
+
+--*/
+
+#include "includes/mtdll.h"
+#include "includes/exports.h"
+
+bool
+CreateIoRing(
+    IN uint32_t Entries,
+    OUT PIO_RING Ring
+)
+
+/*++
+
+    Routine description:
+
+        Creates the I/O ring of the current process (one per process).
+
+    Arguments:
+
+        [IN]    uint32_t Entries - Submission entries, rounded up to a power of 2 by the kernel (at most IO_RING_MAX_ENTRIES).
+        [OUT]   PIO_RING Ring - Receives the ring.
+
+    Return Values:
+
+        True on success, false otherwise.
+
+--*/
+
+{
+    void* Base = NULL;
+
+    if (!Ring) return false;
+
+    MTSTATUS Status = MtCreateIoRing(Entries, &Base);
+    if (MT_FAILURE(Status)) return false;
+
+    PIO_RING_HEADER Header = (PIO_RING_HEADER)Base;
+
+    Ring->Header = Header;
+    Ring->Sqes = (PIO_RING_SQE)((uint8_t*)Base + Header->SqOffset);
+    Ring->Cqes = (PIO_RING_CQE)((uint8_t*)Base + Header->CqOffset);
+    Ring->SqMask = Header->SqEntries - 1;
+    Ring->CqMask = Header->CqEntries - 1;
+    Ring->SqTail = Header->SqTail;
+    Ring->Reserved = 0;
+    return true;
+}
+
+PIO_RING_SQE
+IoRingGetSqe(
+    IN PIO_RING Ring
+)
+
+/*++
+
+    Routine description:
+
+        Reserves the next submission entry.
+
+    Arguments:
+
+        [IN]    PIO_RING Ring - The ring.
+
+    Return Values:
+
+        A zeroed entry to fill, NULL if the submission ring is full (call SubmitIoRing).
+
+    Notes:
+
+        The entry is only seen by the kernel after SubmitIoRing.
+
+--*/
+
+{
+    if (Ring->SqTail - Ring->Header->SqHead > Ring->SqMask) return NULL;
+
+    PIO_RING_SQE Sqe = &Ring->Sqes[Ring->SqTail & Ring->SqMask];
+    Ring->SqTail++;
+
+    Sqe->Operation = IoRingOpNop;
+    Sqe->Handle = 0;
+    Sqe->Offset = 0;
+    Sqe->Buffer = 0;
+    Sqe->Length = 0;
+    Sqe->UserData = 0;
+    return Sqe;
+}
+
+bool
+SubmitIoRing(
+    IN PIO_RING Ring,
+    _Out_Opt uint32_t* Submitted
+)
+
+/*++
+
+    Routine description:
+
+        Publishes the reserved entries and has the kernel execute them.
+
+    Arguments:
+
+        [IN]    PIO_RING Ring - The ring.
+        [OUT OPTIONAL] uint32_t* Submitted - Receives the number of entries executed.
+
+    Return Values:
+
+        True on success, false otherwise.
+
+    Notes:
+
+        Entries that didn't fit in the completion ring stay queued, reap completions and submit again.
+
+--*/
+
+{
+    // The entries must be written before the tail (x86 keeps stores in order).
+    __asm__ volatile("" ::: "memory");
+    Ring->Header->SqTail = Ring->SqTail;
+
+    MTSTATUS Status = MtSubmitIoRing(Ring->SqTail - Ring->Header->SqHead, Submitted);
+
+    return MT_SUCCEEDED(Status);
+}
+
+bool
+IoRingGetCompletion(
+    IN PIO_RING Ring,
+    OUT PIO_RING_CQE Completion
+)
+
+/*++
+
+    Routine description:
+
+        Retrieves the oldest completion.
+
+    Arguments:
+
+        [IN]    PIO_RING Ring - The ring.
+        [OUT]   PIO_RING_CQE Completion - Receives the completion (UserData, Status, Result).
+
+    Return Values:
+
+        True if a completion was retrieved, false if none is pending.
+
+--*/
+
+{
+    PIO_RING_HEADER Header = Ring->Header;
+    uint32_t Head = Header->CqHead;
+
+    if (Head == Header->CqTail) return false;
+
+    // The tail is read before the entry (x86 keeps loads in order).
+    __asm__ volatile("" ::: "memory");
+    *Completion = Ring->Cqes[Head & Ring->CqMask];
+
+    __asm__ volatile("" ::: "memory");
+    Header->CqHead = Head + 1;
+    return true;
+}
@@ -0,0 +1,183 @@
+/*++
+
+Module Name:
+
+    lockstat.c
+
+Purpose:
+
+    This translation unit contains the standard library functions for querying and dumping the kernel lock contention statistics.
+
+Author:
+
+    slep (Matanel) 2025.
+
+Revision History:
+
+--*/
+
+#include "includes/mtdll.h"
+#include "includes/exports.h"
+
+// How many call sites DumpLockStatistics prints (the most contended ones, the kernel sorts them).
+#define LOCKSTAT_DUMP_ENTRIES 32
+
+static const char* LockStatTypeNames[LockStatTypeMax] = {
+    "spinlock",
+    "queued",
+    "pushlock",
+    "mutex"
+};
+
+static
+void
+AppendString(
+    IN OUT char* Line,
+    IN OUT size_t* Length,
+    IN size_t Capacity,
+    IN const char* String
+)
+
+{
+    while (*String && *Length + 1 < Capacity) {
+        Line[(*Length)++] = *String++;
+    }
+    Line[*Length] = '\0';
+}
+
+static
+void
+AppendNumber(
+    IN OUT char* Line,
+    IN OUT size_t* Length,
+    IN size_t Capacity,
+    IN uint64_t Value,
+    IN uint32_t Base
+)
+
+{
+    char Digits[24];
+    int Count = 0;
+
+    do {
+        uint32_t Digit = (uint32_t)(Value % Base);
+        Digits[Count++] = (char)(Digit < 10 ? '0' + Digit : 'a' + Digit - 10);
+        Value /= Base;
+    } while (Value);
+
+    if (Base == 16) AppendString(Line, Length, Capacity, "0x");
+
+    while (Count && *Length + 1 < Capacity) {
+        Line[(*Length)++] = Digits[--Count];
+    }
+    Line[*Length] = '\0';
+}
+
+bool
+QueryLockStatistics(
+    OUT void* Buffer,
+    IN size_t BufferSize,
+    _Out_Opt size_t* ReturnLength
+)
+
+/*++
+
+    Routine description:
+
+        Retrieves the kernel lock contention statistics (LOCK_STATISTICS_INFORMATION).
+
+    Arguments:
+
+        [OUT]   void* Buffer - Receives the statistics, most contended call site first.
+        [IN]    size_t BufferSize - The size of the buffer in bytes.
+        [OUT OPTIONAL] size_t* ReturnLength - Receives the size in bytes needed for every entry.
+
+    Return Values:
+
+        True if every entry was copied, false otherwise (the kernel wasn't built with LOCKSTAT=1, or the buffer is too small).
+
+--*/
+
+{
+    // Call kernel, retrieve status.
+    MTSTATUS Status = MtQueryLockStatistics(Buffer, BufferSize, ReturnLength);
+
+    return MT_SUCCEEDED(Status);
+}
+
+bool
+DumpLockStatistics(
+    IN HANDLE FileHandle
+)
+
+/*++
+
+    Routine description:
+
+        Writes the most contended lock call sites as text to a file, one line per call site.
+
+    Arguments:
+
+        [IN]    HANDLE FileHandle - The file to write to (opened with write access), written from offset 0.
+
+    Return Values:
+
+        True on success, false otherwise.
+
+    Notes:
+
+        Call sites are kernel return addresses, resolve them against the kernel symbol map.
+        Cycles are TSC cycles, spin cycles of sleeping locks (push locks, mutexes) include the time slept.
+
+--*/
+
+{
+    uint64_t Buffer[(sizeof(LOCK_STATISTICS_INFORMATION) + LOCKSTAT_DUMP_ENTRIES * sizeof(LOCK_STATISTICS_ENTRY)) / sizeof(uint64_t)];
+    PLOCK_STATISTICS_INFORMATION Information = (PLOCK_STATISTICS_INFORMATION)Buffer;
+    char Line[256];
+    size_t Length;
+    uint64_t Offset = 0;
+    size_t Written;
+
+    // Only the first LOCKSTAT_DUMP_ENTRIES entries are wanted, a partial copy is fine.
+    MTSTATUS Status = MtQueryLockStatistics(Buffer, sizeof(Buffer), NULL);
+    if (MT_FAILURE(Status) && Status != MT_BUFFER_TOO_SMALL) return false;
+
+    Length = 0;
+    AppendString(Line, &Length, sizeof(Line), "call sites: ");
+    AppendNumber(Line, &Length, sizeof(Line), Information->TotalEntries, 10);
+    AppendString(Line, &Length, sizeof(Line), ", dropped records: ");
+    AppendNumber(Line, &Length, sizeof(Line), Information->DroppedRecords, 10);
+    AppendString(Line, &Length, sizeof(Line), "\ncallsite type acquires contended spin maxspin hold maxhold\n");
+
+    for (uint32_t i = 0; ; i++) {
+        Written = 0;
+        if (MT_FAILURE(MtWriteFile(FileHandle, Offset, Line, Length, &Written))) return false;
+        Offset += Written;
+
+        if (i == Information->NumberOfEntries) break;
+
+        PLOCK_STATISTICS_ENTRY Entry = &Information->Entries[i];
+        const char* TypeName = (Entry->Type < LockStatTypeMax) ? LockStatTypeNames[Entry->Type] : "unknown";
+
+        Length = 0;
+        AppendNumber(Line, &Length, sizeof(Line), Entry->CallSite, 16);
+        AppendString(Line, &Length, sizeof(Line), " ");
+        AppendString(Line, &Length, sizeof(Line), TypeName);
+        AppendString(Line, &Length, sizeof(Line), " ");
+        AppendNumber(Line, &Length, sizeof(Line), Entry->Acquires, 10);
+        AppendString(Line, &Length, sizeof(Line), " ");
+        AppendNumber(Line, &Length, sizeof(Line), Entry->Contended, 10);
+        AppendString(Line, &Length, sizeof(Line), " ");
+        AppendNumber(Line, &Length, sizeof(Line), Entry->SpinCycles, 10);
+        AppendString(Line, &Length, sizeof(Line), " ");
+        AppendNumber(Line, &Length, sizeof(Line), Entry->MaxSpinCycles, 10);
+        AppendString(Line, &Length, sizeof(Line), " ");
+        AppendNumber(Line, &Length, sizeof(Line), Entry->HoldCycles, 10);
+        AppendString(Line, &Length, sizeof(Line), " ");
+        AppendNumber(Line, &Length, sizeof(Line), Entry->MaxHoldCycles, 10);
+        AppendString(Line, &Length, sizeof(Line), "\n");
+    }
+
+    return true;
+}
@@ -0,0 +1,134 @@
+/*++
+
+Module Name:
+
+    profile.c
+
+Purpose:
+
+    This translation unit contains the standard library functions for controlling the kernel sampling profiler.
+
+Author:
+
+    slep (Matanel) 2025.
+
+Revision History:
+
+--*/
+
+#include "includes/mtdll.h"
+#include "includes/exports.h"
+
+bool
+StartProfile(
+    IN uint32_t Source,
+    IN uint64_t Interval
+)
+
+/*++
+
+    Routine description:
+
+        Starts the kernel sampling profiler, previous samples are discarded.
+
+    Arguments:
+
+        [IN]    uint32_t Source - PROFILE_SOURCE, ProfileSourceCycles falls back to the timer without a performance counter.
+        [IN]    uint64_t Interval - Clock ticks or core cycles per sample, 0 for the default.
+
+    Return Values:
+
+        True on success, false otherwise.
+
+--*/
+
+{
+    MTSTATUS Status = MtControlProfile(ProfileControlStart, Source, Interval, NULL);
+
+    return MT_SUCCEEDED(Status);
+}
+
+bool
+StopProfile(
+    void
+)
+
+/*++
+
+    Routine description:
+
+        Stops the kernel sampling profiler, the samples are kept for DumpProfile/QueryProfile.
+
+    Arguments:
+
+        None.
+
+    Return Values:
+
+        True on success, false otherwise.
+
+--*/
+
+{
+    MTSTATUS Status = MtControlProfile(ProfileControlStop, 0, 0, NULL);
+
+    return MT_SUCCEEDED(Status);
+}
+
+bool
+DumpProfile(
+    IN const char* Path
+)
+
+/*++
+
+    Routine description:
+
+        Stops the kernel sampling profiler and writes the samples to a file.
+
+    Arguments:
+
+        [IN]    const char* Path - Full path of the dump file, symbolize it with tools/profsym on the host.
+
+    Return Values:
+
+        True on success, false otherwise.
+
+--*/
+
+{
+    MTSTATUS Status = MtControlProfile(ProfileControlDump, 0, 0, Path);
+
+    return MT_SUCCEEDED(Status);
+}
+
+bool
+QueryProfile(
+    OUT void* Buffer,
+    IN size_t BufferSize,
+    _Out_Opt size_t* ReturnLength
+)
+
+/*++
+
+    Routine description:
+
+        Retrieves the kernel sampling profiler entries (PROFILE_INFORMATION).
+
+    Arguments:
+
+        [OUT]   void* Buffer - Receives the PROFILE_INFORMATION and its entries.
+        [IN]    size_t BufferSize - Size of the buffer in bytes, 0 to only query the required size.
+        [OUT OPTIONAL] size_t* ReturnLength - Receives the size in bytes needed for every entry.
+
+    Return Values:
+
+        True if every entry was copied, false otherwise (check ReturnLength).
+
+--*/
+
+{
+    MTSTATUS Status = MtQueryProfile(Buffer, BufferSize, ReturnLength);
+
+    return MT_SUCCEEDED(Status);
+}
@@ -0,0 +1,58 @@
+/*++
+
+Module Name:
+
+    sysinfo.c
+
+Purpose:
+
+    This translation unit contains the standard library functions for querying system information (counters, memory, objects).
+
+Author:
+
+    slep (Matanel) 2025.
+
+Revision History:
+
+--*/
+
+#include "includes/mtdll.h"
+#include "includes/exports.h"
+
+bool
+QuerySystemInformation(
+    IN uint32_t InformationClass,
+    OUT void* Buffer,
+    IN size_t BufferSize,
+    _Out_Opt size_t* ReturnLength
+)
+
+/*++
+
+    Routine description:
+
+        Retrieves system information of a class (SYSTEM_INFORMATION_CLASS), e.g the kernel event counters.
+
+    Arguments:
+
+        [IN]    uint32_t InformationClass - The SYSTEM_INFORMATION_CLASS to query.
+        [OUT]   void* Buffer - Receives the structure of the class.
+        [IN]    size_t BufferSize - Size of the buffer in bytes, 0 to only query the required size.
+        [OUT OPTIONAL] size_t* ReturnLength - Receives the size in bytes the class needs.
+
+    Return Values:
+
+        True on success, false otherwise (check ReturnLength, nothing is copied to a buffer too small).
+
+    Notes:
+
+        A monitor samples SystemCounterInformation periodically and subtracts the previous values for rates,
+        the counters only grow (until they wrap at 64 bits).
+
+--*/
+
+{
+    MTSTATUS Status = MtQuerySystemInformation(InformationClass, Buffer, BufferSize, ReturnLength);
+
+    return MT_SUCCEEDED(Status);
+}
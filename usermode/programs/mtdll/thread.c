@@ -17,6 +17,7 @@ Revision History:
 --*/
 
 #include "includes/mtdll.h"
+#include "includes/exports.h"
 
 bool
 TerminateThread(
@@ -25,9 +26,11 @@ TerminateThread(
 )
 
 {
+    // Hand the thread's cached heap blocks to the other threads.
+    if (ThreadHandle == MtCurrentThread()) HeapReleaseThreadCache();
+
     // Assume ExitStatus is MTSTATUS for now, we need termination ports for custom statuses.
     MTSTATUS Status = MtTerminateThread(ThreadHandle, ExitStatus);
 
     return MT_SUCCEEDED(Status);
 }
-
@@ -0,0 +1,172 @@
+/*++
+
+Module Name:
+
+    time.c
+
+Purpose:
+
+    This translation unit contains the standard library functions for reading time (tick count, performance counter, system time)
+    from the shared user data page, without a system call.
+
+Author:
+
+    slep (Matanel) 2025.
+
+Revision History:
+
+--*/
+
+#include "includes/mtdll.h"
+#include "includes/exports.h"
+
+static
+inline
+uint64_t
+ReadTsc(
+    void
+)
+
+{
+    uint32_t Low, High;
+    __asm__ volatile("rdtsc" : "=a"(Low), "=d"(High));
+    return ((uint64_t)High << 32) | Low;
+}
+
+static
+inline
+void
+CompilerBarrier(
+    void
+)
+
+{
+    __asm__ volatile("" ::: "memory");
+}
+
+uint64_t
+GetTickCount(
+    void
+)
+
+/*++
+
+    Routine description:
+
+        Retrieves the time since boot, as of the last clock interrupt.
+
+    Arguments:
+
+        None.
+
+    Return Values:
+
+        Milliseconds since boot.
+
+--*/
+
+{
+    uint64_t InterruptTime;
+
+    for (;;) {
+        uint32_t Sequence = SharedUserData->Sequence;
+        CompilerBarrier();
+
+        InterruptTime = SharedUserData->InterruptTime;
+
+        CompilerBarrier();
+        if (!(Sequence & 1) && Sequence == SharedUserData->Sequence) break;
+    }
+
+    return InterruptTime / 10000;
+}
+
+bool
+QueryPerformanceCounter(
+    OUT uint64_t* Counter
+)
+
+/*++
+
+    Routine description:
+
+        Retrieves the current value of the performance counter (the TSC).
+
+    Arguments:
+
+        [OUT]   uint64_t* Counter - Receives the counter, in QueryPerformanceFrequency units per second.
+
+    Return Values:
+
+        True on success, false otherwise.
+
+--*/
+
+{
+    if (!Counter) return false;
+
+    *Counter = ReadTsc();
+    return true;
+}
+
+bool
+QueryPerformanceFrequency(
+    OUT uint64_t* Frequency
+)
+
+/*++
+
+    Routine description:
+
+        Retrieves the frequency of the performance counter.
+
+    Arguments:
+
+        [OUT]   uint64_t* Frequency - Receives the counts per second.
+
+    Return Values:
+
+        True on success, false if the kernel couldn't measure it.
+
+--*/
+
+{
+    if (!Frequency || !SharedUserData->TscFrequency) return false;
+
+    *Frequency = SharedUserData->TscFrequency;
+    return true;
+}
+
+bool
+GetSystemTime(
+    OUT uint64_t* SystemTime
+)
+
+/*++
+
+    Routine description:
+
+        Retrieves the current UTC time.
+
+    Arguments:
+
+        [OUT]   uint64_t* SystemTime - Receives the time in 100ns units since 1970-01-01.
+
+    Return Values:
+
+        True on success, false if the kernel couldn't measure the TSC frequency.
+
+    Notes:
+
+        The base is read from the real time clock once at boot, the TSC carries it from there.
+
+--*/
+
+{
+    if (!SystemTime || !SharedUserData->TscScale) return false;
+
+    uint64_t Cycles = ReadTsc() - SharedUserData->TscBase;
+
+    *SystemTime = SharedUserData->SystemTimeBase + (uint64_t)(((unsigned __int128)Cycles * SharedUserData->TscScale) >> 32);
+    return true;
+}
@@ -0,0 +1,101 @@
+/*++
+
+Module Name:
+
+    trace.c
+
+Purpose:
+
+    This translation unit contains the standard library functions for controlling the kernel trace (static tracepoints).
+
+Author:
+
+    slep (Matanel) 2025.
+
+Revision History:
+
+--*/
+
+#include "includes/mtdll.h"
+#include "includes/exports.h"
+
+bool
+StartTrace(
+    void
+)
+
+/*++
+
+    Routine description:
+
+        Starts the kernel trace, previously recorded events are discarded.
+
+    Arguments:
+
+        None.
+
+    Return Values:
+
+        True on success, false otherwise.
+
+--*/
+
+{
+    MTSTATUS Status = MtControlTrace(TraceControlStart, NULL);
+
+    return MT_SUCCEEDED(Status);
+}
+
+bool
+StopTrace(
+    void
+)
+
+/*++
+
+    Routine description:
+
+        Stops the kernel trace, the recorded events are kept for DumpTrace.
+
+    Arguments:
+
+        None.
+
+    Return Values:
+
+        True on success, false otherwise.
+
+--*/
+
+{
+    MTSTATUS Status = MtControlTrace(TraceControlStop, NULL);
+
+    return MT_SUCCEEDED(Status);
+}
+
+bool
+DumpTrace(
+    IN const char* Path
+)
+
+/*++
+
+    Routine description:
+
+        Stops the kernel trace and writes the recorded events to a file.
+
+    Arguments:
+
+        [IN]    const char* Path - Full path of the dump file, convert it with tools/trace2json on the host.
+
+    Return Values:
+
+        True on success, false otherwise.
+
+--*/
+
+{
+    MTSTATUS Status = MtControlTrace(TraceControlDump, Path);
+
+    return MT_SUCCEEDED(Status);
+}
@@ -138,4 +138,135 @@ MtTerminateThread:
 	mov rax, 7
 	mov r10, rcx
 	syscall
+	ret
+
+; MTSTATUS
+; MtQueryLockStatistics(
+;     OUT void* Buffer,
+;     IN size_t BufferSize,
+;     _Out_Opt size_t* ReturnLength
+; );
+; Syscall number is 8.
+
+global MtQueryLockStatistics
+MtQueryLockStatistics:
+	mov rax, 8
+	mov r10, rcx
+	syscall
+	ret
+
+; MTSTATUS
+; MtControlTrace(
+;     IN uint32_t Operation,
+;     _In_Opt const char* Path
+; );
+; Syscall number is 9.
+
+global MtControlTrace
+MtControlTrace:
+	mov rax, 9
+	mov r10, rcx
+	syscall
+	ret
+
+; MtControlProfile(
+;     IN uint32_t Operation,
+;     IN uint32_t Source,
+;     IN uint64_t Interval,
+;     _In_Opt const char* Path
+; );
+; Syscall number is 10.
+
+global MtControlProfile
+MtControlProfile:
+	mov rax, 10
+	mov r10, rcx
+	syscall
+	ret
+
+; MtQueryProfile(
+;     OUT void* Buffer,
+;     IN size_t BufferSize,
+;     _Out_Opt size_t* ReturnLength
+; );
+; Syscall number is 11.
+
+global MtQueryProfile
+MtQueryProfile:
+	mov rax, 11
+	mov r10, rcx
+	syscall
+	ret
+
+; MtQuerySystemInformation(
+;     IN uint32_t InformationClass,
+;     OUT void* Buffer,
+;     IN size_t BufferSize,
+;     _Out_Opt size_t* ReturnLength
+; );
+; Syscall number is 12.
+
+global MtQuerySystemInformation
+MtQuerySystemInformation:
+	mov rax, 12
+	mov r10, rcx
+	syscall
+	ret
+
+; MtCreateIoRing(
+;     IN uint32_t Entries,
+;     OUT void** RingBase
+; );
+; Syscall number is 13.
+
+global MtCreateIoRing
+MtCreateIoRing:
+	mov rax, 13
+	mov r10, rcx
+	syscall
+	ret
+
+; MtSubmitIoRing(
+;     IN uint32_t ToSubmit,
+;     _Out_Opt uint32_t* Submitted
+; );
+; Syscall number is 14.
+
+global MtSubmitIoRing
+MtSubmitIoRing:
+	mov rax, 14
+	mov r10, rcx
+	syscall
+	ret
+
+; MtReadFileScatter(
+;     IN HANDLE FileHandle,
+;     IN uint64_t FileOffset,
+;     IN const IO_VECTOR* Vectors,
+;     IN uint32_t VectorCount,
+;     _Out_Opt size_t* BytesRead
+; );
+; Syscall number is 15.
+
+global MtReadFileScatter
+MtReadFileScatter:
+	mov rax, 15
+	mov r10, rcx
+	syscall
+	ret
+
+; MtWriteFileGather(
+;     IN HANDLE FileHandle,
+;     IN uint64_t FileOffset,
+;     IN const IO_VECTOR* Vectors,
+;     IN uint32_t VectorCount,
+;     _Out_Opt size_t* BytesWritten
+; );
+; Syscall number is 16.
+
+global MtWriteFileGather
+MtWriteFileGather:
+	mov rax, 16
+	mov r10, rcx
+	syscall
 	ret
\ No newline at end of file